@@ -0,0 +1,38 @@
+#!/bin/sh
+# discofs - disconnected file system
+# Copyright (c) 2012 Robin Martinjak
+# see LICENSE for full license (BSD 2-Clause)
+#
+# compare two reports of bench/run.sh or bench/scan.sh
+#
+# usage: bench/compare.sh <baseline> <report>
+
+[ $# -eq 2 ] || { echo "usage: $0 <baseline> <report>" >&2; exit 1; }
+
+awk '
+function field(name,    v) {
+    v = $0
+    if (!sub(".*\"" name "\": \"?", "", v))
+        return "-"
+    sub(/["},].*/, "", v)
+    return v
+}
+/"workload"/ {
+    w = field("workload")
+    s = field("seconds")
+    t = field("settle")
+    if (FILENAME == ARGV[1]) { bs[w] = s; bt[w] = t }
+    else { ns[w] = s; nt[w] = t; order[++n] = w }
+}
+function change(a, b) {
+    return (a ~ /^[0-9.]+$/ && b ~ /^[0-9.]+$/ && a > 0) ? sprintf("%+.1f%%", (b - a) * 100 / a) : "-"
+}
+END {
+    printf "%-10s %10s %10s %8s %10s %10s %8s\n", "workload", "seconds", "before", "", "settle", "before", ""
+    for (i = 1; i <= n; i++) {
+        w = order[i]
+        if (!(w in bs)) { bs[w] = "-"; bt[w] = "-" }
+        printf "%-10s %10s %10s %8s %10s %10s %8s\n", w,
+            ns[w], bs[w], change(bs[w], ns[w]), nt[w], bt[w], change(bt[w], nt[w])
+    }
+}' "$1" "$2"
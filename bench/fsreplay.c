@@ -0,0 +1,702 @@
+/*! @file fsreplay.c
+ * replay file system operations recorded with "record".
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: fsreplay -p <record> <dir>
+ *        fsreplay [-s <speed>] <record> <dir>
+ *
+ * the first form creates the files and directories that existed when the
+ * operations were recorded below <dir>, the stand-in for the remote fs.
+ * files get the largest size seen in the record, contents are zeros.
+ *
+ * the second form performs the operations on <dir> (a discofs mount point
+ * over the stand-in) and prints the number of calls, errors, results that
+ * differ from the record and latency percentiles of each operation.
+ * operations are started in the order they were, each recorded thread by
+ * its own thread. with -s <speed>, the time between them is kept, divided
+ * by <speed>; -s 0 (the default) starts each operation as soon as the one
+ * before it was started.
+ *
+ * flush, opendir and releasedir are counted but not performed: closing a
+ * file or a directory causes them.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#define RECORD_VERSION 1
+#define LINE_MAX_LEN 16384
+#define ARGS_MAX 8
+#define FD_MAX 65536
+
+/* same order as op_names in src/stats.c */
+enum ops
+{
+    GETATTR, FGETATTR, ACCESS, READLINK, OPENDIR, READDIR, MKNOD, MKDIR,
+    RMDIR, UNLINK, LINK, SYMLINK, RENAME, RELEASEDIR, OPEN, CREATE, FLUSH,
+    RELEASE, FSYNC, FSYNCDIR, READ, WRITE, TRUNCATE, CHOWN, CHMOD, UTIMENS,
+    STATFS, SETXATTR, GETXATTR, LISTXATTR, OPS
+};
+
+static const char *op_names[] =
+{
+    "getattr", "fgetattr", "access", "readlink", "opendir", "readdir",
+    "mknod", "mkdir", "rmdir", "unlink", "link", "symlink", "rename",
+    "releasedir", "open", "create", "flush", "release", "fsync",
+    "fsyncdir", "read", "write", "truncate", "chown", "chmod", "utimens",
+    "statfs", "setxattr", "getxattr", "listxattr"
+};
+
+struct rec
+{
+    unsigned long long start;
+    unsigned long thread;
+    int op;
+    int res;
+    int argc;
+    char *argv[ARGS_MAX];
+    unsigned long long us;      /* replayed duration */
+    int replay_res;
+};
+
+static struct rec *recs = NULL;
+static size_t rec_n = 0;
+
+static const char *root;
+static size_t root_len;
+static double speed = 0;
+
+/* issuing operations in order */
+static size_t next_rec = 0;
+static unsigned long long t0;
+static pthread_mutex_t m_next = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_next = PTHREAD_COND_INITIALIZER;
+
+/* recorded file descriptor -> ours */
+static int fds[FD_MAX];
+static pthread_mutex_t m_fds = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "fsreplay: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static unsigned long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long long num(const struct rec *r, int i)
+{
+    return (i < r->argc) ? strtoll(r->argv[i], NULL, 10) : 0;
+}
+
+/* <dir> followed by the i-th argument */
+static char *path(const struct rec *r, int i, char *buf)
+{
+    snprintf(buf, PATH_MAX, "%s%s", root, (i < r->argc) ? r->argv[i] : "");
+    return buf;
+}
+
+/* undo the escaping of src/record.c in place */
+static void unescape(char *s)
+{
+    char *d = s;
+
+    for (; *s; s++)
+    {
+        if (*s == '\\' && s[1])
+        {
+            s++;
+            *d++ = (*s == 't') ? '\t' : ((*s == 'n') ? '\n' : *s);
+        }
+        else
+            *d++ = *s;
+    }
+    *d = '\0';
+}
+
+static int cmp_start(const void *a, const void *b)
+{
+    const struct rec *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static void read_record(const char *file)
+{
+    FILE *f;
+    char line[LINE_MAX_LEN];
+    char *field[5 + ARGS_MAX];
+    char *p;
+    size_t size = 0, len;
+    int n, i, version;
+    struct rec *r;
+
+    if ((f = fopen(file, "r")) == NULL)
+        die("can't open the record");
+
+    if (!fgets(line, sizeof line, f) || sscanf(line, "# discofs record %d", &version) != 1)
+        die("not a discofs record");
+    if (version != RECORD_VERSION)
+        die("unsupported record version");
+
+    while (fgets(line, sizeof line, f))
+    {
+        if (*line == '#')
+            continue;
+
+        len = strlen(line);
+        if (len && line[len - 1] == '\n')
+            line[--len] = '\0';
+
+        for (n = 0, p = line; n < 5 + ARGS_MAX; n++)
+        {
+            field[n] = p;
+            if ((p = strchr(p, '\t')) == NULL)
+            {
+                n++;
+                break;
+            }
+            *p++ = '\0';
+        }
+        if (n < 5)
+            continue;
+
+        if (rec_n == size)
+        {
+            size = size ? 2 * size : 4096;
+            if ((recs = realloc(recs, size * sizeof *recs)) == NULL)
+                die("out of memory");
+        }
+        r = &recs[rec_n];
+
+        for (r->op = 0; r->op < OPS && strcmp(op_names[r->op], field[3]); r->op++);
+        if (r->op == OPS)
+            continue;
+
+        r->start = strtoull(field[0], NULL, 10);
+        r->thread = strtoul(field[2], NULL, 10);
+        r->res = atoi(field[4]);
+        r->argc = n - 5;
+        for (i = 0; i < r->argc; i++)
+        {
+            unescape(field[5 + i]);
+            if ((r->argv[i] = strdup(field[5 + i])) == NULL)
+                die("out of memory");
+        }
+        r->us = 0;
+        r->replay_res = 0;
+        rec_n++;
+    }
+
+    fclose(f);
+
+    /* records are written when operations end */
+    qsort(recs, rec_n, sizeof *recs, cmp_start);
+}
+
+
+/*-----------------------------*
+ * preparing the stand-in      *
+ *-----------------------------*/
+
+/* what is known about a path before the recorded operations */
+struct node
+{
+    char *path;
+    int seen;           /* no longer needs to be prepared */
+    mode_t mode;        /* 0: unknown */
+    off_t size;
+};
+
+static struct node *nodes = NULL;
+static size_t node_size = 0;
+
+static struct node *node_get(const char *p)
+{
+    unsigned long h = 5381;
+    const char *s;
+    size_t i;
+
+    if (!node_size)
+    {
+        node_size = 2 * rec_n + 1024;
+        if ((nodes = calloc(node_size, sizeof *nodes)) == NULL)
+            die("out of memory");
+    }
+
+    for (s = p; *s; s++)
+        h = ((h << 5) + h) + (unsigned char)*s;
+
+    for (i = h % node_size; nodes[i].path && strcmp(nodes[i].path, p); i = (i + 1) % node_size);
+
+    if (!nodes[i].path && (nodes[i].path = strdup(p)) == NULL)
+        die("out of memory");
+
+    return &nodes[i];
+}
+
+static void mkdirs(char *p)
+{
+    char *s;
+
+    for (s = p + root_len + 1; (s = strchr(s, '/')); s++)
+    {
+        *s = '\0';
+        mkdir(p, 0755);
+        *s = '/';
+    }
+}
+
+static void prepare(void)
+{
+    size_t i;
+    int j, fd;
+    struct rec *r;
+    struct node *n;
+    char buf[PATH_MAX];
+    unsigned long files = 0, dirs = 0, links = 0;
+
+    /* sizes and types first, any time they show up */
+    for (i = 0; i < rec_n; i++)
+    {
+        r = &recs[i];
+        if (!r->argc)
+            continue;
+
+        n = node_get(r->argv[0]);
+
+        if ((r->op == GETATTR && r->res == 0) || (r->op == FGETATTR && r->res == 0))
+        {
+            n->mode = num(r, (r->op == GETATTR) ? 1 : 2);
+            if (num(r, (r->op == GETATTR) ? 2 : 3) > n->size)
+                n->size = num(r, (r->op == GETATTR) ? 2 : 3);
+        }
+        else if (r->op == READ && r->res > 0 && num(r, 3) + r->res > n->size)
+            n->size = num(r, 3) + r->res;
+        else if ((r->op == OPENDIR || r->op == READDIR) && !n->mode)
+            n->mode = S_IFDIR;
+    }
+
+    /* paths that were used before they were created existed already */
+    for (i = 0; i < rec_n; i++)
+    {
+        r = &recs[i];
+
+        for (j = 0; j < r->argc && j < 2; j++)
+        {
+            /* only these take a second path, symlink's is its target */
+            if (j == 1 && r->op != LINK && r->op != RENAME)
+                break;
+
+            n = node_get(r->argv[j]);
+            if (n->seen)
+                continue;
+            n->seen = 1;
+
+            /* created, or didn't exist */
+            if (j == 0 && (r->op == MKNOD || r->op == MKDIR || r->op == CREATE
+                        || r->op == SYMLINK || r->op == LINK))
+                continue;
+            if (j == 1 && r->op == LINK)
+                continue;
+            if (r->res < 0 || (j == 1 && r->op == RENAME))
+                continue;
+
+            path(r, j, buf);
+            mkdirs(buf);
+
+            if (S_ISDIR(n->mode) || r->op == RMDIR)
+            {
+                mkdir(buf, 0755);
+                dirs++;
+            }
+            else if (S_ISLNK(n->mode) || r->op == READLINK)
+            {
+                if (symlink("target", buf) == 0)
+                    links++;
+            }
+            else if ((fd = open(buf, O_WRONLY | O_CREAT, 0644)) != -1)
+            {
+                if (ftruncate(fd, n->size))
+                    perror(buf);
+                close(fd);
+                files++;
+            }
+        }
+    }
+
+    printf("%lu files, %lu directories, %lu symlinks\n", files, dirs, links);
+}
+
+
+/*-----------------------------*
+ * replaying                   *
+ *-----------------------------*/
+
+/* our descriptor for a recorded one, opened if it was opened before the
+   recording started */
+static int fd_get(const struct rec *r, int i)
+{
+    long long rfd = num(r, i);
+    char buf[PATH_MAX];
+    int fd = -1;
+
+    if (rfd < 0 || rfd >= FD_MAX)
+        return -1;
+
+    pthread_mutex_lock(&m_fds);
+    if ((fd = fds[rfd]) == -1)
+    {
+        path(r, 0, buf);
+        if ((fd = open(buf, O_RDWR)) == -1)
+            fd = open(buf, O_RDONLY);
+        fds[rfd] = fd;
+    }
+    pthread_mutex_unlock(&m_fds);
+
+    return fd;
+}
+
+static void fd_set(const struct rec *r, int i, int fd)
+{
+    long long rfd = num(r, i);
+
+    if (fd == -1 || rfd < 0 || rfd >= FD_MAX)
+        return;
+
+    pthread_mutex_lock(&m_fds);
+    if (fds[rfd] != -1)
+        close(fds[rfd]);
+    fds[rfd] = fd;
+    pthread_mutex_unlock(&m_fds);
+}
+
+static int fd_close(const struct rec *r, int i)
+{
+    long long rfd = num(r, i);
+    int fd;
+
+    if (rfd < 0 || rfd >= FD_MAX)
+        return -1;
+
+    pthread_mutex_lock(&m_fds);
+    fd = fds[rfd];
+    fds[rfd] = -1;
+    pthread_mutex_unlock(&m_fds);
+
+    return (fd == -1) ? 0 : close(fd);
+}
+
+/* perform _r_, returns a negative errno like the fuse operation did */
+static int perform(const struct rec *r, char **io, size_t *io_size)
+{
+    char p0[PATH_MAX], p1[PATH_MAX];
+    struct stat st;
+    struct statvfs sv;
+    struct timespec ts[2];
+    DIR *d;
+    size_t size;
+    int res = 0, fd;
+
+    /* buffer for read, write, readlink and xattrs */
+    size = (r->op == READ || r->op == WRITE) ? num(r, 2)
+        : (r->op == READLINK || r->op == SETXATTR || r->op == GETXATTR) ? num(r, r->op == READLINK ? 1 : 2)
+        : (r->op == LISTXATTR) ? num(r, 1) : 0;
+    if (size + 1 > *io_size)
+    {
+        free(*io);
+        if ((*io = calloc(1, size + 1)) == NULL)
+            die("out of memory");
+        *io_size = size + 1;
+    }
+
+    switch (r->op)
+    {
+        case GETATTR:    res = lstat(path(r, 0, p0), &st); break;
+        case FGETATTR:   res = fstat(fd_get(r, 1), &st); break;
+        case ACCESS:     res = access(path(r, 0, p0), num(r, 1)); break;
+        case READLINK:   res = (readlink(path(r, 0, p0), *io, size) < 0) ? -1 : 0; break;
+        case MKNOD:      res = mknod(path(r, 0, p0), num(r, 1), num(r, 2)); break;
+        case MKDIR:      res = mkdir(path(r, 0, p0), num(r, 1)); break;
+        case RMDIR:      res = rmdir(path(r, 0, p0)); break;
+        case UNLINK:     res = unlink(path(r, 0, p0)); break;
+        case LINK:       res = link(path(r, 0, p0), path(r, 1, p1)); break;
+        case RENAME:     res = rename(path(r, 0, p0), path(r, 1, p1)); break;
+        case TRUNCATE:   res = truncate(path(r, 0, p0), num(r, 1)); break;
+        case CHOWN:      res = lchown(path(r, 0, p0), num(r, 1), num(r, 2)); break;
+        case CHMOD:      res = chmod(path(r, 0, p0), num(r, 1)); break;
+        case STATFS:     res = statvfs(path(r, 0, p0), &sv); break;
+        case RELEASE:    res = fd_close(r, 1); break;
+        case FSYNC:      fd = fd_get(r, 1); res = num(r, 2) ? fdatasync(fd) : fsync(fd); break;
+
+        /* the target isn't a path below <dir> */
+        case SYMLINK:    res = symlink((r->argc > 1) ? r->argv[1] : "", path(r, 0, p0)); break;
+
+        case OPEN:
+            res = fd = open(path(r, 0, p0), num(r, 2));
+            fd_set(r, 1, fd);
+            break;
+        case CREATE:
+            res = fd = open(path(r, 0, p0), num(r, 3) | O_CREAT, num(r, 2));
+            fd_set(r, 1, fd);
+            break;
+
+        case READ:
+            res = pread(fd_get(r, 1), *io, size, num(r, 3));
+            break;
+        case WRITE:
+            res = pwrite(fd_get(r, 1), *io, size, num(r, 3));
+            break;
+
+        case READDIR:
+            if (num(r, 1) == 0 && (d = opendir(path(r, 0, p0))))
+            {
+                while (readdir(d));
+                closedir(d);
+            }
+            else if (num(r, 1) == 0)
+                res = -1;
+            break;
+
+        case UTIMENS:
+            ts[0].tv_sec = num(r, 1);
+            ts[0].tv_nsec = num(r, 2);
+            ts[1].tv_sec = num(r, 3);
+            ts[1].tv_nsec = num(r, 4);
+            res = utimensat(AT_FDCWD, path(r, 0, p0), ts, AT_SYMLINK_NOFOLLOW);
+            break;
+
+        case SETXATTR:
+            res = lsetxattr(path(r, 0, p0), (r->argc > 1) ? r->argv[1] : "", *io, size, num(r, 3));
+            break;
+        case GETXATTR:
+            res = lgetxattr(path(r, 0, p0), (r->argc > 1) ? r->argv[1] : "", *io, size);
+            break;
+        case LISTXATTR:
+            res = llistxattr(path(r, 0, p0), *io, size);
+            break;
+
+        /* caused by close(), opendir() and closedir() */
+        case FLUSH:
+        case OPENDIR:
+        case RELEASEDIR:
+        case FSYNCDIR:
+            break;
+    }
+
+    return (res < 0) ? -errno : res;
+}
+
+static void *replay_thread(void *arg)
+{
+    unsigned long thread = (uintptr_t)arg;
+    unsigned long long start, due, now;
+    char *io = NULL;
+    size_t io_size = 0;
+    size_t i;
+    struct rec *r;
+    struct timespec ts;
+
+    for (i = 0; i < rec_n; i++)
+    {
+        r = &recs[i];
+        if (r->thread != thread)
+            continue;
+
+        /* wait until the operations started before this one were */
+        pthread_mutex_lock(&m_next);
+        while (next_rec != i)
+            pthread_cond_wait(&c_next, &m_next);
+        pthread_mutex_unlock(&m_next);
+
+        if (speed > 0)
+        {
+            due = t0 + (unsigned long long)(r->start / speed);
+            if ((now = now_us()) < due)
+            {
+                ts.tv_sec = (due - now) / 1000000;
+                ts.tv_nsec = (due - now) % 1000000 * 1000;
+                nanosleep(&ts, NULL);
+            }
+        }
+
+        pthread_mutex_lock(&m_next);
+        next_rec++;
+        pthread_cond_broadcast(&c_next);
+        pthread_mutex_unlock(&m_next);
+
+        start = now_us();
+        r->replay_res = perform(r, &io, &io_size);
+        r->us = now_us() - start;
+    }
+
+    free(io);
+    return NULL;
+}
+
+static int cmp_us(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+/* nearest rank */
+static unsigned long long percentile(const unsigned long long *us, size_t n, int p)
+{
+    size_t i = (n * p + 99) / 100;
+    return us[i ? i - 1 : 0];
+}
+
+static void report(double seconds)
+{
+    unsigned long long *us;
+    unsigned long long total;
+    size_t i, n, errors, differ;
+    int op;
+
+    if ((us = malloc((rec_n + 1) * sizeof *us)) == NULL)
+        die("out of memory");
+
+    printf("%-12s %9s %7s %7s %9s %9s %9s %9s %11s\n", "operation",
+            "calls", "errors", "differ", "p50/us", "p90/us", "p99/us", "max/us", "total/s");
+
+    for (op = 0; op < OPS; op++)
+    {
+        n = errors = differ = 0;
+        total = 0;
+
+        for (i = 0; i < rec_n; i++)
+        {
+            if (recs[i].op != op)
+                continue;
+
+            us[n++] = recs[i].us;
+            total += recs[i].us;
+            if (recs[i].replay_res < 0)
+                errors++;
+            if ((recs[i].replay_res < 0) != (recs[i].res < 0))
+                differ++;
+        }
+
+        if (!n)
+            continue;
+
+        qsort(us, n, sizeof *us, cmp_us);
+        printf("%-12s %9zu %7zu %7zu %9llu %9llu %9llu %9llu %11.3f\n", op_names[op],
+                n, errors, differ, percentile(us, n, 50), percentile(us, n, 90),
+                percentile(us, n, 99), us[n - 1], total / 1e6);
+    }
+
+    printf("\n%zu operations in %.3f s, recorded in %.3f s\n", rec_n, seconds,
+            rec_n ? recs[rec_n - 1].start / 1e6 : 0.0);
+
+    free(us);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, prep = 0;
+    size_t i, j, threads_n = 0;
+    unsigned long *threads = NULL;
+    pthread_t *tids;
+    char *end;
+
+    while ((opt = getopt(argc, argv, "ps:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                prep = 1;
+                break;
+            case 's':
+                speed = strtod(optarg, &end);
+                if (*end || speed < 0)
+                    die("speed must be a number >= 0");
+                break;
+            default:
+                fprintf(stderr, "usage: fsreplay -p <record> <dir>\n"
+                                "       fsreplay [-s <speed>] <record> <dir>\n");
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2)
+        die("a record and a directory are needed");
+
+    read_record(argv[optind]);
+
+    root = argv[optind + 1];
+    root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/')
+        root_len--;
+    if ((root = strndup(root, root_len)) == NULL)
+        die("out of memory");
+
+    if (prep)
+    {
+        prepare();
+        return EXIT_SUCCESS;
+    }
+
+    for (i = 0; i < FD_MAX; i++)
+        fds[i] = -1;
+
+    /* one thread for each recorded one */
+    for (i = 0; i < rec_n; i++)
+    {
+        for (j = 0; j < threads_n && threads[j] != recs[i].thread; j++);
+        if (j < threads_n)
+            continue;
+        if ((threads = realloc(threads, (threads_n + 1) * sizeof *threads)) == NULL)
+            die("out of memory");
+        threads[threads_n++] = recs[i].thread;
+    }
+
+    if ((tids = malloc((threads_n + 1) * sizeof *tids)) == NULL)
+        die("out of memory");
+
+    t0 = now_us();
+
+    for (i = 0; i < threads_n; i++)
+    {
+        if (pthread_create(&tids[i], NULL, replay_thread, (void *)(uintptr_t)threads[i]))
+            die("can't create thread");
+    }
+    for (i = 0; i < threads_n; i++)
+        pthread_join(tids[i], NULL);
+
+    report((now_us() - t0) / 1e6);
+
+    for (i = 0; i < FD_MAX; i++)
+    {
+        if (fds[i] != -1)
+            close(fds[i]);
+    }
+
+    free(tids);
+    free(threads);
+    return EXIT_SUCCESS;
+}
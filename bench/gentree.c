@@ -0,0 +1,190 @@
+/*! @file gentree.c
+ * generate a directory tree to be used as the remote fs in benchmarks.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: gentree [-d <depth>] [-f <fanout>] [-n <files>] [-s <min>[-<max>]]
+ *                [-S <seed>] <dir>
+ *        gentree -m <fraction> [-S <seed>] <dir>
+ *
+ * the first form creates <dir> with <fanout> subdirectories in each
+ * directory down to <depth> levels, and <files> files of <min> to <max>
+ * bytes in each directory. defaults: -d 3 -f 8 -n 32 -s 0-65536.
+ *
+ * the second form changes the contents of about <fraction> (0 to 1) of
+ * the files below <dir>, so their mtime changes like between two scans.
+ *
+ * the same seed gives the same tree, the counts are printed at the end.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static unsigned int depth = 3;
+static unsigned int fanout = 8;
+static unsigned int files = 32;
+static unsigned long size_min = 0;
+static unsigned long size_max = 65536;
+static double fraction = -1;
+static unsigned long long seed = 1;
+
+static unsigned long n_dirs = 0, n_files = 0, n_modified = 0;
+static unsigned long long n_bytes = 0;
+
+static char buf[65536];
+
+
+/* xorshift64*, reproducible with the same seed */
+static unsigned long long rnd(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ULL;
+}
+
+static void die(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static void write_file(const char *path, unsigned long size, int flags)
+{
+    int fd;
+    size_t n;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | flags, 0644)) == -1)
+        die(path);
+
+    n_bytes += size;
+
+    while (size)
+    {
+        n = (size < sizeof buf) ? size : sizeof buf;
+        if (write(fd, buf, n) != n)
+            die(path);
+        size -= n;
+    }
+
+    close(fd);
+}
+
+static void gen_dir(const char *path, unsigned int level)
+{
+    char p[PATH_MAX];
+    unsigned int i;
+    unsigned long size;
+
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+        die(path);
+    n_dirs++;
+
+    for (i = 0; i < files; i++)
+    {
+        size = size_min;
+        if (size_max > size_min)
+            size += rnd() % (size_max - size_min + 1);
+
+        snprintf(p, sizeof p, "%s/file%u", path, i);
+        write_file(p, size, O_TRUNC);
+        n_files++;
+    }
+
+    if (level >= depth)
+        return;
+
+    for (i = 0; i < fanout; i++)
+    {
+        snprintf(p, sizeof p, "%s/dir%u", path, i);
+        gen_dir(p, level + 1);
+    }
+}
+
+/* append a little, so the size changes as well */
+static int modify(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if (type == FTW_D)
+        n_dirs++;
+    else if (type == FTW_F)
+    {
+        n_files++;
+        if ((rnd() >> 11) * (1.0 / 9007199254740992.0) < fraction)
+        {
+            write_file(path, 1 + rnd() % 512, O_APPEND);
+            n_modified++;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    size_t i;
+    char *p;
+
+    while ((c = getopt(argc, argv, "d:f:n:s:m:S:")) != -1)
+    {
+        switch (c)
+        {
+            case 'd':
+                depth = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                fanout = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                files = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                size_min = size_max = strtoul(optarg, &p, 10);
+                if (*p == '-')
+                    size_max = strtoul(p + 1, NULL, 10);
+                break;
+            case 'm':
+                fraction = strtod(optarg, NULL);
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 10) | 1;
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if (optind != argc - 1 || size_max < size_min)
+        goto usage;
+
+    for (i = 0; i < sizeof buf; i++)
+        buf[i] = rnd();
+
+    if (fraction >= 0)
+    {
+        if (nftw(argv[optind], modify, 32, FTW_PHYS))
+            die(argv[optind]);
+    }
+    else
+        gen_dir(argv[optind], 0);
+
+    printf("dirs %lu files %lu bytes %llu modified %lu\n",
+            n_dirs, n_files, n_bytes, n_modified);
+    return EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "usage: %s [-d <depth>] [-f <fanout>] [-n <files>] [-s <min>[-<max>]] [-S <seed>] <dir>\n"
+            "       %s -m <fraction> [-S <seed>] <dir>\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
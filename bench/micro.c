@@ -0,0 +1,385 @@
+/*! @file micro.c
+ * microbenchmarks of the data structures used on every file system
+ * operation.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: micro [-n <paths>] [-j <jobs>] [-s mixed|flat|deep] [-S <seed>]
+ *              [<benchmark>...]
+ *
+ * generates <paths> paths (default 100000) in a tree of the given shape
+ * and runs the benchmarks (default: all) on them, reporting time and
+ * allocations per operation and the peak RSS so far. allocations are
+ * counted for discofs and datastructs code only, not sqlite. the job
+ * benchmarks use <jobs> jobs (default 10000) and a database in a
+ * temporary directory.
+ *
+ * shapes:
+ *   mixed  a random tree, few directories hold most files (default)
+ *   flat   all files in one directory
+ *   deep   a binary tree of directories, files spread evenly
+ */
+
+#include "config.h"
+
+/* the hash table functions of sync.c are static */
+#include "sync.c"
+
+#include "lock.h"
+#include "job.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define SHAPE_MIXED 0
+#define SHAPE_FLAT  1
+#define SHAPE_DEEP  2
+
+/* average number of files per directory */
+#define FILES_PER_DIR 16
+
+struct options discofs_options = OPTIONS_INIT;
+
+static char **paths = NULL;
+static size_t *order = NULL;    /* paths in random order */
+static size_t path_n = 100000;
+static size_t job_n = 10000;
+static int shape = SHAPE_MIXED;
+static unsigned long long seed = 1;
+
+static char tmpdir[] = "/tmp/discofs-micro.XXXXXX";
+
+/* prevents the compiler from dropping results */
+static volatile unsigned long sink;
+
+
+/*-----------------------------------------------*
+ * allocation counting, linked with --wrap=malloc *
+ *-----------------------------------------------*/
+
+static unsigned long allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+    __sync_fetch_and_add(&allocs, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    __sync_fetch_and_add(&allocs, 1);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    __sync_fetch_and_add(&allocs, 1);
+    return __real_realloc(p, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    __sync_fetch_and_add(&allocs, 1);
+    return __real_strdup(s);
+}
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* xorshift64*, reproducible with the same seed */
+static unsigned long long rnd(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ULL;
+}
+
+static double rnd_unit(void)
+{
+    return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void die(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static char *xprintf(const char *fmt, const char *s, size_t n)
+{
+    char *p;
+    int len = snprintf(NULL, 0, fmt, s, n);
+
+    if ((p = __real_malloc(len + 1)) == NULL)
+        die("malloc");
+    snprintf(p, len + 1, fmt, s, n);
+    return p;
+}
+
+static void gen_paths(void)
+{
+    size_t i, d, parent, dir_n;
+    char **dirs;
+
+    dir_n = (shape == SHAPE_FLAT) ? 1 : path_n / FILES_PER_DIR + 1;
+
+    if ((dirs = __real_malloc(dir_n * sizeof *dirs)) == NULL
+            || (paths = __real_malloc(path_n * sizeof *paths)) == NULL
+            || (order = __real_malloc(path_n * sizeof *order)) == NULL)
+        die("malloc");
+
+    /* the root is "", so its files are "/name" */
+    dirs[0] = "";
+    for (d = 1; d < dir_n; d++)
+    {
+        parent = (shape == SHAPE_DEEP) ? (d - 1) / 2 : rnd() % d;
+        dirs[d] = xprintf("%s/dir%zu", dirs[parent], d);
+    }
+
+    for (i = 0; i < path_n; i++)
+    {
+        if (shape == SHAPE_DEEP)
+            d = i % dir_n;
+        /* skewed towards the first directories */
+        else
+            d = (size_t)(dir_n * rnd_unit() * rnd_unit() * rnd_unit());
+
+        paths[i] = xprintf("%s/file%zu.c", dirs[d], i);
+        order[i] = i;
+    }
+
+    /* Fisher-Yates */
+    for (i = path_n - 1; i > 0; i--)
+    {
+        d = rnd() % (i + 1);
+        parent = order[i];
+        order[i] = order[d];
+        order[d] = parent;
+    }
+
+    /* the directory strings are leaked on purpose, like the paths */
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, size_t ops, unsigned long long ns, unsigned long a)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%-14s %10zu %12.1f %10.2f %10.1f\n", name, ops,
+            ops ? (double)ns / ops : 0.0, ops ? (double)a / ops : 0.0,
+            ru.ru_maxrss / 1024.0);
+}
+
+/* run _stmt_ for each path (in random order if _shuffle_) and report */
+#define BENCH(name, shuffle, stmt)                          \
+    do {                                                    \
+        size_t i_;                                          \
+        const char *path;                                   \
+        unsigned long a_ = allocs;                          \
+        unsigned long long t_ = now_ns();                   \
+        for (i_ = 0; i_ < path_n; i_++)                     \
+        {                                                   \
+            path = paths[(shuffle) ? order[i_] : i_];       \
+            stmt;                                           \
+        }                                                   \
+        report(name, path_n, now_ns() - t_, allocs - a_);   \
+    } while (0)
+
+
+/*------------*
+ * benchmarks *
+ *------------*/
+
+static void bench_djb2(void)
+{
+    BENCH("djb2", 0, sink += djb2(path, SIZE_MAX));
+}
+
+/* as used for the cache and remote paths */
+static void bench_join(void)
+{
+    char *p;
+
+    BENCH("join_path2", 0,
+            p = join_path2("/home/user/.local/share/discofs/cache", 0, path, 0);
+            sink += (unsigned long)p;
+            free(p));
+}
+
+/* directories are read from an empty db the first time */
+static void bench_sync(void)
+{
+    char dir[] = "/tmp/discofs-micro.XXXXXX";
+    char db[sizeof dir + 16];
+    struct sync s;
+    sync_xtime_t t;
+
+    memset(&t, 0, sizeof t);
+    if (mkdtemp(dir) == NULL)
+        die("mkdtemp");
+
+    snprintf(db, sizeof db, "%s/db.sqlite", dir);
+    if (db_init(db, 1) != DB_OK || sync_init())
+        die("initializing sync");
+
+    BENCH("sync_ht_set", 0, sink += sync_ht_set(path, t, t));
+    BENCH("sync_ht_get", 1, sink += sync_ht_get(path, &s));
+    BENCH("sync_ht_set/2", 1, sink += sync_ht_set(path, t, t));
+
+    sync_destroy();
+    db_destroy();
+
+    unlink(db);
+    rmdir(dir);
+}
+
+static void bench_lock(void)
+{
+    if (lock_init())
+        die("lock_init");
+
+    BENCH("lock_set", 1, sink += lock_set(path, LOCK_OPEN));
+    BENCH("lock_has", 1, sink += lock_has(path, LOCK_OPEN));
+    BENCH("lock_remove", 1, sink += lock_remove(path, LOCK_OPEN));
+
+    lock_destroy();
+}
+
+static void bench_job(void)
+{
+    size_t i, n = (job_n < path_n) ? job_n : path_n;
+    char db[sizeof tmpdir + 16];
+    struct job *j;
+    unsigned long a;
+    unsigned long long t;
+
+    if (mkdtemp(tmpdir) == NULL)
+        die("mkdtemp");
+
+    snprintf(db, sizeof db, "%s/db.sqlite", tmpdir);
+    if (db_init(db, 1) != DB_OK || timer_init() || job_init())
+        die("initializing the job queue");
+
+    /* metadata jobs, transfers would look at the cache */
+    a = allocs;
+    t = now_ns();
+    for (i = 0; i < n; i++)
+        job_schedule(JOB_CHMOD, paths[order[i]], 0644, 0, NULL, NULL);
+    report("job_schedule", n, now_ns() - t, allocs - a);
+
+    a = allocs;
+    t = now_ns();
+    job_store();
+    report("job_store", n, now_ns() - t, allocs - a);
+
+    a = allocs;
+    t = now_ns();
+    for (i = 0; i < n && db_job_get(&j) == DB_OK && j; i++)
+    {
+        db_job_delete_id(j->id);
+        job_free(j);
+    }
+    report("db_job_get", i, now_ns() - t, allocs - a);
+
+    job_destroy();
+    timer_destroy();
+    db_destroy();
+
+    unlink(db);
+    rmdir(tmpdir);
+}
+
+static const struct
+{
+    const char *name;
+    void (*f)(void);
+} benchmarks[] =
+{
+    { "djb2", bench_djb2 },
+    { "join", bench_join },
+    { "sync", bench_sync },
+    { "lock", bench_lock },
+    { "job", bench_job },
+};
+
+#define BENCHMARKS (sizeof benchmarks / sizeof *benchmarks)
+
+
+int main(int argc, char **argv)
+{
+    int c, i;
+    size_t b;
+    unsigned long long t;
+
+    while ((c = getopt(argc, argv, "n:j:s:S:")) != -1)
+    {
+        switch (c)
+        {
+            case 'n':
+                path_n = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                job_n = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                if (!strcmp(optarg, "mixed"))
+                    shape = SHAPE_MIXED;
+                else if (!strcmp(optarg, "flat"))
+                    shape = SHAPE_FLAT;
+                else if (!strcmp(optarg, "deep"))
+                    shape = SHAPE_DEEP;
+                else
+                    goto usage;
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 10) | 1;
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if (!path_n)
+        goto usage;
+
+    t = now_ns();
+    gen_paths();
+    fprintf(stderr, "generated %zu paths in %.2fs\n", path_n, (now_ns() - t) / 1e9);
+
+    printf("%-14s %10s %12s %10s %10s\n", "benchmark", "ops", "ns/op", "allocs/op", "rss/MB");
+
+    for (b = 0; b < BENCHMARKS; b++)
+    {
+        for (i = optind; i < argc && strcmp(argv[i], benchmarks[b].name); i++);
+
+        if (optind == argc || i < argc)
+            benchmarks[b].f();
+    }
+
+    return EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "usage: %s [-n <paths>] [-j <jobs>] [-s mixed|flat|deep] [-S <seed>] [<benchmark>...]\n"
+            "benchmarks: djb2 join sync lock job\n", argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,348 @@
+#!/bin/sh
+# discofs - disconnected file system
+# Copyright (c) 2012 Robin Martinjak
+# see LICENSE for full license (BSD 2-Clause)
+#
+# end-to-end benchmark: mounts discofs over a local directory acting as the
+# remote fs (optionally behind bench/throttlefs) and times workloads.
+#
+# usage: bench/run.sh [-l <ms>] [-b <kbytes>] [-o <report>] [<workload>...]
+#
+#   -l <ms>      latency added to each remote operation
+#   -b <kbytes>  bandwidth limit of the remote fs, per second
+#   -o <report>  where to write the report (default bench/results/<date>.json)
+#
+# workloads (default: all of them, in this order):
+#   create    create $BENCH_FILES small files in 20 directories
+#   stat      list them with their attributes, 5 times (needs create)
+#   untar     extract a tarball ($BENCH_TARBALL, default: the source tree)
+#   seqwrite  write a file of $BENCH_MB megabytes
+#   seqread   read a file of $BENCH_MB megabytes that is only on the remote fs
+#   git       clone $BENCH_GIT (default: this repository) and check out its
+#             first and last commit
+#   replay    make changes while offline, then measure applying them
+#   trace     replay the operations recorded in $BENCH_TRACE (see "record"
+#             in discofs(1)) with bench/fsreplay, $BENCH_TRACE_SPEED times
+#             as fast (default 0: without pauses). not run by default, the
+#             latencies of each operation are written next to the report
+#
+# for each workload, the report contains the time it took ("seconds") and
+# the time until all resulting changes were applied to the remote fs
+# ("settle"). bench/compare.sh compares two reports.
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH_DIR")
+
+DISCOFS=${DISCOFS:-$TOP/discofs}
+THROTTLEFS=${THROTTLEFS:-$BENCH_DIR/throttlefs}
+FSREPLAY=${FSREPLAY:-$BENCH_DIR/fsreplay}
+BENCH_FILES=${BENCH_FILES:-2000}
+BENCH_MB=${BENCH_MB:-256}
+BENCH_GIT=${BENCH_GIT:-$TOP}
+BENCH_TARBALL=${BENCH_TARBALL:-}
+BENCH_SETTLE_MAX=${BENCH_SETTLE_MAX:-600}
+BENCH_TRACE=${BENCH_TRACE:-}
+BENCH_TRACE_SPEED=${BENCH_TRACE_SPEED:-0}
+
+latency=0
+bw=0
+report=
+
+while getopts l:b:o: c
+do
+    case $c in
+        l) latency=$OPTARG ;;
+        b) bw=$OPTARG ;;
+        o) report=$OPTARG ;;
+        *) sed -n 's/^# usage: /usage: /p' "$0" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+workloads=${*:-create stat untar seqwrite seqread git replay}
+
+if [ -z "$report" ]
+then
+    mkdir -p "$BENCH_DIR/results"
+    report=$BENCH_DIR/results/$(date +%Y%m%d-%H%M%S).json
+fi
+
+[ -x "$DISCOFS" ] || { echo "$DISCOFS not found, run make first" >&2; exit 1; }
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/discofs-bench.XXXXXX")
+backing=$tmp/backing
+remote=$tmp/remote
+data=$tmp/data
+mnt=$tmp/mnt
+mkdir "$backing" "$remote" "$data" "$mnt"
+
+discofs_pid=
+throttle_mounted=
+
+cleanup()
+{
+    if [ -n "$discofs_pid" ]
+    then
+        fusermount -u "$mnt" 2>/dev/null || true
+        wait "$discofs_pid" 2>/dev/null || true
+    fi
+    if [ -n "$throttle_mounted" ]
+    then
+        fusermount -u "$remote" 2>/dev/null || true
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+
+#-----------------*
+# helpers         *
+#-----------------*
+
+now()
+{
+    date +%s.%N
+}
+
+elapsed()
+{
+    echo "$1 $(now)" | awk '{ printf "%.3f", $2 - $1 }'
+}
+
+stat_value()
+{
+    awk -v m="$1" '$1 == m { print $2 }' "$mnt/.discofs/stats"
+}
+
+pending_jobs()
+{
+    awk '/^discofs_jobs\{/ { n += $2 } END { print n + 0 }' "$mnt/.discofs/stats"
+}
+
+wait_online()
+{
+    i=0
+    until [ "$(stat_value discofs_online 2>/dev/null)" = "$1" ]
+    do
+        i=$((i + 1))
+        [ $i -lt 600 ] || { echo "timeout waiting for online=$1" >&2; exit 1; }
+        sleep 0.1
+    done
+}
+
+# seconds until no jobs are pending, -1 after BENCH_SETTLE_MAX
+settle()
+{
+    start=$(now)
+    while [ "$(pending_jobs)" -gt 0 ]
+    do
+        if [ "$(elapsed "$start" | cut -d. -f1)" -ge "$BENCH_SETTLE_MAX" ]
+        then
+            echo -1
+            return
+        fi
+        sleep 0.1
+    done
+    elapsed "$start"
+}
+
+first=1
+result()
+{
+    [ $first -eq 1 ] || printf ',\n' >> "$report"
+    first=0
+    printf '    {"workload": "%s", "seconds": %s, "settle": %s}' "$1" "$2" "$3" >> "$report"
+    printf '%-10s %10ss %10ss\n' "$1" "$2" "$3"
+}
+
+# time a workload given as a function name
+run()
+{
+    start=$(now)
+    "w_$1"
+    t=$(elapsed "$start")
+    result "$1" "$t" "$(settle)"
+}
+
+
+#-----------------*
+# workloads       *
+#-----------------*
+
+w_create()
+{
+    mkdir "$mnt/small"
+    d=0
+    while [ $d -lt 20 ]
+    do
+        mkdir "$mnt/small/$d"
+        d=$((d + 1))
+    done
+
+    i=0
+    while [ $i -lt "$BENCH_FILES" ]
+    do
+        head -c 1024 /dev/zero > "$mnt/small/$((i % 20))/f$i"
+        i=$((i + 1))
+    done
+}
+
+w_stat()
+{
+    for i in 1 2 3 4 5
+    do
+        ls -lR "$mnt/small" > /dev/null
+    done
+}
+
+w_untar()
+{
+    mkdir "$mnt/untar"
+    tar -xf "$tarball" -C "$mnt/untar"
+}
+
+w_seqwrite()
+{
+    dd if=/dev/zero of="$mnt/big" bs=1M count="$BENCH_MB" conv=fsync 2>/dev/null
+}
+
+w_seqread()
+{
+    cat "$mnt/bigr" > /dev/null
+}
+
+w_git()
+{
+    git clone -q "$BENCH_GIT" "$mnt/git"
+    (
+        cd "$mnt/git"
+        git checkout -q "$(git rev-list --max-parents=0 HEAD | tail -n 1)"
+        git checkout -q -
+    )
+}
+
+w_replay()
+{
+    kill -USR2 "$discofs_pid"
+    wait_online 0
+
+    mkdir "$mnt/replay"
+    i=0
+    while [ $i -lt $((BENCH_FILES / 4)) ]
+    do
+        head -c 4096 /dev/zero > "$mnt/replay/f$i"
+        i=$((i + 1))
+    done
+    [ -d "$mnt/small" ] && mv "$mnt/small/0" "$mnt/replay/moved"
+
+    # only the time to get back in sync counts
+    start=$(now)
+    kill -USR2 "$discofs_pid"
+    wait_online 1
+}
+
+w_trace()
+{
+    "$FSREPLAY" -s "$BENCH_TRACE_SPEED" "$BENCH_TRACE" "$mnt/trace" > "${report%.json}.trace.txt"
+}
+
+
+#-----------------*
+# setup           *
+#-----------------*
+
+if [ "$latency" -gt 0 ] || [ "$bw" -gt 0 ]
+then
+    [ -x "$THROTTLEFS" ] || { echo "$THROTTLEFS not found, run make bench" >&2; exit 1; }
+    "$THROTTLEFS" -o latency="$latency",bw="$bw" "$backing" "$remote"
+    throttle_mounted=1
+else
+    remote=$backing
+fi
+
+# prepared before mounting, so they don't count
+for w in $workloads
+do
+    case $w in
+        untar)
+            tarball=$BENCH_TARBALL
+            if [ -z "$tarball" ]
+            then
+                tarball=$tmp/src.tar
+                tar -cf "$tarball" -C "$TOP" src
+            fi
+            ;;
+        stat)
+            case " $workloads " in
+                *" create "*) ;;
+                *) echo "stat needs create" >&2; exit 1 ;;
+            esac
+            ;;
+        git)
+            command -v git > /dev/null || { echo "git not found" >&2; exit 1; }
+            ;;
+        trace)
+            [ -r "$BENCH_TRACE" ] || { echo "trace needs BENCH_TRACE" >&2; exit 1; }
+            [ -x "$FSREPLAY" ] || { echo "$FSREPLAY not found, run make bench" >&2; exit 1; }
+            mkdir "$backing/trace"
+            "$FSREPLAY" -p "$BENCH_TRACE" "$backing/trace" > /dev/null
+            ;;
+    esac
+done
+
+"$DISCOFS" -f -o data="$data",loglevel=error,logfile="$tmp/discofs.log" "$remote" "$mnt" &
+discofs_pid=$!
+
+i=0
+until [ -r "$mnt/.discofs/stats" ]
+do
+    i=$((i + 1))
+    [ $i -lt 100 ] || { echo "discofs did not come up, see $tmp/discofs.log" >&2; exit 1; }
+    sleep 0.1
+done
+wait_online 1
+
+cat > "$report" <<EOT
+{
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "commit": "$(git -C "$TOP" rev-parse --short HEAD 2>/dev/null)",
+  "latency_ms": $latency,
+  "bw_kbytes": $bw,
+  "files": $BENCH_FILES,
+  "mbytes": $BENCH_MB,
+  "results": [
+EOT
+
+
+#-----------------*
+# run             *
+#-----------------*
+
+printf '%-10s %11s %11s\n' workload seconds settle
+for w in $workloads
+do
+    case $w in
+        seqread)
+            # directly on the remote fs, so it has to be pulled
+            dd if=/dev/zero of="$backing/bigr" bs=1M count="$BENCH_MB" 2>/dev/null
+            run seqread
+            ;;
+        replay)
+            w_replay
+            t=$(elapsed "$start")
+            result replay "$t" "$(settle)"
+            ;;
+        create|stat|untar|seqwrite|git|trace)
+            run "$w"
+            ;;
+        *)
+            echo "unknown workload: $w" >&2
+            exit 1
+            ;;
+    esac
+done
+
+printf '\n  ]\n}\n' >> "$report"
+echo "report written to $report"
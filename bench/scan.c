@@ -0,0 +1,330 @@
+/*! @file scan.c
+ * benchmark of loading the sync table and scanning the remote fs.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: scan -D <datadir> [-r <rows>] [-w <name>] [-k] [<tree>]
+ *
+ * uses (and creates) the database and cache in <datadir> and
+ *  - with -r, first adds <rows> synthetic entries to the sync table
+ *  - measures loading the sync table (sync_init) as at startup
+ *  - if <tree> is given, scans it completely like the worker does with
+ *    <tree> as the remote fs, and counts the lstat() calls and jobs
+ *  - with -k, marks everything below <tree> as synchronized and drops the
+ *    jobs afterwards, so the next run only finds what changed meanwhile
+ *    (see gentree -m)
+ *
+ * each measurement is printed as one line of JSON. lstat() calls are
+ * counted by linking with --wrap=lstat, which needs glibc 2.33 or later
+ * (before, lstat is an inline function and 0 is reported).
+ */
+
+/* nftw() */
+#define _XOPEN_SOURCE 700
+
+#include "config.h"
+
+/* the scan functions of worker.c are static */
+#include "worker.c"
+
+#include "db.h"
+
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <sys/stat.h>
+
+/* synthetic sync entries per directory */
+#define ROWS_PER_DIR 32
+
+struct options discofs_options = OPTIONS_INIT;
+
+static unsigned long lstat_n = 0;
+static unsigned long long jobs_n = 0;
+static sqlite3 *keep_db = NULL;
+static sqlite3_stmt *keep_stmt = NULL;
+static size_t tree_len = 0;
+
+int __real_lstat(const char *path, struct stat *buf);
+
+int __wrap_lstat(const char *path, struct stat *buf)
+{
+    __sync_fetch_and_add(&lstat_n, 1);
+    return __real_lstat(path, buf);
+}
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "scan: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* resident memory in bytes */
+static unsigned long long rss(void)
+{
+    unsigned long size, resident = 0;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/statm", "r")) != NULL)
+    {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+
+    return (unsigned long long)resident * sysconf(_SC_PAGESIZE);
+}
+
+static sqlite3 *open_db(const char *fn)
+{
+    sqlite3 *db;
+
+    if (sqlite3_open(fn, &db) != SQLITE_OK)
+        die(sqlite3_errmsg(db));
+
+    sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    return db;
+}
+
+static void close_db(sqlite3 *db)
+{
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+        die(sqlite3_errmsg(db));
+    sqlite3_close(db);
+}
+
+/* the statement of db_store_sync() */
+static sqlite3_stmt *prepare_sync(sqlite3 *db)
+{
+    sqlite3_stmt *stmt;
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO sync (path, mtime_s, mtime_ns, ctime_s, ctime_ns) "
+                "VALUES (?, ?, ?, ?, ?);", -1, &stmt, NULL) != SQLITE_OK)
+#else
+    if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO sync (path, mtime_s, ctime_s) "
+                "VALUES (?, ?, ?);", -1, &stmt, NULL) != SQLITE_OK)
+#endif
+        die(sqlite3_errmsg(db));
+
+    return stmt;
+}
+
+static void insert_sync(sqlite3_stmt *stmt, const char *path, const struct stat *st)
+{
+    sqlite3_bind_text (stmt, 1, path, -1, SQLITE_TRANSIENT);
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    sqlite3_bind_int64(stmt, 2, st->st_mtim.tv_sec);
+    sqlite3_bind_int64(stmt, 3, st->st_mtim.tv_nsec);
+    sqlite3_bind_int64(stmt, 4, st->st_ctim.tv_sec);
+    sqlite3_bind_int64(stmt, 5, st->st_ctim.tv_nsec);
+#else
+    sqlite3_bind_int64(stmt, 2, st->st_mtime);
+    sqlite3_bind_int64(stmt, 3, st->st_ctime);
+#endif
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        die("inserting into the sync table");
+    sqlite3_reset(stmt);
+}
+
+static void add_rows(const char *fn, unsigned long rows)
+{
+    unsigned long i;
+    char path[64];
+    struct stat st;
+    sqlite3 *db = open_db(fn);
+    sqlite3_stmt *stmt = prepare_sync(db);
+
+    memset(&st, 0, sizeof st);
+    st.st_mtime = st.st_ctime = time(NULL);
+
+    for (i = 0; i < rows; i++)
+    {
+        snprintf(path, sizeof path, "/synthetic/dir%lu/file%lu", i / ROWS_PER_DIR, i);
+        insert_sync(stmt, path, &st);
+    }
+
+    sqlite3_finalize(stmt);
+    close_db(db);
+}
+
+static int keep_entry(const char *fpath, const struct stat *st, int type, struct FTW *ftw)
+{
+    if (fpath[tree_len])
+        insert_sync(keep_stmt, fpath + tree_len, st);
+    return 0;
+}
+
+static void keep(const char *fn, const char *tree)
+{
+    keep_db = open_db(fn);
+    keep_stmt = prepare_sync(keep_db);
+    tree_len = strlen(tree);
+
+    if (nftw(tree, keep_entry, 32, FTW_PHYS))
+        die("walking the tree");
+
+    if (sqlite3_exec(keep_db, "DELETE FROM job;", NULL, NULL, NULL) != SQLITE_OK)
+        die(sqlite3_errmsg(keep_db));
+
+    sqlite3_finalize(keep_stmt);
+    close_db(keep_db);
+}
+
+static unsigned long long count_rows(const char *fn)
+{
+    unsigned long long n = 0;
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_open(fn, &db) != SQLITE_OK)
+        die(sqlite3_errmsg(db));
+
+    if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sync;", -1, &stmt, NULL) == SQLITE_OK
+            && sqlite3_step(stmt) == SQLITE_ROW)
+        n = sqlite3_column_int64(stmt, 0);
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return n;
+}
+
+static void count_jobs(job_op op, unsigned long n, void *arg)
+{
+    jobs_n += n;
+}
+
+static char *root(const char *path, size_t *len)
+{
+    char *p;
+
+    if ((p = realpath(path, NULL)) == NULL)
+        die(path);
+
+    *len = strlen(p);
+    return p;
+}
+
+
+int main(int argc, char **argv)
+{
+    int c, k = 0;
+    char fn[PATH_MAX];
+    const char *data = NULL, *name = "scan";
+    unsigned long rows = 0, dirs = 0;
+    unsigned long long mem;
+    double t;
+    queue *scan_q;
+
+    while ((c = getopt(argc, argv, "D:r:w:k")) != -1)
+    {
+        switch (c)
+        {
+            case 'D':
+                data = optarg;
+                break;
+            case 'r':
+                rows = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                name = optarg;
+                break;
+            case 'k':
+                k = 1;
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if (!data || optind < argc - 1 || (k && optind == argc))
+        goto usage;
+
+    snprintf(fn, sizeof fn, "%s/cache", data);
+    mkdir(data, 0755);
+    mkdir(fn, 0755);
+    discofs_options.cache_root = root(fn, &discofs_options.cache_root_len);
+    discofs_options.data_root = (char *)data;
+    discofs_options.fs_features = FEAT_NS;
+    discofs_options.rtimeout = 0;
+
+    snprintf(fn, sizeof fn, "%s/db.sqlite", data);
+    if (db_init(fn, 0) != DB_OK)
+        die("db_init");
+
+    if (rows)
+        add_rows(fn, rows);
+
+    /* startup */
+    mem = rss();
+    t = now();
+    if (sync_init())
+        die("sync_init");
+    t = now() - t;
+
+    printf("{\"workload\": \"startup\", \"seconds\": %.3f, \"rows\": %llu, \"rss_mb\": %.1f}\n",
+            t, count_rows(fn), (rss() - mem) / 1048576.0);
+
+    if (optind < argc)
+    {
+        discofs_options.remote_root = root(argv[optind], &discofs_options.remote_root_len);
+
+        if (lock_init() || timer_init() || job_init() || sparse_init() || policy_init())
+            die("initializing");
+
+        state_set(STATE_ONLINE, NULL);
+
+        if ((scan_q = q_init()) == NULL || q_enqueue(scan_q, strdup("/")))
+            die("q_init");
+
+        lstat_n = 0;
+        t = now();
+        while (!q_empty(scan_q))
+        {
+            worker_scan_dir(scan_q);
+            dirs++;
+        }
+        job_store();
+        t = now() - t;
+
+        db_job_count(count_jobs, NULL);
+        printf("{\"workload\": \"%s\", \"seconds\": %.3f, \"dirs\": %lu, \"lstat\": %lu, \"jobs\": %llu}\n",
+                name, t, dirs, lstat_n, jobs_n);
+
+        q_free(scan_q, free);
+        policy_destroy();
+        sparse_destroy();
+        job_destroy();
+        timer_destroy();
+        lock_destroy();
+    }
+
+    sync_destroy();
+    db_destroy();
+
+    if (k)
+        keep(fn, discofs_options.remote_root);
+
+    return EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "usage: %s -D <datadir> [-r <rows>] [-w <name>] [-k] [<tree>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
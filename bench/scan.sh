@@ -0,0 +1,81 @@
+#!/bin/sh
+# discofs - disconnected file system
+# Copyright (c) 2012 Robin Martinjak
+# see LICENSE for full license (BSD 2-Clause)
+#
+# scan and startup benchmark on a generated tree.
+#
+# usage: bench/scan.sh [-d <depth>] [-f <fanout>] [-n <files>] [-m <fraction>]
+#                      [-r <rows>] [-o <report>]
+#
+# generates a tree with bench/gentree (default: depth 4, fanout 8, 32 files
+# per directory, about 150000 files) and measures with bench/scan:
+#
+#   scan_cold         first scan, everything is new
+#   startup_tree      loading the sync table of the tree
+#   scan_incremental  scan after <fraction> of the files changed (0.01)
+#   startup_rows      loading a sync table of <rows> entries (1000000)
+#
+# the report has the format of bench/run.sh, see bench/compare.sh.
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+
+depth=4
+fanout=8
+files=32
+fraction=0.01
+rows=1000000
+report=
+
+while getopts d:f:n:m:r:o: c
+do
+    case $c in
+        d) depth=$OPTARG ;;
+        f) fanout=$OPTARG ;;
+        n) files=$OPTARG ;;
+        m) fraction=$OPTARG ;;
+        r) rows=$OPTARG ;;
+        o) report=$OPTARG ;;
+        *) sed -n 's/^# usage: /usage: /p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+if [ -z "$report" ]
+then
+    mkdir -p "$BENCH_DIR/results"
+    report=$BENCH_DIR/results/scan-$(date +%Y%m%d-%H%M%S).json
+fi
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/discofs-scan.XXXXXX")
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+echo "generating tree: $("$BENCH_DIR/gentree" -d "$depth" -f "$fanout" -n "$files" -s 0-4096 "$tmp/tree")"
+
+{
+    "$BENCH_DIR/scan" -D "$tmp/data" -w scan_cold -k "$tmp/tree" | grep -v '"startup"'
+    echo "modifying: $("$BENCH_DIR/gentree" -m "$fraction" "$tmp/tree")" >&2
+    "$BENCH_DIR/scan" -D "$tmp/data" -w scan_incremental "$tmp/tree" | sed 's/"startup"/"startup_tree"/'
+    "$BENCH_DIR/scan" -D "$tmp/rows" -r "$rows" | sed 's/"startup"/"startup_rows"/'
+} > "$tmp/results"
+
+cat "$tmp/results"
+
+{
+    cat <<EOT
+{
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "commit": "$(git -C "$BENCH_DIR" rev-parse --short HEAD 2>/dev/null)",
+  "depth": $depth,
+  "fanout": $fanout,
+  "files": $files,
+  "fraction": $fraction,
+  "rows": $rows,
+  "results": [
+EOT
+    sed 's/^/    /; $!s/$/,/' "$tmp/results"
+    printf '  ]\n}\n'
+} > "$report"
+
+echo "report written to $report"
@@ -0,0 +1,372 @@
+/*! @file throttlefs.c
+ * passthrough file system that adds latency and limits bandwidth.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: throttlefs [-o latency=<ms>,bw=<kbytes>] <dir> <mountpoint>
+ *
+ * makes <dir> available at <mountpoint>, like a network file system would:
+ * every operation takes at least <ms> milliseconds, and reads and writes
+ * share <kbytes> per second. used by bench/run.sh as the remote fs.
+ */
+
+#define FUSE_USE_VERSION 26
+
+#include <fuse.h>
+#include <fuse_opt.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+struct options
+{
+    char *root;
+    unsigned int latency;       /* ms per operation */
+    unsigned int bw;            /* kbytes per second, 0 for unlimited */
+};
+
+static struct options opt = { NULL, 0, 0 };
+
+/* time at which the bandwidth used so far is paid off */
+static struct timespec bw_next;
+static pthread_mutex_t m_bw = PTHREAD_MUTEX_INITIALIZER;
+
+#define OPT_KEY(t, p) { t, offsetof(struct options, p), 0 }
+static struct fuse_opt throttle_opts[] =
+{
+    OPT_KEY("latency=%u", latency),
+    OPT_KEY("bw=%u", bw),
+    FUSE_OPT_END
+};
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static void ts_add_us(struct timespec *ts, unsigned long long us)
+{
+    ts->tv_sec += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void delay(void)
+{
+    struct timespec ts;
+
+    if (!opt.latency)
+        return;
+
+    ts.tv_sec = opt.latency / 1000;
+    ts.tv_nsec = (opt.latency % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+/* transfers are queued behind each other, each one waits until the
+   bandwidth used before it and by itself is paid off */
+static void throttle(size_t bytes)
+{
+    struct timespec now, until;
+
+    if (!opt.bw || !bytes)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&m_bw);
+    if (bw_next.tv_sec < now.tv_sec
+            || (bw_next.tv_sec == now.tv_sec && bw_next.tv_nsec < now.tv_nsec))
+        bw_next = now;
+    ts_add_us(&bw_next, (unsigned long long)bytes * 1000000 / (opt.bw * 1024ULL));
+    until = bw_next;
+    pthread_mutex_unlock(&m_bw);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+/* path in the backing directory */
+static const char *real(const char *path, char *buf)
+{
+    snprintf(buf, PATH_MAX, "%s%s", opt.root, path);
+    return buf;
+}
+
+#define REAL(p) real(p, buf_ ## p)
+#define RES(x) (((x) == -1) ? -errno : 0)
+
+
+/*============*
+ * OPERATIONS *
+ *============*/
+
+static int t_getattr(const char *path, struct stat *st)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(lstat(REAL(path), st));
+}
+
+static int t_fgetattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+    delay();
+    return RES(fstat(fi->fh, st));
+}
+
+static int t_access(const char *path, int mode)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(access(REAL(path), mode));
+}
+
+static int t_readlink(const char *path, char *out, size_t size)
+{
+    char buf_path[PATH_MAX];
+    ssize_t n;
+
+    delay();
+    if ((n = readlink(REAL(path), out, size - 1)) == -1)
+        return -errno;
+    out[n] = '\0';
+    return 0;
+}
+
+static int t_readdir(const char *path, void *out, fuse_fill_dir_t filler,
+        off_t offset, struct fuse_file_info *fi)
+{
+    char buf_path[PATH_MAX];
+    DIR *dir;
+    struct dirent *ent;
+
+    delay();
+    if ((dir = opendir(REAL(path))) == NULL)
+        return -errno;
+
+    while ((ent = readdir(dir)) != NULL)
+        if (filler(out, ent->d_name, NULL, 0))
+            break;
+
+    closedir(dir);
+    return 0;
+}
+
+static int t_mknod(const char *path, mode_t mode, dev_t rdev)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(mknod(REAL(path), mode, rdev));
+}
+
+static int t_mkdir(const char *path, mode_t mode)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(mkdir(REAL(path), mode));
+}
+
+static int t_unlink(const char *path)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(unlink(REAL(path)));
+}
+
+static int t_rmdir(const char *path)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(rmdir(REAL(path)));
+}
+
+static int t_symlink(const char *to, const char *from)
+{
+    char buf_from[PATH_MAX];
+    delay();
+    return RES(symlink(to, REAL(from)));
+}
+
+static int t_rename(const char *from, const char *to)
+{
+    char buf_from[PATH_MAX], buf_to[PATH_MAX];
+    delay();
+    return RES(rename(REAL(from), REAL(to)));
+}
+
+static int t_link(const char *from, const char *to)
+{
+    char buf_from[PATH_MAX], buf_to[PATH_MAX];
+    delay();
+    return RES(link(REAL(from), REAL(to)));
+}
+
+static int t_chmod(const char *path, mode_t mode)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(chmod(REAL(path), mode));
+}
+
+static int t_chown(const char *path, uid_t uid, gid_t gid)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(lchown(REAL(path), uid, gid));
+}
+
+static int t_truncate(const char *path, off_t size)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(truncate(REAL(path), size));
+}
+
+static int t_utimens(const char *path, const struct timespec ts[2])
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(utimensat(AT_FDCWD, REAL(path), ts, AT_SYMLINK_NOFOLLOW));
+}
+
+static int t_open(const char *path, struct fuse_file_info *fi)
+{
+    char buf_path[PATH_MAX];
+    int fd;
+
+    delay();
+    if ((fd = open(REAL(path), fi->flags)) == -1)
+        return -errno;
+    fi->fh = fd;
+    return 0;
+}
+
+static int t_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    char buf_path[PATH_MAX];
+    int fd;
+
+    delay();
+    if ((fd = open(REAL(path), fi->flags | O_CREAT, mode)) == -1)
+        return -errno;
+    fi->fh = fd;
+    return 0;
+}
+
+static int t_read(const char *path, char *out, size_t size, off_t offset,
+        struct fuse_file_info *fi)
+{
+    ssize_t n;
+
+    delay();
+    if ((n = pread(fi->fh, out, size, offset)) == -1)
+        return -errno;
+    throttle(n);
+    return n;
+}
+
+static int t_write(const char *path, const char *in, size_t size, off_t offset,
+        struct fuse_file_info *fi)
+{
+    ssize_t n;
+
+    delay();
+    throttle(size);
+    if ((n = pwrite(fi->fh, in, size, offset)) == -1)
+        return -errno;
+    return n;
+}
+
+static int t_statfs(const char *path, struct statvfs *st)
+{
+    char buf_path[PATH_MAX];
+    delay();
+    return RES(statvfs(REAL(path), st));
+}
+
+static int t_release(const char *path, struct fuse_file_info *fi)
+{
+    close(fi->fh);
+    return 0;
+}
+
+static int t_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    delay();
+    return RES(datasync ? fdatasync(fi->fh) : fsync(fi->fh));
+}
+
+static struct fuse_operations throttle_oper =
+{
+    .getattr = t_getattr,
+    .fgetattr = t_fgetattr,
+    .access = t_access,
+    .readlink = t_readlink,
+    .readdir = t_readdir,
+    .mknod = t_mknod,
+    .mkdir = t_mkdir,
+    .unlink = t_unlink,
+    .rmdir = t_rmdir,
+    .symlink = t_symlink,
+    .rename = t_rename,
+    .link = t_link,
+    .chmod = t_chmod,
+    .chown = t_chown,
+    .truncate = t_truncate,
+    .utimens = t_utimens,
+    .open = t_open,
+    .create = t_create,
+    .read = t_read,
+    .write = t_write,
+    .statfs = t_statfs,
+    .release = t_release,
+    .fsync = t_fsync,
+};
+
+/* the first non-option argument is the backing directory */
+static int opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+    if (key == FUSE_OPT_KEY_NONOPT && !opt.root)
+    {
+        if ((opt.root = realpath(arg, NULL)) == NULL)
+        {
+            perror(arg);
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    if (fuse_opt_parse(&args, &opt, throttle_opts, opt_proc) == -1)
+        return EXIT_FAILURE;
+
+    if (!opt.root)
+    {
+        fprintf(stderr, "usage: %s [-o latency=<ms>,bw=<kbytes>] <dir> <mountpoint>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return fuse_main(args.argc, args.argv, &throttle_oper, NULL);
+}
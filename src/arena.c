@@ -0,0 +1,81 @@
+/*! @file arena.c
+ * allocation of small objects that are freed together.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "arena.h"
+
+#include <stdlib.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+struct arena_chunk
+{
+    struct arena_chunk *next;   /* the chunk allocated before */
+    size_t size;                /* of data */
+    size_t used;
+    /* data follows, aligned to ARENA_ALIGN */
+};
+
+/* the header, rounded up to ARENA_ALIGN */
+#define CHUNK_HEAD ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+#define CHUNK_DATA(c) ((char *)(c) + CHUNK_HEAD)
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_chunk *c = a->chunk;
+    size_t n;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (!c || c->size - c->used < size)
+    {
+        /* twice the last one, small arenas stay small */
+        n = (c) ? 2 * c->size : ARENA_CHUNK_MIN;
+        if (n > ARENA_CHUNK_MAX)
+            n = ARENA_CHUNK_MAX;
+        if (n < size)
+            n = size;
+
+        if ((c = malloc(CHUNK_HEAD + n)) == NULL)
+            return NULL;
+
+        c->next = a->chunk;
+        c->size = n;
+        c->used = 0;
+
+        a->chunk = c;
+        a->size += n;
+    }
+
+    p = CHUNK_DATA(c) + c->used;
+    c->used += size;
+
+    return p;
+}
+
+void arena_free(struct arena *a)
+{
+    struct arena_chunk *c, *next;
+
+    for (c = a->chunk; c; c = next)
+    {
+        next = c->next;
+        free(c);
+    }
+
+    a->chunk = NULL;
+    a->size = 0;
+}
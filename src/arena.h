@@ -0,0 +1,48 @@
+/*! @file arena.h
+ * allocation of small objects that are freed together.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_ARENA_H
+#define DISCOFS_ARENA_H
+
+#include "config.h"
+
+#include <stddef.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! size of the first chunk of an arena, each following one is twice as
+   large up to ARENA_CHUNK_MAX. objects larger than that get their own */
+#define ARENA_CHUNK_MIN 256
+#define ARENA_CHUNK_MAX 65536
+
+/*! alignment of the objects */
+#define ARENA_ALIGN 8
+
+struct arena_chunk;
+
+struct arena
+{
+    struct arena_chunk *chunk;  /* the one allocated from, and the older ones */
+    size_t size;                /* bytes of all chunks */
+};
+
+#define ARENA_INIT { NULL, 0 }
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! _size_ bytes from _a_, NULL if out of memory */
+void *arena_alloc(struct arena *a, size_t size);
+
+/*! free all objects of _a_ */
+void arena_free(struct arena *a);
+
+#endif
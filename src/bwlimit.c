@@ -0,0 +1,307 @@
+/*! @file bwlimit.c
+ * bandwidth limits for transfers.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "bwlimit.h"
+
+#include "discofs.h"
+#include "state.h"
+#include "log.h"
+#include "worker.h"
+
+#include <errno.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+#define BW_LINE_MAX 256
+
+/*! token bucket */
+struct bucket
+{
+    unsigned long long rate;    /* bytes per second, 0: unlimited */
+    unsigned long long tokens;  /* bytes that may be transferred now */
+    unsigned long long last;    /* time of the last refill */
+};
+
+/*! limits from a time of day on */
+struct period
+{
+    int start;                  /* minutes since midnight */
+    unsigned long long rate[2]; /* bytes per second for BW_PUSH, BW_PULL */
+};
+
+static struct bucket buckets[2];
+
+static struct period *periods = NULL;
+static size_t periods_n = 0;
+static time_t sched_mtime = 0;
+static time_t sched_checked = 0;
+
+/* limits set with bwlimit_set(), -1: none */
+static long long override[2] = { -1, -1 };
+
+static pthread_mutex_t m_bwlimit = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static unsigned long long bw_now(void);
+static int period_cmp(const void *a, const void *b);
+static int bw_load(void);
+static void bw_update(void);
+static void bw_refill(struct bucket *b, size_t bytes);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* monotonic time in microseconds */
+static unsigned long long bw_now(void)
+{
+#if HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static int period_cmp(const void *a, const void *b)
+{
+    return ((const struct period *)a)->start - ((const struct period *)b)->start;
+}
+
+/* (re-)read the schedule file. lines are "HH:MM <push> <pull>" with
+   limits in kbytes per second. the old schedule is kept on errors */
+static int bw_load(void)
+{
+    FILE *f;
+    char line[BW_LINE_MAX];
+    char *p;
+    struct period *new = NULL, *tmp, per;
+    size_t new_n = 0;
+    unsigned int h, m, n = 0;
+    unsigned long push, pull;
+    struct stat st;
+
+    if ((f = fopen(discofs_options.bwlimit, "r")) == NULL)
+    {
+        ERROR("opening bandwidth schedule %s: %s", discofs_options.bwlimit, strerror(errno));
+        return -1;
+    }
+
+    if (!fstat(fileno(f), &st))
+        sched_mtime = st.st_mtime;
+
+    while (fgets(line, sizeof line, f))
+    {
+        n++;
+
+        /* skip leading whitespace, comments and empty lines */
+        for (p = line; isspace((unsigned char)*p); p++);
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        if (sscanf(p, "%u:%u %lu %lu", &h, &m, &push, &pull) != 4 || h > 23 || m > 59)
+        {
+            ERROR("%s:%u: invalid bandwidth limit", discofs_options.bwlimit, n);
+            goto failure;
+        }
+
+        per.start = h * 60 + m;
+        per.rate[BW_PUSH] = (unsigned long long)push * 1024;
+        per.rate[BW_PULL] = (unsigned long long)pull * 1024;
+
+        if ((tmp = realloc(new, (new_n + 1) * sizeof *new)) == NULL)
+            goto failure;
+        new = tmp;
+        new[new_n++] = per;
+    }
+
+    fclose(f);
+
+    qsort(new, new_n, sizeof *new, period_cmp);
+
+    free(periods);
+    periods = new;
+    periods_n = new_n;
+
+    VERBOSE("loaded %lu bandwidth limit periods", (unsigned long)periods_n);
+    return 0;
+
+failure:
+    fclose(f);
+    free(new);
+    return -1;
+}
+
+/* pick up changes of the schedule file and the current time of day.
+   m_bwlimit must be held */
+static void bw_update(void)
+{
+    int i, min;
+    time_t now = time(NULL);
+    struct tm tm;
+    struct stat st;
+    unsigned long long rate[2];
+
+    if (discofs_options.bwlimit && now - sched_checked >= BW_RELOAD_INTERVAL)
+    {
+        sched_checked = now;
+        if (!stat(discofs_options.bwlimit, &st) && st.st_mtime != sched_mtime)
+            bw_load();
+    }
+
+    rate[BW_PUSH] = (unsigned long long)discofs_options.bwpush * 1024;
+    rate[BW_PULL] = (unsigned long long)discofs_options.bwpull * 1024;
+
+    /* the last period starting before now, or the last one of the day
+       before */
+    if (periods_n && localtime_r(&now, &tm))
+    {
+        min = tm.tm_hour * 60 + tm.tm_min;
+
+        for (i = periods_n - 1; i > 0 && periods[i].start > min; i--);
+        if (periods[i].start > min)
+            i = periods_n - 1;
+
+        rate[BW_PUSH] = periods[i].rate[BW_PUSH];
+        rate[BW_PULL] = periods[i].rate[BW_PULL];
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        if (override[i] >= 0)
+            rate[i] = override[i];
+
+        if (buckets[i].rate != rate[i])
+        {
+            DEBUG("%s limit is now %llu bytes/s", (i == BW_PUSH) ? "push" : "pull", rate[i]);
+            buckets[i].rate = rate[i];
+            buckets[i].tokens = 0;
+            buckets[i].last = bw_now();
+        }
+    }
+}
+
+/* add the tokens accumulated since the last refill. at most one second
+   worth of tokens (or _bytes_, if more) are saved up */
+static void bw_refill(struct bucket *b, size_t bytes)
+{
+    unsigned long long now = bw_now();
+    unsigned long long max = (b->rate > bytes) ? b->rate : bytes;
+
+    b->tokens += (now - b->last) * b->rate / 1000000;
+    if (b->tokens > max)
+        b->tokens = max;
+
+    b->last = now;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int bwlimit_init(void)
+{
+    if (!discofs_options.bwlimit)
+        return 0;
+
+    sched_checked = time(NULL);
+    return bw_load();
+}
+
+void bwlimit_destroy(void)
+{
+    free(periods);
+    periods = NULL;
+    periods_n = 0;
+}
+
+void bwlimit_set(int dir, long kbytes)
+{
+    pthread_mutex_lock(&m_bwlimit);
+    override[dir] = (kbytes < 0) ? -1 : (long long)kbytes * 1024;
+    pthread_mutex_unlock(&m_bwlimit);
+}
+
+unsigned long long bwlimit_rate(int dir)
+{
+    unsigned long long rate;
+
+    pthread_mutex_lock(&m_bwlimit);
+    bw_update();
+    rate = buckets[dir].rate;
+    pthread_mutex_unlock(&m_bwlimit);
+
+    return rate;
+}
+
+int bwlimit_wait(int dir, size_t bytes)
+{
+    struct bucket *b = &buckets[dir];
+    unsigned long long now, end, wait;
+
+    pthread_mutex_lock(&m_bwlimit);
+
+    bw_update();
+
+    end = bw_now() + BW_SLICE_MS * 1000;
+
+    while (b->rate)
+    {
+        bw_refill(b, bytes);
+
+        if (b->tokens >= bytes)
+        {
+            b->tokens -= bytes;
+            break;
+        }
+
+        /* let the worker perform other jobs in the meantime */
+        now = bw_now();
+        if (now >= end)
+        {
+            pthread_mutex_unlock(&m_bwlimit);
+            return -1;
+        }
+
+        wait = (bytes - b->tokens) * 1000000 / b->rate + 1;
+        if (wait > end - now)
+            wait = end - now;
+
+        pthread_mutex_unlock(&m_bwlimit);
+        usleep(wait);
+
+        /* instant pulls and renames go first */
+        if (worker_blocked() || !ONLINE)
+            return -1;
+
+        pthread_mutex_lock(&m_bwlimit);
+    }
+
+    pthread_mutex_unlock(&m_bwlimit);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*! @file bwlimit.h
+ * bandwidth limits for transfers.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_BWLIMIT_H
+#define DISCOFS_BWLIMIT_H
+
+#include "config.h"
+#include "discofs.h"
+
+#include <stddef.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! directions, each one has its own budget */
+#define BW_PUSH 0
+#define BW_PULL 1
+
+/*! bwlimit_wait() sleeps at most this long (milliseconds) before letting
+   the worker do other things */
+#define BW_SLICE_MS 100
+
+/*! seconds between two checks of the schedule file for changes */
+#define BW_RELOAD_INTERVAL 10
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! load the schedule from the file given with the "bwlimit" option */
+int bwlimit_init(void);
+void bwlimit_destroy(void);
+
+/*! limit direction _dir_ to _kbytes_ per second (0: unlimited) until the
+   mount ends, overriding the options and the schedule. -1 removes the
+   override */
+void bwlimit_set(int dir, long kbytes);
+
+/*! the limit in bytes per second currently in effect, 0: unlimited */
+unsigned long long bwlimit_rate(int dir);
+
+/*! wait until _bytes_ may be transferred in direction _dir_. returns
+   non-zero if the transfer should be interrupted instead, because waiting
+   would take too long or the worker is blocked */
+int bwlimit_wait(int dir, size_t bytes);
+
+#endif
@@ -0,0 +1,444 @@
+/*! @file ctl.c
+ * control socket for discofsctl.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "ctl.h"
+
+#include "state.h"
+#include "log.h"
+#include "funcs.h"
+#include "job.h"
+#include "db.h"
+#include "worker.h"
+#include "bwlimit.h"
+#include "rcall.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! a command returns NULL on success, an error message otherwise */
+struct ctl_cmd
+{
+    const char *name;
+    int min_args;
+    int max_args;
+    const char *(*f)(FILE *out, int argc, char **argv);
+};
+
+static int ctl_fd = -1;
+static char *ctl_path = NULL;
+
+static const char *prio_names[] = { "low", "mid", "high", "urgent" };
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static const char *ctl_status(FILE *out, int argc, char **argv);
+static const char *ctl_jobs(FILE *out, int argc, char **argv);
+static const char *ctl_prio(FILE *out, int argc, char **argv);
+static const char *ctl_flush(FILE *out, int argc, char **argv);
+static const char *ctl_set(FILE *out, int argc, char **argv);
+static const char *ctl_scan(FILE *out, int argc, char **argv);
+
+static const struct ctl_cmd ctl_cmds[] =
+{
+    { "status", 0, 0, ctl_status },
+    { "jobs",   0, 1, ctl_jobs },
+    { "prio",   2, 2, ctl_prio },
+    { "flush",  1, 1, ctl_flush },
+    { "set",    2, 2, ctl_set },
+    { "scan",   1, 1, ctl_scan },
+    { NULL, 0, 0, NULL }
+};
+
+static int ctl_file_path(char *path);
+static int ctl_uint(const char *s, unsigned long *val);
+static void print_job(const struct job *j, void *arg);
+static void print_job_count(job_op op, unsigned long n, void *arg);
+static void ctl_serve(int fd);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* check a path given by the client, trailing slashes are removed */
+static int ctl_file_path(char *path)
+{
+    size_t len = strlen(path);
+
+    if (*path != '/')
+        return -1;
+
+    while (len > 1 && path[len-1] == '/')
+        path[--len] = '\0';
+
+    return 0;
+}
+
+static int ctl_uint(const char *s, unsigned long *val)
+{
+    char *end;
+
+    if (*s < '0' || *s > '9')
+        return -1;
+
+    errno = 0;
+    *val = strtoul(s, &end, 10);
+
+    return (errno || *end) ? -1 : 0;
+}
+
+static void print_job(const struct job *j, void *arg)
+{
+    FILE *out = arg;
+    timer_ms now = timer_now();
+    const char *op = job_opstr(j->op);
+
+    if (!strncmp(op, "JOB_", 4))
+        op += 4;
+
+    fprintf(out, "%ld\t%s\t%s\t", (long)j->id,
+            (j->prio >= PRIO_LOW && j->prio <= PRIO_URGENT) ? prio_names[j->prio] : "?", op);
+
+    if (j->due > now)
+        fprintf(out, "%llus", (unsigned long long)(j->due - now + 999) / 1000);
+    else
+        fprintf(out, "now");
+
+    fprintf(out, "\t%u\t%lld\t%s\n", j->attempts, (long long)j->size, j->path);
+}
+
+static void print_job_count(job_op op, unsigned long n, void *arg)
+{
+    FILE *out = arg;
+    const char *s = job_opstr(op);
+
+    if (!strncmp(s, "JOB_", 4))
+        s += 4;
+
+    fprintf(out, "jobs %s: %lu\n", s, n);
+}
+
+/*-------------------*
+ * commands          *
+ *-------------------*/
+
+static const char *ctl_status(FILE *out, int argc, char **argv)
+{
+    unsigned long long push = bwlimit_rate(BW_PUSH), pull = bwlimit_rate(BW_PULL);
+
+    fprintf(out, "state: %s\n", ONLINE ? "online" : "offline");
+    fprintf(out, "scan: %s\n", worker_scan_paused() ? "paused" : "running");
+    fprintf(out, "scan_interval: %u\n", discofs_options.scan_interval);
+    fprintf(out, "threads: %u\n", discofs_options.threads);
+
+    if (push)
+        fprintf(out, "bwpush: %llu\n", push / 1024);
+    else
+        fprintf(out, "bwpush: unlimited\n");
+
+    if (pull)
+        fprintf(out, "bwpull: %llu\n", pull / 1024);
+    else
+        fprintf(out, "bwpull: unlimited\n");
+
+    job_store();
+    if (db_job_count(print_job_count, out) != DB_OK)
+        return "failed to count jobs";
+
+    return NULL;
+}
+
+/* jobs [path]: the jobs of path and below, in the order they are performed
+   (with sched=prio) */
+static const char *ctl_jobs(FILE *out, int argc, char **argv)
+{
+    char *path = (argc) ? argv[0] : "/";
+
+    if (ctl_file_path(path))
+        return "path must be absolute";
+
+    fprintf(out, "id\tprio\top\tdue\tattempts\tsize\tpath\n");
+
+    if (job_list(path, CTL_JOBS_MAX, print_job, out))
+        return "failed to list jobs";
+
+    return NULL;
+}
+
+/* prio <path> <low|mid|high|urgent>: jobs of path and below */
+static const char *ctl_prio(FILE *out, int argc, char **argv)
+{
+    int prio;
+    long n;
+
+    if (ctl_file_path(argv[0]))
+        return "path must be absolute";
+
+    for (prio = PRIO_LOW; prio <= PRIO_URGENT && strcmp(argv[1], prio_names[prio]); prio++);
+    if (prio > PRIO_URGENT)
+        return "priority must be low, mid, high or urgent";
+
+    if ((n = job_set_prio(argv[0], prio)) < 0)
+        return "failed to change the priority";
+
+    fprintf(out, "%ld jobs changed\n", n);
+    INFO("priority of %ld jobs of %s set to %s", n, argv[0], argv[1]);
+    return NULL;
+}
+
+/* flush <path>: perform the jobs of path and below before all others, even
+   if they are deferred */
+static const char *ctl_flush(FILE *out, int argc, char **argv)
+{
+    long n;
+
+    if (ctl_file_path(argv[0]))
+        return "path must be absolute";
+
+    if ((n = job_flush(argv[0])) < 0)
+        return "failed to flush jobs";
+
+    fprintf(out, "%ld jobs flushed\n", n);
+    INFO("flushing %ld jobs of %s", n, argv[0]);
+    return NULL;
+}
+
+/* set <option> <value>: options that can be changed while mounted */
+static const char *ctl_set(FILE *out, int argc, char **argv)
+{
+    unsigned long val;
+    int dir;
+
+    if (!strcmp(argv[0], "bwpush") || !strcmp(argv[0], "bwpull"))
+    {
+        dir = strcmp(argv[0], "bwpush") ? BW_PULL : BW_PUSH;
+
+        /* back to the options and the schedule */
+        if (!strcmp(argv[1], "auto"))
+            bwlimit_set(dir, -1);
+        else if (ctl_uint(argv[1], &val) || val > 0x7fffffffUL)
+            return "value must be a number of kbytes or 'auto'";
+        else
+            bwlimit_set(dir, val);
+    }
+    else if (ctl_uint(argv[1], &val) || val > 0x7fffffffUL)
+        return "value must be a number";
+    else if (!strcmp(argv[0], "scan_interval"))
+    {
+        discofs_options.scan_interval = val;
+        worker_wakeup();
+    }
+    else if (!strcmp(argv[0], "threads"))
+    {
+        if (!val)
+            return "at least 1 thread is needed";
+        discofs_options.threads = val;
+    }
+    else
+        return "option must be scan_interval, threads, bwpush or bwpull";
+
+    INFO("%s set to %s", argv[0], argv[1]);
+    return NULL;
+}
+
+/* scan <pause|resume|path> */
+static const char *ctl_scan(FILE *out, int argc, char **argv)
+{
+    struct stat st;
+    char *p;
+    int res;
+
+    if (!strcmp(argv[0], "pause") || !strcmp(argv[0], "resume"))
+    {
+        worker_pause_scan(!strcmp(argv[0], "pause"));
+        INFO("scanning %s", worker_scan_paused() ? "paused" : "resumed");
+        return NULL;
+    }
+
+    if (ctl_file_path(argv[0]))
+        return "expected pause, resume or an absolute path";
+
+    if (!ONLINE)
+        return "remote fs is offline";
+
+    if ((p = remote_path(argv[0])) == NULL)
+        return "out of memory";
+    res = rcall_lstat(p, &st);
+    free(p);
+
+    if (res || !S_ISDIR(st.st_mode))
+        return "not a directory on the remote fs";
+
+    if (worker_rescan(argv[0]))
+        return "out of memory";
+
+    INFO("rescan of %s requested", argv[0]);
+    return NULL;
+}
+
+/* read one request from _fd_, perform it and close _fd_ */
+static void ctl_serve(int fd)
+{
+    char req[CTL_REQ_MAX + 1];
+    char *argv[CTL_ARGS_MAX];
+    int argc = 0;
+    size_t len = 0, i;
+    ssize_t n;
+    const struct ctl_cmd *cmd;
+    const char *err = NULL;
+    struct timeval tv = { CTL_TIMEOUT, 0 };
+    FILE *out;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    while (len < CTL_REQ_MAX && (n = read(fd, req + len, CTL_REQ_MAX - len)) > 0)
+        len += n;
+    req[len] = '\0';
+
+    if ((out = fdopen(fd, "w")) == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    /* split at '\0', the last argument may lack it */
+    for (i = 0; i < len && argc < CTL_ARGS_MAX; i += strlen(req + i) + 1)
+        argv[argc++] = req + i;
+
+    if (!argc)
+        err = "no command";
+    else if (i < len)
+        err = "too many arguments";
+    else
+    {
+        for (cmd = ctl_cmds; cmd->name && strcmp(cmd->name, argv[0]); cmd++);
+
+        if (!cmd->name)
+            err = "unknown command";
+        else if (argc - 1 < cmd->min_args || argc - 1 > cmd->max_args)
+            err = "wrong number of arguments";
+        else
+            err = cmd->f(out, argc - 1, argv + 1);
+    }
+
+    if (err)
+        fprintf(out, "ERROR %s\n", err);
+    else
+        fprintf(out, "OK\n");
+
+    fclose(out);
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int ctl_init(void)
+{
+    struct sockaddr_un addr;
+    mode_t mask;
+
+    if (discofs_options.ctl)
+        ctl_path = strdup(discofs_options.ctl);
+    else
+        ctl_path = join_path(discofs_options.data_root, CTL_SOCKET);
+
+    if (!ctl_path)
+        return -1;
+
+    if (strlen(ctl_path) >= sizeof addr.sun_path)
+    {
+        ERROR("control socket path %s is too long", ctl_path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, ctl_path);
+
+    if ((ctl_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        PERROR("creating control socket");
+        return -1;
+    }
+
+    /* left behind by a discofs that didn't exit cleanly */
+    unlink(ctl_path);
+
+    /* only the user may control the file system */
+    mask = umask(S_IRWXG | S_IRWXO);
+
+    if (bind(ctl_fd, (struct sockaddr *)&addr, sizeof addr) || listen(ctl_fd, 4))
+    {
+        umask(mask);
+        PERROR("binding control socket");
+        close(ctl_fd);
+        ctl_fd = -1;
+        return -1;
+    }
+
+    umask(mask);
+
+    VERBOSE("control socket is %s", ctl_path);
+    return 0;
+}
+
+void ctl_destroy(void)
+{
+    if (ctl_fd != -1)
+    {
+        close(ctl_fd);
+        unlink(ctl_path);
+        ctl_fd = -1;
+    }
+
+    free(ctl_path);
+    ctl_path = NULL;
+}
+
+void *ctl_main(void *arg)
+{
+    struct pollfd pfd;
+    int fd;
+
+    pfd.fd = ctl_fd;
+    pfd.events = POLLIN;
+
+    /* check for EXITING once per second */
+    while (!EXITING)
+    {
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+
+        if ((fd = accept(ctl_fd, NULL, NULL)) == -1)
+            continue;
+
+        ctl_serve(fd);
+    }
+
+    VERBOSE("exiting control thread");
+    return NULL;
+}
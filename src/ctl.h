@@ -0,0 +1,46 @@
+/*! @file ctl.h
+ * control socket for discofsctl.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_CTL_H
+#define DISCOFS_CTL_H
+
+#include "config.h"
+#include "discofs.h"
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! name of the socket in the data directory, unless "ctl" is given */
+#define CTL_SOCKET "ctl"
+
+/*! a request is a command and its arguments, each terminated by '\0',
+   followed by the end of the stream (shutdown()). the reply is the output
+   of the command, followed by a line that is either "OK" or "ERROR"
+   and a message. tools/discofsctl.c is the client */
+#define CTL_REQ_MAX 4096
+#define CTL_ARGS_MAX 8
+
+/*! seconds a client may take to send its request */
+#define CTL_TIMEOUT 2
+
+/*! at most this many jobs are listed */
+#define CTL_JOBS_MAX 1000
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! create the socket. requests are served by ctl_main() */
+int ctl_init(void);
+void ctl_destroy(void);
+
+/*! thread serving requests, one at a time, until EXITING */
+void *ctl_main(void *arg);
+
+#endif
@@ -11,6 +11,7 @@
 #include "queue.h"
 #include "job.h"
 #include "sync.h"
+#include "stats.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -41,7 +42,9 @@
     "n1 INTEGER,"                   \
     "n2 INTEGER,"                   \
     "s1 TEXT,"                      \
-    "s2 TEXT"                       \
+    "s2 TEXT,"                      \
+    "size INTEGER DEFAULT 0,"       \
+    "due INTEGER DEFAULT 0"         \
     " "
 
 #define TABLE_SYNC " sync "
@@ -53,10 +56,60 @@
     "ctime_ns INTEGER"              \
     " "
 
+#define TABLE_SPARSE " sparse "
+#define SCHEMA_SPARSE " "           \
+    "path TEXT UNIQUE NOT NULL,"    \
+    "size INTEGER,"                 \
+    "map BLOB"                      \
+    " "
+
+/* jobs that failed permanently */
+#define TABLE_DEAD " dead_job "
+#define SCHEMA_DEAD " "             \
+    "rowid INTEGER PRIMARY KEY,"    \
+    "op INTEGER,"                   \
+    "time INTEGER,"                 \
+    "attempts INTEGER,"             \
+    "path TEXT,"                    \
+    "n1 INTEGER,"                   \
+    "n2 INTEGER,"                   \
+    "s1 TEXT,"                      \
+    "s2 TEXT,"                      \
+    "size INTEGER,"                 \
+    "error INTEGER"                 \
+    " "
+
+/* directories in the order they got a transfer, for sched=fair */
+#define TABLE_SCHED " sched "
+#define SCHEMA_SCHED " "            \
+    "dir TEXT UNIQUE NOT NULL,"     \
+    "served INTEGER"                \
+    " "
+
+#define TABLE_CACHE " cache "
+#define SCHEMA_CACHE " "            \
+    "path TEXT UNIQUE NOT NULL,"    \
+    "size INTEGER,"                 \
+    "atime INTEGER,"                \
+    "hits INTEGER,"                 \
+    "pinned INTEGER"                \
+    " "
+
 /*--------------------*
  * convenience macros *
  *--------------------*/
 
+/* columns read by column_job() */
+#define JOB_COLS " rowid, op, time, attempts, path, n1, n2, s1, s2, size, due, prio "
+
+/* directory part of a path (with trailing '/') */
+#define SQL_DIRNAME(col) " rtrim(" col ", replace(" col ", '/', '')) "
+
+/* path is _dir_ or below it. exact, LIKE would treat '%' and '_'
+   in _dir_ as wildcards and ignore case */
+#define SQL_BELOW(dir) " (" dir " = '/' OR path = " dir \
+    " OR substr(path, 1, length(" dir ") + 1) = " dir " || '/') "
+
 #define ERRMSG(msg) ERROR(msg ": %s", sqlite3_errmsg(db))
 
 #define PREPARE(sql, stmt)                                                  \
@@ -76,12 +129,16 @@ static sqlite3 *db;
 /* mutex because only one function should access the database */
 static pthread_mutex_t m_db = PTHREAD_MUTEX_INITIALIZER;
 
+/* when the current db call started */
+static stats_us db_call_start;
+
 
 /*-------------------*
  * static prototypes *
  *-------------------*/
 
 static char *column_text(sqlite3_stmt *stmt, int n);
+static struct job *column_job(sqlite3_stmt *stmt);
 static void db_open(void);
 static void db_close(void);
 
@@ -100,14 +157,52 @@ static char *column_text(sqlite3_stmt *stmt, int n)
     return strdup((const char*)p);
 }
 
+/* read a job from a row of JOB_COLS */
+static struct job *column_job(sqlite3_stmt *stmt)
+{
+    struct job *p = job_alloc();
+
+    if (!p)
+        return NULL;
+
+    p->id       = sqlite3_column_int64(stmt, 0);
+    p->op       = sqlite3_column_int(stmt, 1);
+
+    p->time     = sqlite3_column_int64(stmt, 2);
+    p->attempts = sqlite3_column_int(stmt, 3);
+
+    p->path     = column_text(stmt, 4);
+
+    p->n1       = sqlite3_column_int64(stmt, 5);
+    p->n2       = sqlite3_column_int64(stmt, 6);
+
+    p->s1       = column_text(stmt, 7);
+    p->s2       = column_text(stmt, 8);
+
+    p->size     = sqlite3_column_int64(stmt, 9);
+    p->due      = sqlite3_column_int64(stmt, 10);
+    p->prio     = sqlite3_column_int(stmt, 11);
+
+    return p;
+}
+
 static void db_open(void)
 {
+    stats_us start = stats_now();
+
     pthread_mutex_lock(&m_db);
+
+    /* waiting for the db counts, too */
+    db_call_start = start;
 }
 
 static void db_close(void)
 {
+    stats_us start = db_call_start;
+
     pthread_mutex_unlock(&m_db);
+
+    stats_observe(STATS_DB, start);
 }
 
 
@@ -154,6 +249,31 @@ int db_init(const char *path, int clear)
     CREATE_TABLE(TABLE_CFG, SCHEMA_CFG);
     CREATE_TABLE(TABLE_JOB, SCHEMA_JOB);
     CREATE_TABLE(TABLE_SYNC, SCHEMA_SYNC);
+    CREATE_TABLE(TABLE_SPARSE, SCHEMA_SPARSE);
+    CREATE_TABLE(TABLE_CACHE, SCHEMA_CACHE);
+    CREATE_TABLE(TABLE_SCHED, SCHEMA_SCHED);
+    CREATE_TABLE(TABLE_DEAD, SCHEMA_DEAD);
+
+    /* columns added to existing tables. fails if they exist already */
+    sqlite3_exec(db, "ALTER TABLE " TABLE_JOB " ADD COLUMN size INTEGER DEFAULT 0;",
+            NULL, NULL, NULL);
+    if (!sqlite3_exec(db, "ALTER TABLE " TABLE_JOB " ADD COLUMN due INTEGER DEFAULT 0;",
+            NULL, NULL, NULL))
+        sqlite3_exec(db, "UPDATE " TABLE_JOB " SET due = time * 1000;", NULL, NULL, NULL);
+
+    /* find due jobs without looking at deferred ones */
+    sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS job_due ON " TABLE_JOB " (due);",
+            NULL, NULL, NULL);
+
+    /* load the sync entries of one directory */
+    sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS sync_dir ON " TABLE_SYNC
+            " (" SQL_DIRNAME("path") ");", NULL, NULL, NULL);
+
+    /* sched=fair: find the jobs of a directory, the last one served */
+    sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS job_dir ON " TABLE_JOB
+            " (" SQL_DIRNAME("path") ");", NULL, NULL, NULL);
+    sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS sched_served ON " TABLE_SCHED
+            " (served);", NULL, NULL, NULL);
 
 #undef NEW_TABLE
 #undef CREATE_TABLE
@@ -319,8 +439,8 @@ int db_job_store(const struct job *j)
 
     db_open();
 
-#define COLS "rowid, prio, op, time, attempts, path, n1, n2, s1, s2"
-#define VALS "?, ?, ?, ?, ?, ?, ?, ?, ?, ?"
+#define COLS "rowid, prio, op, time, attempts, path, n1, n2, s1, s2, size, due"
+#define VALS "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?"
     PREPARE("INSERT OR REPLACE INTO " TABLE_JOB " (" COLS ") VALUES (" VALS ");", &stmt);
 #undef COLS
 #undef VALS
@@ -330,7 +450,7 @@ int db_job_store(const struct job *j)
     else
         sqlite3_bind_int64(stmt, 1, j->id);
 
-    sqlite3_bind_int  (stmt,  2, OP_PRIO(j->op));
+    sqlite3_bind_int  (stmt,  2, (j->prio < 0) ? OP_PRIO(j->op) : j->prio);
     sqlite3_bind_int  (stmt,  3, j->op);
 
     sqlite3_bind_int64(stmt,  4, j->time);
@@ -344,6 +464,9 @@ int db_job_store(const struct job *j)
     sqlite3_bind_text (stmt,  9, j->s1,     -1, SQLITE_STATIC);
     sqlite3_bind_text (stmt, 10, j->s2,     -1, SQLITE_STATIC);
 
+    sqlite3_bind_int64(stmt, 11, j->size);
+    sqlite3_bind_int64(stmt, 12, j->due);
+
     if (sqlite3_step(stmt) != SQLITE_DONE)
     {
         ERRMSG("db_store_job:");
@@ -366,39 +489,46 @@ int db_job_get(struct job **j)
 
     db_open();
 
-    PREPARE("SELECT rowid, op, time, attempts, path, n1, n2, s1, s2 FROM "
-            TABLE_JOB " WHERE time < ? ORDER BY prio DESC, time ASC LIMIT 1;",
-            &stmt);
+    /* PULLs of files in the working set come before other PULLs.
+       ?1: now, ?2: JOB_PULL, ?3: PULL_HOT, ?4: SCHED_AGING, ?5: now (ms) */
+#define JOB_GET(order) "SELECT" JOB_COLS "FROM" TABLE_JOB "AS j WHERE due <= ?5 " \
+    "ORDER BY prio DESC, (op = ?2 AND (n1 & ?3) != 0) DESC, " order " LIMIT 1;"
+/* small files first, waiting makes files "smaller" */
+#define SJF "size - (?1 - time) * ?4 ASC, due ASC"
+
+    switch (discofs_options.sched)
+    {
+        case SCHED_SJF:
+            PREPARE(JOB_GET(SJF), &stmt);
+            break;
+        case SCHED_FAIR:
+            /* the directory that waits longest for its turn first */
+            PREPARE(JOB_GET("IFNULL((SELECT served FROM" TABLE_SCHED "WHERE dir ="
+                        SQL_DIRNAME("j.path") "), 0) ASC, " SJF), &stmt);
+            break;
+        default:
+            PREPARE(JOB_GET("due ASC"), &stmt);
+            break;
+    }
+#undef JOB_GET
+#undef SJF
+
     sqlite3_bind_int64(stmt, 1, now);
+    sqlite3_bind_int  (stmt, 2, JOB_PULL);
+    sqlite3_bind_int  (stmt, 3, PULL_HOT);
+    sqlite3_bind_int64(stmt, 4, SCHED_AGING);
+    sqlite3_bind_int64(stmt, 5, timer_now());
 
     sql_res = sqlite3_step(stmt);
 
     if (sql_res == SQLITE_ROW)
     {
-        p = job_alloc();
+        p = column_job(stmt);
 
         if (!p)
-        {
             res = DB_ERROR;
-        }
         else
-        {
-            p->id       = sqlite3_column_int64(stmt, 0);
-            p->op       = sqlite3_column_int(stmt, 1);
-
-            p->time     = sqlite3_column_int64(stmt, 2);
-            p->attempts = sqlite3_column_int(stmt, 3);
-
-            p->path     = column_text(stmt, 4);
-
-            p->n1       = sqlite3_column_int64(stmt, 5);
-            p->n2       = sqlite3_column_int64(stmt, 6);
-
-            p->s1       = column_text(stmt, 7);
-            p->s2       = column_text(stmt, 8);
-
             *j = p;
-        }
     }
     /* if no rows returned, sql_res would be SQLITE_DONE */
     else if (sql_res != SQLITE_DONE)
@@ -409,55 +539,71 @@ int db_job_get(struct job **j)
 
     sqlite3_finalize(stmt);
     db_close();
+
     return res;
 }
 
-int db_job_exists(const char *path, int opmask)
+int db_sched_served(const char *path)
 {
     int res = DB_OK;
     sqlite3_stmt *stmt;
 
     db_open();
-    if (opmask == JOB_ANY)
+
+    PREPARE("INSERT OR REPLACE INTO" TABLE_SCHED "(dir, served) VALUES ("
+            SQL_DIRNAME("?1") ", (SELECT IFNULL(MAX(served), 0) + 1 FROM" TABLE_SCHED "));",
+            &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
     {
-        PREPARE("SELECT rowid FROM " TABLE_JOB " WHERE path=?;", &stmt);
-        sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+        ERRMSG("db_sched_served");
+        res = DB_ERROR;
     }
-    else
+    sqlite3_finalize(stmt);
+
+    /* +dir: compare without TEXT affinity, or the job_dir index can't be
+       used */
+    PREPARE("DELETE FROM" TABLE_SCHED "WHERE NOT EXISTS (SELECT 1 FROM" TABLE_JOB
+            "WHERE" SQL_DIRNAME("path") "= +" TABLE_SCHED ".dir);", &stmt);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
     {
-        PREPARE("SELECT rowid FROM " TABLE_JOB " WHERE path=? AND (op & ?) != 0;", &stmt);
-        sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
-        sqlite3_bind_int (stmt, 2, opmask);
+        ERRMSG("db_sched_served");
+        res = DB_ERROR;
     }
 
-    res = (sqlite3_step(stmt) == SQLITE_ROW);
-
     sqlite3_finalize(stmt);
     db_close();
     return res;
 }
 
-int db_job_delete(const char *path, int opmask)
+int db_job_get_ready(queue *q, int limit, int opmask)
 {
-    int res = DB_OK;
+    int res = DB_OK, sql_res;
     sqlite3_stmt *stmt;
+    struct job *p;
 
     db_open();
-    if (opmask == JOB_ANY)
-    {
-        PREPARE("DELETE FROM " TABLE_JOB " WHERE path=?;", &stmt);
-        sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
-    }
-    else
+
+    /* same order as db_job_get, jobs scheduled in the same second in the
+       order they were stored */
+    PREPARE("SELECT " JOB_COLS " FROM "
+            TABLE_JOB " WHERE due <= ? AND (op & ?) != 0 "
+            "ORDER BY prio DESC, due ASC, rowid ASC LIMIT ?;", &stmt);
+    sqlite3_bind_int64(stmt, 1, timer_now());
+    sqlite3_bind_int  (stmt, 2, opmask);
+    sqlite3_bind_int  (stmt, 3, limit);
+
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        PREPARE("DELETE FROM " TABLE_JOB " WHERE path=? AND (op & ?) != 0;", &stmt);
-        sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
-        sqlite3_bind_int  (stmt, 2, opmask);
+        if ((p = column_job(stmt)))
+            q_enqueue(q, p);
     }
 
-    if (sqlite3_step(stmt) != SQLITE_DONE)
+    if (sql_res != SQLITE_DONE)
     {
-        ERRMSG("db_job_delete");
+        ERRMSG("db_job_get_ready");
         res = DB_ERROR;
     }
 
@@ -466,41 +612,130 @@ int db_job_delete(const char *path, int opmask)
     return res;
 }
 
-int db_job_delete_id(job_id id)
+int db_job_bury(const struct job *j)
 {
     int res = DB_OK;
     sqlite3_stmt *stmt;
 
     db_open();
 
-    PREPARE("DELETE FROM " TABLE_JOB " WHERE rowid=?;", &stmt);
-    sqlite3_bind_int64(stmt, 1, id);
+    PREPARE("INSERT INTO" TABLE_DEAD "(op, time, attempts, path, n1, n2, s1, s2, size, error) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", &stmt);
+    sqlite3_bind_int  (stmt,  1, j->op);
+    sqlite3_bind_int64(stmt,  2, time(NULL));
+    sqlite3_bind_int  (stmt,  3, j->attempts);
+    sqlite3_bind_text (stmt,  4, j->path,   -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt,  5, j->n1);
+    sqlite3_bind_int64(stmt,  6, j->n2);
+    sqlite3_bind_text (stmt,  7, j->s1,     -1, SQLITE_STATIC);
+    sqlite3_bind_text (stmt,  8, j->s2,     -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt,  9, j->size);
+    sqlite3_bind_int  (stmt, 10, j->error);
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
     {
-        ERRMSG("db_job_delete_id");
+        ERRMSG("db_job_bury");
         res = DB_ERROR;
     }
+    sqlite3_finalize(stmt);
+
+    if (res == DB_OK)
+    {
+        PREPARE("DELETE FROM" TABLE_JOB "WHERE rowid=?;", &stmt);
+        sqlite3_bind_int64(stmt, 1, j->id);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            ERRMSG("db_job_bury");
+            res = DB_ERROR;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    db_close();
+    return res;
+}
+
+int db_job_dead_exists(const char *path)
+{
+    int res;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("SELECT rowid FROM" TABLE_DEAD "WHERE path=?;", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    res = (sqlite3_step(stmt) == SQLITE_ROW);
 
     sqlite3_finalize(stmt);
     db_close();
     return res;
 }
 
-int db_job_delete_rename_to(const char *path)
+int db_job_resurrect(const char *path)
 {
     int res = DB_OK;
     sqlite3_stmt *stmt;
+    int i;
+
+    /* the WHERE clause matches everything if ?1 is NULL */
+    static const char *sql[] = {
+        "INSERT INTO" TABLE_JOB "(prio, op, time, attempts, path, n1, n2, s1, s2, size) "
+            "SELECT CASE WHEN (op & ?2) != 0 THEN ?3 WHEN (op & ?4) != 0 THEN ?5 ELSE ?6 END, "
+            "op, 0, 0, path, n1, n2, s1, s2, size FROM" TABLE_DEAD
+            "WHERE ?1 IS NULL OR path = ?1 ORDER BY rowid;",
+        "DELETE FROM" TABLE_DEAD "WHERE ?1 IS NULL OR path = ?1;"
+    };
 
     db_open();
 
-    PREPARE("DELETE FROM " TABLE_JOB " WHERE op=? AND s1=?;", &stmt);
-    sqlite3_bind_int  (stmt, 1, JOB_RENAME);
-    sqlite3_bind_text (stmt, 2, path, -1, SQLITE_STATIC);
+    for (i = 0; res == DB_OK && i < 2; i++)
+    {
+        PREPARE(sql[i], &stmt);
 
-    if (sqlite3_step(stmt) != SQLITE_DONE)
+        if (path)
+            sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+        else
+            sqlite3_bind_null(stmt, 1);
+
+        if (i == 0)
+        {
+            sqlite3_bind_int(stmt, 2, PRIO_LOW_JOBS);
+            sqlite3_bind_int(stmt, 3, PRIO_LOW);
+            sqlite3_bind_int(stmt, 4, PRIO_HIGH_JOBS);
+            sqlite3_bind_int(stmt, 5, PRIO_HIGH);
+            sqlite3_bind_int(stmt, 6, PRIO_MID);
+        }
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            ERRMSG("db_job_resurrect");
+            res = DB_ERROR;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    db_close();
+    return res;
+}
+
+int db_job_deadlines(timer_ms now, int (*f)(timer_ms))
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("SELECT due FROM" TABLE_JOB "WHERE due > ?;", &stmt);
+    sqlite3_bind_int64(stmt, 1, now);
+
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
+        f(sqlite3_column_int64(stmt, 0));
+
+    if (sql_res != SQLITE_DONE)
     {
-        ERRMSG("db_job_delete_rename_to");
+        ERRMSG("db_job_deadlines");
         res = DB_ERROR;
     }
 
@@ -509,48 +744,56 @@ int db_job_delete_rename_to(const char *path)
     return res;
 }
 
-
-/*------*
- * sync *
- *------*/
-
-int db_load_sync(sync_load_cb_t callback)
+int db_job_count(void (*f)(job_op, unsigned long, void *), void *arg)
 {
     int res = DB_OK, sql_res;
     sqlite3_stmt *stmt;
-    char *path;
-    sync_xtime_t mtime, ctime;
 
     db_open();
 
-#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
-    PREPARE("SELECT path, mtime_s, mtime_ns, ctime_s, ctime_ns FROM " TABLE_SYNC ";", &stmt);
-#else
-    PREPARE("SELECT path, mtime_s, ctime_s FROM " TABLE_SYNC ";", &stmt);
-#endif
+    PREPARE("SELECT op, COUNT(*) FROM" TABLE_JOB "GROUP BY op;", &stmt);
 
     while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
+        f(sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1), arg);
+
+    if (sql_res != SQLITE_DONE)
     {
-        path = column_text(stmt, 0);
+        ERRMSG("db_job_count");
+        res = DB_ERROR;
+    }
 
-#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
-        mtime.tv_sec  = sqlite3_column_int64(stmt, 1);
-        mtime.tv_nsec = sqlite3_column_int64(stmt, 2);
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
 
-        ctime.tv_sec  = sqlite3_column_int64(stmt, 3);
-        ctime.tv_nsec = sqlite3_column_int64(stmt, 4);
-#else
-        mtime sqlite3_column_int64(stmt, 1);
-        ctime sqlite3_column_int64(stmt, 2);
-#endif
+int db_job_list(const char *path, int limit, void (*f)(const struct job *, void *), void *arg)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+    struct job *p;
 
-        callback(path, mtime, ctime);
-        free(path);
+    db_open();
+
+    /* the order db_job_get uses with sched=prio */
+    PREPARE("SELECT" JOB_COLS "FROM" TABLE_JOB
+            "WHERE" SQL_BELOW("?1") "ORDER BY prio DESC, due ASC, rowid ASC LIMIT ?2;", &stmt);
+
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+    sqlite3_bind_int (stmt, 2, limit);
+
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if ((p = column_job(stmt)))
+        {
+            f(p, arg);
+            job_free(p);
+        }
     }
 
     if (sql_res != SQLITE_DONE)
     {
-        ERRMSG("db_load_syncs in sqlite3_step()");
+        ERRMSG("db_job_list");
         res = DB_ERROR;
     }
 
@@ -559,51 +802,706 @@ int db_load_sync(sync_load_cb_t callback)
     return res;
 }
 
-int db_store_sync(const struct sync *s)
+int db_job_update(const char *path, int prio, timer_ms due, unsigned long *n)
 {
     int res = DB_OK;
     sqlite3_stmt *stmt;
 
     db_open();
 
-#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
-    PREPARE("INSERT OR REPLACE INTO " TABLE_SYNC " (path, mtime_s, mtime_ns, ctime_s, ctime_ns) VALUES (?, ?, ?, ?, ?)", &stmt);
-    sqlite3_bind_text (stmt, 1, s->path, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 2, s->mtime.tv_sec);
-    sqlite3_bind_int64(stmt, 3, s->mtime.tv_nsec);
-    sqlite3_bind_int64(stmt, 4, s->ctime.tv_sec);
-    sqlite3_bind_int64(stmt, 5, s->ctime.tv_nsec);
-#else
-    PREPARE("INSERT OR REPLACE INTO " TABLE_SYNC " (path, mtime_s, ctime_s) VALUES (?, ?, ?)", &stmt);
-    sqlite3_bind_text (stmt, 1, s->path, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 2, s->mtime);
-    sqlite3_bind_int64(stmt, 3, s->ctime);
-#endif
+    /* NULL keeps the old value */
+    PREPARE("UPDATE" TABLE_JOB "SET prio = IFNULL(?2, prio), due = MIN(due, IFNULL(?3, due)) "
+            "WHERE" SQL_BELOW("?1") ";", &stmt);
+
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (prio < 0)
+        sqlite3_bind_null(stmt, 2);
+    else
+        sqlite3_bind_int (stmt, 2, prio);
+
+    if (!due)
+        sqlite3_bind_null(stmt, 3);
+    else
+        sqlite3_bind_int64(stmt, 3, due);
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
     {
-        ERRMSG("error setting sync");
+        ERRMSG("db_job_update");
         res = DB_ERROR;
     }
+    else
+        *n = sqlite3_changes(db);
 
     sqlite3_finalize(stmt);
     db_close();
     return res;
 }
 
-int db_sync_delete_path(const char *path)
+int db_job_exists(const char *path, int opmask)
 {
     int res = DB_OK;
     sqlite3_stmt *stmt;
 
+    db_open();
+    if (opmask == JOB_ANY)
+    {
+        PREPARE("SELECT rowid FROM " TABLE_JOB " WHERE path=?;", &stmt);
+        sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+    }
+    else
+    {
+        PREPARE("SELECT rowid FROM " TABLE_JOB " WHERE path=? AND (op & ?) != 0;", &stmt);
+        sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+        sqlite3_bind_int (stmt, 2, opmask);
+    }
+
+    res = (sqlite3_step(stmt) == SQLITE_ROW);
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_dir(queue *q, const char *dir, int opmask)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+    char *path;
+
     db_open();
 
-    PREPARE("DELETE FROM " TABLE_SYNC " WHERE path=?;", &stmt);
-    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+    /* uses the job_dir index */
+    PREPARE("SELECT path FROM" TABLE_JOB "WHERE" SQL_DIRNAME("path")
+            "= CASE ?1 WHEN '/' THEN '/' ELSE ?1 || '/' END AND (op & ?2) != 0;", &stmt);
+    sqlite3_bind_text(stmt, 1, dir, -1, SQLITE_STATIC);
+    sqlite3_bind_int (stmt, 2, opmask);
 
-    if (sqlite3_step(stmt) != SQLITE_DONE)
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        ERRMSG("db_sync_delete_path");
+        if ((path = column_text(stmt, 0)))
+            q_enqueue(q, path);
+    }
+
+    if (sql_res != SQLITE_DONE)
+    {
+        ERRMSG("db_job_dir");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_delete(const char *path, int opmask)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+    if (opmask == JOB_ANY)
+    {
+        PREPARE("DELETE FROM " TABLE_JOB " WHERE path=?;", &stmt);
+        sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
+    }
+    else
+    {
+        PREPARE("DELETE FROM " TABLE_JOB " WHERE path=? AND (op & ?) != 0;", &stmt);
+        sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
+        sqlite3_bind_int  (stmt, 2, opmask);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_job_delete");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_delete_id(job_id id)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("DELETE FROM " TABLE_JOB " WHERE rowid=?;", &stmt);
+    sqlite3_bind_int64(stmt, 1, id);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_job_delete_id");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_delete_rename_to(const char *path)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("DELETE FROM " TABLE_JOB " WHERE op=? AND s1=?;", &stmt);
+    sqlite3_bind_int  (stmt, 1, JOB_RENAME);
+    sqlite3_bind_text (stmt, 2, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_job_delete_rename_to");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_exists_n1(const char *path, int opmask, job_param flags)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("SELECT rowid FROM " TABLE_JOB " WHERE path=? AND (op & ?) != 0 AND (n1 & ?) != 0;", &stmt);
+    sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
+    sqlite3_bind_int  (stmt, 2, opmask);
+    sqlite3_bind_int64(stmt, 3, flags);
+
+    res = (sqlite3_step(stmt) == SQLITE_ROW);
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_get_rename_to(const char *path, job_id *id, char **from, job_param *n1)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("SELECT rowid, path, n1 FROM " TABLE_JOB " WHERE op=? AND s1=? LIMIT 1;", &stmt);
+    sqlite3_bind_int  (stmt, 1, JOB_RENAME);
+    sqlite3_bind_text (stmt, 2, path, -1, SQLITE_STATIC);
+
+    sql_res = sqlite3_step(stmt);
+
+    if (sql_res == SQLITE_ROW)
+    {
+        *id = sqlite3_column_int64(stmt, 0);
+        if (n1)
+            *n1 = sqlite3_column_int64(stmt, 2);
+        if ((*from = column_text(stmt, 1)) == NULL)
+            res = DB_ERROR;
+    }
+    else if (sql_res != SQLITE_DONE)
+    {
+        ERRMSG("db_job_get_rename_to");
+        res = DB_ERROR;
+    }
+    else
+        res = DB_NOTFOUND;
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_set_s1(job_id id, const char *s1)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("UPDATE " TABLE_JOB " SET s1=? WHERE rowid=?;", &stmt);
+    sqlite3_bind_text (stmt, 1, s1, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, id);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_job_set_s1");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_job_set_n1(job_id id, job_param n1)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("UPDATE " TABLE_JOB " SET n1=? WHERE rowid=?;", &stmt);
+    sqlite3_bind_int64(stmt, 1, n1);
+    sqlite3_bind_int64(stmt, 2, id);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_job_set_n1");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+
+/*------*
+ * sync *
+ *------*/
+
+int db_load_sync(const char *dir, sync_load_cb_t callback, void *arg)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+    char *path;
+    sync_xtime_t mtime, ctime;
+
+    db_open();
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    PREPARE("SELECT path, mtime_s, mtime_ns, ctime_s, ctime_ns FROM " TABLE_SYNC
+            " WHERE " SQL_DIRNAME("path") "= ?1 || '/';", &stmt);
+#else
+    PREPARE("SELECT path, mtime_s, ctime_s FROM " TABLE_SYNC
+            " WHERE " SQL_DIRNAME("path") "= ?1 || '/';", &stmt);
+#endif
+    sqlite3_bind_text(stmt, 1, dir, -1, SQLITE_STATIC);
+
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        path = column_text(stmt, 0);
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+        mtime.tv_sec  = sqlite3_column_int64(stmt, 1);
+        mtime.tv_nsec = sqlite3_column_int64(stmt, 2);
+
+        ctime.tv_sec  = sqlite3_column_int64(stmt, 3);
+        ctime.tv_nsec = sqlite3_column_int64(stmt, 4);
+#else
+        mtime = sqlite3_column_int64(stmt, 1);
+        ctime = sqlite3_column_int64(stmt, 2);
+#endif
+
+        res = (path) ? callback(path, mtime, ctime, arg) : -1;
+        free(path);
+
+        if (res)
+            break;
+    }
+
+    if (res)
+        res = DB_ERROR;
+    else if (sql_res != SQLITE_DONE)
+    {
+        ERRMSG("db_load_syncs in sqlite3_step()");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_store_sync(const struct sync *s)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    PREPARE("INSERT OR REPLACE INTO " TABLE_SYNC " (path, mtime_s, mtime_ns, ctime_s, ctime_ns) VALUES (?, ?, ?, ?, ?)", &stmt);
+    sqlite3_bind_text (stmt, 1, s->path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, s->mtime.tv_sec);
+    sqlite3_bind_int64(stmt, 3, s->mtime.tv_nsec);
+    sqlite3_bind_int64(stmt, 4, s->ctime.tv_sec);
+    sqlite3_bind_int64(stmt, 5, s->ctime.tv_nsec);
+#else
+    PREPARE("INSERT OR REPLACE INTO " TABLE_SYNC " (path, mtime_s, ctime_s) VALUES (?, ?, ?)", &stmt);
+    sqlite3_bind_text (stmt, 1, s->path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, s->mtime);
+    sqlite3_bind_int64(stmt, 3, s->ctime);
+#endif
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("error setting sync");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_sync_delete_path(const char *path)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("DELETE FROM " TABLE_SYNC " WHERE path=?;", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_sync_delete_path");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+
+/*--------*
+ * sparse *
+ *--------*/
+
+int db_sparse_get(const char *path, off_t *size, unsigned char **map, size_t *mapsize)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+    const void *blob;
+
+    db_open();
+
+    PREPARE("SELECT size, map FROM " TABLE_SPARSE " WHERE path=?;", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    sql_res = sqlite3_step(stmt);
+
+    if (sql_res == SQLITE_ROW)
+    {
+        *size = sqlite3_column_int64(stmt, 0);
+
+        blob = sqlite3_column_blob(stmt, 1);
+        *mapsize = sqlite3_column_bytes(stmt, 1);
+
+        /* allocate at least one byte, an empty file has an empty map */
+        if ((*map = malloc(*mapsize + 1)) == NULL)
+            res = DB_ERROR;
+        else if (blob)
+            memcpy(*map, blob, *mapsize);
+    }
+    else if (sql_res != SQLITE_DONE)
+    {
+        ERRMSG("db_sparse_get");
+        res = DB_ERROR;
+    }
+    else
+        res = DB_NOTFOUND;
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_sparse_set(const char *path, off_t size, const unsigned char *map, size_t mapsize)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("INSERT OR REPLACE INTO " TABLE_SPARSE " (path, size, map) VALUES (?, ?, ?);", &stmt);
+    sqlite3_bind_text (stmt, 1, path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, size);
+    sqlite3_bind_blob (stmt, 3, map, mapsize, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_sparse_set");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_sparse_delete(const char *path)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("DELETE FROM " TABLE_SPARSE " WHERE path=?;", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_sparse_delete");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+
+/*-------*
+ * cache *
+ *-------*/
+
+int db_cache_touch(const char *path, time_t atime, unsigned int hits, off_t size)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("INSERT OR IGNORE INTO " TABLE_CACHE " (path, size, atime, hits, pinned) VALUES (?, 0, 0, 0, 0);", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_touch");
+        res = DB_ERROR;
+    }
+    sqlite3_finalize(stmt);
+
+    if (res == DB_OK)
+    {
+        PREPARE("UPDATE " TABLE_CACHE " SET size=?, atime=MAX(atime, ?), hits=hits+? WHERE path=?;", &stmt);
+        sqlite3_bind_int64(stmt, 1, size);
+        sqlite3_bind_int64(stmt, 2, atime);
+        sqlite3_bind_int  (stmt, 3, hits);
+        sqlite3_bind_text (stmt, 4, path, -1, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            ERRMSG("db_cache_touch");
+            res = DB_ERROR;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    db_close();
+    return res;
+}
+
+int db_cache_set_size(const char *path, off_t size)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("UPDATE " TABLE_CACHE " SET size=? WHERE path=?;", &stmt);
+    sqlite3_bind_int64(stmt, 1, size);
+    sqlite3_bind_text (stmt, 2, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_set_size");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_cache_pin(const char *path, int pinned)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("INSERT OR IGNORE INTO " TABLE_CACHE " (path, size, atime, hits, pinned) VALUES (?, 0, 0, 0, 0);", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_pin");
+        res = DB_ERROR;
+    }
+    sqlite3_finalize(stmt);
+
+    if (res == DB_OK)
+    {
+        PREPARE("UPDATE " TABLE_CACHE " SET pinned=? WHERE path=?;", &stmt);
+        sqlite3_bind_int (stmt, 1, pinned);
+        sqlite3_bind_text(stmt, 2, path, -1, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            ERRMSG("db_cache_pin");
+            res = DB_ERROR;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    db_close();
+    return res;
+}
+
+int db_cache_unpin(int pinned)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("UPDATE " TABLE_CACHE " SET pinned=0 WHERE pinned=?;", &stmt);
+    sqlite3_bind_int(stmt, 1, pinned);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_unpin");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_cache_usage(off_t *bytes, unsigned long *files)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("SELECT TOTAL(size), COUNT(*) FROM " TABLE_CACHE " WHERE size > 0;", &stmt);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        *bytes = sqlite3_column_int64(stmt, 0);
+        *files = sqlite3_column_int64(stmt, 1);
+    }
+    else
+    {
+        ERRMSG("db_cache_usage");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_cache_victims(queue *q, int limit, time_t hit_bonus)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+    char *path;
+
+    db_open();
+
+    /* least recently used first, but every hit is worth _hit_bonus_
+       seconds of recency */
+    PREPARE("SELECT path FROM " TABLE_CACHE " WHERE size > 0 AND pinned = 0 "
+            "ORDER BY atime + MIN(hits, 100) * ? ASC LIMIT ?;", &stmt);
+    sqlite3_bind_int64(stmt, 1, hit_bonus);
+    sqlite3_bind_int  (stmt, 2, limit);
+
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if ((path = column_text(stmt, 0)))
+            q_enqueue(q, path);
+    }
+
+    if (sql_res != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_victims");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_cache_hot(queue *q, int limit, unsigned int min_hits)
+{
+    int res = DB_OK, sql_res;
+    sqlite3_stmt *stmt;
+    char *path;
+
+    db_open();
+
+    PREPARE("SELECT path FROM " TABLE_CACHE " WHERE hits >= ? "
+            "ORDER BY hits DESC, atime DESC LIMIT ?;", &stmt);
+    sqlite3_bind_int(stmt, 1, min_hits);
+    sqlite3_bind_int(stmt, 2, limit);
+
+    while ((sql_res = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if ((path = column_text(stmt, 0)))
+            q_enqueue(q, path);
+    }
+
+    if (sql_res != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_hot");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_cache_decay(void)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("UPDATE " TABLE_CACHE " SET hits = hits / 2;", &stmt);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_decay");
+        res = DB_ERROR;
+    }
+
+    sqlite3_finalize(stmt);
+    db_close();
+    return res;
+}
+
+int db_cache_delete(const char *path)
+{
+    int res = DB_OK;
+    sqlite3_stmt *stmt;
+
+    db_open();
+
+    PREPARE("DELETE FROM " TABLE_CACHE " WHERE path=?;", &stmt);
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        ERRMSG("db_cache_delete");
         res = DB_ERROR;
     }
 
@@ -704,3 +1602,5 @@ DB_x_RENAME_DIR (n, t, c)
 
 DB_x_(job, TABLE_JOB, "path")
 DB_x_(sync, TABLE_SYNC, "path")
+DB_x_(sparse, TABLE_SPARSE, "path")
+DB_x_(cache, TABLE_CACHE, "path")
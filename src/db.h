@@ -24,6 +24,7 @@
 /* config option names */
 #define CFG_VERSION "version"
 #define CFG_FS_FEATURES "fs_features"
+#define CFG_HITS_DECAYED "hits_decayed"
 
 /*--------------*
  * return codes *
@@ -75,18 +76,68 @@ int db_job_store(const struct job *j);
 /*! get the next highest-priority job */
 int db_job_get(struct job **j);
 
+/*! the directory of _path_ got its turn with "sched=fair": move it to the
+   end of the line. forget directories without jobs */
+int db_sched_served(const char *path);
+
+/*! put (at most _limit_) due jobs matching _opmask_ into _q_, in the order
+   db_job_get would return them. the jobs must be freed by the caller */
+int db_job_get_ready(queue *q, int limit, int opmask);
+
+/*! move _j_ from the job table to the table of dead jobs */
+int db_job_bury(const struct job *j);
+
+/*! move dead jobs of _path_ (all if NULL) back to the job table */
+int db_job_resurrect(const char *path);
+
+/*! return non-zero if a dead job for _path_ exists */
+int db_job_dead_exists(const char *path);
+
+/*! call _f_ with the due time of each job that is not due at _now_ yet */
+int db_job_deadlines(timer_ms now, int (*f)(timer_ms));
+
+/*! call _f_ with the number of jobs of each op */
+int db_job_count(void (*f)(job_op, unsigned long, void *), void *arg);
+
+/*! call _f_ with (at most _limit_) jobs of _path_ and the files below it,
+   in the order they would be performed */
+int db_job_list(const char *path, int limit, void (*f)(const struct job *, void *), void *arg);
+
+/*! set the priority (unless negative) of the jobs of _path_ and the files
+   below it and make them due at _due_ (unless 0) at the latest. *n is set
+   to the number of jobs changed */
+int db_job_update(const char *path, int prio, timer_ms due, unsigned long *n);
+
 /*! return non-zero if a job matching _path_ and _opmask_ exits in the db */
 int db_job_exists(const char *path, int opmask);
 
 /*! delete job with _id_ */
 int db_job_delete_id(job_id id);
 
+/*! put the paths of the jobs matching _opmask_ of the entries directly in
+   directory _dir_ into _q_. the paths must be freed by the caller */
+int db_job_dir(queue *q, const char *dir, int opmask);
+
 /*! delete all jobs for path _path_ with a job mathching _opmask_ */
 int db_job_delete(const char *path, int opmask);
 
 /*! delete all RENAME jobs, where the new name equals _path_ */
 int db_job_delete_rename_to(const char *path);
 
+/*! return non-zero if a job matching _path_ and _opmask_ with any of
+   _flags_ set in n1 exists */
+int db_job_exists_n1(const char *path, int opmask, job_param flags);
+
+/*! find a RENAME job with new name _path_. *from must be freed by the
+   caller, _n1_ may be NULL */
+int db_job_get_rename_to(const char *path, job_id *id, char **from, job_param *n1);
+
+/*! change s1 of the job with _id_ */
+int db_job_set_s1(job_id id, const char *s1);
+
+/*! change n1 of the job with _id_ */
+int db_job_set_n1(job_id id, job_param n1);
+
 /*! rename job entries */
 int db_job_rename_file(const char *from, const char *to);
 int db_job_rename_dir(const char *from, const char *to);
@@ -96,8 +147,9 @@ int db_job_rename_dir(const char *from, const char *to);
  * sync *
  *------*/
 
-/*! load all sync entries from the db and pass them to _callback_ */
-int db_load_sync(sync_load_cb_t callback);
+/*! pass the sync entries of the files in _dir_ ("" for the root) to
+   _callback_, stops if it returns nonzero */
+int db_load_sync(const char *dir, sync_load_cb_t callback, void *arg);
 
 /*! store one sync entry */
 int db_store_sync(const struct sync *s);
@@ -110,4 +162,62 @@ int db_sync_rename_file(const char *from, const char *to);
 /*! rename sync directories */
 int db_sync_rename_dir(const char *from, const char *to);
 
+
+/*--------*
+ * sparse *
+ *--------*/
+
+/*! load the block bitmap of _path_. *map must be freed by the caller */
+int db_sparse_get(const char *path, off_t *size, unsigned char **map, size_t *mapsize);
+
+/*! store the block bitmap of _path_ */
+int db_sparse_set(const char *path, off_t size, const unsigned char *map, size_t mapsize);
+
+/*! delete the block bitmap of _path_ */
+int db_sparse_delete(const char *path);
+
+/*! rename block bitmaps */
+int db_sparse_rename_file(const char *from, const char *to);
+int db_sparse_rename_dir(const char *from, const char *to);
+
+
+/*-------*
+ * cache *
+ *-------*/
+
+/*! record _hits_ accesses of _path_, the last one at _atime_. _size_ is
+   the number of bytes the file currently occupies in the cache */
+int db_cache_touch(const char *path, time_t atime, unsigned int hits, off_t size);
+
+/*! update the number of bytes _path_ occupies in the cache */
+int db_cache_set_size(const char *path, off_t size);
+
+/*! pin/unpin _path_. pinned files are never evicted */
+int db_cache_pin(const char *path, int pinned);
+
+/*! unpin all files pinned with _pinned_ */
+int db_cache_unpin(int pinned);
+
+/*! get the total size and number of files with data in the cache */
+int db_cache_usage(off_t *bytes, unsigned long *files);
+
+/*! put (at most _limit_) paths of files to evict into _q_, best candidate
+   first. the paths must be freed by the caller */
+int db_cache_victims(queue *q, int limit, time_t hit_bonus);
+
+/*! put (at most _limit_) paths of files that were opened at least
+   _min_hits_ times into _q_, most used first. the paths must be freed by
+   the caller */
+int db_cache_hot(queue *q, int limit, unsigned int min_hits);
+
+/*! halve all hit counts, so old accesses count less than new ones */
+int db_cache_decay(void);
+
+/*! delete the cache entry of _path_ */
+int db_cache_delete(const char *path);
+
+/*! rename cache entries */
+int db_cache_rename_file(const char *from, const char *to);
+int db_cache_rename_dir(const char *from, const char *to);
+
 #endif
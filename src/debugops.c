@@ -8,10 +8,15 @@
 
 #include "fsops.h"
 #include "log.h"
+#include "trace.h"
+#include "record.h"
 
 #include <fuse.h>
 #include <sys/types.h>
 
+/* arguments of record_op() */
+#define N(x) ((long long)(x))
+
 static unsigned long debug_op_id = 0;
 
 static void breakpoint(void)
@@ -32,10 +37,15 @@ void debug_op_destroy(void *p)
 int debug_op_getattr(const char *path, struct stat *buf)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] getattr(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_getattr(path, buf);
+    trace_op(STATS_OP_GETATTR, path, start, res);
+    record_op(STATS_OP_GETATTR, rec, res, "pnn", path, N(res ? 0 : buf->st_mode), N(res ? 0 : buf->st_size));
     FSOP("[%d] getattr(%s) returns %d", id, path, res);
     return res;
 }
@@ -43,10 +53,15 @@ int debug_op_getattr(const char *path, struct stat *buf)
 int debug_op_fgetattr(const char *path, struct stat *buf, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] fgetattr(%s, %d)", id, path, FI_FD(fi));
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_fgetattr(path, buf, fi);
+    trace_op(STATS_OP_FGETATTR, path, start, res);
+    record_op(STATS_OP_FGETATTR, rec, res, "pnnn", path, N(FI_FD(fi)), N(res ? 0 : buf->st_mode), N(res ? 0 : buf->st_size));
     FSOP("[%d] fgetattr(%s, %d) returns %d", id, path, FI_FD(fi), res);
     return res;
 }
@@ -54,10 +69,15 @@ int debug_op_fgetattr(const char *path, struct stat *buf, struct fuse_file_info
 int debug_op_access(const char *path, int mode)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] access(%s, %d)", id, path, mode);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_access(path, mode);
+    trace_op(STATS_OP_ACCESS, path, start, res);
+    record_op(STATS_OP_ACCESS, rec, res, "pn", path, N(mode));
     FSOP("[%d] access(%s, %d) returns %d", id, path, mode, res);
     return res;
 }
@@ -65,10 +85,15 @@ int debug_op_access(const char *path, int mode)
 int debug_op_readlink(const char *path, char *buf, size_t bufsize)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] readlink(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_readlink(path, buf, bufsize);
+    trace_op(STATS_OP_READLINK, path, start, res);
+    record_op(STATS_OP_READLINK, rec, res, "pn", path, N(bufsize));
     FSOP("[%d] readlink(%s) returns %d", id, path, res);
     return res;
 }
@@ -76,10 +101,15 @@ int debug_op_readlink(const char *path, char *buf, size_t bufsize)
 int debug_op_opendir(const char *path, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] opendir(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_opendir(path, fi);
+    trace_op(STATS_OP_OPENDIR, path, start, res);
+    record_op(STATS_OP_OPENDIR, rec, res, "p", path);
     FSOP("[%d] opendir(%s) returns %d", id, path, res);
     return res;
 }
@@ -87,10 +117,15 @@ int debug_op_opendir(const char *path, struct fuse_file_info *fi)
 int debug_op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] readdir(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_readdir(path, buf, filler, offset, fi);
+    trace_op(STATS_OP_READDIR, path, start, res);
+    record_op(STATS_OP_READDIR, rec, res, "pn", path, N(offset));
     FSOP("[%d] readdir(%s) returns %d", id, path, res);
     return res;
 }
@@ -98,10 +133,15 @@ int debug_op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t
 int debug_op_releasedir(const char* path, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] releasedir(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_releasedir(path, fi);
+    trace_op(STATS_OP_RELEASEDIR, path, start, res);
+    record_op(STATS_OP_RELEASEDIR, rec, res, "p", path);
     FSOP("[%d] releasedir(%s) returns %d", id, path, res);
     return res;
 }
@@ -109,10 +149,15 @@ int debug_op_releasedir(const char* path, struct fuse_file_info *fi)
 int debug_op_mknod(const char *path, mode_t mode, dev_t rdev)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] mknod(%s, %d, %d)", id, path, mode, rdev);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_mknod(path, mode, rdev);
+    trace_op(STATS_OP_MKNOD, path, start, res);
+    record_op(STATS_OP_MKNOD, rec, res, "pnn", path, N(mode), N(rdev));
     FSOP("[%d] mknod(%s, %d, %d) returns %d", id, path, mode, rdev, res);
     return res;
 }
@@ -120,10 +165,15 @@ int debug_op_mknod(const char *path, mode_t mode, dev_t rdev)
 int debug_op_mkdir(const char *path, mode_t mode)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] mkdir(%s, %d)", id, path, mode);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_mkdir(path, mode);
+    trace_op(STATS_OP_MKDIR, path, start, res);
+    record_op(STATS_OP_MKDIR, rec, res, "pn", path, N(mode));
     FSOP("[%d] mkdir(%s, %d) returns %d", id, path, mode, res);
     return res;
 }
@@ -131,10 +181,15 @@ int debug_op_mkdir(const char *path, mode_t mode)
 int debug_op_rmdir(const char *path)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] rmdir(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_rmdir(path);
+    trace_op(STATS_OP_RMDIR, path, start, res);
+    record_op(STATS_OP_RMDIR, rec, res, "p", path);
     FSOP("[%d] rmdir(%s) returns %d", id, path, res);
     return res;
 }
@@ -142,10 +197,15 @@ int debug_op_rmdir(const char *path)
 int debug_op_unlink(const char *path)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] unlink(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_unlink(path);
+    trace_op(STATS_OP_UNLINK, path, start, res);
+    record_op(STATS_OP_UNLINK, rec, res, "p", path);
     FSOP("[%d] unlink(%s) returns %d", id, path, res);
     return res;
 }
@@ -153,10 +213,15 @@ int debug_op_unlink(const char *path)
 int debug_op_link(const char *from, const char *to)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] link(%s, %s)", id, from, to);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_link(from, to);
+    trace_op(STATS_OP_LINK, from, start, res);
+    record_op(STATS_OP_LINK, rec, res, "pp", from, to);
     FSOP("[%d] link(%s, %s) returns %d", id, from, to, res);
     return res;
 }
@@ -164,10 +229,15 @@ int debug_op_link(const char *from, const char *to)
 int debug_op_symlink(const char *to, const char *from)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] symlink(%s, %s)", id, to, from);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_symlink(to, from);
+    trace_op(STATS_OP_SYMLINK, from, start, res);
+    record_op(STATS_OP_SYMLINK, rec, res, "pp", from, to);
     FSOP("[%d] symlink(%s, %s) returns %d", id, to, from, res);
     return res;
 }
@@ -175,10 +245,15 @@ int debug_op_symlink(const char *to, const char *from)
 int debug_op_rename(const char *from, const char *to)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] rename(%s, %s)", id, from, to);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_rename(from, to);
+    trace_op(STATS_OP_RENAME, from, start, res);
+    record_op(STATS_OP_RENAME, rec, res, "pp", from, to);
     FSOP("[%d] rename(%s, %s) returns %d", id, from, to, res);
     return res;
 }
@@ -186,10 +261,15 @@ int debug_op_rename(const char *from, const char *to)
 int debug_op_open(const char *path, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] open(%s, %o)", id, path, fi->flags);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_open(path, fi);
+    trace_op(STATS_OP_OPEN, path, start, res);
+    record_op(STATS_OP_OPEN, rec, res, "pnn", path, N(res ? -1 : FI_FD(fi)), N(fi->flags));
     FSOP("[%d] open(%s) returns %d", id, path, res);
     return res;
 }
@@ -197,10 +277,15 @@ int debug_op_open(const char *path, struct fuse_file_info *fi)
 int debug_op_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] create(%s, %o, %o)", id, path, mode, fi->flags);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_create(path, mode, fi);
+    trace_op(STATS_OP_CREATE, path, start, res);
+    record_op(STATS_OP_CREATE, rec, res, "pnnn", path, N(res ? -1 : FI_FD(fi)), N(mode), N(fi->flags));
     FSOP("[%d] create(%s, %o) returns %d", id, path, mode, res);
     return res;
 }
@@ -208,10 +293,15 @@ int debug_op_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 int debug_op_flush(const char *path, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] flush(%s, %d)", id, path, FI_FD(fi));
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_flush(path, fi);
+    trace_op(STATS_OP_FLUSH, path, start, res);
+    record_op(STATS_OP_FLUSH, rec, res, "pn", path, N(FI_FD(fi)));
     FSOP("[%d] flush(%s, %d) returns %d", id, path, FI_FD(fi), res);
     return res;
 }
@@ -219,10 +309,16 @@ int debug_op_flush(const char *path, struct fuse_file_info *fi)
 int debug_op_release(const char *path, struct fuse_file_info *fi)
 {
     int id, res;
+    int fd = FI_FD(fi);     /* fi->fh is freed by op_release */
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] release(%s, %d)", id, path, FI_FD(fi));
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_release(path, fi);
+    trace_op(STATS_OP_RELEASE, path, start, res);
+    record_op(STATS_OP_RELEASE, rec, res, "pn", path, N(fd));
     FSOP("[%d] release(%s) returns %d", id, path, res);
     return res;
 }
@@ -230,10 +326,15 @@ int debug_op_release(const char *path, struct fuse_file_info *fi)
 int debug_op_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] fsync(%s, %d, %d)", id, path, isdatasync, FI_FD(fi));
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_fsync(path, isdatasync, fi);
+    trace_op(STATS_OP_FSYNC, path, start, res);
+    record_op(STATS_OP_FSYNC, rec, res, "pnn", path, N(FI_FD(fi)), N(isdatasync));
     FSOP("[%d] fsync(%s, %d, %d) returns %d", id, path, isdatasync, FI_FD(fi), res);
     return res;
 }
@@ -241,10 +342,15 @@ int debug_op_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
 int debug_op_fsyncdir(const char *path, int isdatasync, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] fsyncdir(%s, %d)", id, path, isdatasync);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_fsyncdir(path, isdatasync, fi);
+    trace_op(STATS_OP_FSYNCDIR, path, start, res);
+    record_op(STATS_OP_FSYNCDIR, rec, res, "pn", path, N(isdatasync));
     FSOP("[%d] fsyncdir(%s, %d) returns %d", id, path, isdatasync, res);
     return res;
 }
@@ -252,10 +358,15 @@ int debug_op_fsyncdir(const char *path, int isdatasync, struct fuse_file_info *f
 int debug_op_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] read(%s, %d, %lld, %d)", id, path, size, offset, FI_FD(fi));
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_read(path, buf, size, offset, fi);
+    trace_op(STATS_OP_READ, path, start, res);
+    record_op(STATS_OP_READ, rec, res, "pnnn", path, N(FI_FD(fi)), N(size), N(offset));
     FSOP("[%d] read(%s, %d, %lld, %d) returns %d", id, path, size, offset, FI_FD(fi), res);
     return res;
 }
@@ -263,10 +374,15 @@ int debug_op_read(const char *path, char *buf, size_t size, off_t offset, struct
 int debug_op_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] write(%s, %u, %lld, %d)", id, path, size, offset, FI_FD(fi));
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_write(path, buf, size, offset, fi);
+    trace_op(STATS_OP_WRITE, path, start, res);
+    record_op(STATS_OP_WRITE, rec, res, "pnnn", path, N(FI_FD(fi)), N(size), N(offset));
     FSOP("[%d] write(%s, %u, %lld, %d) returns %d", id, path, size, offset, FI_FD(fi), res);
     return res;
 }
@@ -274,10 +390,15 @@ int debug_op_write(const char *path, const char *buf, size_t size, off_t offset,
 int debug_op_truncate(const char *path, off_t size)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] truncate(%s, %lld)", id, path, size);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_truncate(path, size);
+    trace_op(STATS_OP_TRUNCATE, path, start, res);
+    record_op(STATS_OP_TRUNCATE, rec, res, "pn", path, N(size));
     FSOP("[%d] truncate(%s, %lld) returns %d", id, path, size, res);
     return res;
 }
@@ -285,10 +406,15 @@ int debug_op_truncate(const char *path, off_t size)
 int debug_op_chown(const char *path, uid_t uid, gid_t gid)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] chown(%s, %d, %d)", id, path, uid, gid);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_chown(path, uid, gid);
+    trace_op(STATS_OP_CHOWN, path, start, res);
+    record_op(STATS_OP_CHOWN, rec, res, "pnn", path, N(uid), N(gid));
     FSOP("[%d] chown(%s, %d, %d) returns %d", id, path, uid, gid, res);
     return res;
 }
@@ -296,10 +422,15 @@ int debug_op_chown(const char *path, uid_t uid, gid_t gid)
 int debug_op_chmod(const char *path, mode_t mode)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] chmod(%s, %d)", id, path, mode);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_chmod(path, mode);
+    trace_op(STATS_OP_CHMOD, path, start, res);
+    record_op(STATS_OP_CHMOD, rec, res, "pn", path, N(mode));
     FSOP("[%d] chmod(%s, %d) returns %d", id, path, mode, res);
     return res;
 }
@@ -307,10 +438,15 @@ int debug_op_chmod(const char *path, mode_t mode)
 int debug_op_utimens(const char *path, const struct timespec ts[2])
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] utimens(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_utimens(path, ts);
+    trace_op(STATS_OP_UTIMENS, path, start, res);
+    record_op(STATS_OP_UTIMENS, rec, res, "pnnnn", path, N(ts[0].tv_sec), N(ts[0].tv_nsec), N(ts[1].tv_sec), N(ts[1].tv_nsec));
     FSOP("[%d] utimens(%s) returns %d", id, path, res);
     return res;
 }
@@ -318,10 +454,15 @@ int debug_op_utimens(const char *path, const struct timespec ts[2])
 int debug_op_statfs(const char *path, struct statvfs *buf)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] statfs(%s)", id, path);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_statfs(path, buf);
+    trace_op(STATS_OP_STATFS, path, start, res);
+    record_op(STATS_OP_STATFS, rec, res, "p", path);
     FSOP("[%d] statfs(%s) returns %d", id, path, res);
     return res;
 }
@@ -330,10 +471,15 @@ int debug_op_statfs(const char *path, struct statvfs *buf)
 int debug_op_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] setxattr(%s, %s, %s, %d, %d)", id, path, name, value, size, flags);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_setxattr(path, name, value, size, flags);
+    trace_op(STATS_OP_SETXATTR, path, start, res);
+    record_op(STATS_OP_SETXATTR, rec, res, "psnn", path, name, N(size), N(flags));
     FSOP("[%d] setxattr(%s, %s, %s, %d, %d) returns %d", id, path, name, value, size, flags, res);
     return res;
 }
@@ -341,10 +487,15 @@ int debug_op_setxattr(const char *path, const char *name, const char *value, siz
 int debug_op_getxattr(const char *path, const char *name, char *value, size_t size)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] getxattr(%s, %s, %d)", id, path, name, size);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_getxattr(path, name, value, size);
+    trace_op(STATS_OP_GETXATTR, path, start, res);
+    record_op(STATS_OP_GETXATTR, rec, res, "psn", path, name, N(size));
     FSOP("[%d] getxattr(%s, %s, %d) returns %d", id, path, name, size, res);
     return res;
 }
@@ -352,10 +503,15 @@ int debug_op_getxattr(const char *path, const char *name, char *value, size_t si
 int debug_op_listxattr(const char *path, char *list, size_t size)
 {
     int id, res;
+    stats_us start, rec;
     id = debug_op_id++;
     FSOP("[%d] listxattr(%s, %d)", id, path, size);
     breakpoint();
+    start = trace_start();
+    rec = record_start();
     res = op_listxattr(path, list, size);
+    trace_op(STATS_OP_LISTXATTR, path, start, res);
+    record_op(STATS_OP_LISTXATTR, rec, res, "pn", path, N(size));
     FSOP("[%d] listxattr(%s, %d) returns %d", id, path, size, res);
     return res;
 }
@@ -1,5 +1,5 @@
 /*! @file debugops.h
- * debug operations.
+ * debug operations, logged and traced.
  * discofs - disconnected file system
  * Copyright (c) 2012 Robin Martinjak
  * see LICENSE for full license (BSD 2-Clause)
@@ -17,6 +17,18 @@
 #include "worker.h"
 #include "db.h"
 #include "paths.h"
+#include "sparse.h"
+#include "readahead.h"
+#include "bwlimit.h"
+#include "timer.h"
+#include "probe.h"
+#include "rcall.h"
+#include "statsops.h"
+#include "trace.h"
+#include "ctl.h"
+#include "record.h"
+#include "evict.h"
+#include "policy.h"
 
 #if DEBUG_FSOPS
 #include "debugops.h"
@@ -69,14 +81,47 @@ static void print_usage()
         "\n"
         PROG_NAME " options:\n"
         " data=<dir>            directory for database and cache\n"
-        " host=<host>           hostname or IP address to PING for remote fs availability\n"
+        " host=<host>           hostname or IP address to probe for remote fs availability\n"
         " pid=<filename>        file containing PID to test for remote fs avialability\n"
+        " probe=<method>        how to check remote fs availability. possible values:\n"
+        "                       'icmp', 'tcp' or 'statfs'. default is 'icmp' if host\n"
+        "                       is given, 'statfs' otherwise\n"
+        " probeport=<port>      port to connect to with probe=tcp. default is " STR(DEF_PROBE_PORT) "\n"
+        " rtimeout=<seconds>    go offline if a call to the remote fs takes longer.\n"
+        "                       0 disables this. default is " STR(DEF_RTIMEOUT) "\n"
         " scan=<seconds>        interval to wait before scanning remote fs for changes. default is " STR(DEF_SCAN_INTERVAL) "\n"
         " conflict=<mode>       conflict resolution mode. possible values:\n"
         "                       'newer', 'mine' or 'theirs'. default is 'newer'\n"
+        " sched=<policy>        order of file transfers. possible values:\n"
+        "                       'prio', 'sjf' or 'fair'. default is 'prio'\n"
         " bprefix=<prefix>\n"
         " bsuffix=<suffix>      backup prefix/suffix (see the manual for more information)\n"
         " clear                 delete database and cache before mounting\n"
+        " retry                 retry changes that failed permanently before\n"
+        " sparse                only fetch the parts of a file that are actually read\n"
+        " readahead=<kbytes>    maximum amount of data to prefetch for sequential reads\n"
+        "                       in sparse mode. 0 disables read-ahead. default is " STR(DEF_READAHEAD) "\n"
+        " cache_size=<mbytes>   maximum amount of cached data. default is unlimited\n"
+        " cache_files=<n>       maximum number of files with cached data. default is unlimited\n"
+        " policy=<file>         file containing caching policies (see the manual)\n"
+        " hotset=<n>            number of most used files to keep complete in the cache.\n"
+        "                       0 disables this. default is " STR(DEF_HOTSET) "\n"
+        " synccache=<n>         number of files whose sync state is kept in memory.\n"
+        "                       0 keeps all of them. default is " STR(DEF_SYNC_CACHE) "\n"
+        " threads=<n>           number of pending operations to apply to the remote fs\n"
+        "                       in parallel. default is " STR(DEF_THREADS) "\n"
+        " writeback             don't wait for the remote fs when changing metadata,\n"
+        "                       apply the changes in the background\n"
+        " wbwait=<seconds>      in writeback mode, let fsync and close wait at most this long\n"
+        "                       for the changes of a file to be applied. default is 0\n"
+        " bwpush=<kbytes>\n"
+        " bwpull=<kbytes>       limit file transfers to <kbytes> per second. default is unlimited\n"
+        " bwlimit=<file>        file containing limits for different times of day (see the manual)\n"
+        " trace=<n>             keep the last <n> operations of each thread in the trace file.\n"
+        "                       default is 0 (disabled)\n"
+        " ctl=<socket>          control socket for discofsctl. default is 'ctl' in the data directory\n"
+        " record=<file>         record file system operations to <file> for bench/fsreplay\n"
+        " recordanon            replace the names of recorded paths by hashes\n"
         " loglevel=<level>      logging level, possible values: none"
         #ifdef LOG_ENABLE_ERROR
         ", error"
@@ -96,6 +141,7 @@ static void print_usage()
         "\n"
         "                       each including its predecessors. default is 'none'\n"
         " logfile=<file>        logging output file. default ist stderr\n"
+        " logformat=<format>    'text' or 'json' (one object per line). default is 'text'\n"
         "\n"
         "filesystem specific options:\n"
         " no-mode               don't sync access permissions\n"
@@ -136,9 +182,30 @@ static void log_options(int loglevel, struct options opt)
     LOG_PRINT(loglevel, "uid: %d", opt.uid);
     LOG_PRINT(loglevel, "gid: %d", opt.gid);
     LOG_PRINT(loglevel, "pid file: %s", opt.pid_file);
+    LOG_PRINT(loglevel, "probe port: %u", opt.probe_port);
+    LOG_PRINT(loglevel, "remote call timeout: %u", opt.rtimeout);
     LOG_PRINT(loglevel, "backup prefix: %s", opt.backup_prefix);
     LOG_PRINT(loglevel, "backup suffix: %s", opt.backup_suffix);
     LOG_PRINT(loglevel, "clear: %s", YESNO(opt.clear));
+    LOG_PRINT(loglevel, "retry: %s", YESNO(opt.retry));
+    LOG_PRINT(loglevel, "sparse: %s", YESNO(opt.sparse));
+    LOG_PRINT(loglevel, "readahead: %u", opt.readahead);
+    LOG_PRINT(loglevel, "cache size: %u", opt.cache_size);
+    LOG_PRINT(loglevel, "cache files: %u", opt.cache_files);
+    LOG_PRINT(loglevel, "policy file: %s", opt.policy);
+    LOG_PRINT(loglevel, "hotset: %u", opt.hotset);
+    LOG_PRINT(loglevel, "sync cache: %u", opt.sync_cache);
+    LOG_PRINT(loglevel, "threads: %u", opt.threads);
+    LOG_PRINT(loglevel, "writeback: %s", YESNO(opt.writeback));
+    LOG_PRINT(loglevel, "writeback wait: %u", opt.wbwait);
+    LOG_PRINT(loglevel, "push limit: %u", opt.bwpush);
+    LOG_PRINT(loglevel, "pull limit: %u", opt.bwpull);
+    LOG_PRINT(loglevel, "bandwidth schedule: %s", opt.bwlimit);
+    LOG_PRINT(loglevel, "trace: %u", opt.trace);
+    LOG_PRINT(loglevel, "control socket: %s", opt.ctl);
+    LOG_PRINT(loglevel, "record: %s", opt.record);
+    LOG_PRINT(loglevel, "record anonymized: %s", YESNO(opt.record_anon));
+    LOG_PRINT(loglevel, "log format: %s", (opt.logformat == LOG_JSON) ? "json" : "text");
 
     switch (opt.conflict) {
         case CONFLICT_NEWER:
@@ -155,6 +222,36 @@ static void log_options(int loglevel, struct options opt)
     }
     LOG_PRINT(loglevel, "conflict: %s", tmp);
 
+    switch (opt.sched) {
+        case SCHED_PRIO:
+            tmp = "prio";
+            break;
+        case SCHED_SJF:
+            tmp = "sjf";
+            break;
+        case SCHED_FAIR:
+            tmp = "fair";
+            break;
+        default:
+            FATAL("invalid \"sched\" option!\n");
+    }
+    LOG_PRINT(loglevel, "sched: %s", tmp);
+
+    switch (opt.probe) {
+        case PROBE_ICMP:
+            tmp = "icmp";
+            break;
+        case PROBE_TCP:
+            tmp = "tcp";
+            break;
+        case PROBE_STATFS:
+            tmp = "statfs";
+            break;
+        default:
+            FATAL("invalid \"probe\" option!\n");
+    }
+    LOG_PRINT(loglevel, "probe: %s", tmp);
+
     LOG_PRINT(loglevel, "no-mode: %s", YESNO((opt.copyattr & COPYATTR_NO_MODE)));
     LOG_PRINT(loglevel, "no-owner: %s", YESNO((opt.copyattr & COPYATTR_NO_OWNER)));
     LOG_PRINT(loglevel, "no-group: %s", YESNO((opt.copyattr & COPYATTR_NO_GROUP)));
@@ -185,18 +282,28 @@ static struct fuse_opt discofs_opts[] =
     /* alternate directory for database and cache */
     OPT_KEY("data=%s", data_root, 0),
 
-    /* host to PING */
+    /* host to probe */
     OPT_KEY("host=%s", host, 0),
 
     /* PID file to check */
     OPT_KEY("pid=%s", pid_file, 0),
 
+    /* availability check */
+    FUSE_OPT_KEY("probe=%s", DISCOFS_OPT_PROBE),
+    OPT_KEY("probeport=%u", probe_port, 0),
+
+    /* deadline of remote calls */
+    OPT_KEY("rtimeout=%u", rtimeout, 0),
+
     /* interval to wait before scanning remote fs for changes */
     OPT_KEY("scan=%u", scan_interval, 0),
 
     /* conflict resolution mode */
     FUSE_OPT_KEY("conflict=%s", DISCOFS_OPT_CONFLICT),
 
+    /* transfer scheduling policy */
+    FUSE_OPT_KEY("sched=%s", DISCOFS_OPT_SCHED),
+
     /* backup prefix/sufix */
     OPT_KEY("bprefix=%s", backup_prefix, 0),
     OPT_KEY("bsuffix=%s", backup_suffix, 0),
@@ -204,9 +311,46 @@ static struct fuse_opt discofs_opts[] =
     /* start with a fresh db and cache */
     OPT_KEY("clear", clear, 1),
 
+    /* resurrect dead jobs */
+    OPT_KEY("retry", retry, 1),
+
+    /* block-granular caching */
+    OPT_KEY("sparse", sparse, 1),
+    OPT_KEY("readahead=%u", readahead, 0),
+
+    /* cache limits */
+    OPT_KEY("cache_size=%u", cache_size, 0),
+    OPT_KEY("cache_files=%u", cache_files, 0),
+
+    /* caching policies */
+    OPT_KEY("policy=%s", policy, 0),
+
+    /* number of files in the working set */
+    OPT_KEY("hotset=%u", hotset, 0),
+
+    /* sync entries in memory */
+    OPT_KEY("synccache=%u", sync_cache, 0),
+
+    /* parallel replay of scheduled jobs */
+    OPT_KEY("threads=%u", threads, 0),
+
+    /* write-behind */
+    OPT_KEY("writeback", writeback, 1),
+    OPT_KEY("wbwait=%u", wbwait, 0),
+
+    /* bandwidth limits */
+    OPT_KEY("bwpush=%u", bwpush, 0),
+    OPT_KEY("bwpull=%u", bwpull, 0),
+    OPT_KEY("bwlimit=%s", bwlimit, 0),
+    OPT_KEY("trace=%u", trace, 0),
+    OPT_KEY("ctl=%s", ctl, 0),
+    OPT_KEY("record=%s", record, 0),
+    OPT_KEY("recordanon", record_anon, 1),
+
     /* logging */
     FUSE_OPT_KEY("loglevel=%s", DISCOFS_OPT_LOGLEVEL),
     OPT_KEY("logfile=%s", logfile, 0),
+    FUSE_OPT_KEY("logformat=%s", DISCOFS_OPT_LOGFORMAT),
 
     /* file attributes not to copy */
     FUSE_OPT_KEY("no-mode", DISCOFS_OPT_NO_MODE),
@@ -445,6 +589,24 @@ static int discofs_opt_proc(void *data, const char *arg, int key, struct fuse_ar
             return 0;
 
 
+        /*===========*
+         * LOGFORMAT *
+         *===========*/
+
+        case DISCOFS_OPT_LOGFORMAT:
+            val = arg + strlen("logformat=");
+            if (!strcmp(val, "text"))
+                discofs_options.logformat = LOG_TEXT;
+            else if (!strcmp(val, "json"))
+                discofs_options.logformat = LOG_JSON;
+            else
+            {
+                fprintf(stderr, "invalid logformat \"%s\"\n", val);
+                exit(EXIT_FAILURE);
+            }
+            return 0;
+
+
         /*==========================*
          * CONFLICT RESOLUTION MODE *
          *==========================*/
@@ -464,6 +626,48 @@ static int discofs_opt_proc(void *data, const char *arg, int key, struct fuse_ar
                 exit(EXIT_FAILURE);
             }
             return 0;
+
+
+        /*============================*
+         * TRANSFER SCHEDULING POLICY *
+         *============================*/
+
+        case DISCOFS_OPT_SCHED:
+            val = arg + strlen("sched=");
+
+            if (!strcmp(val, "prio"))
+                discofs_options.sched = SCHED_PRIO;
+            else if (!strcmp(val, "sjf"))
+                discofs_options.sched = SCHED_SJF;
+            else if (!strcmp(val, "fair"))
+                discofs_options.sched = SCHED_FAIR;
+            else
+            {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            return 0;
+
+
+        /*=====================*
+         * AVAILABILITY PROBES *
+         *=====================*/
+
+        case DISCOFS_OPT_PROBE:
+            val = arg + strlen("probe=");
+
+            if (!strcmp(val, "icmp"))
+                discofs_options.probe = PROBE_ICMP;
+            else if (!strcmp(val, "tcp"))
+                discofs_options.probe = PROBE_TCP;
+            else if (!strcmp(val, "statfs"))
+                discofs_options.probe = PROBE_STATFS;
+            else
+            {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            return 0;
     }
 
     /* unknown key */
@@ -563,11 +767,7 @@ static void sig_handler(int signo)
 }
 
 /*! @struct discofs_oper operations struct which will be passed to fuse_main() */
-#if DEBUG_FSOPS
-#define OPER(n) .n = debug_op_ ## n
-#else
-#define OPER(n) .n = op_ ## n
-#endif
+#define OPER(n) .n = stats_op_ ## n
 static struct fuse_operations discofs_oper =
 {
     OPER(init),
@@ -717,9 +917,9 @@ int main(int argc, char **argv)
 
     /* if -d is specified, override logging settings */
     if (discofs_options.debug)
-        log_init(LOG_DEBUG, NULL);
+        log_init(LOG_DEBUG, NULL, discofs_options.logformat);
     else
-        log_init(discofs_options.loglevel, discofs_options.logfile);
+        log_init(discofs_options.loglevel, discofs_options.logfile, discofs_options.logformat);
 
 
 
@@ -782,12 +982,16 @@ int main(int argc, char **argv)
     /* initialize tables etc */
     db_init(db_file, discofs_options.clear);
 
+    /* needed to test the remote fs features */
+    if (probe_init())
+        FATAL("error initializing probe\n");
+
     /* try to load filesystem features from DB */
     if (db_cfg_get_int(CFG_FS_FEATURES, &discofs_options.fs_features))
     {
 
         /* if loading failed, try to determine them */
-        if (is_mounted(REMOTE_ROOT) && is_reachable(discofs_options.host))
+        if (probe_run())
         {
             if (test_fs_features(&discofs_options.fs_features))
             {
@@ -815,7 +1019,17 @@ int main(int argc, char **argv)
             FATAL("error initializing " #name)
     INIT(lock);
     INIT(sync);
+    INIT(timer);
     INIT(job);
+    INIT(sparse);
+    INIT(readahead);
+    INIT(policy);
+    INIT(evict);
+    INIT(bwlimit);
+    INIT(rcall);
+    INIT(trace);
+    INIT(ctl);
+    INIT(record);
     #undef INIT
 
 
@@ -838,6 +1052,17 @@ int main(int argc, char **argv)
     lock_destroy();
     sync_destroy();
     job_destroy();
+    timer_destroy();
+    sparse_destroy();
+    readahead_destroy();
+    evict_destroy();
+    policy_destroy();
+    bwlimit_destroy();
+    probe_destroy();
+    rcall_destroy();
+    trace_destroy();
+    ctl_destroy();
+    record_destroy();
 
     /* free arguments */
     fuse_opt_free_args(&args);
@@ -66,11 +66,22 @@ extern struct options discofs_options;
  *-----------------*/
 #define DEF_COPYATTR 0
 #define DEF_LOGLEVEL LOG_ERROR
+#define DEF_LOGFORMAT LOG_TEXT
 #define DEF_SCAN_INTERVAL 10
 #define DEF_CONFLICT CONFLICT_NEWER
+#define DEF_SCHED SCHED_PRIO
+#define DEF_READAHEAD 4096
+#define DEF_HOTSET 100
+#define DEF_SYNC_CACHE 100000
+#define DEF_THREADS 8
+#define DEF_PROBE PROBE_AUTO
+#define DEF_PROBE_PORT 22
+#define DEF_RTIMEOUT 10
 
 
 enum opt_conflict { CONFLICT_NEWER, CONFLICT_THEIRS, CONFLICT_MINE };
+enum opt_sched { SCHED_PRIO, SCHED_SJF, SCHED_FAIR };
+enum opt_probe { PROBE_AUTO, PROBE_ICMP, PROBE_TCP, PROBE_STATFS };
 
 /*! @struct options
  * mount options. 
@@ -87,16 +98,39 @@ struct options
     int fs_features;            /* features of remote filesystem */
     uid_t uid;                  /* uid to setuid() to */
     gid_t gid;                  /* gid to setgid() to */
-    char *host;                 /* host to PING for remote fs availability */
+    char *host;                 /* host to probe for remote fs availability */
     char *pid_file;             /* PID file to check for remote fs availability */
+    int probe;                  /* how to check remote fs availability */
+    unsigned int probe_port;    /* port to connect to with probe=tcp */
+    unsigned int rtimeout;      /* seconds a call to the remote fs may take */
     char *backup_prefix;        /* prefix for backups during conflict resolution */
     char *backup_suffix;        /* suffix ... */
     int conflict;               /* conflict resolution mode */
+    int sched;                  /* order of PUSH/PULL jobs */
     int clear;                  /* delete database and cache before starting */
+    int retry;                  /* retry jobs that failed permanently */
     int copyattr;               /* attribute copy mask */
+    int sparse;                 /* pull only placeholders, fetch blocks on demand */
+    unsigned int readahead;     /* maximum read-ahead window in kilobytes */
+    unsigned int cache_size;    /* maximum size of cached data in megabytes */
+    unsigned int cache_files;   /* maximum number of files with cached data */
+    char *policy;               /* file containing caching policies */
+    unsigned int hotset;        /* number of most used files to keep complete */
+    unsigned int sync_cache;    /* sync entries kept in memory */
+    unsigned int threads;       /* number of remote operations performed in parallel */
+    int writeback;              /* schedule changes instead of applying them while ONLINE */
+    unsigned int wbwait;        /* seconds fsync/close wait for scheduled changes */
+    unsigned int bwpush;        /* upload limit in kbytes per second */
+    unsigned int bwpull;        /* download limit in kbytes per second */
+    char *bwlimit;              /* file containing a schedule of bandwidth limits */
+    unsigned int trace;         /* operations per thread kept in the trace file */
+    char *ctl;                  /* control socket */
+    char *record;               /* file operations are recorded to */
+    int record_anon;            /* hash the names of recorded paths */
     unsigned int scan_interval; /* interval between scan_remote() passes */
     int loglevel;               /* logging level */
     char *logfile;              /* log file name */
+    int logformat;              /* text or JSON lines */
 };
 
 /*! options initializer */
@@ -111,14 +145,37 @@ struct options
     .gid = 0,\
     .host = NULL,\
     .pid_file = NULL,\
+    .probe = DEF_PROBE,\
+    .probe_port = DEF_PROBE_PORT,\
+    .rtimeout = DEF_RTIMEOUT,\
     .backup_prefix = NULL,\
     .backup_suffix = NULL,\
     .clear = 0,\
+    .retry = 0,\
     .conflict = DEF_CONFLICT,\
+    .sched = DEF_SCHED,\
     .copyattr = DEF_COPYATTR,\
+    .sparse = 0,\
+    .readahead = DEF_READAHEAD,\
+    .cache_size = 0,\
+    .cache_files = 0,\
+    .policy = NULL,\
+    .hotset = DEF_HOTSET,\
+    .sync_cache = DEF_SYNC_CACHE,\
+    .threads = DEF_THREADS,\
+    .writeback = 0,\
+    .wbwait = 0,\
+    .bwpush = 0,\
+    .bwpull = 0,\
+    .bwlimit = NULL,\
+    .trace = 0,\
+    .ctl = NULL,\
+    .record = NULL,\
+    .record_anon = 0,\
     .scan_interval = DEF_SCAN_INTERVAL, \
     .loglevel = DEF_LOGLEVEL,\
-    .logfile = NULL }
+    .logfile = NULL,\
+    .logformat = DEF_LOGFORMAT }
 
 
 /*! option keys for discofs_opt_proc */
@@ -130,7 +187,10 @@ enum discofs_opt_keys
     DISCOFS_OPT_GID,
     DISCOFS_OPT_PID,
     DISCOFS_OPT_CONFLICT,
+    DISCOFS_OPT_SCHED,
+    DISCOFS_OPT_PROBE,
     DISCOFS_OPT_LOGLEVEL,
+    DISCOFS_OPT_LOGFORMAT,
     DISCOFS_OPT_DEBUG,
     DISCOFS_OPT_FOREGROUND,
     DISCOFS_OPT_NO_MODE,
@@ -0,0 +1,356 @@
+/*! @file evict.c
+ * cache size limits.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "evict.h"
+
+#include "discofs.h"
+#include "state.h"
+#include "log.h"
+#include "funcs.h"
+#include "sync.h"
+#include "lock.h"
+#include "job.h"
+#include "sparse.h"
+#include "policy.h"
+#include "hashtable.h"
+#include "queue.h"
+#include "db.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! accesses of a file since the last evict_store() */
+struct access
+{
+    char *path;
+    time_t atime;
+    unsigned int hits;
+};
+
+/* recorded accesses, key is the path */
+static hashtable *access_ht = NULL;
+static pthread_mutex_t m_access_ht = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static hash_t access_hash(const void *p, const void *n);
+static int access_cmp(const void *p1, const void *p2, const void *n);
+static void access_free(void *p);
+
+static void evict_record(const char *path, int hit, int recent);
+static off_t evict_resident(const char *path);
+static int evict_file(const char *path, off_t *freed);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static hash_t access_hash(const void *p, const void *n)
+{
+    return djb2(p, SIZE_MAX);
+}
+
+static int access_cmp(const void *p1, const void *p2, const void *n)
+{
+    return strcmp(p1, p2);
+}
+
+static void access_free(void *p)
+{
+    struct access *a = p;
+
+    if (a)
+        free(a->path);
+    free(a);
+}
+
+static void evict_record(const char *path, int hit, int recent)
+{
+    struct access *a;
+
+    pthread_mutex_lock(&m_access_ht);
+
+    if ((a = ht_get(access_ht, path)) == NULL)
+    {
+        if ((a = malloc(sizeof *a)) == NULL || (a->path = strdup(path)) == NULL)
+        {
+            free(a);
+            pthread_mutex_unlock(&m_access_ht);
+            return;
+        }
+        a->atime = 0;
+        a->hits = 0;
+
+        if (ht_insert(access_ht, a->path, a) != HT_OK)
+        {
+            access_free(a);
+            pthread_mutex_unlock(&m_access_ht);
+            return;
+        }
+    }
+
+    if (hit)
+        a->hits++;
+    if (recent)
+        a->atime = time(NULL);
+
+    pthread_mutex_unlock(&m_access_ht);
+}
+
+/* number of bytes _path_ occupies in the cache, -1 if it doesn't exist */
+static off_t evict_resident(const char *path)
+{
+    int res;
+    char *p;
+    struct stat st;
+
+    if ((p = cache_path(path)) == NULL)
+        return 0;
+
+    res = lstat(p, &st);
+    free(p);
+
+    if (res == -1)
+        return (errno == ENOENT) ? -1 : 0;
+
+    if (!S_ISREG(st.st_mode))
+        return 0;
+
+    return (off_t)st.st_blocks * 512;
+}
+
+/* drop the data of _path_ from the cache if it is safe to do so */
+static int evict_file(const char *path, off_t *freed)
+{
+    off_t size;
+
+    /* never evict anything that hasn't been written back yet (also if
+       writing it back failed for good), or is being used or transferred */
+    if (lock_has(path, LOCK_OPEN) || lock_has(path, LOCK_TRANSFER)
+            || job_exists(path, JOB_ANY) || db_job_dead_exists(path))
+        return -1;
+
+    /* don't look at it again */
+    if (policy_get(path) == POLICY_OFFLINE)
+    {
+        db_cache_pin(path, EVICT_PIN_POLICY);
+        return -1;
+    }
+
+    size = evict_resident(path);
+
+    /* stale entry */
+    if (size == -1)
+    {
+        db_cache_delete(path);
+        return -1;
+    }
+
+    /* the blocks are read back from the remote file, it must be the one
+       the cache has */
+    if (size > 0 && sync_get(path) != SYNC_SYNC)
+        return -1;
+
+    if (size == 0 || sparse_evict(path))
+    {
+        db_cache_set_size(path, 0);
+        return -1;
+    }
+
+    VERBOSE("evicted %s from cache", path);
+    db_cache_set_size(path, 0);
+    *freed = size;
+    return 0;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int evict_init(void)
+{
+    if (ht_init(&access_ht, access_hash, access_cmp) == HT_ERROR)
+        return -1;
+
+    /* policies might have changed since the last start */
+    if (db_cache_unpin(EVICT_PIN_POLICY) != DB_OK)
+        return -1;
+
+    return 0;
+}
+
+void evict_destroy(void)
+{
+    evict_store();
+
+    pthread_mutex_lock(&m_access_ht);
+    ht_free_f(access_ht, NULL, access_free);
+    access_ht = NULL;
+    pthread_mutex_unlock(&m_access_ht);
+}
+
+void evict_access(const char *path, int open)
+{
+    evict_record(path, open, 1);
+}
+
+void evict_update(const char *path)
+{
+    evict_record(path, 0, 0);
+}
+
+int evict_store(void)
+{
+    int res = DB_OK;
+    htiter *it;
+    struct access *a;
+    off_t size;
+
+    pthread_mutex_lock(&m_access_ht);
+
+    if (ht_empty(access_ht))
+    {
+        pthread_mutex_unlock(&m_access_ht);
+        return 0;
+    }
+
+    it = ht_iter(access_ht);
+    if (!it)
+    {
+        pthread_mutex_unlock(&m_access_ht);
+        return -1;
+    }
+
+    while (res == DB_OK && htiter_next(it, NULL, (void**)&a))
+    {
+        if ((size = evict_resident(a->path)) != -1)
+            res = db_cache_touch(a->path, a->atime, a->hits, size);
+    }
+    free(it);
+
+    ht_free_f(access_ht, NULL, access_free);
+    if (ht_init(&access_ht, access_hash, access_cmp) == HT_ERROR)
+        res = DB_ERROR;
+
+    pthread_mutex_unlock(&m_access_ht);
+
+    if (res != DB_OK)
+        return -1;
+    return 0;
+}
+
+int evict_run(void)
+{
+    static time_t last = 0;
+    time_t now;
+    char *path;
+    queue *q;
+    off_t bytes, max_bytes, freed;
+    unsigned long files, max_files;
+
+#define OVER_LIMITS() ((max_bytes && bytes > max_bytes) || (max_files && files > max_files))
+
+    max_bytes = (off_t)discofs_options.cache_size * 1024 * 1024;
+    max_files = discofs_options.cache_files;
+
+    /* evicted blocks can't be read back while OFFLINE */
+    if ((!max_bytes && !max_files) || !ONLINE)
+        return 0;
+
+    now = time(NULL);
+    if (now - last < EVICT_INTERVAL)
+        return 0;
+    last = now;
+
+    if (db_cache_usage(&bytes, &files) != DB_OK)
+        return -1;
+
+    if (!OVER_LIMITS())
+        return 0;
+
+    DEBUG("cache uses %lld bytes in %lu files, evicting",
+            (long long)bytes, files);
+
+    if ((q = q_init()) == NULL)
+        return -1;
+
+    if (db_cache_victims(q, EVICT_BATCH, EVICT_HIT_BONUS) != DB_OK)
+    {
+        q_free(q, free);
+        return -1;
+    }
+
+    while (OVER_LIMITS() && (path = q_dequeue(q)))
+    {
+        if (!evict_file(path, &freed))
+        {
+            bytes -= freed;
+            files--;
+        }
+        free(path);
+    }
+#undef OVER_LIMITS
+
+    q_free(q, free);
+    return 0;
+}
+
+int evict_pin(const char *path, int pinned)
+{
+    if (db_cache_pin(path, pinned) != DB_OK)
+        return -1;
+    return 0;
+}
+
+int evict_delete(const char *path)
+{
+    struct access *a;
+
+    pthread_mutex_lock(&m_access_ht);
+    if ((a = ht_remove(access_ht, path)))
+        access_free(a);
+    pthread_mutex_unlock(&m_access_ht);
+
+    if (db_cache_delete(path) != DB_OK)
+        return -1;
+    return 0;
+}
+
+int evict_rename_file(const char *from, const char *to)
+{
+    evict_store();
+
+    db_cache_delete(to);
+    if (db_cache_rename_file(from, to) != DB_OK)
+        return -1;
+    return 0;
+}
+
+int evict_rename_dir(const char *from, const char *to)
+{
+    evict_store();
+
+    if (db_cache_rename_dir(from, to) != DB_OK)
+        return -1;
+    return 0;
+}
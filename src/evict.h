@@ -0,0 +1,66 @@
+/*! @file evict.h
+ * cache size limits.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_EVICT_H
+#define DISCOFS_EVICT_H
+
+#include "config.h"
+#include "discofs.h"
+
+#include <time.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! minimum number of seconds between two checks of the cache size */
+#define EVICT_INTERVAL SLEEP_SHORT
+
+/*! maximum number of files to look at per check */
+#define EVICT_BATCH 64
+
+/*! each access makes a file look this many seconds more recent */
+#define EVICT_HIT_BONUS 60
+
+/*! pin reasons. pins set because of a policy are reset on every start */
+#define EVICT_PIN_USER   1
+#define EVICT_PIN_POLICY 2
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! initialize/destroy needed data structures */
+int evict_init(void);
+void evict_destroy(void);
+
+/*! record an access to _path_. opening a file counts as a hit, reading
+   from it only refreshes its recency */
+void evict_access(const char *path, int open);
+
+/*! the cached data of _path_ changed (e.g. it was pulled) */
+void evict_update(const char *path);
+
+/*! store recorded accesses to db */
+int evict_store(void);
+
+/*! evict the least valuable files until the cache is within its limits */
+int evict_run(void);
+
+/*! pin (_pinned_ is EVICT_PIN_*) or unpin (0) _path_. pinned files are
+   never evicted */
+int evict_pin(const char *path, int pinned);
+
+/*! forget _path_ (file was deleted) */
+int evict_delete(const char *path);
+
+/*! rename entries */
+int evict_rename_file(const char *from, const char *to);
+int evict_rename_dir(const char *from, const char *to);
+
+#endif
@@ -16,6 +16,13 @@
 #include "lock.h"
 #include "worker.h"
 #include "transfer.h"
+#include "sparse.h"
+#include "readahead.h"
+#include "evict.h"
+#include "policy.h"
+#include "replay.h"
+#include "rcall.h"
+#include "ctl.h"
 #include "bst.h"
 
 #include <fuse.h>
@@ -33,11 +40,66 @@
 
 extern pthread_mutex_t m_instant_pull;
 
-static pthread_t t_worker, t_state;
+static pthread_t t_worker, t_state, t_readahead, t_ctl;
+
+/* apply changes to the remote fs while handling the request. in write-behind
+   mode, they are only scheduled and replayed by the worker thread */
+#define REMOTE_SYNC (ONLINE && !discofs_options.writeback)
+
+/* look up _path_, which is missing in the cache, on the remote fs. not if
+   it was removed or renamed and that wasn't applied to the remote fs yet */
+#define REMOTE_LOOKUP(path) (ONLINE && !job_exists(path, REPLAY_JOBS))
+
+/* wait until the scheduled changes of _path_ were applied to the remote fs.
+   gives up after "wbwait" seconds or when going OFFLINE */
+static void writeback_wait(const char *path)
+{
+    if (!ONLINE)
+        return;
+
+    if (job_wait(path, REPLAY_JOBS, discofs_options.wbwait))
+        VERBOSE("changes of %s not written back after %u seconds", path, discofs_options.wbwait);
+}
+
+/* hashes of the names in _dir_ with changes that weren't applied to the
+   remote fs yet, fetched once per readdir */
+static bst *remote_pending(const char *dir)
+{
+    bst *tree = bst_init();
+    queue *q = q_init();
+    char *p;
+    long hash;
+
+    if (tree && q && !job_dir(dir, REPLAY_JOBS, q))
+    {
+        while ((p = q_dequeue(q)))
+        {
+            hash = djb2(strrchr(p, '/') + 1, SIZE_MAX);
+            if (!bst_contains(tree, hash))
+                bst_insert(tree, hash, NULL);
+            free(p);
+        }
+    }
+
+    if (q)
+        q_free(q, free);
+    return tree;
+}
 
 /* called when fs is initialized.  starts worker and state checking thread */
 void *op_init(struct fuse_conn_info *conn)
 {
+    if (log_start())
+        FATAL("failed to create thread\n");
+
+    VERBOSE("starting remote call threads");
+    if (rcall_start())
+        FATAL("failed to create thread\n");
+
+    VERBOSE("starting replay threads");
+    if (replay_start())
+        FATAL("failed to create thread\n");
+
     VERBOSE("starting state check thread");
     if (pthread_create(&t_state, NULL, state_check_main, NULL))
         FATAL("failed to create thread\n");
@@ -46,6 +108,14 @@ void *op_init(struct fuse_conn_info *conn)
     if (pthread_create(&t_worker, NULL, worker_main, NULL))
         FATAL("failed to create thread\n");
 
+    VERBOSE("starting read-ahead thread");
+    if (pthread_create(&t_readahead, NULL, readahead_main, NULL))
+        FATAL("failed to create thread\n");
+
+    VERBOSE("starting control thread");
+    if (pthread_create(&t_ctl, NULL, ctl_main, NULL))
+        FATAL("failed to create thread\n");
+
     return NULL;
 }
 
@@ -58,6 +128,16 @@ void op_destroy(void *p)
 
     DEBUG("joining worker thread");
     pthread_join(t_worker, NULL);
+
+    DEBUG("joining replay threads");
+    replay_stop();
+
+    DEBUG("joining read-ahead thread");
+    readahead_stop();
+    pthread_join(t_readahead, NULL);
+
+    DEBUG("joining control thread");
+    pthread_join(t_ctl, NULL);
 }
 
 int op_getattr(const char *path, struct stat *buf)
@@ -73,10 +153,10 @@ int op_getattr(const char *path, struct stat *buf)
     err = errno;
     free(p);
 
-    if (res && errno == ENOENT && ONLINE)
+    if (res && err == ENOENT && REMOTE_LOOKUP(path))
     {
         p = remote_path2(path, p_len);
-        res = lstat(p, buf);
+        res = rcall_lstat(p, buf);
         free(p);
     }
 
@@ -109,10 +189,10 @@ int op_access(const char *path, int mode)
     err = errno;
     free(p);
 
-    if (res && errno == ENOENT && ONLINE)
+    if (res && err == ENOENT && REMOTE_LOOKUP(path))
     {
         p = remote_path2(path, p_len);
-        res = access(p, mode);
+        res = rcall_access(p, mode);
         free(p);
     }
 
@@ -123,12 +203,23 @@ int op_access(const char *path, int mode)
 
 int op_readlink(const char *path, char *buf, size_t bufsize)
 {
-    int res;
+    int res = -1;
     char *p;
 
-    p = (ONLINE) ? remote_path(path) : cache_path(path);
-    res = readlink(p, buf, bufsize);
-    free(p);
+    if (REMOTE_SYNC)
+    {
+        p = remote_path(path);
+        res = rcall_readlink(p, buf, bufsize);
+        free(p);
+    }
+
+    /* also if the remote fs timed out above */
+    if (!REMOTE_SYNC)
+    {
+        p = cache_path(path);
+        res = readlink(p, buf, bufsize);
+        free(p);
+    }
 
     if (res == -1)
         return -errno;
@@ -147,6 +238,7 @@ int op_opendir(const char *path, struct fuse_file_info *fi)
     char *p, *p2;
     DIR **dirp;
     DIR **d;
+    int err;
     size_t p_len = strlen(path);
 
     dirp = malloc(2 * sizeof *dirp);
@@ -160,7 +252,8 @@ int op_opendir(const char *path, struct fuse_file_info *fi)
     p = cache_path2(path, p_len);
     if ((*d = opendir(p)) == NULL)
     {
-        if (errno == ENOENT && ONLINE)
+        err = errno;
+        if (err == ENOENT && REMOTE_LOOKUP(path))
         {
             p2 = remote_path2(path, p_len);
             clone_dir(p2, p);
@@ -171,7 +264,7 @@ int op_opendir(const char *path, struct fuse_file_info *fi)
         {
             free(p);
             free(dirp);
-            return -errno;
+            return -err;
         }
     }
     free(p);
@@ -180,7 +273,7 @@ int op_opendir(const char *path, struct fuse_file_info *fi)
     if (ONLINE)
     {
         p = remote_path2(path, p_len);
-        *d = opendir(p);
+        *d = rcall_opendir(p);
         free(p);
     }
     else
@@ -197,6 +290,7 @@ int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
     int res;
     DIR **dirp;
     bst *tree = bst_init();
+    bst *pending = NULL;
 
     size_t dbufsize;
     struct dirent *ent;
@@ -232,6 +326,12 @@ int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
             if (bst_contains(tree, hash))
                 continue;
 
+            /* removed or renamed, but not on the remote fs yet */
+            if (n == 0 && !pending)
+                pending = remote_pending(path);
+            if (n == 0 && pending && bst_contains(pending, hash))
+                continue;
+
             memset(&st, 0, sizeof st);
             st.st_ino = ent->d_ino;
             st.st_mode = DTTOIF(ent->d_type);
@@ -239,17 +339,29 @@ int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
             if (filler(buf, ent->d_name, &st, 0))
             {
                 bst_free(tree, NULL);
+                if (pending)
+                    bst_free(pending, NULL);
                 free(dbuf);
                 return -ENOMEM;
             }
             bst_insert(tree, hash, NULL);
         }
-        while ((res = readdir_r(*dirp, dbuf, &ent)) == 0 && ent);
+        while ((res = (n == 0) ? rcall_readdir_r(*dirp, dbuf, &ent)
+                    : readdir_r(*dirp, dbuf, &ent)) == 0 && ent);
+
+        /* the remote dir is gone with the timed out call, list the cache */
+        if (n == 0 && res == ETIMEDOUT)
+        {
+            *dirp = NULL;
+            res = 0;
+        }
 
         dirp++;
     }
 
     bst_free(tree, NULL);
+    if (pending)
+        bst_free(pending, NULL);
     free(dbuf);
 
     return -res;
@@ -268,21 +380,24 @@ int op_mknod(const char *path, mode_t mode, dev_t rdev)
         return -errno;
     free(p);
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         p = remote_path2(path, p_len);
-        res = mknod(p, mode, rdev);
+        res = rcall_mknod(p, mode, rdev);
         free(p);
-        if (res != 0)
+        if (res == 0)
+        {
+            sync_set(path, 0);
+            return 0;
+        }
+        if (errno != ETIMEDOUT)
             return -errno;
-        sync_set(path, 0);
-    }
-    else
-    {
-        job_schedule_push(path);
     }
 
-    return res;
+    /* the node exists in the cache, the remote one follows */
+    job_schedule_push_sized(path, 0);
+
+    return 0;
 }
 
 int op_mkdir(const char *path, mode_t mode)
@@ -303,7 +418,7 @@ int op_mkdir(const char *path, mode_t mode)
 
     sync_delete_dir(path);
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         res = remoteop_mkdir(path, mode);
         if (!res)
@@ -336,7 +451,7 @@ int op_rmdir(const char *path)
 
     sync_delete_dir(path);
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         res = remoteop_rmdir(path);
         if (!res)
@@ -367,13 +482,17 @@ int op_unlink(const char *path)
             return -errno;
     }
 
-    job_delete(path, JOB_ANY);
-    job_delete_rename_to(path);
-
     sync_delete_file(path);
+    sparse_delete(path);
+    evict_delete(path);
 
-    if (ONLINE)
+    /* while OFFLINE or in write-behind mode, pending jobs are dropped when
+       the unlink job is coalesced (see job_store) */
+    if (REMOTE_SYNC)
     {
+        job_delete(path, JOB_ANY);
+        job_delete_rename_to(path);
+
         res = remoteop_unlink(path);
         if (!res)
             return 0;
@@ -397,7 +516,7 @@ int op_symlink(const char *to, const char *path)
     if (res)
         return -errno;
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         res = remoteop_symlink(to, path);
         if (!res)
@@ -423,6 +542,8 @@ int op_rename(const char *from, const char *to)
     char *pf, *pt;
     size_t len_from, len_to;
     int from_is_dir;
+    job_param flags;
+    struct stat st;
 
     len_from = strlen(from);
     len_to = strlen(to);
@@ -437,6 +558,7 @@ int op_rename(const char *from, const char *to)
 
     /* needed later */
     from_is_dir = is_dir(pf);
+    flags = (!lstat(pt, &st) && !job_not_remote(to)) ? RENAME_REPLACED : 0;
 
     /* rename in cache */
     res = rename(pf, pt);
@@ -459,10 +581,14 @@ int op_rename(const char *from, const char *to)
     if (from_is_dir)
     {
         job_rename_dir(from, to);
+        sparse_rename_dir(from, to);
+        evict_rename_dir(from, to);
     }
     else
     {
         job_rename_file(from, to);
+        sparse_rename_file(from, to);
+        evict_rename_file(from, to);
     }
 
 
@@ -482,7 +608,7 @@ int op_rename(const char *from, const char *to)
     /* rename on remote */
     /*------------------*/
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         /* moving a file or directory may render the data collected by the
            worker thread during worker_scan_dir outdated. worker_cancel_scan()
@@ -501,7 +627,7 @@ int op_rename(const char *from, const char *to)
         }
     }
 
-    job_schedule(JOB_RENAME, from, 0, 0, to, NULL);
+    job_schedule(JOB_RENAME, from, flags, 0, to, NULL);
 
     return 0;
 }
@@ -517,7 +643,7 @@ int op_releasedir(const char* path, struct fuse_file_info *fi)
 
     dirp++;
 
-    if (closedir(*dirp) == -1)
+    if (*dirp && closedir(*dirp) == -1)
         res = -errno;
 
     worker_unblock();
@@ -526,9 +652,43 @@ int op_releasedir(const char* path, struct fuse_file_info *fi)
 
 #define OP_OPEN 0
 #define OP_CREATE 1
+
+/* open a file that is never cached directly on the remote fs */
+static int op_open_remote(int op, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int fh[FH_ELEMENTS], *fhp;
+    char *pr;
+
+    pr = remote_path(path);
+    if (!pr)
+        return -EIO;
+
+    FH_FD(fh) = rcall_open(pr, fi->flags, mode);
+
+    free(pr);
+
+    if (FH_FD(fh) == -1)
+        return -errno;
+
+    FH_FLAGS(fh) = FH_REMOTE;
+
+    lock_set(path, LOCK_OPEN);
+
+    if ((fhp = malloc(sizeof fh)) == NULL)
+    {
+        close(FH_FD(fh));
+        return -EIO;
+    }
+
+    memcpy(fhp, fh, sizeof fh);
+    fi->fh = (uint64_t) fhp;
+    return 0;
+}
+
 static int op_open_create(int op, const char *path, mode_t mode, struct fuse_file_info *fi)
 {
     int sync;
+    int uncached;
     int fh[FH_ELEMENTS], *fhp;
     char *pc, *pr;
     size_t p_len;
@@ -537,16 +697,31 @@ static int op_open_create(int op, const char *path, mode_t mode, struct fuse_fil
 
     FH_FLAGS(fh) = 0;
 
+    /* don't cache files that are not already in the cache */
+    if (ONLINE && policy_get(path) == POLICY_NEVER)
+    {
+        pc = cache_path2(path, p_len);
+        if (!pc)
+            return -EIO;
+
+        uncached = is_nonexist(pc);
+        free(pc);
+
+        if (uncached)
+            return op_open_remote(op, path, mode, fi);
+    }
+
     if (ONLINE && !lock_has(path, LOCK_OPEN))
     {
         sync = sync_get(path);
 
+        /* the remote fs timed out, open the cached file */
         if (sync == -1)
         {
-            return -EIO;
+            if (errno != ETIMEDOUT)
+                return -EIO;
         }
-
-        if (job_exists(path, JOB_PULL))
+        else if (job_exists(path, JOB_PULL))
         {
             /* wait until current instant_pull finished */
             pthread_mutex_lock(&m_instant_pull);
@@ -600,13 +775,14 @@ static int op_open_create(int op, const char *path, mode_t mode, struct fuse_fil
 
     if (op == OP_CREATE)
     {
-        if (ONLINE && !remoteop_create(path, fi->flags,  mode))
+        if (REMOTE_SYNC && !remoteop_create(path, fi->flags,  mode))
             sync_set(path, 0);
         else
             job_schedule(JOB_CREATE, path, fi->flags, mode, NULL, NULL);
     }
 
     lock_set(path, LOCK_OPEN);
+    evict_access(path, 1);
 
     if ((fhp = malloc(sizeof fh)) == NULL)
     {
@@ -614,6 +790,13 @@ static int op_open_create(int op, const char *path, mode_t mode, struct fuse_fil
         return -EIO;
     }
 
+    /* keep the block bitmap in memory while the file is open */
+    if (sparse_open(path))
+    {
+        FH_FLAGS(fh) |= FH_SPARSE;
+        readahead_open(path);
+    }
+
     memcpy(fhp, fh, sizeof fh);
     fi->fh = (uint64_t) fhp;
     return 0;
@@ -637,6 +820,9 @@ int op_flush(const char *path, struct fuse_file_info *fi)
     if (res == -1)
         return -errno;
 
+    if (discofs_options.wbwait)
+        writeback_wait(path);
+
     return 0;
 }
 
@@ -648,14 +834,20 @@ int op_release(const char *path, struct fuse_file_info *fi)
     lock_remove(path, LOCK_OPEN);
     res = close(FI_FD(fi));
 
+    if (FI_FLAGS(fi) & FH_SPARSE)
+    {
+        readahead_close(path);
+        sparse_close(path);
+    }
+
     /* file written -> schedule push */
-    if (FI_FLAGS(fi) & FH_WRITTEN)
+    if ((FI_FLAGS(fi) & FH_WRITTEN) && !(FI_FLAGS(fi) & FH_REMOTE))
     {
         p = cache_path(path);
 
         /* check first if file still exists */
         if (!lstat(p, &st))
-            job_schedule_push(path);
+            job_schedule_push_sized(path, st.st_size);
 
         free(p);
     }
@@ -674,6 +866,10 @@ int op_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
 
     if (res == -1)
         return -errno;
+
+    if (discofs_options.wbwait)
+        writeback_wait(path);
+
     return 0;
 }
 
@@ -691,6 +887,10 @@ int op_fsyncdir(const char *path, int isdatasync, struct fuse_file_info *fi)
 
     if (res == -1)
         return -errno;
+
+    if (discofs_options.wbwait)
+        writeback_wait(path);
+
     return 0;
 }
 
@@ -698,7 +898,19 @@ int op_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
 {
     int res;
 
+    /* fetch missing blocks first */
+    if (FI_FLAGS(fi) & FH_SPARSE)
+    {
+        res = sparse_fetch(path, offset, size);
+        if (res)
+            return res;
+
+        /* prefetch what will probably be read next */
+        readahead_read(path, offset, size);
+    }
+
     res = pread(FI_FD(fi), (void *)buf, size, offset);
+    evict_access(path, 0);
 
     if (res == -1)
         return -errno;
@@ -709,6 +921,13 @@ int op_write(const char *path, const char *buf, size_t size, off_t offset, struc
 {
     int res;
 
+    if (FI_FLAGS(fi) & FH_SPARSE)
+    {
+        res = sparse_write(path, offset, size);
+        if (res)
+            return res;
+    }
+
     res = pwrite(FI_FD(fi), (void *)buf, size, offset);
 
     if (res == -1)
@@ -728,10 +947,21 @@ int op_truncate(const char *path, off_t size)
     res = truncate(p, size);
     free(p);
 
+    /* file is never cached */
+    if (res == -1 && errno == ENOENT && ONLINE && policy_get(path) == POLICY_NEVER)
+    {
+        p = remote_path2(path, p_len);
+        res = rcall_truncate(p, size);
+        free(p);
+        return (res == -1) ? -errno : 0;
+    }
+
     if (res == -1)
         return -errno;
 
-    if (ONLINE)
+    sparse_truncate(path, size);
+
+    if (REMOTE_SYNC)
     {
         if (!lock_has(path, LOCK_OPEN))
         {
@@ -742,15 +972,19 @@ int op_truncate(const char *path, off_t size)
             }
 
             p = remote_path2(path, p_len);
-            res = truncate(p, size);
+            res = rcall_truncate(p, size);
             free(p);
-            if (res == -1 && !job_exists(path, JOB_PUSH))
+
+            /* the remote fs is gone, push the cached file later */
+            if (res == -1 && errno == ETIMEDOUT)
+                job_schedule_push_sized(path, size);
+            else if (res == -1 && !job_exists(path, JOB_PUSH))
                 return -errno;
         }
     }
     else
     {
-        job_schedule_push(path);
+        job_schedule_push_sized(path, size);
     }
 
     return 0;
@@ -768,7 +1002,7 @@ int op_chown(const char *path, uid_t uid, gid_t gid)
     if (res)
         return -errno;
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         res = remoteop_chown(path, uid, gid);
         if (!res)
@@ -795,7 +1029,7 @@ int op_chmod(const char *path, mode_t mode)
     if (res)
         return -errno;
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         res = remoteop_chmod(path, mode);
         if (!res)
@@ -825,7 +1059,7 @@ int op_utimens(const char *path, const struct timespec ts[2])
     if (ONLINE)
     {
         p = remote_path2(path, p_len);
-        utimensat(-1, p, ts, AT_SYMLINK_NOFOLLOW);
+        rcall_utimensat(p, ts);
         free(p);
     }
 
@@ -837,7 +1071,17 @@ int op_statfs(const char *path, struct statvfs *buf)
     int res;
     char *p;
 
-    p = (ONLINE) ? remote_path(path) : cache_path(path);
+    if (ONLINE)
+    {
+        p = remote_path(path);
+        res = rcall_statvfs(p, buf);
+        free(p);
+
+        if (res == 0 || errno != ETIMEDOUT)
+            return (res == -1) ? -errno : 0;
+    }
+
+    p = cache_path(path);
     res = statvfs(p, buf);
     free(p);
 
@@ -865,7 +1109,7 @@ int op_setxattr(const char *path, const char *name, const char *value, size_t si
     if (res)
         return -errno;
 
-    if (ONLINE)
+    if (REMOTE_SYNC)
     {
         res = remoteop_setxattr(path, name, value, size, flags);
         if (!res)
@@ -882,16 +1126,26 @@ int op_setxattr(const char *path, const char *name, const char *value, size_t si
 
 int op_getxattr(const char *path, const char *name, char *value, size_t size)
 {
-    int res;
+    int res = -1;
     char *p;
 
     if (!(discofs_options.fs_features & FEAT_XATTR))
         return -ENOTSUP;
 
-    p = (ONLINE) ? remote_path(path) : cache_path(path);
+    if (REMOTE_SYNC)
+    {
+        p = remote_path(path);
+        res = rcall_lgetxattr(p, name, value, size);
+        free(p);
+    }
 
-    res = lgetxattr(p, name, value, size);
-    free(p);
+    /* also if the remote fs timed out above */
+    if (!REMOTE_SYNC)
+    {
+        p = cache_path(path);
+        res = lgetxattr(p, name, value, size);
+        free(p);
+    }
 
     if (res == -1)
         return -errno;
@@ -900,15 +1154,26 @@ int op_getxattr(const char *path, const char *name, char *value, size_t size)
 
 int op_listxattr(const char *path, char *list, size_t size)
 {
-    int res;
+    int res = -1;
     char *p;
 
     if (!(discofs_options.fs_features & FEAT_XATTR))
         return -ENOTSUP;
 
-    p = (ONLINE) ? remote_path(path) : cache_path(path);
-    res = llistxattr(p, list, size);
-    free(p);
+    if (REMOTE_SYNC)
+    {
+        p = remote_path(path);
+        res = rcall_llistxattr(p, list, size);
+        free(p);
+    }
+
+    /* also if the remote fs timed out above */
+    if (!REMOTE_SYNC)
+    {
+        p = cache_path(path);
+        res = llistxattr(p, list, size);
+        free(p);
+    }
 
     if (res == -1)
         return -errno;
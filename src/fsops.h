@@ -22,6 +22,8 @@
 #define FI_FLAGS(fi) FH_FLAGS((fi->fh))
 
 #define FH_WRITTEN 1
+#define FH_SPARSE 2
+#define FH_REMOTE 4
 
 void *op_init(struct fuse_conn_info *conn);
 void op_destroy(void *p);
@@ -24,7 +24,6 @@
 #include <ctype.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 
 #if HAVE_SETXATTR
 #include <attr/xattr.h>
@@ -84,36 +83,6 @@ char *join_path2(const char *p1, size_t n1, const char *p2, size_t n2)
 
 /* compare time */
 
-int is_running(const char *pidfile)
-{
-    FILE *f;
-    char line[16];
-    char *endptr;
-    pid_t pid;
-
-    if (!pidfile)
-        return 1;
-
-    f = fopen(pidfile, "r");
-    if (!f)
-    {
-        ERROR("cannot open pid file %s", pidfile);
-        PERROR("");
-        return 0;
-    }
-    fgets(line, sizeof line, f);
-    fclose(f);
-
-    pid = strtol(line, &endptr, 10);
-    if (*line == '\0' || (*endptr != '\0' && *endptr != '\n'))
-    {
-        ERROR("failed getting pid from file %s", pidfile);
-        return 0;
-    }
-
-    return (kill(pid, 0) == 0);
-}
-
 /* check if fs is mounted by comparing st_dev with st_dev of parent dir */
 int is_mounted(const char *mpoint)
 {
@@ -139,34 +108,6 @@ int is_mounted(const char *mpoint)
     return (dev != st.st_dev);
 }
 
-/* check if host is reachable */
-int is_reachable(const char *host)
-{
-    int res=0;
-    int status;
-    pid_t pid;
-
-    if (!host || strcmp(host, "") == 0)
-        return 1;
-
-    pid = fork();
-
-    if (pid == 0)
-    {
-        close(1);
-        close(2);
-        execlp("ping", "ping", "-c", PING_COUNT, "-i", PING_INTERVAL, "-w", PING_DEADLINE, host, NULL);
-    }
-
-    else
-    {
-        waitpid(pid, &status, 0);
-        res = WEXITSTATUS(status);
-    }
-
-    return (res == 0);
-}
-
 int copy_rec(const char *from, const char *to)
 {
     int res = 0;
@@ -25,10 +25,6 @@
 
 #define FATAL(...) { printf("FATAL " __VA_ARGS__); exit(EXIT_FAILURE); }
 
-#define PING_COUNT "5"
-#define PING_INTERVAL "0.2"
-#define PING_DEADLINE "2"
-
 
 unsigned long djb2(const char *str, size_t n);
 
@@ -41,9 +37,7 @@ char *join_path2(const char *p1, size_t n1, const char *p2, size_t n2);
 #define cache_path2(p, n) join_path2(CACHE_ROOT, CACHE_ROOT_LEN, p, n)
 #define cache_path(p) cache_path2(p, 0)
 
-int is_running(const char *pidfile);
 int is_mounted(const char *mpoint);
-int is_reachable(const char *host);
 
 int copy_rec(const char *from, const char *to);
 int copy_symlink(const char *from, const char *to);
@@ -0,0 +1,123 @@
+/*! @file hotset.c
+ * keep the working set in the cache.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "hotset.h"
+
+#include "discofs.h"
+#include "state.h"
+#include "log.h"
+#include "funcs.h"
+#include "job.h"
+#include "sync.h"
+#include "sparse.h"
+#include "policy.h"
+#include "queue.h"
+#include "db.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static void hotset_decay(time_t now);
+static int hotset_stale(const char *path);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* let old accesses count less every HOTSET_DECAY_DAYS */
+static void hotset_decay(time_t now)
+{
+    int day, last;
+
+    day = now / (24 * 60 * 60);
+
+    if (db_cfg_get_int(CFG_HITS_DECAYED, &last) != DB_OK)
+    {
+        db_cfg_set_int(CFG_HITS_DECAYED, day);
+        return;
+    }
+
+    if (day - last >= HOTSET_DECAY_DAYS)
+    {
+        DEBUG("decaying access history");
+        if (db_cache_decay() == DB_OK)
+            db_cfg_set_int(CFG_HITS_DECAYED, day);
+    }
+}
+
+/* return non-zero if the cached copy of _path_ is missing data */
+static int hotset_stale(const char *path)
+{
+    int sync;
+
+    /* local changes first */
+    if (job_exists(path, JOB_PUSH))
+        return 0;
+
+    if (policy_get(path) == POLICY_NEVER)
+        return 0;
+
+    sync = sync_get(path);
+    if (sync == -1 || sync & SYNC_NOT_FOUND)
+        return 0;
+
+    return (sync & (SYNC_MOD|SYNC_NEW)) || sparse_has(path);
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int hotset_run(void)
+{
+    static time_t last = 0;
+    time_t now;
+    char *path;
+    queue *q;
+
+    if (!discofs_options.hotset || !ONLINE)
+        return 0;
+
+    now = time(NULL);
+    if (now - last < HOTSET_INTERVAL)
+        return 0;
+    last = now;
+
+    hotset_decay(now);
+
+    if ((q = q_init()) == NULL)
+        return -1;
+
+    if (db_cache_hot(q, discofs_options.hotset, HOTSET_MIN_HITS) != DB_OK)
+    {
+        q_free(q, free);
+        return -1;
+    }
+
+    while ((path = q_dequeue(q)))
+    {
+        if (hotset_stale(path))
+        {
+            VERBOSE("prefetching %s (working set)", path);
+
+            /* replaces any ordinary PULL */
+            job_delete(path, JOB_PULL);
+            job_schedule(JOB_PULL, path, PULL_HOT, 0, NULL, NULL);
+        }
+        free(path);
+    }
+
+    q_free(q, free);
+    return 0;
+}
@@ -0,0 +1,36 @@
+/*! @file hotset.h
+ * keep the working set in the cache.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_HOTSET_H
+#define DISCOFS_HOTSET_H
+
+#include "config.h"
+#include "discofs.h"
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! seconds between two checks of the working set */
+#define HOTSET_INTERVAL 60
+
+/*! a file must have been opened this often to be in the working set */
+#define HOTSET_MIN_HITS 2
+
+/*! halve all hit counts every this many days */
+#define HOTSET_DECAY_DAYS 7
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! schedule complete PULLs for files in the working set that are
+   incomplete or outdated in the cache */
+int hotset_run(void);
+
+#endif
@@ -12,7 +12,16 @@
 #include "log.h"
 #include "queue.h"
 #include "db.h"
-
+#include "state.h"
+#include "worker.h"
+#include "funcs.h"
+#include "rcall.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <pthread.h>
 
 /*=============*
@@ -22,6 +31,13 @@
 #define JOB_STR_BUF_N   5
 #define JOB_STR_BUF_SZ  1024
 
+/* jobs that are made redundant by a PUSH (it copies the attributes) */
+#define JOB_ATTR (JOB_CHMOD | JOB_CHOWN | JOB_SETXATTR)
+
+/* jobs that create a file or directory that doesn't exist on the remote
+   fs yet */
+#define JOB_CREATES (JOB_CREATE | JOB_SYMLINK | JOB_LINK | JOB_MKDIR)
+
 /*! job queue */
 static queue *job_q = NULL;
 static pthread_mutex_t m_job_q = PTHREAD_MUTEX_INITIALIZER;
@@ -32,6 +48,10 @@ static pthread_mutex_t m_job_q = PTHREAD_MUTEX_INITIALIZER;
  *-------------------*/
 
 static int job_q_enqueue(struct job *j);
+static int job_created_offline(const char *path);
+static int job_coalesce(struct job *j);
+static off_t job_size(job_op op, const char *path);
+static timer_ms job_backoff(unsigned int attempts);
 
 /*==================*
  * STATIC FUNCTIONS *
@@ -50,6 +70,157 @@ static int job_q_enqueue(struct job *j)
     return res;
 }
 
+/* size of the file a PUSH or PULL will copy, 0 if unknown */
+static off_t job_size(job_op op, const char *path)
+{
+    struct stat st;
+    char *p;
+    int res;
+
+    p = (op == JOB_PUSH) ? cache_path(path) : remote_path(path);
+    if (!p)
+        return 0;
+
+    res = (op == JOB_PUSH) ? lstat(p, &st) : rcall_lstat(p, &st);
+    free(p);
+
+    return (res || !S_ISREG(st.st_mode)) ? 0 : st.st_size;
+}
+
+/* delay (milliseconds) before the next attempt: exponential, with jitter
+   so jobs that failed together don't retry together */
+static timer_ms job_backoff(unsigned int attempts)
+{
+    timer_ms delay = JOB_DEFER_TIME * 1000;
+
+    while (--attempts && delay < JOB_BACKOFF_MAX * 1000)
+        delay *= 2;
+
+    if (delay > JOB_BACKOFF_MAX * 1000)
+        delay = JOB_BACKOFF_MAX * 1000;
+
+    return delay / 2 + random() % (delay / 2 + 1);
+}
+
+/* return non-zero if _path_ doesn't exist on the remote fs because it was
+   created while OFFLINE */
+static int job_created_offline(const char *path)
+{
+    return db_job_exists(path, JOB_CREATES)
+        || db_job_exists_n1(path, JOB_PUSH, PUSH_CREATED);
+}
+
+/* merge a new job with the jobs already in the db.
+   returns 0 if _j_ became redundant and must not be stored */
+static int job_coalesce(struct job *j)
+{
+    job_id id;
+    job_param flags;
+    char *from;
+
+    switch (j->op)
+    {
+        /*------------------------------------------*
+         * attributes: last one wins, PUSH does all *
+         *------------------------------------------*/
+        case JOB_CHMOD:
+        case JOB_CHOWN:
+            if (db_job_exists(j->path, JOB_PUSH))
+                return 0;
+
+            db_job_delete(j->path, j->op);
+            return 1;
+
+        case JOB_SETXATTR:
+            return !db_job_exists(j->path, JOB_PUSH);
+
+        /*---------------------------------*
+         * PUSH creates the file, too      *
+         *---------------------------------*/
+        case JOB_PUSH:
+            if (db_job_exists(j->path, JOB_CREATE)
+                    || db_job_exists_n1(j->path, JOB_PUSH, PUSH_CREATED))
+                j->n1 |= PUSH_CREATED;
+
+            db_job_delete(j->path, JOB_CREATE | JOB_ATTR);
+            return 1;
+
+        /*--------------------------------------*
+         * a->b, b->c  =>  a->c  (a->a: none)   *
+         *--------------------------------------*/
+        case JOB_RENAME:
+            /* jobs have already been renamed: the file was created offline
+               and will be created with its new name */
+            if (job_created_offline(j->s1))
+                return 0;
+
+            if (db_job_get_rename_to(j->path, &id, &from, &flags) == DB_OK)
+            {
+                /* a->b replaced b on the remote fs, which only goes away
+                   if a->b is performed. same for b->a replacing a */
+                if ((flags & RENAME_REPLACED)
+                        || (!strcmp(from, j->s1) && (j->n1 & RENAME_REPLACED)))
+                {
+                    free(from);
+                    return 1;
+                }
+
+                if (!strcmp(from, j->s1))
+                    db_job_delete_id(id);
+                else
+                {
+                    db_job_set_s1(id, j->s1);
+
+                    /* b->c replaced c on the remote fs, a->c has to */
+                    if (j->n1 & RENAME_REPLACED)
+                        db_job_set_n1(id, flags | RENAME_REPLACED);
+                }
+
+                free(from);
+                return 0;
+            }
+            return 1;
+
+        /*---------------------------------------*
+         * create/mkdir and unlink/rmdir cancel  *
+         *---------------------------------------*/
+        case JOB_UNLINK:
+        case JOB_RMDIR:
+            /* renamed while OFFLINE: remove the original. if the rename
+               replaced a file on the remote fs, that one has to go, too:
+               keep the RENAME and remove its new name after it */
+            if (db_job_get_rename_to(j->path, &id, &from, &flags) == DB_OK)
+            {
+                if (flags & RENAME_REPLACED)
+                {
+                    free(from);
+                    j->prio = OP_PRIO(JOB_RENAME);
+                }
+                else
+                {
+                    db_job_delete(j->path, JOB_ANY & ~(JOB_UNLINK | JOB_RMDIR | JOB_RENAME));
+                    db_job_delete_id(id);
+                    free(j->path);
+                    j->path = from;
+                }
+            }
+
+            /* never existed on the remote fs */
+            if (j->op == JOB_RMDIR ? db_job_exists(j->path, JOB_MKDIR) : job_created_offline(j->path))
+            {
+                db_job_delete(j->path, JOB_ANY & ~(JOB_UNLINK | JOB_RMDIR | JOB_RENAME));
+                return 0;
+            }
+
+            db_job_delete(j->path, JOB_ANY & ~(JOB_UNLINK | JOB_RMDIR | JOB_RENAME));
+
+            /* already removed once */
+            return !db_job_exists(j->path, j->op);
+    }
+
+    return 1;
+}
+
 
 /*====================*
  * EXPORTED FUNCTIONS *
@@ -61,6 +232,16 @@ int job_init(void)
     if (!job_q)
         return -1;
 
+    srandom(time(NULL) ^ getpid());
+
+    /* deadlines of jobs deferred before the last unmount */
+    if (db_job_deadlines(timer_now(), timer_add) != DB_OK)
+        return -1;
+
+    /* give jobs that failed permanently another chance */
+    if (discofs_options.retry && job_retry_dead(NULL))
+        return -1;
+
     return 0;
 }
 
@@ -86,6 +267,16 @@ int job_store(void)
     /* store all jobs from job queue */
     while (res == DB_OK && (j = q_dequeue(job_q)))
     {
+        timer_ms due = j->due;
+
+        /* merge new jobs with existing ones */
+        if (j->id == -1 && !job_coalesce(j))
+        {
+            DEBUG("%s on %s is redundant", job_opstr(j->op), j->path);
+            job_free(j);
+            continue;
+        }
+
         /* only one PUSH or PULL job should exist */
         if (j->op == JOB_PUSH || j->op == JOB_PULL)
             db_job_delete(j->path, JOB_PUSH|JOB_PULL);
@@ -94,7 +285,13 @@ int job_store(void)
 
         /* free the job object if storing in db was OK */
         if (res == DB_OK)
+        {
             job_free(j);
+
+            /* wake up the worker when it is due */
+            if (due > timer_now())
+                timer_add(due);
+        }
     }
 
     pthread_mutex_unlock(&m_job_q);
@@ -114,6 +311,10 @@ struct job *job_alloc(void)
         j->path = NULL;
         j->s1 = NULL;
         j->s2 = NULL;
+        j->size = 0;
+        j->error = 0;
+        j->due = 0;
+        j->prio = -1;
     }
 
     return j;
@@ -167,6 +368,11 @@ char *job_opstr(job_op mask)
 
 
 int job_schedule(job_op op, const char *path, job_param n1, job_param n2, const char *s1, const char *s2)
+{
+    return job_schedule_sized(op, path, n1, n2, s1, s2, -1);
+}
+
+int job_schedule_sized(job_op op, const char *path, job_param n1, job_param n2, const char *s1, const char *s2, off_t size)
 {
     struct job *j;
 
@@ -194,27 +400,41 @@ int job_schedule(job_op op, const char *path, job_param n1, job_param n2, const
 
     j->id = -1;
     j->op = op;
-    j->time = time(NULL);
+    j->due = timer_now();
     j->attempts = 0;
     j->n1 = n1;
     j->n2 = n2;
 
     if (op == JOB_PUSH || op == JOB_PULL)
-        j->time += JOB_DEFER_TIME;
+    {
+        j->due += JOB_DEFER_TIME * 1000;
+        j->size = (size < 0) ? job_size(op, path) : size;
+    }
+
+    j->time = j->due / 1000;
 
     job_q_enqueue(j);
 
+    /* metadata changes are replayed right away, for transfers the worker
+       has to know when they are due */
+    worker_wakeup();
+
     return 0;
 }
 
-void job_return(struct job *j, int reason)
+/* returns when the job is due again, 0 if it is done or was given up.
+   a job is never due earlier than j->due */
+timer_ms job_return(struct job *j, int reason)
 {
+    timer_ms due;
+
     if (!j)
-        return;
+        return 0;
 
     VERBOSE("job %s on %s returned: %s", job_opstr(j->op), j->path,
             (reason == JOB_DONE) ? "done" :
-            ((reason == JOB_FAILED) ? "failed" : "file is locked")
+            ((reason == JOB_FAILED) ? "failed" :
+            ((reason == JOB_BLOCKED) ? "waiting for another job" : "file is locked"))
          );
 
     if (reason == JOB_DONE)
@@ -228,26 +448,46 @@ void job_return(struct job *j, int reason)
 
         db_job_delete_id(j->id);
         job_free(j);
-        return;
+        return 0;
     }
 
-    if (reason == JOB_FAILED)
+    /* failed because the remote fs went away: not the job's fault */
+    if (reason == JOB_FAILED && ONLINE)
     {
+        int class = job_error_class(j->error);
+
         j->attempts++;
-        if (j->attempts > JOB_MAX_ATTEMPTS)
+        if (class == JOB_ERR_PERMANENT
+                || (class == JOB_ERR_CONFLICT && j->attempts >= JOB_MAX_CONFLICTS)
+                || j->attempts >= JOB_MAX_ATTEMPTS)
         {
-            ERROR("number of retries exhausted, giving up");
-            db_job_delete_id(j->id);
+            ERROR("%s on %s failed (%s), giving up", job_opstr(j->op), j->path,
+                    (j->error) ? strerror(j->error) : "unknown error");
+
+            /* keep it for inspection and job_retry_dead() */
+            if (db_job_bury(j) != DB_OK)
+                db_job_delete_id(j->id);
+
             job_free(j);
-            return;
+            return 0;
         }
-    }
 
-    /* JOB_LOCKED or JOB_FAILED and attempt limit not reached */
+        due = timer_now() + job_backoff(j->attempts);
+    }
+    /* JOB_LOCKED, JOB_BLOCKED or OFFLINE: not an attempt */
+    else
+        due = timer_now() + JOB_DEFER_TIME * 1000;
 
-    j->time = time(NULL) + JOB_DEFER_TIME;
+    if (due > j->due)
+        j->due = due;
+    j->time = j->due / 1000;
+    j->error = 0;
 
+    /* j belongs to the queue now */
+    due = j->due;
     job_q_enqueue(j);
+
+    return due;
 }
 
 struct job *job_get(void)
@@ -270,6 +510,57 @@ int job_exists(const char *path, job_op mask)
     return 0;
 }
 
+/* put the paths of the entries of _dir_ with jobs matching _mask_ into _q_ */
+int job_dir(const char *dir, job_op mask, queue *q)
+{
+    job_store();
+
+    if (db_job_dir(q, dir, mask) != DB_OK)
+        return -1;
+    return 0;
+}
+
+/* return non-zero if _path_ was created while OFFLINE and doesn't exist on
+   the remote fs yet */
+int job_not_remote(const char *path)
+{
+    job_store();
+
+    return job_created_offline(path);
+}
+
+/* return non-zero if a RENAME job with new name _path_ exists */
+int job_renamed_to(const char *path)
+{
+    job_id id;
+    char *from;
+
+    job_store();
+
+    if (db_job_get_rename_to(path, &id, &from, NULL) != DB_OK)
+        return 0;
+
+    free(from);
+    return 1;
+}
+
+/* wait at most _timeout_ seconds until all jobs matching _path_ and _mask_
+   are done. returns 0 if no such job is left */
+int job_wait(const char *path, job_op mask, unsigned int timeout)
+{
+    time_t end = time(NULL) + timeout;
+
+    while (job_exists(path, mask))
+    {
+        if (!ONLINE || EXITING || time(NULL) >= end)
+            return -1;
+
+        usleep(JOB_WAIT_INTERVAL);
+    }
+
+    return 0;
+}
+
 int job_rename_dir(const char *from, const char *to)
 {
     job_store();
@@ -297,6 +588,90 @@ int job_delete(const char *path, job_op mask)
     return 0;
 }
 
+/* call _f_ with the jobs of _path_ and below */
+int job_list(const char *path, int limit, void (*f)(const struct job *, void *), void *arg)
+{
+    job_store();
+
+    if (db_job_list(path, limit, f, arg) != DB_OK)
+        return -1;
+    return 0;
+}
+
+/* change the priority of the jobs of _path_ and below. returns the number
+   of jobs changed or -1 */
+long job_set_prio(const char *path, int prio)
+{
+    unsigned long n;
+
+    job_store();
+
+    if (db_job_update(path, prio, 0, &n) != DB_OK)
+        return -1;
+    return n;
+}
+
+/* make the jobs of _path_ and below due now, and perform them before all
+   others. returns the number of jobs changed or -1 */
+long job_flush(const char *path)
+{
+    unsigned long n;
+
+    job_store();
+
+    if (db_job_update(path, PRIO_URGENT, timer_now(), &n) != DB_OK)
+        return -1;
+
+    if (n)
+        worker_wakeup();
+    return n;
+}
+
+/* classify errno values of failed jobs */
+int job_error_class(int err)
+{
+    switch (err)
+    {
+        /* retrying won't help */
+        case EACCES:
+        case EPERM:
+        case EROFS:
+        case ENOSPC:
+#ifdef EDQUOT
+        case EDQUOT:
+#endif
+        case EFBIG:
+        case ENAMETOOLONG:
+        case EINVAL:
+        case ENOTSUP:
+#if defined(EOPNOTSUPP) && EOPNOTSUPP != ENOTSUP
+        case EOPNOTSUPP:
+#endif
+            return JOB_ERR_PERMANENT;
+
+        /* the remote fs is in an unexpected state */
+        case EEXIST:
+        case ENOENT:
+        case ENOTDIR:
+        case EISDIR:
+        case ENOTEMPTY:
+            return JOB_ERR_CONFLICT;
+    }
+
+    /* EIO, ETIMEDOUT, ESTALE, ... or unknown */
+    return JOB_ERR_TRANSIENT;
+}
+
+/* move dead jobs of _path_ (all if NULL) back to the job table */
+int job_retry_dead(const char *path)
+{
+    job_store();
+
+    if (db_job_resurrect(path) != DB_OK)
+        return -1;
+    return 0;
+}
+
 int job_delete_rename_to(const char *path)
 {
     job_store();
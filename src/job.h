@@ -10,10 +10,13 @@
 
 #include "config.h"
 #include "discofs.h"
+#include "timer.h"
+#include "queue.h"
 
 #define PRIO_LOW    0
 #define PRIO_MID    1
 #define PRIO_HIGH   2
+#define PRIO_URGENT 3   /* only set with discofsctl */
 
 #define PRIO_LOW_JOBS   (JOB_PUSH | JOB_PULL)
 #define PRIO_HIGH_JOBS  (JOB_UNLINK | JOB_CREATE | JOB_MKDIR)
@@ -38,13 +41,40 @@
 #define JOB_SETXATTR    (1U << 10)
 #define JOB_CREATE      (1U << 11)
 
+/* flags for PULL jobs (n1) */
+#define PULL_HOT    (1 << 0)    /* file is in the working set: copy completely
+                                   and before other PULLs */
+
+/* flags for PUSH jobs (n1) */
+#define PUSH_CREATED (1 << 0)   /* replaces a CREATE, the file doesn't exist
+                                   on the remote fs yet */
+
+/* flags for RENAME jobs (n1) */
+#define RENAME_REPLACED (1 << 0)    /* the new name existed on the remote fs
+                                       and was replaced */
+
 /* "reason" values for job_return() */
 #define JOB_DONE    0
 #define JOB_FAILED  1
 #define JOB_LOCKED  2
+#define JOB_BLOCKED 3   /* a job this one depends on failed */
 
-#define JOB_MAX_ATTEMPTS    5
+/* retries of failed jobs, see job_error_class() */
+#define JOB_MAX_ATTEMPTS    10      /* transient errors */
+#define JOB_MAX_CONFLICTS   3       /* remote fs doesn't look as expected */
 #define JOB_DEFER_TIME      10
+#define JOB_BACKOFF_MAX     3600    /* longest delay between two retries */
+
+/* error classes for failed jobs */
+#define JOB_ERR_TRANSIENT   0       /* retry with backoff */
+#define JOB_ERR_CONFLICT    1       /* may resolve when other jobs are done */
+#define JOB_ERR_PERMANENT   2       /* give up immediately */
+
+/* bytes a PUSH/PULL counts as smaller per second it waits (sched=sjf/fair) */
+#define SCHED_AGING         (8 << 20)
+
+/* microseconds between two checks in job_wait() */
+#define JOB_WAIT_INTERVAL   100000
 
 typedef long job_id;
 typedef unsigned int job_op;
@@ -56,11 +86,15 @@ struct job
     job_op op;
     char *path;
     time_t time;
+    timer_ms due;   /* when the job may be performed */
     unsigned int attempts;
     job_param n1;
     job_param n2;
     char *s1;
     char *s2;
+    off_t size;     /* file size for PUSH/PULL, used for scheduling */
+    int error;      /* errno of the last failure, not stored in the db */
+    int prio;       /* -1: derived from the op with OP_PRIO */
 };
 
 int job_init(void);
@@ -75,11 +109,21 @@ int job_schedule(job_op op, const char *path, job_param n1, job_param n2, const
 #define job_schedule_push(path) job_schedule(JOB_PUSH, path, 0, 0, NULL, NULL)
 #define job_schedule_pull(path) job_schedule(JOB_PULL, path, 0, 0, NULL, NULL)
 
+/* for callers that already know the size of the file to PUSH or PULL,
+   -1 if unknown */
+int job_schedule_sized(job_op op, const char *path, job_param n1, job_param n2, const char *s1, const char *s2, off_t size);
+#define job_schedule_push_sized(path, size) job_schedule_sized(JOB_PUSH, path, 0, 0, NULL, NULL, size)
+#define job_schedule_pull_sized(path, size) job_schedule_sized(JOB_PULL, path, 0, 0, NULL, NULL, size)
+
 
 struct job *job_get(void);
-void job_return(struct job *j, int reason);
+timer_ms job_return(struct job *j, int reason);
 
 int job_exists(const char *path, job_op mask);
+int job_not_remote(const char *path);
+int job_dir(const char *dir, job_op mask, queue *q);
+int job_renamed_to(const char *path);
+int job_wait(const char *path, job_op mask, unsigned int timeout);
 
 int job_rename_dir(const char *from, const char *to);
 int job_rename_file(const char *from, const char *to);
@@ -87,4 +131,11 @@ int job_rename_file(const char *from, const char *to);
 int job_delete(const char *path, job_op mask);
 int job_delete_rename_to(const char *path);
 
+int job_list(const char *path, int limit, void (*f)(const struct job *, void *), void *arg);
+long job_set_prio(const char *path, int prio);
+long job_flush(const char *path);
+
+int job_error_class(int err);
+int job_retry_dead(const char *path);
+
 #endif
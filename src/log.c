@@ -13,19 +13,293 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <sys/time.h>
 
+/* longer lines are cut */
+#define LOG_LINE_MAX 1024
+
+/* lines buffered for the writer thread, a power of 2 */
+#define LOG_RING_SIZE 1024
+
+/* ms the writer sleeps if it wasn't woken up */
+#define LOG_WRITER_INTERVAL 100
+
+/*! a formatted line. slots are reserved and published with _seq_
+   (a bounded MPSC queue): a slot at position pos is free if seq == pos and
+   holds a line if seq == pos + 1 */
+struct log_slot
+{
+    volatile unsigned long seq;
+    size_t len;
+    char line[LOG_LINE_MAX];
+};
+
+static struct log_slot log_ring[LOG_RING_SIZE];
+static volatile unsigned long log_head = 0;    /* next slot to reserve */
+static unsigned long log_tail = 0;              /* next slot to write, writer only */
+static volatile unsigned long log_dropped = 0;
+
+/* writes go through the writer thread while it is running */
+static volatile int log_running = 0;
+static volatile int log_sleeping = 0;
+static int log_exit = 0;
+static pthread_t t_log;
+static pthread_mutex_t m_log_writer = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_log_writer = PTHREAD_COND_INITIALIZER;
+
+/* direct writes before the writer thread is started */
 static pthread_mutex_t m_log_print = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t m_log_error = PTHREAD_MUTEX_INITIALIZER;
 
 static char *log_lvlstr[] = { "", "ERROR", "INFO", "VERBOSE", "DEBUG", "FSOP" };
 
 static int loglvl = LOG_NONE;
+static int logfmt = LOG_TEXT;
 static FILE *logf = NULL;
 
 
-void log_init(int level, const char *file)
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static size_t log_format(char *line, int level, const char *where, const char *func,
+        const char *fmt, va_list ap);
+static size_t log_json_str(char *buf, size_t size, const char *s);
+static void log_enqueue(const char *line, size_t len);
+static unsigned long log_drain(void);
+static void log_dropped_line(const char *fmt, ...);
+static void *log_main(void *arg);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* format one line into _line_ (LOG_LINE_MAX bytes), including the '\n' */
+static size_t log_format(char *line, int level, const char *where, const char *func,
+        const char *fmt, va_list ap)
+{
+    struct timeval tv;
+    struct tm tm;
+    char msg[LOG_LINE_MAX];
+    char tim[32];
+    size_t n;
+    int res;
+
+    gettimeofday(&tv, NULL);
+
+    if (vsnprintf(msg, sizeof msg, fmt, ap) < 0)
+        *msg = '\0';
+
+    if (logfmt == LOG_JSON)
+    {
+        gmtime_r(&tv.tv_sec, &tm);
+        n = strftime(tim, sizeof tim, "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(tim + n, sizeof tim - n, ".%03dZ", (int)(tv.tv_usec / 1000));
+
+        /* keep room for the end of the object */
+        res = snprintf(line, LOG_LINE_MAX - 4, "{\"time\":\"%s\",\"level\":\"%s\",\"where\":\"%s\",\"func\":\"%s\",\"msg\":\"",
+                tim, log_lvlstr[level], where, func);
+        n = (res < 0) ? 0 : (size_t)res;
+        if (n > LOG_LINE_MAX - 5)
+            n = LOG_LINE_MAX - 5;
+        n += log_json_str(line + n, LOG_LINE_MAX - 4 - n, msg);
+        memcpy(line + n, "\"}\n", 4);
+        return n + 3;
+    }
+
+    /* same as ctime(), without the '\n' */
+    localtime_r(&tv.tv_sec, &tm);
+    strftime(tim, sizeof tim, "%a %b %e %H:%M:%S %Y", &tm);
+
+    res = snprintf(line, LOG_LINE_MAX - 1, "%s %s: %s %s\t%s", tim, log_lvlstr[level], where, func, msg);
+    n = (res < 0) ? 0 : (size_t)res;
+    if (n > LOG_LINE_MAX - 2)
+        n = LOG_LINE_MAX - 2;
+    line[n++] = '\n';
+    line[n] = '\0';
+    return n;
+}
+
+/* copy _s_ to _buf_ as the contents of a JSON string. returns the length
+   written, escapes are never cut */
+static size_t log_json_str(char *buf, size_t size, const char *s)
+{
+    size_t n = 0;
+    unsigned char c;
+    char esc[8];
+    size_t len;
+
+    for (; (c = *s); s++)
+    {
+        if (c == '"' || c == '\\')
+            len = snprintf(esc, sizeof esc, "\\%c", c);
+        else if (c == '\n')
+            len = snprintf(esc, sizeof esc, "\\n");
+        else if (c == '\t')
+            len = snprintf(esc, sizeof esc, "\\t");
+        else if (c < 0x20)
+            len = snprintf(esc, sizeof esc, "\\u%04x", c);
+        else
+        {
+            esc[0] = c;
+            len = 1;
+        }
+
+        if (n + len >= size)
+            break;
+        memcpy(buf + n, esc, len);
+        n += len;
+    }
+
+    buf[n] = '\0';
+    return n;
+}
+
+/* never blocks: if the ring is full, the line is dropped and counted */
+static void log_enqueue(const char *line, size_t len)
 {
+    unsigned long pos = log_head;
+    struct log_slot *s;
+    long dif;
+
+    for (;;)
+    {
+        s = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        dif = (long)(s->seq - pos);
+
+        if (dif == 0)
+        {
+            if (__sync_bool_compare_and_swap(&log_head, pos, pos + 1))
+                break;
+            pos = log_head;
+        }
+        /* the writer is behind by a whole ring */
+        else if (dif < 0)
+        {
+            __sync_fetch_and_add(&log_dropped, 1);
+            return;
+        }
+        else
+            pos = log_head;
+    }
+
+    memcpy(s->line, line, len);
+    s->len = len;
+
+    /* the line must be complete before it is published */
+    __sync_synchronize();
+    s->seq = pos + 1;
+
+    if (log_sleeping)
+        pthread_cond_signal(&c_log_writer);
+}
+
+/* write all published lines, returns their number */
+static unsigned long log_drain(void)
+{
+    unsigned long n = 0;
+    struct log_slot *s;
+
+    for (;;)
+    {
+        s = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+
+        if (s->seq != log_tail + 1)
+            break;
+        __sync_synchronize();
+
+        fwrite(s->line, 1, s->len, logf);
+
+        /* free for the next round */
+        __sync_synchronize();
+        s->seq = log_tail + LOG_RING_SIZE;
+        log_tail++;
+        n++;
+    }
+
+    return n;
+}
+
+static void log_dropped_line(const char *fmt, ...)
+{
+    va_list ap;
+    char line[LOG_LINE_MAX];
+    size_t len;
+
+    va_start(ap, fmt);
+    len = log_format(line, LOG_ERROR, "", "log_main", fmt, ap);
+    va_end(ap);
+
+    fwrite(line, 1, len, logf);
+}
+
+static void *log_main(void *arg)
+{
+    unsigned long n, dropped = 0, d;
+    struct timespec ts;
+
+    for (;;)
+    {
+        n = log_drain();
+
+        if ((d = log_dropped) != dropped)
+        {
+            log_dropped_line("%lu log messages dropped", d - dropped);
+            dropped = d;
+            n++;
+        }
+
+        if (n)
+        {
+            fflush(logf);
+            continue;
+        }
+
+        pthread_mutex_lock(&m_log_writer);
+
+        if (log_exit)
+        {
+            pthread_mutex_unlock(&m_log_writer);
+            break;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_WRITER_INTERVAL * 1000000L;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        /* a wakeup lost between draining and this is made up for by the
+           timeout */
+        log_sleeping = 1;
+        pthread_cond_timedwait(&c_log_writer, &m_log_writer, &ts);
+        log_sleeping = 0;
+
+        pthread_mutex_unlock(&m_log_writer);
+    }
+
+    /* lines published after the last check */
+    log_drain();
+    fflush(logf);
+    return NULL;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+void log_init(int level, const char *file, int format)
+{
+    unsigned long i;
+
     loglvl = level;
+    logfmt = format;
+
+    for (i = 0; i < LOG_RING_SIZE; i++)
+        log_ring[i].seq = i;
 
     if (!file)
         logf = stderr;
@@ -41,8 +315,31 @@ void log_init(int level, const char *file)
     log_print(LOG_VERBOSE, "", "", "Logging initialized with level %s", log_lvlstr[level]);
 }
 
+int log_start(void)
+{
+    if (loglvl == LOG_NONE)
+        return 0;
+
+    if (pthread_create(&t_log, NULL, log_main, NULL))
+        return -1;
+
+    log_running = 1;
+    return 0;
+}
+
 void log_destroy(void)
 {
+    if (log_running)
+    {
+        pthread_mutex_lock(&m_log_writer);
+        log_exit = 1;
+        pthread_cond_signal(&c_log_writer);
+        pthread_mutex_unlock(&m_log_writer);
+
+        pthread_join(t_log, NULL);
+        log_running = 0;
+    }
+
     loglvl = LOG_NONE;
 
     if (logf != stderr)
@@ -51,47 +348,38 @@ void log_destroy(void)
 
 void log_error(const char *where, const char *func, const char *s)
 {
-    pthread_mutex_lock(&m_log_error);
-    log_print(LOG_ERROR, where, func, "%s: %s", s, strerror(errno));
-    pthread_mutex_unlock(&m_log_error);
+    char buf[256];
+    int err = errno;
+
+    if (strerror_r(err, buf, sizeof buf))
+        snprintf(buf, sizeof buf, "error %d", err);
+
+    log_print(LOG_ERROR, where, func, "%s: %s", s, buf);
 }
 
 #if HAVE_VFPRINTF
 void log_print(int level, const char *where, const char *func, const char *fmt, ...)
 {
-    time_t now;
-    char *ctim;
     va_list ap;
+    char line[LOG_LINE_MAX];
+    size_t len;
+
+    if (level > loglvl)
+        return;
 
     va_start(ap, fmt);
+    len = log_format(line, level, where, func, fmt, ap);
+    va_end(ap);
 
-    if (level <= loglvl)
+    if (log_running)
+        log_enqueue(line, len);
+    else
     {
         pthread_mutex_lock(&m_log_print);
-
-        now = time(NULL);
-        if (!(ctim = strdup(ctime(&now))))
-        {
-            pthread_mutex_lock(&m_log_print);
-            va_end(ap);
-            return;
-        }
-
-        /* remove \n */
-        ctim[strlen(ctim)-1] = '\0';
-
-        fprintf(logf, "%s %s: %s %s\t", ctim, log_lvlstr[level], where, func);
-
-        vfprintf(logf, fmt, ap);
-        fprintf(logf, "\n");
-
+        fwrite(line, 1, len, logf);
         fflush(logf);
-
-        free(ctim);
         pthread_mutex_unlock(&m_log_print);
     }
-
-    va_end(ap);
 }
 #else
 void log_print(int level, const char *where, const char *func, const char *fmt, ...)
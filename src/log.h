@@ -20,6 +20,12 @@ enum log_levels
     LOG_FSOP
 };
 
+enum log_formats
+{
+    LOG_TEXT,
+    LOG_JSON
+};
+
 
 
 #if defined(LOG_ENABLE_WHERE) || defined(LOG_ENABLE_DEBUG) || defined(DEBUG_FSOPS)
@@ -85,7 +91,8 @@ enum log_levels
 #define ERROR(...)
 #endif
 
-void log_init(int level, const char *path);
+void log_init(int level, const char *path, int format);
+int log_start(void);
 void log_destroy(void);
 void log_error(const char *where, const char *func, const char *s);
 void log_print(int level, const char *where, const char *func, const char *fmt, ...);
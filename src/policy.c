@@ -0,0 +1,276 @@
+/*! @file policy.c
+ * per-path caching policies.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "policy.h"
+
+#include "discofs.h"
+#include "log.h"
+#include "funcs.h"
+
+#include <errno.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fnmatch.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+#define POLICY_LINE_MAX (PATH_MAX + 32)
+
+/*! a pattern and the policy for matching paths */
+struct rule
+{
+    char *pattern;
+    int policy;
+    size_t prefix_len;  /* length of the part before the first wildcard */
+    bool literal;       /* no wildcards at all */
+    bool subtree;       /* pattern ended with '/', also match everything below */
+    bool basename;      /* pattern contains no '/', match the file name only */
+};
+
+static struct rule *rules = NULL;
+static size_t rules_n = 0;
+static int policy_default = POLICY_DEFAULT;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static int policy_parse(const char *s);
+static int rule_add(const char *pattern, int policy);
+static int rule_fnmatch(const struct rule *r, char *path, size_t len);
+static int rule_match(const struct rule *r, const char *path);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static int policy_parse(const char *s)
+{
+    if (!strcmp(s, "offline"))
+        return POLICY_OFFLINE;
+    if (!strcmp(s, "ondemand"))
+        return POLICY_ONDEMAND;
+    if (!strcmp(s, "never"))
+        return POLICY_NEVER;
+    return -1;
+}
+
+/* "compile" a pattern: find out which (cheap) comparisons can be done
+   before calling fnmatch() */
+static int rule_add(const char *pattern, int policy)
+{
+    struct rule *tmp, *r;
+    size_t len;
+
+    if ((tmp = realloc(rules, (rules_n + 1) * sizeof *rules)) == NULL)
+        return -1;
+    rules = tmp;
+    r = &rules[rules_n];
+
+    if ((r->pattern = strdup(pattern)) == NULL)
+        return -1;
+
+    len = strlen(r->pattern);
+
+    r->subtree = (len > 1 && r->pattern[len-1] == '/');
+    if (r->subtree)
+        r->pattern[--len] = '\0';
+
+    r->basename = (strchr(r->pattern, '/') == NULL);
+    r->prefix_len = strcspn(r->pattern, "*?[\\");
+    r->literal = (r->prefix_len == len);
+    r->policy = policy;
+
+    rules_n++;
+    return 0;
+}
+
+/* match the first _len_ characters of _path_ */
+static int rule_fnmatch(const struct rule *r, char *path, size_t len)
+{
+    int res;
+    char c = path[len];
+
+    path[len] = '\0';
+
+    if (r->literal)
+        res = !strcmp(r->pattern, path);
+    else
+        res = !fnmatch(r->pattern, path, FNM_PATHNAME | FNM_PERIOD);
+
+    path[len] = c;
+    return res;
+}
+
+static int rule_match(const struct rule *r, const char *path)
+{
+    int res = 0;
+    char *p;
+    size_t i, len;
+
+    /* "*.iso": only look at the file name */
+    if (r->basename)
+    {
+        if ((p = strrchr(path, '/')))
+            path = p + 1;
+
+        if (strncmp(path, r->pattern, r->prefix_len))
+            return 0;
+
+        return (r->literal) ? !strcmp(path, r->pattern) : !fnmatch(r->pattern, path, FNM_PERIOD);
+    }
+
+    /* everything not starting with the literal part can't match */
+    if (strncmp(path, r->pattern, r->prefix_len))
+        return 0;
+
+    if (!r->subtree)
+        return (r->literal) ? !strcmp(path, r->pattern) : !fnmatch(r->pattern, path, FNM_PATHNAME | FNM_PERIOD);
+
+    /* "/dir/": "/dir" and everything below */
+    if (r->literal)
+        return (path[r->prefix_len] == '\0' || path[r->prefix_len] == '/');
+
+    if ((p = strdup(path)) == NULL)
+        return 0;
+
+    len = strlen(p);
+
+    for (i = (r->prefix_len) ? r->prefix_len : 1; !res && i <= len; i++)
+    {
+        if (p[i] == '/' || p[i] == '\0')
+            res = rule_fnmatch(r, p, i);
+    }
+
+    free(p);
+    return res;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int policy_init(void)
+{
+    FILE *f;
+    char line[POLICY_LINE_MAX];
+    char *p, *name, *pattern;
+    int policy;
+    unsigned int n = 0;
+
+    if (!discofs_options.policy)
+        return 0;
+
+    if ((f = fopen(discofs_options.policy, "r")) == NULL)
+    {
+        ERROR("opening policy file %s: %s", discofs_options.policy, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof line, f))
+    {
+        n++;
+
+        /* strip newline and trailing whitespace */
+        p = line + strlen(line);
+        while (p > line && isspace((unsigned char)p[-1]))
+            *--p = '\0';
+
+        /* skip leading whitespace, comments and empty lines */
+        for (p = line; isspace((unsigned char)*p); p++);
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        /* "<policy> <pattern>" or "default <policy>" */
+        name = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        if (*p)
+            *p++ = '\0';
+        while (isspace((unsigned char)*p))
+            p++;
+        pattern = p;
+
+        if (!strcmp(name, "default"))
+        {
+            if ((policy = policy_parse(pattern)) == -1)
+                goto invalid;
+            policy_default = policy;
+            continue;
+        }
+
+        if ((policy = policy_parse(name)) == -1 || *pattern == '\0')
+            goto invalid;
+
+        if (rule_add(pattern, policy))
+        {
+            fclose(f);
+            return -1;
+        }
+
+        DEBUG("policy %s for %s", policy_str(policy), pattern);
+        continue;
+
+invalid:
+        ERROR("%s:%u: invalid policy rule", discofs_options.policy, n);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+void policy_destroy(void)
+{
+    size_t i;
+
+    for (i = 0; i < rules_n; i++)
+        free(rules[i].pattern);
+
+    free(rules);
+    rules = NULL;
+    rules_n = 0;
+}
+
+int policy_get(const char *path)
+{
+    size_t i;
+
+    /* first match wins */
+    for (i = 0; i < rules_n; i++)
+    {
+        if (rule_match(&rules[i], path))
+            return rules[i].policy;
+    }
+
+    return policy_default;
+}
+
+const char *policy_str(int policy)
+{
+    switch (policy)
+    {
+        case POLICY_OFFLINE:
+            return "offline";
+        case POLICY_ONDEMAND:
+            return "ondemand";
+        case POLICY_NEVER:
+            return "never";
+    }
+    return "default";
+}
@@ -0,0 +1,42 @@
+/*! @file policy.h
+ * per-path caching policies.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_POLICY_H
+#define DISCOFS_POLICY_H
+
+#include "config.h"
+#include "discofs.h"
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! no rule matched and no default set. behave as without policies */
+#define POLICY_DEFAULT  0
+/*! always keep a complete copy in the cache, never evict */
+#define POLICY_OFFLINE  1
+/*! only create placeholders, fetch data when it is read */
+#define POLICY_ONDEMAND 2
+/*! never cache, access the remote file directly */
+#define POLICY_NEVER    3
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! load rules from the file given with the "policy" option */
+int policy_init(void);
+void policy_destroy(void);
+
+/*! get the policy for _path_ */
+int policy_get(const char *path);
+
+/*! get the name of _policy_ */
+const char *policy_str(int policy);
+
+#endif
@@ -0,0 +1,403 @@
+/*! @file probe.c
+ * checks of the remote fs availability.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "probe.h"
+
+#include "funcs.h"
+#include "log.h"
+#include "rcall.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! address of the host given with the "host" option. resolved when
+   needed and forgotten when a probe fails, so address changes are
+   picked up */
+static struct sockaddr_storage host_addr;
+static socklen_t host_addrlen = 0;
+
+/*! unprivileged ICMP ("ping") socket */
+static int icmp_fd = -1;
+static unsigned short echo_seq = 0;
+
+/*! process from the pid file, read again when the file changes */
+static pid_t pid = 0;
+static time_t pid_mtime = 0;
+
+/*! statvfs() of the remote root runs in its own thread, a hanging remote
+   fs can't be interrupted */
+static int statfs_busy = 0;
+static int statfs_res = 0;
+static pthread_mutex_t m_statfs = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_statfs = PTHREAD_COND_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static void probe_deadline(struct timespec *end);
+static int ms_left(const struct timespec *end);
+static int pid_running(void);
+static int host_resolve(int socktype);
+static int probe_icmp(void);
+static int probe_tcp(void);
+static void *statfs_main(void *arg);
+static int probe_statfs(void);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* the time (CLOCK_REALTIME) at which a probe starting now times out */
+static void probe_deadline(struct timespec *end)
+{
+    clock_gettime(CLOCK_REALTIME, end);
+    end->tv_sec += PROBE_TIMEOUT / 1000;
+    end->tv_nsec += (PROBE_TIMEOUT % 1000) * 1000000;
+    if (end->tv_nsec >= 1000000000)
+    {
+        end->tv_sec++;
+        end->tv_nsec -= 1000000000;
+    }
+}
+
+/* milliseconds until _end_ */
+static int ms_left(const struct timespec *end)
+{
+    struct timespec now;
+    long long ms;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    ms = (long long)(end->tv_sec - now.tv_sec) * 1000 + (end->tv_nsec - now.tv_nsec) / 1000000;
+
+    return (ms > 0) ? ms : 0;
+}
+
+static int pid_running(void)
+{
+    FILE *f;
+    char line[16];
+    char *endptr;
+    struct stat st;
+
+    if (!discofs_options.pid_file)
+        return 1;
+
+    if (stat(discofs_options.pid_file, &st))
+        return 0;
+
+    if (!pid || st.st_mtime != pid_mtime)
+    {
+        pid = 0;
+        pid_mtime = st.st_mtime;
+
+        f = fopen(discofs_options.pid_file, "r");
+        if (!f)
+        {
+            ERROR("cannot open pid file %s", discofs_options.pid_file);
+            PERROR("");
+            return 0;
+        }
+        if (!fgets(line, sizeof line, f))
+            *line = '\0';
+        fclose(f);
+
+        pid = strtol(line, &endptr, 10);
+        if (*line == '\0' || (*endptr != '\0' && *endptr != '\n'))
+        {
+            ERROR("failed getting pid from file %s", discofs_options.pid_file);
+            pid = 0;
+            return 0;
+        }
+    }
+
+    return (kill(pid, 0) == 0);
+}
+
+static int host_resolve(int socktype)
+{
+    int res;
+    char port[8];
+    struct addrinfo hints, *ai;
+
+    if (host_addrlen)
+        return 0;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+
+    snprintf(port, sizeof port, "%u", discofs_options.probe_port);
+
+    res = getaddrinfo(discofs_options.host, port, &hints, &ai);
+    if (res)
+    {
+        DEBUG("resolving %s: %s", discofs_options.host, gai_strerror(res));
+        return -1;
+    }
+
+    memcpy(&host_addr, ai->ai_addr, ai->ai_addrlen);
+    host_addrlen = ai->ai_addrlen;
+
+    freeaddrinfo(ai);
+    return 0;
+}
+
+/* send an echo request and wait for the reply */
+static int probe_icmp(void)
+{
+    int res, family, proto;
+    unsigned short seq;
+    ssize_t n;
+    struct pollfd pfd;
+    struct timespec end;
+    unsigned char buf[256];
+    struct icmphdr *h4 = (struct icmphdr *)buf;
+    struct icmp6_hdr *h6 = (struct icmp6_hdr *)buf;
+
+    if (host_resolve(SOCK_DGRAM))
+        return 0;
+
+    family = host_addr.ss_family;
+    proto = (family == AF_INET6) ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+
+    if (icmp_fd == -1)
+    {
+        icmp_fd = socket(family, SOCK_DGRAM, proto);
+        if (icmp_fd == -1)
+        {
+            /* see net.ipv4.ping_group_range */
+            ERROR("creating ICMP socket: %s, using TCP probe", strerror(errno));
+            discofs_options.probe = PROBE_TCP;
+            host_addrlen = 0;
+            return probe_tcp();
+        }
+    }
+
+    /* the kernel fills in the identifier and the checksum */
+    seq = ++echo_seq;
+    memset(buf, 0, sizeof buf);
+    if (family == AF_INET6)
+    {
+        h6->icmp6_type = ICMP6_ECHO_REQUEST;
+        h6->icmp6_seq = htons(seq);
+        n = sizeof *h6;
+    }
+    else
+    {
+        h4->type = ICMP_ECHO;
+        h4->un.echo.sequence = htons(seq);
+        n = sizeof *h4;
+    }
+
+    if (sendto(icmp_fd, buf, n, 0, (struct sockaddr *)&host_addr, host_addrlen) == -1)
+    {
+        DEBUG("sending echo request: %s", strerror(errno));
+        close(icmp_fd);
+        icmp_fd = -1;
+        host_addrlen = 0;
+        return 0;
+    }
+
+    probe_deadline(&end);
+
+    pfd.fd = icmp_fd;
+    pfd.events = POLLIN;
+
+    /* skip late replies to earlier requests */
+    while ((res = poll(&pfd, 1, ms_left(&end))) > 0)
+    {
+        n = recv(icmp_fd, buf, sizeof buf, 0);
+        if (n < (ssize_t)sizeof *h4)
+            continue;
+
+        if (family == AF_INET6)
+        {
+            if (h6->icmp6_type == ICMP6_ECHO_REPLY && ntohs(h6->icmp6_seq) == seq)
+                return 1;
+        }
+        else if (h4->type == ICMP_ECHOREPLY && ntohs(h4->un.echo.sequence) == seq)
+            return 1;
+    }
+
+    /* the address may have a different family after resolving it again */
+    close(icmp_fd);
+    icmp_fd = -1;
+    host_addrlen = 0;
+    return 0;
+}
+
+/* connect to the "probeport" of the host */
+static int probe_tcp(void)
+{
+    int fd, res, err = 0;
+    socklen_t errlen = sizeof err;
+    struct pollfd pfd;
+
+    if (host_resolve(SOCK_STREAM))
+        return 0;
+
+    fd = socket(host_addr.ss_family, SOCK_STREAM, 0);
+    if (fd == -1)
+        return 0;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    res = connect(fd, (struct sockaddr *)&host_addr, host_addrlen);
+    if (res == -1 && errno == EINPROGRESS)
+    {
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+
+        if (poll(&pfd, 1, PROBE_TIMEOUT) == 1
+                && !getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) && !err)
+            res = 0;
+    }
+    else if (res == -1)
+        err = errno;
+
+    if (res)
+    {
+        DEBUG("connecting to %s:%u: %s", discofs_options.host,
+                discofs_options.probe_port, err ? strerror(err) : "timeout");
+        host_addrlen = 0;
+    }
+
+    close(fd);
+    return (res == 0);
+}
+
+static void *statfs_main(void *arg)
+{
+    int res;
+    struct statvfs st;
+
+    res = statvfs(REMOTE_ROOT, &st);
+
+    pthread_mutex_lock(&m_statfs);
+    statfs_res = (res == 0);
+    statfs_busy = 0;
+    pthread_cond_signal(&c_statfs);
+    pthread_mutex_unlock(&m_statfs);
+
+    return NULL;
+}
+
+/* statvfs() the remote root. if it is still hanging from an earlier
+   probe, wait for that one instead of starting another */
+static int probe_statfs(void)
+{
+    int res;
+    pthread_t t;
+    pthread_attr_t attr;
+    struct timespec end;
+
+    pthread_mutex_lock(&m_statfs);
+
+    if (!statfs_busy)
+    {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        statfs_busy = 1;
+        if (pthread_create(&t, &attr, statfs_main, NULL))
+        {
+            ERROR("failed to create statfs thread");
+            statfs_busy = 0;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    probe_deadline(&end);
+
+    while (statfs_busy)
+    {
+        if (pthread_cond_timedwait(&c_statfs, &m_statfs, &end) == ETIMEDOUT)
+            break;
+    }
+
+    res = statfs_busy ? 0 : statfs_res;
+    if (statfs_busy)
+        DEBUG("statfs of %s timed out", REMOTE_ROOT);
+
+    pthread_mutex_unlock(&m_statfs);
+    return res;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int probe_init(void)
+{
+    if (discofs_options.probe == PROBE_AUTO)
+        discofs_options.probe = (discofs_options.host && *discofs_options.host)
+            ? PROBE_ICMP : PROBE_STATFS;
+
+    if ((discofs_options.probe == PROBE_ICMP || discofs_options.probe == PROBE_TCP)
+            && (!discofs_options.host || !*discofs_options.host))
+    {
+        ERROR("\"probe\" needs a \"host\"");
+        return -1;
+    }
+
+    return 0;
+}
+
+void probe_destroy(void)
+{
+    if (icmp_fd != -1)
+        close(icmp_fd);
+    icmp_fd = -1;
+}
+
+int probe_run(void)
+{
+    /* a remote call is still hanging */
+    if (rcall_hung())
+        return 0;
+
+    if (!pid_running() || !is_mounted(REMOTE_ROOT))
+        return 0;
+
+    switch (discofs_options.probe)
+    {
+        case PROBE_ICMP:
+            return probe_icmp();
+        case PROBE_TCP:
+            return probe_tcp();
+        case PROBE_STATFS:
+            return probe_statfs();
+    }
+
+    return 1;
+}
@@ -0,0 +1,42 @@
+/*! @file probe.h
+ * checks of the remote fs availability.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_PROBE_H
+#define DISCOFS_PROBE_H
+
+#include "config.h"
+#include "discofs.h"
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! milliseconds a single probe may take */
+#define PROBE_TIMEOUT 1000
+
+/*! milliseconds between probes. the interval doubles while the probes agree
+   with the current state and drops to the minimum when one doesn't */
+#define PROBE_INTERVAL_MIN 250
+#define PROBE_INTERVAL_MAX (SLEEP_SHORT * 1000)
+
+/*! consecutive probes needed to go ONLINE/OFFLINE */
+#define PROBE_RISE 3
+#define PROBE_FALL 2
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int probe_init(void);
+void probe_destroy(void);
+
+/*! check whether the remote fs is available (pid file, mount point and
+   the probe selected with the "probe" option). returns non-zero if it is */
+int probe_run(void);
+
+#endif
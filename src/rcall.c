@@ -0,0 +1,727 @@
+/*! @file rcall.c
+ * system calls on the remote fs with a deadline.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "rcall.h"
+
+#include "state.h"
+#include "log.h"
+#include "queue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#if HAVE_SETXATTR
+#include <attr/xattr.h>
+#endif
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+enum rcall_op
+{
+    RC_LSTAT,
+    RC_ACCESS,
+    RC_READLINK,
+    RC_MKNOD,
+    RC_MKDIR,
+    RC_RMDIR,
+    RC_UNLINK,
+    RC_RENAME,
+    RC_SYMLINK,
+    RC_CHOWN,
+    RC_CHMOD,
+    RC_TRUNCATE,
+    RC_UTIMENSAT,
+    RC_STATVFS,
+    RC_OPEN,
+    RC_OPENDIR,
+    RC_READDIR,
+    RC_PREAD,
+    RC_LSETXATTR,
+    RC_LGETXATTR,
+    RC_LLISTXATTR
+};
+
+/* states of a call */
+#define RCALL_QUEUED    0
+#define RCALL_RUNNING   1
+#define RCALL_DONE      2
+#define RCALL_ABANDONED 3
+
+/* what a call operates on, for log messages */
+#define RCALL_NAME(c) ((c)->p1 ? (c)->p1 : "open file")
+
+/*! a call and everything it needs. owned by the caller until the deadline
+   passes, by the helper thread after that */
+struct rcall
+{
+    int op;
+    int state;
+    char *p1;                   /* path, NULL for calls on a descriptor */
+    char *p2;                   /* second path or attribute name */
+    long long n1, n2;           /* integer arguments */
+    void *buf;                  /* data passed in or out */
+    size_t size;                /* size of buf */
+    struct stat st;
+    struct statvfs vfs;
+    struct timespec ts[2];
+    DIR *dir;
+    long long res;              /* return value of the system call */
+    int err;                    /* errno after the system call */
+};
+
+static queue *rcall_q = NULL;
+static int rcall_hung_n = 0;
+static int rcall_exit = 0;
+static int rcall_started = 0;
+
+static pthread_mutex_t m_rcall = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_rcall_q = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t c_rcall_done = PTHREAD_COND_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static struct rcall *rcall_alloc(int op, const char *p1, const char *p2);
+static void rcall_free(struct rcall *c);
+static void rcall_perform(struct rcall *c);
+static void *rcall_main(void *arg);
+static int rcall_run(struct rcall *c);
+static long long rcall_return(struct rcall *c);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static struct rcall *rcall_alloc(int op, const char *p1, const char *p2)
+{
+    struct rcall *c;
+
+    if ((c = calloc(1, sizeof *c)) == NULL)
+        goto failure;
+
+    c->op = op;
+    c->state = RCALL_QUEUED;
+
+    if (p1 && (c->p1 = strdup(p1)) == NULL)
+        goto failure;
+    if (p2 && (c->p2 = strdup(p2)) == NULL)
+        goto failure;
+
+    return c;
+
+failure:
+    rcall_free(c);
+    errno = ENOMEM;
+    return NULL;
+}
+
+static void rcall_free(struct rcall *c)
+{
+    if (!c)
+        return;
+
+    free(c->p1);
+    free(c->p2);
+    free(c->buf);
+    free(c);
+}
+
+static void rcall_perform(struct rcall *c)
+{
+    errno = 0;
+
+    switch (c->op)
+    {
+        case RC_LSTAT:
+            c->res = lstat(c->p1, &c->st);
+            break;
+        case RC_ACCESS:
+            c->res = access(c->p1, c->n1);
+            break;
+        case RC_READLINK:
+            c->res = readlink(c->p1, c->buf, c->size);
+            break;
+        case RC_MKNOD:
+            c->res = mknod(c->p1, c->n1, c->n2);
+            break;
+        case RC_MKDIR:
+            c->res = mkdir(c->p1, c->n1);
+            break;
+        case RC_RMDIR:
+            c->res = rmdir(c->p1);
+            break;
+        case RC_UNLINK:
+            c->res = unlink(c->p1);
+            break;
+        case RC_RENAME:
+            c->res = rename(c->p1, c->p2);
+            break;
+        case RC_SYMLINK:
+            c->res = symlink(c->p2, c->p1);
+            break;
+        case RC_CHOWN:
+            c->res = chown(c->p1, c->n1, c->n2);
+            break;
+        case RC_CHMOD:
+            c->res = chmod(c->p1, c->n1);
+            break;
+        case RC_TRUNCATE:
+            c->res = truncate(c->p1, c->n1);
+            break;
+        case RC_UTIMENSAT:
+            c->res = utimensat(-1, c->p1, c->ts, AT_SYMLINK_NOFOLLOW);
+            break;
+        case RC_STATVFS:
+            c->res = statvfs(c->p1, &c->vfs);
+            break;
+        case RC_OPEN:
+            c->res = open(c->p1, c->n1, (mode_t)c->n2);
+            break;
+        case RC_OPENDIR:
+            c->dir = opendir(c->p1);
+            c->res = (c->dir) ? 0 : -1;
+            break;
+        case RC_READDIR:
+        {
+            struct dirent *ent;
+            c->res = readdir_r(c->dir, c->buf, &ent);
+            c->n2 = (ent != NULL);
+            break;
+        }
+        case RC_PREAD:
+            c->res = pread(c->n1, c->buf, c->size, c->n2);
+            break;
+#if HAVE_SETXATTR
+        case RC_LSETXATTR:
+            c->res = lsetxattr(c->p1, c->p2, c->buf, c->size, c->n1);
+            break;
+        case RC_LGETXATTR:
+            c->res = lgetxattr(c->p1, c->p2, c->buf, c->size);
+            break;
+        case RC_LLISTXATTR:
+            c->res = llistxattr(c->p1, c->buf, c->size);
+            break;
+#endif
+        default:
+            c->res = -1;
+            errno = ENOSYS;
+    }
+
+    c->err = errno;
+}
+
+/* helper thread */
+static void *rcall_main(void *arg)
+{
+    struct rcall *c;
+
+    pthread_mutex_lock(&m_rcall);
+
+    for (;;)
+    {
+        while (!rcall_exit && q_empty(rcall_q))
+            pthread_cond_wait(&c_rcall_q, &m_rcall);
+
+        if (rcall_exit)
+            break;
+
+        c = q_dequeue(rcall_q);
+
+        /* the caller gave up before the call even started */
+        if (c->state == RCALL_ABANDONED)
+        {
+            rcall_free(c);
+            continue;
+        }
+
+        c->state = RCALL_RUNNING;
+        pthread_mutex_unlock(&m_rcall);
+
+        rcall_perform(c);
+
+        pthread_mutex_lock(&m_rcall);
+
+        if (c->state == RCALL_ABANDONED)
+        {
+            VERBOSE("remote call on %s returned after its deadline", RCALL_NAME(c));
+            rcall_hung_n--;
+
+            /* nobody is going to close these */
+            if (c->op == RC_OPEN && c->res != -1)
+                close(c->res);
+            else if ((c->op == RC_OPENDIR || c->op == RC_READDIR) && c->dir)
+                closedir(c->dir);
+            else if (c->op == RC_PREAD)
+                close(c->n1);
+
+            rcall_free(c);
+        }
+        else
+        {
+            c->state = RCALL_DONE;
+            pthread_cond_broadcast(&c_rcall_done);
+        }
+    }
+
+    pthread_mutex_unlock(&m_rcall);
+    return NULL;
+}
+
+/* perform _c_ in a helper thread and wait for it until the deadline. if
+   it passes, ownership of _c_ goes to the helper thread and -1 is returned */
+static int rcall_run(struct rcall *c)
+{
+    struct timespec end;
+
+    if (!rcall_started)
+    {
+        rcall_perform(c);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &end);
+    end.tv_sec += discofs_options.rtimeout;
+
+    pthread_mutex_lock(&m_rcall);
+
+    if (q_enqueue(rcall_q, c))
+    {
+        pthread_mutex_unlock(&m_rcall);
+        c->res = -1;
+        c->err = ENOMEM;
+        return 0;
+    }
+    pthread_cond_signal(&c_rcall_q);
+
+    while (c->state != RCALL_DONE)
+    {
+        if (pthread_cond_timedwait(&c_rcall_done, &m_rcall, &end) == ETIMEDOUT)
+            break;
+    }
+
+    if (c->state != RCALL_DONE)
+    {
+        if (c->state == RCALL_RUNNING)
+            rcall_hung_n++;
+        c->state = RCALL_ABANDONED;
+
+        pthread_mutex_unlock(&m_rcall);
+
+        ERROR("remote call on %s timed out after %u seconds", RCALL_NAME(c), discofs_options.rtimeout);
+        state_set(STATE_OFFLINE, NULL);
+
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    pthread_mutex_unlock(&m_rcall);
+    return 0;
+}
+
+/* free _c_ and return its result like the system call would */
+static long long rcall_return(struct rcall *c)
+{
+    long long res = c->res;
+    int err = c->err;
+
+    rcall_free(c);
+
+    if (res == -1)
+        errno = err;
+    return res;
+}
+
+/* prepare a call, or return -1 */
+#define RCALL_ALLOC(c, op, p1, p2)              \
+    if ((c = rcall_alloc(op, p1, p2)) == NULL)  \
+        return -1
+
+/* perform a call, or return -1 if it timed out */
+#define RCALL_RUN(c)                            \
+    if (rcall_run(c))                           \
+        return -1
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int rcall_init(void)
+{
+    if (!discofs_options.rtimeout)
+        return 0;
+
+    if ((rcall_q = q_init()) == NULL)
+        return -1;
+
+    return 0;
+}
+
+int rcall_start(void)
+{
+    int i;
+    pthread_t t;
+    pthread_attr_t attr;
+
+    if (!rcall_q)
+        return 0;
+
+    /* a thread that hangs in a system call can't be joined */
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (i = 0; i < RCALL_THREADS; i++)
+    {
+        if (pthread_create(&t, &attr, rcall_main, NULL))
+        {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    rcall_started = 1;
+    return 0;
+}
+
+void rcall_destroy(void)
+{
+    if (!rcall_q)
+        return;
+
+    pthread_mutex_lock(&m_rcall);
+    rcall_exit = 1;
+    rcall_started = 0;
+    pthread_cond_broadcast(&c_rcall_q);
+    q_free(rcall_q, (void (*)(void *))rcall_free);
+    rcall_q = NULL;
+    pthread_mutex_unlock(&m_rcall);
+}
+
+int rcall_hung(void)
+{
+    return rcall_hung_n;
+}
+
+int rcall_lstat(const char *path, struct stat *buf)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_LSTAT, path, NULL);
+    RCALL_RUN(c);
+
+    if (c->res == 0)
+        memcpy(buf, &c->st, sizeof *buf);
+
+    return rcall_return(c);
+}
+
+int rcall_access(const char *path, int mode)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_ACCESS, path, NULL);
+    c->n1 = mode;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+ssize_t rcall_readlink(const char *path, char *buf, size_t size)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_READLINK, path, NULL);
+    if ((c->buf = malloc(size)) == NULL)
+    {
+        rcall_free(c);
+        errno = ENOMEM;
+        return -1;
+    }
+    c->size = size;
+    RCALL_RUN(c);
+
+    if (c->res > 0)
+        memcpy(buf, c->buf, c->res);
+
+    return rcall_return(c);
+}
+
+int rcall_mknod(const char *path, mode_t mode, dev_t dev)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_MKNOD, path, NULL);
+    c->n1 = mode;
+    c->n2 = dev;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_mkdir(const char *path, mode_t mode)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_MKDIR, path, NULL);
+    c->n1 = mode;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_rmdir(const char *path)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_RMDIR, path, NULL);
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_unlink(const char *path)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_UNLINK, path, NULL);
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_rename(const char *from, const char *to)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_RENAME, from, to);
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_symlink(const char *to, const char *path)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_SYMLINK, path, to);
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_chown(const char *path, uid_t uid, gid_t gid)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_CHOWN, path, NULL);
+    c->n1 = uid;
+    c->n2 = gid;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_chmod(const char *path, mode_t mode)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_CHMOD, path, NULL);
+    c->n1 = mode;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_truncate(const char *path, off_t size)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_TRUNCATE, path, NULL);
+    c->n1 = size;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_utimensat(const char *path, const struct timespec ts[2])
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_UTIMENSAT, path, NULL);
+    c->ts[0] = ts[0];
+    c->ts[1] = ts[1];
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+int rcall_statvfs(const char *path, struct statvfs *buf)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_STATVFS, path, NULL);
+    RCALL_RUN(c);
+
+    if (c->res == 0)
+        memcpy(buf, &c->vfs, sizeof *buf);
+
+    return rcall_return(c);
+}
+
+int rcall_open(const char *path, int flags, mode_t mode)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_OPEN, path, NULL);
+    c->n1 = flags;
+    c->n2 = mode;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+DIR *rcall_opendir(const char *path)
+{
+    DIR *dir;
+    struct rcall *c;
+
+    if ((c = rcall_alloc(RC_OPENDIR, path, NULL)) == NULL)
+        return NULL;
+    if (rcall_run(c))
+        return NULL;
+
+    dir = c->dir;
+    rcall_return(c);
+    return dir;
+}
+
+int rcall_readdir_r(DIR *dir, struct dirent *entry, struct dirent **result)
+{
+    int res;
+    struct rcall *c;
+
+    if ((c = rcall_alloc(RC_READDIR, NULL, NULL)) == NULL)
+        return ENOMEM;
+    if ((c->buf = malloc(sizeof *entry)) == NULL)
+    {
+        rcall_free(c);
+        return ENOMEM;
+    }
+    c->dir = dir;
+    if (rcall_run(c))
+        return ETIMEDOUT;
+
+    *result = NULL;
+    res = c->res;
+
+    /* _entry_ may be shorter than struct dirent, see dirent_buf_size() */
+    if (res == 0 && c->n2)
+    {
+        memcpy(entry, c->buf, offsetof(struct dirent, d_name)
+            + strlen(((struct dirent *)c->buf)->d_name) + 1);
+        *result = entry;
+    }
+
+    rcall_free(c);
+    return res;
+}
+
+ssize_t rcall_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_PREAD, NULL, NULL);
+    if ((c->buf = malloc(count)) == NULL)
+    {
+        rcall_free(c);
+        errno = ENOMEM;
+        return -1;
+    }
+    c->size = count;
+    c->n1 = fd;
+    c->n2 = offset;
+    RCALL_RUN(c);
+
+    if (c->res > 0)
+        memcpy(buf, c->buf, c->res);
+
+    return rcall_return(c);
+}
+
+#if HAVE_SETXATTR
+int rcall_lsetxattr(const char *path, const char *name, const void *value,
+    size_t size, int flags)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_LSETXATTR, path, name);
+    if (size && (c->buf = malloc(size)) == NULL)
+    {
+        rcall_free(c);
+        errno = ENOMEM;
+        return -1;
+    }
+    if (size)
+        memcpy(c->buf, value, size);
+    c->size = size;
+    c->n1 = flags;
+    RCALL_RUN(c);
+
+    return rcall_return(c);
+}
+
+ssize_t rcall_lgetxattr(const char *path, const char *name, void *value, size_t size)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_LGETXATTR, path, name);
+    if (size && (c->buf = malloc(size)) == NULL)
+    {
+        rcall_free(c);
+        errno = ENOMEM;
+        return -1;
+    }
+    c->size = size;
+    RCALL_RUN(c);
+
+    if (c->res > 0 && size)
+        memcpy(value, c->buf, c->res);
+
+    return rcall_return(c);
+}
+
+ssize_t rcall_llistxattr(const char *path, char *list, size_t size)
+{
+    struct rcall *c;
+
+    RCALL_ALLOC(c, RC_LLISTXATTR, path, NULL);
+    if (size && (c->buf = malloc(size)) == NULL)
+    {
+        rcall_free(c);
+        errno = ENOMEM;
+        return -1;
+    }
+    c->size = size;
+    RCALL_RUN(c);
+
+    if (c->res > 0 && size)
+        memcpy(list, c->buf, c->res);
+
+    return rcall_return(c);
+}
+#endif
@@ -0,0 +1,77 @@
+/*! @file rcall.h
+ * system calls on the remote fs with a deadline.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_RCALL_H
+#define DISCOFS_RCALL_H
+
+#include "config.h"
+#include "discofs.h"
+
+#include <stddef.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! number of helper threads performing remote calls */
+#define RCALL_THREADS 8
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! with "rtimeout=0", or before rcall_start(), calls are made directly */
+int rcall_init(void);
+void rcall_destroy(void);
+
+/*! start the helper threads. threads don't survive daemonizing, so this is
+   called from op_init() */
+int rcall_start(void);
+
+/*! number of calls that missed their deadline and have not returned yet */
+int rcall_hung(void);
+
+/*! these behave like the system calls of the same name, but give up after
+   "rtimeout" seconds. errno is then ETIMEDOUT and the state is changed
+   to OFFLINE; the call keeps running in its helper thread */
+int rcall_lstat(const char *path, struct stat *buf);
+int rcall_access(const char *path, int mode);
+ssize_t rcall_readlink(const char *path, char *buf, size_t size);
+int rcall_mknod(const char *path, mode_t mode, dev_t dev);
+int rcall_mkdir(const char *path, mode_t mode);
+int rcall_rmdir(const char *path);
+int rcall_unlink(const char *path);
+int rcall_rename(const char *from, const char *to);
+int rcall_symlink(const char *to, const char *path);
+int rcall_chown(const char *path, uid_t uid, gid_t gid);
+int rcall_chmod(const char *path, mode_t mode);
+int rcall_truncate(const char *path, off_t size);
+int rcall_utimensat(const char *path, const struct timespec ts[2]);
+int rcall_statvfs(const char *path, struct statvfs *buf);
+int rcall_open(const char *path, int flags, mode_t mode);
+DIR *rcall_opendir(const char *path);
+
+/*! like readdir_r() and pread(). when they time out, _dir_ or _fd_ is
+   closed by the helper thread once the call returns and must not be used
+   or closed by the caller anymore */
+int rcall_readdir_r(DIR *dir, struct dirent *entry, struct dirent **result);
+ssize_t rcall_pread(int fd, void *buf, size_t count, off_t offset);
+
+#if HAVE_SETXATTR
+int rcall_lsetxattr(const char *path, const char *name, const void *value,
+    size_t size, int flags);
+ssize_t rcall_lgetxattr(const char *path, const char *name, void *value, size_t size);
+ssize_t rcall_llistxattr(const char *path, char *list, size_t size);
+#endif
+
+#endif
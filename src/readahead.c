@@ -0,0 +1,407 @@
+/*! @file readahead.c
+ * read-ahead for sparse cache files.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "readahead.h"
+
+#include "discofs.h"
+#include "state.h"
+#include "log.h"
+#include "funcs.h"
+#include "sparse.h"
+#include "hashtable.h"
+#include "queue.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! access pattern of an open file */
+struct readahead
+{
+    char *path;
+    unsigned int refs;      /* number of open file handles */
+    off_t last_offset;      /* offset of the previous read */
+    size_t last_size;       /* size of the previous read */
+    off_t stride;           /* distance between the previous two reads */
+    unsigned int hits;      /* consecutive reads matching the pattern */
+    off_t next;             /* everything before this has been queued */
+};
+
+/*! a range to prefetch */
+struct ra_request
+{
+    char *path;
+    off_t offset;
+    size_t size;
+};
+
+/* access patterns, key is the path */
+static hashtable *ra_ht = NULL;
+static pthread_mutex_t m_ra_ht = PTHREAD_MUTEX_INITIALIZER;
+
+/* prefetch requests */
+static queue *ra_q = NULL;
+static unsigned int ra_queued = 0;
+static bool ra_exit = false;
+static pthread_mutex_t m_ra_q = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_ra_q = PTHREAD_COND_INITIALIZER;
+
+/* measured throughput of the remote fs in bytes per second. 0 means
+   nothing has been measured yet. protected by m_ra_q */
+static unsigned long long ra_rate = 0;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static hash_t ra_hash(const void *p, const void *n);
+static int ra_cmp(const void *p1, const void *p2, const void *n);
+
+static void ra_free(void *p);
+static void ra_request_free(void *p);
+
+static unsigned long long ra_now(void);
+static size_t ra_window(void);
+static void ra_schedule(const char *path, off_t offset, size_t size);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static hash_t ra_hash(const void *p, const void *n)
+{
+    return djb2(p, SIZE_MAX);
+}
+
+static int ra_cmp(const void *p1, const void *p2, const void *n)
+{
+    return strcmp(p1, p2);
+}
+
+static void ra_free(void *p)
+{
+    struct readahead *r = p;
+
+    if (r)
+        free(r->path);
+    free(r);
+}
+
+static void ra_request_free(void *p)
+{
+    struct ra_request *req = p;
+
+    if (req)
+        free(req->path);
+    free(req);
+}
+
+/* monotonic time in microseconds */
+static unsigned long long ra_now(void)
+{
+#if HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/* number of bytes to keep ahead of the reader. this is what the link
+   transfers in RA_LOOKAHEAD_MS, rounded up to whole blocks */
+static size_t ra_window(void)
+{
+    unsigned long long w;
+    size_t max = (size_t)discofs_options.readahead * 1024;
+
+    pthread_mutex_lock(&m_ra_q);
+    w = ra_rate * RA_LOOKAHEAD_MS / 1000;
+    pthread_mutex_unlock(&m_ra_q);
+
+    w = SPARSE_NBLOCKS(w) * SPARSE_BLOCK_SIZE;
+
+    if (w > max)
+        w = max;
+    if (w < RA_MIN_WINDOW)
+        w = RA_MIN_WINDOW;
+
+    return w;
+}
+
+/* add a request to the prefetch queue */
+static void ra_schedule(const char *path, off_t offset, size_t size)
+{
+    struct ra_request *req;
+
+    pthread_mutex_lock(&m_ra_q);
+
+    /* the prefetcher is lagging behind, the reader will fetch on its own */
+    if (ra_exit || ra_queued >= RA_MAX_QUEUED)
+    {
+        pthread_mutex_unlock(&m_ra_q);
+        return;
+    }
+
+    if ((req = malloc(sizeof *req)) && (req->path = strdup(path)))
+    {
+        req->offset = offset;
+        req->size = size;
+
+        if (q_enqueue(ra_q, req))
+        {
+            ra_request_free(req);
+        }
+        else
+        {
+            ra_queued++;
+            pthread_cond_signal(&c_ra_q);
+        }
+    }
+    else
+        free(req);
+
+    pthread_mutex_unlock(&m_ra_q);
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int readahead_init(void)
+{
+    if (ht_init(&ra_ht, ra_hash, ra_cmp) == HT_ERROR)
+        return -1;
+
+    if ((ra_q = q_init()) == NULL)
+    {
+        ht_free(ra_ht);
+        ra_ht = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void readahead_destroy(void)
+{
+    pthread_mutex_lock(&m_ra_ht);
+    ht_free_f(ra_ht, NULL, ra_free);
+    ra_ht = NULL;
+    pthread_mutex_unlock(&m_ra_ht);
+
+    pthread_mutex_lock(&m_ra_q);
+    q_free(ra_q, ra_request_free);
+    ra_q = NULL;
+    pthread_mutex_unlock(&m_ra_q);
+}
+
+int readahead_open(const char *path)
+{
+    struct readahead *r;
+
+    pthread_mutex_lock(&m_ra_ht);
+
+    if ((r = ht_get(ra_ht, path)) == NULL)
+    {
+        if ((r = calloc(1, sizeof *r)) == NULL || (r->path = strdup(path)) == NULL)
+        {
+            free(r);
+            pthread_mutex_unlock(&m_ra_ht);
+            return -1;
+        }
+
+        r->last_offset = -1;
+
+        if (ht_insert(ra_ht, r->path, r) != HT_OK)
+        {
+            ra_free(r);
+            pthread_mutex_unlock(&m_ra_ht);
+            return -1;
+        }
+    }
+
+    r->refs++;
+
+    pthread_mutex_unlock(&m_ra_ht);
+    return 0;
+}
+
+void readahead_close(const char *path)
+{
+    struct readahead *r;
+
+    pthread_mutex_lock(&m_ra_ht);
+
+    if ((r = ht_get(ra_ht, path)) && --r->refs == 0)
+    {
+        ht_remove(ra_ht, path);
+        ra_free(r);
+    }
+
+    pthread_mutex_unlock(&m_ra_ht);
+}
+
+void readahead_read(const char *path, off_t offset, size_t size)
+{
+    int k, n;
+    off_t end = offset + size;
+    off_t stride;
+    size_t window;
+    struct readahead *r;
+
+    if (!discofs_options.readahead || !size)
+        return;
+
+    window = ra_window();
+
+    pthread_mutex_lock(&m_ra_ht);
+
+    if ((r = ht_get(ra_ht, path)) == NULL)
+    {
+        pthread_mutex_unlock(&m_ra_ht);
+        return;
+    }
+
+    stride = offset - r->last_offset;
+
+    /*------------*
+     * sequential *
+     *------------*/
+    if (r->last_offset != -1 && offset == r->last_offset + (off_t)r->last_size)
+    {
+        r->hits++;
+
+        /* only refill once half of the window has been consumed, so
+           requests are reasonably large */
+        if (r->hits >= RA_MIN_HITS && r->next - end < (off_t)window / 2)
+        {
+            if (r->next < end)
+                r->next = end;
+
+            ra_schedule(path, r->next, end + window - r->next);
+            r->next = end + window;
+        }
+    }
+
+    /*---------*
+     * strided *
+     *---------*/
+    else if (r->last_offset != -1 && stride > 0 && stride == r->stride)
+    {
+        r->hits++;
+
+        if (r->hits >= RA_MIN_HITS)
+        {
+            n = window / size;
+            if (n > RA_MAX_STRIDES)
+                n = RA_MAX_STRIDES;
+
+            for (k = 1; k <= n; k++)
+            {
+                if (offset + k * stride < r->next)
+                    continue;
+
+                ra_schedule(path, offset + k * stride, size);
+                r->next = offset + k * stride + size;
+            }
+        }
+    }
+
+    /*--------*
+     * random *
+     *--------*/
+    else
+    {
+        r->hits = 0;
+        r->next = 0;
+    }
+
+    r->stride = stride;
+    r->last_offset = offset;
+    r->last_size = size;
+
+    pthread_mutex_unlock(&m_ra_ht);
+}
+
+void readahead_stop(void)
+{
+    pthread_mutex_lock(&m_ra_q);
+    ra_exit = true;
+    pthread_cond_broadcast(&c_ra_q);
+    pthread_mutex_unlock(&m_ra_q);
+}
+
+void *readahead_main(void *arg)
+{
+    int res;
+    struct ra_request *req;
+    unsigned long long t, rate;
+
+    while (1)
+    {
+        pthread_mutex_lock(&m_ra_q);
+
+        while (!ra_exit && q_empty(ra_q))
+            pthread_cond_wait(&c_ra_q, &m_ra_q);
+
+        if (ra_exit)
+        {
+            pthread_mutex_unlock(&m_ra_q);
+            break;
+        }
+
+        req = q_dequeue(ra_q);
+        ra_queued--;
+
+        pthread_mutex_unlock(&m_ra_q);
+
+        if (!ONLINE)
+        {
+            ra_request_free(req);
+            continue;
+        }
+
+        t = ra_now();
+        res = sparse_fetch(req->path, req->offset, req->size);
+        t = ra_now() - t;
+
+        if (res)
+            DEBUG("prefetching %s failed: %s", req->path, strerror(-res));
+
+        /* requests that took less than a millisecond were (mostly) served
+           from the cache and tell us nothing about the link */
+        else if (t >= 1000)
+        {
+            rate = (unsigned long long)req->size * 1000000 / t;
+
+            pthread_mutex_lock(&m_ra_q);
+            ra_rate = (ra_rate) ? (3 * ra_rate + rate) / 4 : rate;
+            pthread_mutex_unlock(&m_ra_q);
+        }
+
+        ra_request_free(req);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,60 @@
+/*! @file readahead.h
+ * read-ahead for sparse cache files.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_READAHEAD_H
+#define DISCOFS_READAHEAD_H
+
+#include "config.h"
+#include "discofs.h"
+#include "sparse.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! number of consecutive reads matching a pattern before prefetching */
+#define RA_MIN_HITS 2
+
+/*! the window should cover this many milliseconds of transfer */
+#define RA_LOOKAHEAD_MS 1000
+
+/*! smallest window (bytes) */
+#define RA_MIN_WINDOW (2 * SPARSE_BLOCK_SIZE)
+
+/*! maximum number of strided records to prefetch at once */
+#define RA_MAX_STRIDES 16
+
+/*! maximum number of queued prefetch requests */
+#define RA_MAX_QUEUED 256
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! initialize/destroy needed data structures */
+int readahead_init(void);
+void readahead_destroy(void);
+
+/*! start/stop tracking the access pattern of _path_ */
+int readahead_open(const char *path);
+void readahead_close(const char *path);
+
+/*! record a read of _size_ bytes at _offset_ and schedule prefetching if a
+   sequential or strided pattern is detected */
+void readahead_read(const char *path, off_t offset, size_t size);
+
+/*! make readahead_main() return */
+void readahead_stop(void);
+
+/*! prefetching thread */
+void *readahead_main(void *arg);
+
+#endif
@@ -0,0 +1,239 @@
+/*! @file record.c
+ * recording of file system operations for bench/fsreplay.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "record.h"
+
+#include "log.h"
+#include "funcs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+static FILE *record_f = NULL;
+static stats_us record_t0 = 0;
+static time_t record_flushed = 0;
+static unsigned long record_salt = 0;
+static unsigned long record_dropped = 0;
+
+/* threads are numbered in the order of their first operation */
+static pthread_key_t thread_key;
+static unsigned long thread_n = 0;
+
+static pthread_mutex_t m_record = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static unsigned long record_thread(void);
+static size_t put_str(char *buf, size_t len, const char *s, size_t n);
+static size_t put_path(char *buf, size_t len, const char *path);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static unsigned long record_thread(void)
+{
+    void *p;
+
+    if ((p = pthread_getspecific(thread_key)) == NULL)
+    {
+        p = (void *)(uintptr_t)__sync_add_and_fetch(&thread_n, 1);
+        pthread_setspecific(thread_key, p);
+    }
+
+    return (uintptr_t)p - 1;
+}
+
+/* append _n_ bytes of _s_ at _len_, escaped. returns the new length, or
+   RECORD_LINE_MAX if it doesn't fit */
+static size_t put_str(char *buf, size_t len, const char *s, size_t n)
+{
+    const char *end = s + n;
+
+    for (; s < end && len < RECORD_LINE_MAX - 2; s++)
+    {
+        switch (*s)
+        {
+            case '\\': buf[len++] = '\\'; buf[len++] = '\\'; break;
+            case '\t': buf[len++] = '\\'; buf[len++] = 't'; break;
+            case '\n': buf[len++] = '\\'; buf[len++] = 'n'; break;
+            default: buf[len++] = *s;
+        }
+    }
+
+    return (s < end) ? RECORD_LINE_MAX : len;
+}
+
+/* append _path_, anonymized with "recordanon" */
+static size_t put_path(char *buf, size_t len, const char *path)
+{
+    const char *p, *next, *ext;
+    unsigned long hash;
+    size_t n;
+    char tmp[32];
+
+    if (!discofs_options.record_anon)
+        return put_str(buf, len, path, strlen(path));
+
+    for (p = path; *p && len < RECORD_LINE_MAX; p = next)
+    {
+        if (*p == '/')
+        {
+            next = p + 1;
+            len = put_str(buf, len, "/", 1);
+            continue;
+        }
+
+        for (next = p; *next && *next != '/'; next++);
+        n = next - p;
+
+        /* the same name gets the same hash within one recording */
+        hash = record_salt;
+        for (ext = p; ext < next; ext++)
+            hash = ((hash << 5) + hash) + (unsigned char)*ext;
+
+        snprintf(tmp, sizeof tmp, "%08lx", hash & 0xffffffffUL);
+        len = put_str(buf, len, tmp, strlen(tmp));
+
+        /* short extensions tell what kind of file it is */
+        for (ext = next - 1; ext > p && *ext != '.'; ext--);
+        if (ext > p && next - ext <= 6)
+            len = put_str(buf, len, ext, next - ext);
+    }
+
+    return len;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int record_init(void)
+{
+    if (!discofs_options.record)
+        return 0;
+
+    if ((record_f = fopen(discofs_options.record, "w")) == NULL)
+    {
+        PERROR("opening record file");
+        return -1;
+    }
+
+    if (pthread_key_create(&thread_key, NULL))
+    {
+        fclose(record_f);
+        record_f = NULL;
+        return -1;
+    }
+
+    record_salt = 5381 ^ ((unsigned long)time(NULL) * 2654435761UL) ^ getpid();
+    record_t0 = stats_now();
+    record_flushed = time(NULL);
+
+    fprintf(record_f, "# discofs record %d\n", RECORD_VERSION);
+    fprintf(record_f, "# start\tduration\tthread\top\tresult\targuments...\n");
+
+    return 0;
+}
+
+void record_destroy(void)
+{
+    if (!record_f)
+        return;
+
+    pthread_mutex_lock(&m_record);
+
+    if (record_dropped)
+        ERROR("%lu operations were too long to record", record_dropped);
+
+    fclose(record_f);
+    record_f = NULL;
+
+    pthread_mutex_unlock(&m_record);
+
+    pthread_key_delete(thread_key);
+}
+
+stats_us record_start(void)
+{
+    return record_f ? stats_now() : 0;
+}
+
+void record_op(int op, stats_us start, int res, const char *sig, ...)
+{
+    char buf[RECORD_LINE_MAX];
+    size_t len;
+    int n;
+    va_list ap;
+    time_t now;
+
+    if (!start)
+        return;
+
+    n = snprintf(buf, sizeof buf, "%llu\t%llu\t%lu\t%s\t%d",
+            start - record_t0, stats_now() - start, record_thread(),
+            stats_op_name(op), res);
+    len = (n < 0) ? RECORD_LINE_MAX : (size_t)n;
+
+    va_start(ap, sig);
+    for (; *sig && len < RECORD_LINE_MAX - 1; sig++)
+    {
+        buf[len++] = '\t';
+
+        if (*sig == 'p')
+            len = put_path(buf, len, va_arg(ap, const char *));
+        else if (*sig == 's')
+        {
+            const char *s = va_arg(ap, const char *);
+            len = put_str(buf, len, s, strlen(s));
+        }
+        else
+        {
+            n = snprintf(buf + len, sizeof buf - len, "%lld", va_arg(ap, long long));
+            len = (n < 0 || (size_t)n >= sizeof buf - len) ? RECORD_LINE_MAX : len + n;
+        }
+    }
+    va_end(ap);
+
+    pthread_mutex_lock(&m_record);
+
+    if (!record_f)
+        ;
+    else if (len >= RECORD_LINE_MAX - 1)
+        record_dropped++;
+    else
+    {
+        buf[len++] = '\n';
+        fwrite(buf, 1, len, record_f);
+
+        /* records aren't lost if discofs doesn't exit cleanly */
+        now = time(NULL);
+        if (now - record_flushed >= RECORD_FLUSH_INTERVAL)
+        {
+            fflush(record_f);
+            record_flushed = now;
+        }
+    }
+
+    pthread_mutex_unlock(&m_record);
+}
@@ -0,0 +1,54 @@
+/*! @file record.h
+ * recording of file system operations for bench/fsreplay.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_RECORD_H
+#define DISCOFS_RECORD_H
+
+#include "config.h"
+#include "discofs.h"
+#include "stats.h"
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+#define RECORD_VERSION 1
+
+/*! longest record, longer ones are dropped */
+#define RECORD_LINE_MAX 16384
+
+/*! seconds between two flushes of the record file */
+#define RECORD_FLUSH_INTERVAL 1
+
+/*! the record file starts with "# discofs record RECORD_VERSION", followed
+ *  by one line per operation with these fields, separated by '\t':
+ *  - start (µs since recording started), duration (µs)
+ *  - thread: a small number per fuse thread
+ *  - the operation (see stats_op_name()) and its return value
+ *  - the arguments of the operation, see debugops.c
+ * '\\', '\t' and '\n' in paths and names are escaped as in C. with
+ * "recordanon", each path component is replaced by a hash, its extension
+ * is kept */
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! without "record", nothing is recorded */
+int record_init(void);
+void record_destroy(void);
+
+/*! start of an operation, 0 if not recording */
+stats_us record_start(void);
+
+/*! record the operation _op_ (a STATS_OP_ hist) started at _start_ that
+   returned _res_. _sig_ describes the arguments following it: 'p' a path,
+   's' a string, 'n' a long long */
+void record_op(int op, stats_us start, int res, const char *sig, ...);
+
+#endif
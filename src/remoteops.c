@@ -14,6 +14,7 @@
 #include "conflict.h"
 #include "transfer.h"
 #include "funcs.h"
+#include "rcall.h"
 
 #include <errno.h>
 #include <unistd.h>
@@ -84,7 +85,7 @@ int remoteop_rename(const char *from, const char *to)
     /* do the actual renaming */
     if (pt)
     {
-        res = rename(pf, pt);
+        res = rcall_rename(pf, pt);
         free(pf);
         free(pt);
 
@@ -109,8 +110,8 @@ int remoteop_rename(const char *from, const char *to)
     else
     {
         /* one of those two will work */
-        unlink(pf);
-        rmdir(pf);
+        rcall_unlink(pf);
+        rcall_rmdir(pf);
 
         res = 0;
         free(pf);
@@ -129,7 +130,7 @@ int remoteop_create(const char *path, int flags, mode_t mode)
 
     p = remote_path(path);
 
-    fd = open(p, flags, mode);
+    fd = rcall_open(p, flags, mode);
 
     free(p);
 
@@ -169,7 +170,7 @@ int remoteop_unlink(const char *path)
     if (!p)
         return -EIO;
 
-    res = unlink(p);
+    res = rcall_unlink(p);
     free(p);
 
     if (res)
@@ -187,7 +188,7 @@ int remoteop_symlink(const char *to, const char *path)
     if (!p)
         return -EIO;
 
-    res = symlink(to, p);
+    res = rcall_symlink(to, p);
     free(p);
 
     if (res)
@@ -210,7 +211,7 @@ int remoteop_mkdir(const char *path, mode_t mode)
     if (!p)
         return -EIO;
 
-    res = mkdir(p, mode);
+    res = rcall_mkdir(p, mode);
     free(p);
 
     if (res)
@@ -228,7 +229,7 @@ int remoteop_rmdir(const char *path)
     if (!p)
         return -EIO;
 
-    res = rmdir(p);
+    res = rcall_rmdir(p);
     free(p);
 
     if (res)
@@ -259,7 +260,7 @@ int remoteop_chown(const char *path, uid_t uid, gid_t gid)
     if (!p)
         return -EIO;
 
-    res = chown(p, uid, gid);
+    res = rcall_chown(p, uid, gid);
     free(p);
 
     if (res)
@@ -280,7 +281,7 @@ int remoteop_chmod(const char *path, mode_t mode)
     if (!p)
         return -EIO;
 
-    res = chmod(p, mode);
+    res = rcall_chmod(p, mode);
     free (p);
 
     if (res)
@@ -303,7 +304,7 @@ int remoteop_setxattr(const char *path, const char *name, const char *value,
     if (!p)
         return -EIO;
 
-    res = lsetxattr(p, name, value, size, flags);
+    res = rcall_lsetxattr(p, name, value, size, flags);
     free(p);
 
     if (res)
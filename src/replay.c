@@ -0,0 +1,488 @@
+/*! @file replay.c
+ * parallel replay of scheduled remote operations.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "replay.h"
+
+#include "discofs.h"
+#include "state.h"
+#include "log.h"
+#include "job.h"
+#include "remoteops.h"
+#include "queue.h"
+#include "db.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! a job and its place in the dependency graph */
+struct node
+{
+    struct job *job;
+    size_t deps;        /* number of unfinished jobs this one waits for */
+    size_t *next;       /* jobs waiting for this one */
+    size_t next_n;
+    int reason;         /* argument for job_return() */
+};
+
+/*! the batch that is currently replayed */
+static struct replay
+{
+    struct node *nodes;
+    size_t n;
+    size_t *ready;      /* jobs that can be performed, FIFO */
+    size_t ready_head, ready_tail;
+    size_t pending;     /* jobs that didn't finish yet */
+} r;
+
+static pthread_mutex_t m_replay = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_replay = PTHREAD_COND_INITIALIZER;
+
+/*! helper threads, started in op_init() */
+static pthread_t *replay_pool = NULL;
+static size_t replay_pool_n = 0;
+static int replay_started = 0;
+static int replay_exit = 0;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static int replay_perform(struct job *j);
+static int path_related(const char *a, const char *b);
+static int path_below(const char *path, const char *dir);
+static int job_depends(const struct job *a, const struct job *b);
+static int replay_graph(void);
+static void replay_finish(size_t i, int reason);
+static void replay_take(void);
+static void *replay_main(void *arg);
+static int replay_grow(void);
+static int node_cmp(const void *a, const void *b);
+static void replay_order(void);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static int replay_perform(struct job *j)
+{
+    if (!j)
+        return -1;
+
+    switch (j->op)
+    {
+        case JOB_RENAME:
+            return remoteop_rename(j->path, j->s1);
+        case JOB_CREATE:
+            return remoteop_create(j->path, j->n1, j->n2);
+        case JOB_UNLINK:
+            return remoteop_unlink(j->path);
+        case JOB_SYMLINK:
+            return remoteop_symlink(j->s1, j->path);
+        case JOB_LINK:
+            return remoteop_link(j->s1, j->path);
+        case JOB_MKDIR:
+            return remoteop_mkdir(j->path, j->n1);
+        case JOB_RMDIR:
+            return remoteop_rmdir(j->path);
+        case JOB_CHOWN:
+            return remoteop_chown(j->path, j->n1, j->n2);
+        case JOB_CHMOD:
+            return remoteop_chmod(j->path, j->n1);
+#if HAVE_SETXATTR
+        case JOB_SETXATTR:
+            return remoteop_setxattr(j->path, j->s1, j->s2, j->n1, j->n2);
+#endif
+    }
+
+    return -1;
+}
+
+/* return non-zero if _a_ and _b_ are the same or one is below the other */
+static int path_related(const char *a, const char *b)
+{
+    size_t a_len = strlen(a);
+    size_t b_len = strlen(b);
+
+    if (a_len > b_len)
+    {
+        const char *tmp = a;
+        a = b;
+        b = tmp;
+        a_len = b_len;
+    }
+
+    if (strncmp(a, b, a_len))
+        return 0;
+
+    return (b[a_len] == '\0' || b[a_len] == '/' || !strcmp(a, "/"));
+}
+
+/* return non-zero if _path_ is _dir_ or below it */
+static int path_below(const char *path, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    if (strncmp(path, dir, len))
+        return 0;
+
+    return (path[len] == '\0' || path[len] == '/' || !strcmp(dir, "/"));
+}
+
+/* return non-zero if _b_ must not be performed before _a_ has finished.
+   this is the case if the jobs touch the same path or a path below the
+   other's: parent mkdir before child create, rmdir after the unlinks
+   inside, renames in order */
+static int job_depends(const struct job *a, const struct job *b)
+{
+    /* s1 is a path for RENAME and LINK, but the link content for SYMLINK */
+#define S1_PATH(j) (((j)->op & (JOB_RENAME | JOB_LINK)) && (j)->s1)
+
+    if (path_related(a->path, b->path))
+        return 1;
+    if (S1_PATH(a) && path_related(a->s1, b->path))
+        return 1;
+    if (S1_PATH(b) && path_related(a->path, b->s1))
+        return 1;
+    if (S1_PATH(a) && S1_PATH(b) && path_related(a->s1, b->s1))
+        return 1;
+
+    return 0;
+#undef S1_PATH
+}
+
+/* add an edge from every job to all later jobs depending on it */
+static int replay_graph(void)
+{
+    size_t i, k;
+    size_t *tmp;
+
+    for (i = 0; i < r.n; i++)
+    {
+        for (k = i + 1; k < r.n; k++)
+        {
+            if (!job_depends(r.nodes[i].job, r.nodes[k].job))
+                continue;
+
+            tmp = realloc(r.nodes[i].next, (r.nodes[i].next_n + 1) * sizeof *tmp);
+            if (!tmp)
+                return -1;
+
+            r.nodes[i].next = tmp;
+            r.nodes[i].next[r.nodes[i].next_n++] = k;
+            r.nodes[k].deps++;
+        }
+
+        if (!r.nodes[i].deps)
+            r.ready[r.ready_tail++] = i;
+    }
+
+    return 0;
+}
+
+/* mark job _i_ finished and release the jobs waiting for it.
+   m_replay must be held */
+static void replay_finish(size_t i, int reason)
+{
+    size_t k;
+    struct node *nd = &r.nodes[i], *next;
+
+    nd->reason = reason;
+
+    for (k = 0; k < nd->next_n; k++)
+    {
+        next = &r.nodes[nd->next[k]];
+
+        /* don't rename into a directory that couldn't be created etc.,
+           try again after it */
+        if (reason != JOB_DONE)
+            next->reason = JOB_BLOCKED;
+
+        if (--next->deps == 0)
+            r.ready[r.ready_tail++] = nd->next[k];
+    }
+
+    r.pending--;
+    pthread_cond_broadcast(&c_replay);
+}
+
+/* take a ready job of the current batch and perform it.
+   m_replay must be held, it is released while the job runs */
+static void replay_take(void)
+{
+    size_t i;
+    int res, reason;
+    struct job *j;
+
+    i = r.ready[r.ready_head++];
+    j = r.nodes[i].job;
+    reason = r.nodes[i].reason;
+
+    pthread_mutex_unlock(&m_replay);
+
+    /* going offline: try again later */
+    if (reason == JOB_DONE && (!ONLINE || EXITING))
+        reason = JOB_LOCKED;
+
+    /* JOB_BLOCKED if a job this one depends on failed */
+    if (reason == JOB_DONE)
+    {
+        VERBOSE("performing %s on %s", job_opstr(j->op), j->path);
+        res = replay_perform(j);
+        reason = (!res) ? JOB_DONE : JOB_FAILED;
+        j->error = -res;
+    }
+
+    pthread_mutex_lock(&m_replay);
+    replay_finish(i, reason);
+}
+
+/* helper thread _arg_ (1, 2, ...) takes part in all batches while the
+   "threads" option allows it */
+static void *replay_main(void *arg)
+{
+    size_t id = (size_t)arg;
+
+    pthread_mutex_lock(&m_replay);
+
+    for (;;)
+    {
+        while (!replay_exit && (r.ready_head == r.ready_tail || id >= discofs_options.threads))
+            pthread_cond_wait(&c_replay, &m_replay);
+
+        if (replay_exit)
+            break;
+
+        replay_take();
+    }
+
+    pthread_mutex_unlock(&m_replay);
+    return NULL;
+}
+
+/* start helper threads until there are "threads" - 1 */
+static int replay_grow(void)
+{
+    pthread_t *tmp;
+
+    while (replay_pool_n + 1 < discofs_options.threads)
+    {
+        tmp = realloc(replay_pool, (replay_pool_n + 1) * sizeof *tmp);
+        if (!tmp)
+            return -1;
+        replay_pool = tmp;
+
+        if (pthread_create(&replay_pool[replay_pool_n], NULL, replay_main,
+                    (void *)(replay_pool_n + 1)))
+            return -1;
+
+        replay_pool_n++;
+    }
+
+    return 0;
+}
+
+/* order of creation */
+static int node_cmp(const void *a, const void *b)
+{
+    const struct node *x = a, *y = b;
+
+    return (x->job->id > y->job->id) - (x->job->id < y->job->id);
+}
+
+/* a RENAME moves the older jobs below its new name along (job_rename_dir),
+   e.g. "mkdir d/sub, mv d e" is stored as MKDIR e/sub before RENAME d->e.
+   move every RENAME in front of the first such job, unless a job in
+   between must be performed before it */
+static void replay_order(void)
+{
+    size_t i, k, t;
+    struct node ren;
+    const struct job *a, *b;
+
+#define BELOW(j, dir) (path_below((j)->path, dir) \
+        || (((j)->op & (JOB_RENAME | JOB_LINK)) && (j)->s1 && path_below((j)->s1, dir)))
+
+    for (k = 0; k < r.n; k++)
+    {
+        b = r.nodes[k].job;
+        if (b->op != JOB_RENAME || !b->s1)
+            continue;
+
+        for (t = 0; t < k && !BELOW(r.nodes[t].job, b->s1); t++)
+            ;
+
+        for (i = t; i < k; i++)
+        {
+            a = r.nodes[i].job;
+            if (!BELOW(a, b->s1) && job_depends(a, b))
+                break;
+        }
+
+        if (t == k || i < k)
+            continue;
+
+        ren = r.nodes[k];
+        memmove(&r.nodes[t + 1], &r.nodes[t], (k - t) * sizeof *r.nodes);
+        r.nodes[t] = ren;
+    }
+
+#undef BELOW
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int replay_start(void)
+{
+    replay_started = 1;
+
+    return replay_grow();
+}
+
+void replay_stop(void)
+{
+    size_t i;
+
+    pthread_mutex_lock(&m_replay);
+    replay_exit = 1;
+    pthread_cond_broadcast(&c_replay);
+    pthread_mutex_unlock(&m_replay);
+
+    for (i = 0; i < replay_pool_n; i++)
+        pthread_join(replay_pool[i], NULL);
+
+    free(replay_pool);
+    replay_pool = NULL;
+    replay_pool_n = 0;
+    replay_started = 0;
+}
+
+int replay_run(void)
+{
+    size_t i, k, helpers;
+    struct node *next;
+    timer_ms due;
+    queue *q;
+    struct job *j;
+
+    job_store();
+
+    q = q_init();
+    if (!q)
+        return -1;
+
+    if (db_job_get_ready(q, REPLAY_BATCH, REPLAY_JOBS) != DB_OK || q_empty(q))
+    {
+        q_free(q, job_free);
+        return 0;
+    }
+
+    /* "threads" may have been raised with discofsctl */
+    if (replay_started && replay_grow())
+        ERROR("starting replay threads failed");
+
+    pthread_mutex_lock(&m_replay);
+
+    memset(&r, 0, sizeof r);
+
+    r.nodes = calloc(REPLAY_BATCH, sizeof *r.nodes);
+    r.ready = malloc(REPLAY_BATCH * sizeof *r.ready);
+
+    if (!r.nodes || !r.ready)
+    {
+        free(r.nodes);
+        free(r.ready);
+        memset(&r, 0, sizeof r);
+        pthread_mutex_unlock(&m_replay);
+        q_free(q, job_free);
+        return -1;
+    }
+
+    while ((j = q_dequeue(q)))
+    {
+        r.nodes[r.n].job = j;
+        r.nodes[r.n].reason = JOB_DONE;
+        r.n++;
+    }
+    q_free(q, NULL);
+
+    /* the jobs were fetched by priority, but depend on each other in the
+       order they were created */
+    qsort(r.nodes, r.n, sizeof *r.nodes, node_cmp);
+    replay_order();
+
+    /* out of memory: try again later */
+    if (replay_graph())
+    {
+        ERROR("building replay dependency graph failed");
+        for (i = 0; i < r.n; i++)
+            r.nodes[i].reason = JOB_LOCKED;
+        r.ready_head = r.ready_tail = 0;
+        pthread_mutex_unlock(&m_replay);
+        goto out;
+    }
+
+    r.pending = r.n;
+
+    helpers = (discofs_options.threads > 1) ? discofs_options.threads - 1 : 0;
+    if (helpers > replay_pool_n)
+        helpers = replay_pool_n;
+
+    DEBUG("replaying %lu jobs with %lu threads", (unsigned long)r.n, (unsigned long)helpers + 1);
+
+    /* hand the batch to the helper threads. the worker thread takes part,
+       too, until all jobs are finished */
+    pthread_cond_broadcast(&c_replay);
+
+    while (r.pending)
+    {
+        if (r.ready_head == r.ready_tail)
+            pthread_cond_wait(&c_replay, &m_replay);
+        else
+            replay_take();
+    }
+
+    pthread_mutex_unlock(&m_replay);
+
+out:
+    /* finish jobs in the order they were created. edges only lead to later
+       jobs, so a job that waits for a failed one is due after it */
+    for (i = 0; i < r.n; i++)
+    {
+        due = job_return(r.nodes[i].job, r.nodes[i].reason);
+
+        for (k = 0; k < r.nodes[i].next_n; k++)
+        {
+            next = &r.nodes[r.nodes[i].next[k]];
+            if (next->reason == JOB_BLOCKED && next->job->due < due)
+                next->job->due = due;
+        }
+
+        free(r.nodes[i].next);
+    }
+
+    free(r.nodes);
+    free(r.ready);
+
+    pthread_mutex_lock(&m_replay);
+    i = r.n;
+    memset(&r, 0, sizeof r);
+    pthread_mutex_unlock(&m_replay);
+
+    return i;
+}
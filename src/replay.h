@@ -0,0 +1,41 @@
+/*! @file replay.h
+ * parallel replay of scheduled remote operations.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_REPLAY_H
+#define DISCOFS_REPLAY_H
+
+#include "config.h"
+#include "discofs.h"
+#include "job.h"
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! jobs fetched from the db per replay pass */
+#define REPLAY_BATCH 512
+
+/*! jobs that are replayed (everything except transfers) */
+#define REPLAY_JOBS (JOB_ANY & ~(JOB_PUSH | JOB_PULL))
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! start the helper threads. like the other threads, they must be started
+   after fuse has daemonized */
+int replay_start(void);
+
+/*! stop and join the helper threads */
+void replay_stop(void);
+
+/*! perform due non-transfer jobs on the remote fs, independent ones in
+   parallel. returns the number of jobs that were fetched */
+int replay_run(void);
+
+#endif
@@ -0,0 +1,808 @@
+/*! @file sparse.c
+ * sparse, block-granular cache files.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "sparse.h"
+
+#include "discofs.h"
+#include "state.h"
+#include "log.h"
+#include "funcs.h"
+#include "lock.h"
+#include "hashtable.h"
+#include "db.h"
+#include "rcall.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+#define MAP_TEST(map, i) ((map)[(i) / 8] & (1 << ((i) % 8)))
+#define MAP_SET(map, i) ((map)[(i) / 8] |= (1 << ((i) % 8)))
+
+/*! block bitmap of a file.
+   "map" is NULL if all blocks are present */
+struct sparse
+{
+    char *path;
+    off_t size;
+    size_t nblocks;
+    size_t missing;         /* number of blocks not present */
+    unsigned char *map;
+    int fd_remote;          /* read from this when fetching blocks... */
+    int fd_cache;           /* ...and write to this */
+    unsigned int refs;
+    bool dirty;
+    pthread_mutex_t m;
+};
+
+/* bitmaps currently in use, key is the path */
+static hashtable *sparse_ht = NULL;
+static pthread_mutex_t m_sparse_ht = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static hash_t sparse_hash(const void *p, const void *n);
+static int sparse_cmp(const void *p1, const void *p2, const void *n);
+
+static struct sparse *sparse_alloc(const char *path, off_t size, unsigned char *map);
+static void sparse_free(void *p);
+
+static struct sparse *sparse_get(const char *path);
+static void sparse_put(struct sparse *s);
+
+static size_t sparse_count_missing(const struct sparse *s);
+static int sparse_resize(struct sparse *s, off_t size);
+static int sparse_open_cache(const char *path);
+static int sparse_fetch_block(struct sparse *s, size_t i);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static hash_t sparse_hash(const void *p, const void *n)
+{
+    return djb2(p, SIZE_MAX);
+}
+
+static int sparse_cmp(const void *p1, const void *p2, const void *n)
+{
+    return strcmp(p1, p2);
+}
+
+static struct sparse *sparse_alloc(const char *path, off_t size, unsigned char *map)
+{
+    struct sparse *s = malloc(sizeof *s);
+
+    if (!s)
+        return NULL;
+
+    s->path = strdup(path);
+    if (!s->path)
+    {
+        free(s);
+        return NULL;
+    }
+
+    s->size = size;
+    s->nblocks = SPARSE_NBLOCKS(size);
+    s->map = map;
+    s->missing = sparse_count_missing(s);
+    s->fd_remote = -1;
+    s->fd_cache = -1;
+    s->refs = 0;
+    s->dirty = false;
+    pthread_mutex_init(&s->m, NULL);
+
+    return s;
+}
+
+static void sparse_free(void *p)
+{
+    struct sparse *s = p;
+
+    if (!s)
+        return;
+
+    if (s->fd_remote != -1)
+        close(s->fd_remote);
+    if (s->fd_cache != -1)
+        close(s->fd_cache);
+
+    pthread_mutex_destroy(&s->m);
+    free(s->map);
+    free(s->path);
+    free(s);
+}
+
+/* get the bitmap of _path_, loading it from the db if necessary. the
+   returned object must be released with sparse_put() */
+static struct sparse *sparse_get(const char *path)
+{
+    struct sparse *s;
+    off_t size;
+    unsigned char *map;
+    size_t mapsize;
+
+    pthread_mutex_lock(&m_sparse_ht);
+
+    s = ht_get(sparse_ht, path);
+
+    if (!s && db_sparse_get(path, &size, &map, &mapsize) == DB_OK)
+    {
+        if (mapsize < SPARSE_MAPSIZE(SPARSE_NBLOCKS(size)))
+        {
+            ERROR("block bitmap of %s is truncated", path);
+            free(map);
+        }
+        else if ((s = sparse_alloc(path, size, map)) == NULL)
+        {
+            free(map);
+        }
+        else if (ht_insert(sparse_ht, s->path, s) != HT_OK)
+        {
+            sparse_free(s);
+            s = NULL;
+        }
+    }
+
+    if (s)
+        s->refs++;
+
+    pthread_mutex_unlock(&m_sparse_ht);
+    return s;
+}
+
+static void sparse_put(struct sparse *s)
+{
+    if (!s)
+        return;
+
+    pthread_mutex_lock(&m_sparse_ht);
+
+    if (--s->refs == 0)
+    {
+        if (s->dirty && s->map)
+            db_sparse_set(s->path, s->size, s->map, SPARSE_MAPSIZE(s->nblocks));
+
+        /* the entry might have been replaced by a rename */
+        if (ht_get(sparse_ht, s->path) == s)
+            ht_remove(sparse_ht, s->path);
+
+        sparse_free(s);
+    }
+
+    pthread_mutex_unlock(&m_sparse_ht);
+}
+
+static size_t sparse_count_missing(const struct sparse *s)
+{
+    size_t i, n = 0;
+
+    if (!s->map)
+        return 0;
+
+    for (i = 0; i < s->nblocks; i++)
+    {
+        if (!MAP_TEST(s->map, i))
+            n++;
+    }
+    return n;
+}
+
+/* adjust the bitmap to a new file size. blocks that are completely beyond
+   the old size are present by definition (the file is zero-filled there).
+   must be called with s->m held */
+static int sparse_resize(struct sparse *s, off_t size)
+{
+    size_t i, nblocks;
+    unsigned char *map;
+
+    if (!s->map)
+    {
+        s->size = size;
+        return 0;
+    }
+
+    nblocks = SPARSE_NBLOCKS(size);
+
+    if (SPARSE_MAPSIZE(nblocks) != SPARSE_MAPSIZE(s->nblocks))
+    {
+        map = realloc(s->map, SPARSE_MAPSIZE(nblocks) ? SPARSE_MAPSIZE(nblocks) : 1);
+        if (!map)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        s->map = map;
+    }
+
+    for (i = s->nblocks; i < nblocks; i++)
+        MAP_SET(s->map, i);
+
+    s->size = size;
+    s->nblocks = nblocks;
+    s->missing = sparse_count_missing(s);
+    s->dirty = true;
+
+    /* e.g. truncated to 0 */
+    if (s->missing == 0)
+    {
+        db_sparse_delete(s->path);
+        free(s->map);
+        s->map = NULL;
+        s->dirty = false;
+    }
+
+    return 0;
+}
+
+/* open the cache file for writing, even if its mode doesn't allow that */
+static int sparse_open_cache(const char *path)
+{
+    int fd;
+    char *p;
+    struct stat st;
+
+    p = cache_path(path);
+    if (!p)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    fd = open(p, O_WRONLY);
+
+    if (fd == -1 && errno == EACCES && lstat(p, &st) == 0)
+    {
+        chmod(p, st.st_mode | S_IWUSR);
+        fd = open(p, O_WRONLY);
+        chmod(p, st.st_mode);
+    }
+
+    free(p);
+    return fd;
+}
+
+/* copy block _i_ from the remote file to the cache. must be called with
+   s->m held */
+static int sparse_fetch_block(struct sparse *s, size_t i)
+{
+    char *p;
+    char *buf;
+    off_t offset;
+    size_t len;
+    ssize_t res;
+
+    if (!s->map || i >= s->nblocks || MAP_TEST(s->map, i))
+        return 0;
+
+    if (!ONLINE)
+        return -EIO;
+
+    if (s->fd_remote == -1)
+    {
+        if ((p = remote_path(s->path)) == NULL)
+            return -EIO;
+        s->fd_remote = rcall_open(p, O_RDONLY, 0);
+        free(p);
+
+        if (s->fd_remote == -1)
+            return -errno;
+    }
+
+    if (s->fd_cache == -1 && (s->fd_cache = sparse_open_cache(s->path)) == -1)
+        return -errno;
+
+    offset = (off_t)i * SPARSE_BLOCK_SIZE;
+    len = SPARSE_BLOCK_SIZE;
+
+    /* never write beyond the (possibly truncated) cache file */
+    if (offset + len > s->size)
+        len = s->size - offset;
+
+    if ((buf = malloc(len)) == NULL)
+        return -ENOMEM;
+
+    res = rcall_pread(s->fd_remote, buf, len, offset);
+
+    if (res > 0 && pwrite(s->fd_cache, buf, res, offset) != res)
+        res = -1;
+
+    free(buf);
+
+    if (res < 0)
+    {
+        res = -errno;
+        PERROR("fetching block");
+
+        /* a timed out call owns the descriptor now */
+        if (res != -ETIMEDOUT)
+            close(s->fd_remote);
+        s->fd_remote = -1;
+        return res;
+    }
+
+    MAP_SET(s->map, i);
+    s->dirty = true;
+
+    /* all blocks there -> file isn't sparse anymore */
+    if (--s->missing == 0)
+    {
+        VERBOSE("all blocks of %s fetched", s->path);
+        db_sparse_delete(s->path);
+        free(s->map);
+        s->map = NULL;
+        s->dirty = false;
+    }
+
+    return 0;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int sparse_init(void)
+{
+    if (ht_init(&sparse_ht, sparse_hash, sparse_cmp) == HT_ERROR)
+        return -1;
+
+    return 0;
+}
+
+void sparse_destroy(void)
+{
+    sparse_store();
+
+    pthread_mutex_lock(&m_sparse_ht);
+    ht_free_f(sparse_ht, NULL, sparse_free);
+    sparse_ht = NULL;
+    pthread_mutex_unlock(&m_sparse_ht);
+}
+
+int sparse_store(void)
+{
+    int res = DB_OK;
+    htiter *it;
+    struct sparse *s;
+
+    pthread_mutex_lock(&m_sparse_ht);
+
+    it = ht_iter(sparse_ht);
+    if (!it)
+    {
+        pthread_mutex_unlock(&m_sparse_ht);
+        return -1;
+    }
+
+    while (res == DB_OK && htiter_next(it, NULL, (void**)&s))
+    {
+        pthread_mutex_lock(&s->m);
+
+        if (s->dirty && s->map)
+            res = db_sparse_set(s->path, s->size, s->map, SPARSE_MAPSIZE(s->nblocks));
+        s->dirty = false;
+
+        pthread_mutex_unlock(&s->m);
+    }
+
+    free(it);
+    pthread_mutex_unlock(&m_sparse_ht);
+
+    if (res != DB_OK)
+        return -1;
+    return 0;
+}
+
+int sparse_create(const char *path)
+{
+    int fd;
+    char *pr, *pc;
+    size_t p_len = strlen(path);
+    struct stat st;
+    struct sparse *s;
+    unsigned char *map;
+    size_t mapsize;
+
+    pr = remote_path2(path, p_len);
+    pc = cache_path2(path, p_len);
+    if (!pr || !pc)
+    {
+        free(pr), free(pc);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (lstat(pr, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        free(pr), free(pc);
+        errno = EINVAL;
+        return -1;
+    }
+
+    VERBOSE("creating placeholder for %s", path);
+
+    /* a truncated file has no blocks allocated */
+    if ((fd = open(pc, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1
+            || ftruncate(fd, st.st_size) == -1) {
+        if (fd != -1)
+            close(fd);
+        free(pr), free(pc);
+        return -1;
+    }
+    close(fd);
+
+    copy_attrs(pr, pc);
+    free(pr), free(pc);
+
+    if (st.st_size == 0)
+        return sparse_delete(path);
+
+    mapsize = SPARSE_MAPSIZE(SPARSE_NBLOCKS(st.st_size));
+    if ((map = calloc(mapsize, 1)) == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (db_sparse_set(path, st.st_size, map, mapsize) != DB_OK)
+    {
+        free(map);
+        return -1;
+    }
+
+    /* reset the in-memory bitmap if the file is being used */
+    if ((s = sparse_get(path)))
+    {
+        pthread_mutex_lock(&s->m);
+        free(s->map);
+        s->map = map;
+        s->size = st.st_size;
+        s->nblocks = SPARSE_NBLOCKS(st.st_size);
+        s->missing = s->nblocks;
+        s->dirty = false;
+        if (s->fd_remote != -1)
+        {
+            close(s->fd_remote);
+            s->fd_remote = -1;
+        }
+        pthread_mutex_unlock(&s->m);
+        sparse_put(s);
+    }
+    else
+        free(map);
+
+    return 0;
+}
+
+int sparse_has(const char *path)
+{
+    int res;
+    struct sparse *s;
+
+    s = sparse_get(path);
+    res = (s && s->map);
+    sparse_put(s);
+
+    return res;
+}
+
+int sparse_fetch(const char *path, off_t offset, size_t size)
+{
+    int res = 0;
+    size_t i, last;
+    struct sparse *s;
+
+    if (!size || (s = sparse_get(path)) == NULL)
+        return 0;
+
+    i = offset / SPARSE_BLOCK_SIZE;
+    last = (offset + size - 1) / SPARSE_BLOCK_SIZE;
+
+    /* don't hold the lock for the whole range so concurrent readers
+       of the same file can make progress */
+    for (; !res && i <= last; i++)
+    {
+        pthread_mutex_lock(&s->m);
+        res = sparse_fetch_block(s, i);
+        pthread_mutex_unlock(&s->m);
+    }
+
+    sparse_put(s);
+    return res;
+}
+
+int sparse_complete(const char *path)
+{
+    int res = 0;
+    size_t i;
+    struct sparse *s;
+
+    if ((s = sparse_get(path)) == NULL)
+        return 0;
+
+    for (i = 0; !res && s->map && i < s->nblocks; i++)
+    {
+        pthread_mutex_lock(&s->m);
+        res = sparse_fetch_block(s, i);
+        pthread_mutex_unlock(&s->m);
+    }
+
+    sparse_put(s);
+    return res;
+}
+
+int sparse_write(const char *path, off_t offset, size_t size)
+{
+    int res = 0;
+    size_t i, first, last;
+    off_t end = offset + size;
+    struct sparse *s;
+
+    if (!size || (s = sparse_get(path)) == NULL)
+        return 0;
+
+    pthread_mutex_lock(&s->m);
+
+    first = offset / SPARSE_BLOCK_SIZE;
+    last = (end - 1) / SPARSE_BLOCK_SIZE;
+
+    /* blocks that are only partially overwritten need their old content,
+       also if the write starts at the beginning of the block it ends in */
+    if (offset % SPARSE_BLOCK_SIZE)
+        res = sparse_fetch_block(s, first);
+
+    if (!res && end < s->size && end % SPARSE_BLOCK_SIZE)
+        res = sparse_fetch_block(s, last);
+
+    if (!res && end > s->size)
+        res = sparse_resize(s, end);
+
+    for (i = first; !res && s->map && i <= last && i < s->nblocks; i++)
+    {
+        if (!MAP_TEST(s->map, i))
+        {
+            MAP_SET(s->map, i);
+            s->missing--;
+            s->dirty = true;
+        }
+    }
+
+    pthread_mutex_unlock(&s->m);
+    sparse_put(s);
+    return res;
+}
+
+int sparse_truncate(const char *path, off_t size)
+{
+    int res;
+    struct sparse *s;
+
+    if ((s = sparse_get(path)) == NULL)
+        return 0;
+
+    pthread_mutex_lock(&s->m);
+    res = sparse_resize(s, size);
+    pthread_mutex_unlock(&s->m);
+
+    sparse_put(s);
+    return res;
+}
+
+int sparse_evict(const char *path)
+{
+    int res;
+    char *p;
+    struct stat st;
+    unsigned char *map;
+    size_t mapsize;
+    off_t oldsize;
+    bool was_sparse;
+
+    if (lock_has(path, LOCK_OPEN))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    p = cache_path(path);
+    if (!p)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (lstat(p, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        free(p);
+        return -1;
+    }
+
+    if ((was_sparse = (db_sparse_get(path, &oldsize, &map, &mapsize) == DB_OK)))
+        free(map);
+
+    mapsize = SPARSE_MAPSIZE(SPARSE_NBLOCKS(st.st_size));
+    if ((map = calloc(mapsize, 1)) == NULL)
+    {
+        free(p);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* store the empty bitmap first, so the file is never considered
+       complete while its blocks are gone */
+    if (db_sparse_set(path, st.st_size, map, mapsize) != DB_OK)
+    {
+        free(map);
+        free(p);
+        return -1;
+    }
+    free(map);
+
+    /* the file was opened in the meantime. its file handle might not know
+       about missing blocks, so leave the data alone */
+    if (lock_has(path, LOCK_OPEN))
+    {
+        if (!was_sparse)
+            db_sparse_delete(path);
+        free(p);
+        errno = EBUSY;
+        return -1;
+    }
+
+    DEBUG("evicting blocks of %s", path);
+
+    /* truncating to 0 frees all blocks, truncating back keeps the size */
+    res = truncate(p, 0);
+    if (!res)
+        res = truncate(p, st.st_size);
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    {
+        struct timespec times[2];
+        times[0] = st.st_atim;
+        times[1] = st.st_mtim;
+        utimensat(-1, p, times, AT_SYMLINK_NOFOLLOW);
+    }
+#endif
+
+    free(p);
+    return res;
+}
+
+int sparse_open(const char *path)
+{
+    struct sparse *s;
+
+    /* the reference is kept until sparse_close() */
+    s = sparse_get(path);
+
+    return (s != NULL);
+}
+
+void sparse_close(const char *path)
+{
+    struct sparse *s;
+
+    pthread_mutex_lock(&m_sparse_ht);
+    s = ht_get(sparse_ht, path);
+    pthread_mutex_unlock(&m_sparse_ht);
+
+    sparse_put(s);
+}
+
+int sparse_delete(const char *path)
+{
+    struct sparse *s;
+
+    pthread_mutex_lock(&m_sparse_ht);
+
+    if ((s = ht_get(sparse_ht, path)))
+    {
+        pthread_mutex_lock(&s->m);
+        free(s->map);
+        s->map = NULL;
+        s->missing = 0;
+        s->dirty = false;
+        pthread_mutex_unlock(&s->m);
+    }
+
+    pthread_mutex_unlock(&m_sparse_ht);
+
+    if (db_sparse_delete(path) != DB_OK)
+        return -1;
+    return 0;
+}
+
+int sparse_rename_file(const char *from, const char *to)
+{
+    struct sparse *s;
+    char *newpath;
+
+    sparse_store();
+
+    pthread_mutex_lock(&m_sparse_ht);
+
+    if ((s = ht_remove(sparse_ht, from)) && (newpath = strdup(to)))
+    {
+        /* an entry for "to" will be released by its last sparse_put() */
+        ht_remove(sparse_ht, to);
+
+        free(s->path);
+        s->path = newpath;
+        ht_insert(sparse_ht, s->path, s);
+    }
+
+    pthread_mutex_unlock(&m_sparse_ht);
+
+    db_sparse_delete(to);
+    if (db_sparse_rename_file(from, to) != DB_OK)
+        return -1;
+    return 0;
+}
+
+int sparse_rename_dir(const char *from, const char *to)
+{
+    htiter *it;
+    queue *q;
+    struct sparse *s;
+    char *p, *newpath;
+    size_t from_len = strlen(from);
+
+    sparse_store();
+
+    if ((q = q_init()) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&m_sparse_ht);
+
+    if ((it = ht_iter(sparse_ht)))
+    {
+        while (htiter_next(it, (void**)&p, (void**)&s))
+        {
+            if (!strncmp(p, from, from_len) && p[from_len] == '/')
+                q_enqueue(q, s);
+        }
+        free(it);
+    }
+
+    while ((s = q_dequeue(q)))
+    {
+        ht_remove(sparse_ht, s->path);
+
+        if ((newpath = join_path(to, s->path + from_len)))
+        {
+            free(s->path);
+            s->path = newpath;
+        }
+        ht_insert(sparse_ht, s->path, s);
+    }
+
+    pthread_mutex_unlock(&m_sparse_ht);
+    q_free(q, NULL);
+
+    if (db_sparse_rename_dir(from, to) != DB_OK)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*! @file sparse.h
+ * sparse, block-granular cache files.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_SPARSE_H
+#define DISCOFS_SPARSE_H
+
+#include "config.h"
+#include "discofs.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! size of one cache block */
+#define SPARSE_BLOCK_SIZE (64 * 1024)
+
+/*! number of blocks needed for a file of _size_ bytes */
+#define SPARSE_NBLOCKS(size) (((size) + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE)
+
+/*! number of bytes needed for the bitmap of _nblocks_ blocks */
+#define SPARSE_MAPSIZE(nblocks) (((nblocks) + 7) / 8)
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! initialize/destroy needed data structures */
+int sparse_init(void);
+void sparse_destroy(void);
+
+/*! store changed block bitmaps to db */
+int sparse_store(void);
+
+/*! replace the cache file with a hole-only placeholder of the remote file's
+   size. no data is transferred, blocks are fetched on demand */
+int sparse_create(const char *path);
+
+/*! return non-zero if not all blocks of _path_ are present in the cache */
+int sparse_has(const char *path);
+
+/*! make sure the blocks containing _size_ bytes at _offset_ are present.
+   @return 0 on success or -errno */
+int sparse_fetch(const char *path, off_t offset, size_t size);
+
+/*! fetch all missing blocks */
+int sparse_complete(const char *path);
+
+/*! prepare a write of _size_ bytes at _offset_ (fetches partially
+   overwritten blocks and marks the range present) */
+int sparse_write(const char *path, off_t offset, size_t size);
+
+/*! the cache file was truncated to _size_ */
+int sparse_truncate(const char *path, off_t size);
+
+/*! drop all cached blocks of _path_, but keep the file entry intact.
+   fails with EBUSY if the file is open */
+int sparse_evict(const char *path);
+
+/*! open/close: keep the bitmap of an open file in memory */
+int sparse_open(const char *path);
+void sparse_close(const char *path);
+
+/*! forget the bitmap (file was deleted or transferred completely) */
+int sparse_delete(const char *path);
+
+/*! rename bitmaps */
+int sparse_rename_file(const char *from, const char *to);
+int sparse_rename_dir(const char *from, const char *to);
+
+#endif
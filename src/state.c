@@ -7,7 +7,9 @@
 
 #include "log.h"
 #include "worker.h"
+#include "probe.h"
 
+#include <unistd.h>
 #include <pthread.h>
 
 /* the current state. can be STATE_ONLINE, STATE_OFFLINE or STATE_EXITING */
@@ -42,7 +44,15 @@ void state_set(int s, int *oldstate)
     else if (s == STATE_EXITING && s != state)
         VERBOSE("changing state to EXITING");
 
-    state = s;
+    if (s != state)
+    {
+        state = s;
+        pthread_mutex_unlock(&m_state);
+
+        /* e.g. start replaying jobs when going ONLINE */
+        worker_wakeup();
+        return;
+    }
 
     pthread_mutex_unlock(&m_state);
 }
@@ -55,29 +65,35 @@ void state_toggle_force_offline(void)
 
 void *state_check_main(void *arg)
 {
-    int oldstate = STATE_OFFLINE;
+    int up;
+    unsigned int n = 0;
+    unsigned int interval = PROBE_INTERVAL_MIN;
 
-    while (oldstate != STATE_EXITING)
+    while (state != STATE_EXITING)
     {
-        sleep(SLEEP_SHORT);
+        usleep(interval * 1000);
 
-        /* check and set state */
-        if (
-            !state_force_offline
-            && is_running(discofs_options.pid_file)
-            && is_reachable(discofs_options.host)
-            && is_mounted(discofs_options.remote_root)
-           )
-         {
+        up = !state_force_offline && probe_run();
 
-            state_set(STATE_ONLINE, &oldstate);
-
-            if (oldstate == STATE_OFFLINE)
-                worker_wakeup();
+        /* probe agrees with the state -> check less often */
+        if (up == (state == STATE_ONLINE))
+        {
+            n = 0;
+            interval *= 2;
+            if (interval > PROBE_INTERVAL_MAX)
+                interval = PROBE_INTERVAL_MAX;
         }
+        /* state changes only after a few probes in a row agree, but
+           those follow each other quickly */
         else
         {
-            state_set(STATE_OFFLINE, &oldstate);
+            interval = PROBE_INTERVAL_MIN;
+
+            if (++n >= (up ? PROBE_RISE : PROBE_FALL) || state_force_offline)
+            {
+                n = 0;
+                state_set(up ? STATE_ONLINE : STATE_OFFLINE, NULL);
+            }
         }
     }
 
@@ -0,0 +1,319 @@
+/*! @file stats.c
+ * counters and latency histograms, readable in the virtual stats file.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "stats.h"
+
+#include "state.h"
+#include "job.h"
+#include "db.h"
+#include "rcall.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+#define STATS_BUF_MIN 4096
+
+/* upper bound of histogram bucket _n_ in µs */
+#define BUCKET_BOUND(n) (16ULL << (2 * (n)))
+
+struct hist
+{
+    unsigned long long count;
+    unsigned long long sum;     /* µs */
+    unsigned long long errors;  /* only for file system operations */
+    unsigned long long buckets[STATS_BUCKETS];
+};
+
+/* updated without locks, values are only ever added */
+static unsigned long long counters[STATS_COUNTERS];
+static struct hist hists[STATS_HISTS];
+
+static const char *op_names[] =
+{
+    "getattr", "fgetattr", "access", "readlink", "opendir", "readdir",
+    "mknod", "mkdir", "rmdir", "unlink", "link", "symlink", "rename",
+    "releasedir", "open", "create", "flush", "release", "fsync",
+    "fsyncdir", "read", "write", "truncate", "chown", "chmod", "utimens",
+    "statfs", "setxattr", "getxattr", "listxattr"
+};
+
+/* in the order of the JOB_ bits */
+static const char *job_names[] =
+{
+    "pull", "push", "rename", "unlink", "symlink", "link", "mkdir",
+    "rmdir", "chmod", "chown", "setxattr", "create"
+};
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static void buf_printf(struct stats_buf *b, const char *fmt, ...);
+static void render_hist(struct stats_buf *b, const char *name,
+        const char *labels, const struct hist *h);
+static void render_job_count(job_op op, unsigned long n, void *arg);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static void buf_printf(struct stats_buf *b, const char *fmt, ...)
+{
+    int n;
+    char *tmp;
+    va_list ap;
+
+    for (;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+        va_end(ap);
+
+        if (n < 0)
+            return;
+        if (b->len + n < b->size)
+            break;
+
+        if ((tmp = realloc(b->data, 2 * b->size + n)) == NULL)
+            return;
+        b->data = tmp;
+        b->size = 2 * b->size + n;
+    }
+
+    b->len += n;
+}
+
+/* buckets of one histogram. _labels_ is "" or e.g. "op=\"read\"," */
+static void render_hist(struct stats_buf *b, const char *name,
+        const char *labels, const struct hist *h)
+{
+    int i;
+    unsigned long long n = 0;
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        n += h->buckets[i];
+        buf_printf(b, "%s_bucket{%sle=\"%g\"} %llu\n", name, labels,
+                BUCKET_BOUND(i) / 1e6, n);
+    }
+    buf_printf(b, "%s_bucket{%sle=\"+Inf\"} %llu\n", name, labels, h->count);
+
+    /* without the trailing comma */
+    if (*labels)
+    {
+        buf_printf(b, "%s_sum{%.*s} %g\n", name, (int)strlen(labels) - 1, labels, h->sum / 1e6);
+        buf_printf(b, "%s_count{%.*s} %llu\n", name, (int)strlen(labels) - 1, labels, h->count);
+    }
+    else
+    {
+        buf_printf(b, "%s_sum %g\n", name, h->sum / 1e6);
+        buf_printf(b, "%s_count %llu\n", name, h->count);
+    }
+}
+
+static void render_job_count(job_op op, unsigned long n, void *arg)
+{
+    int i;
+
+    for (i = 0; i < sizeof job_names / sizeof *job_names; i++)
+    {
+        if (op == (1U << i))
+        {
+            buf_printf(arg, "discofs_jobs{op=\"%s\"} %lu\n", job_names[i], n);
+            return;
+        }
+    }
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+stats_us stats_now(void)
+{
+#if HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (stats_us)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (stats_us)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+void stats_add(int counter, long long n)
+{
+    __sync_fetch_and_add(&counters[counter], n);
+}
+
+void stats_set(int counter, unsigned long long v)
+{
+    counters[counter] = v;
+}
+
+void stats_observe(int hist, stats_us start)
+{
+    int i;
+    stats_us us = stats_now() - start;
+    struct hist *h = &hists[hist];
+
+    for (i = 0; i < STATS_BUCKETS && us >= BUCKET_BOUND(i); i++);
+
+    if (i < STATS_BUCKETS)
+        __sync_fetch_and_add(&h->buckets[i], 1);
+    __sync_fetch_and_add(&h->sum, us);
+    __sync_fetch_and_add(&h->count, 1);
+}
+
+const char *stats_op_name(int hist)
+{
+    return op_names[hist - STATS_OP_FIRST];
+}
+
+void stats_fsop(int hist, stats_us start, int res)
+{
+    stats_observe(hist, start);
+
+    if (res < 0)
+        __sync_fetch_and_add(&hists[hist].errors, 1);
+}
+
+int stats_is_file(const char *path)
+{
+    return !strcmp(path, STATS_FILE);
+}
+
+int stats_is_dir(const char *path)
+{
+    return !strcmp(path, STATS_DIR);
+}
+
+void stats_getattr(const char *path, struct stat *buf)
+{
+    memset(buf, 0, sizeof *buf);
+
+    buf->st_uid = getuid();
+    buf->st_gid = getgid();
+    buf->st_mtime = buf->st_ctime = buf->st_atime = time(NULL);
+
+    if (stats_is_dir(path))
+    {
+        buf->st_mode = S_IFDIR | 0555;
+        buf->st_nlink = 2;
+    }
+    /* the size is not known before rendering, it is read with direct_io */
+    else
+    {
+        buf->st_mode = S_IFREG | 0444;
+        buf->st_nlink = 1;
+    }
+}
+
+struct stats_buf *stats_render(void)
+{
+    int i;
+    char labels[32];
+    struct stats_buf *b;
+
+    if ((b = malloc(sizeof *b)) == NULL)
+        return NULL;
+
+    b->len = 0;
+    b->size = STATS_BUF_MIN;
+    if ((b->data = malloc(b->size)) == NULL)
+    {
+        free(b);
+        return NULL;
+    }
+    *b->data = '\0';
+
+    buf_printf(b, "# HELP discofs_online Whether the remote fs is available.\n");
+    buf_printf(b, "# TYPE discofs_online gauge\n");
+    buf_printf(b, "discofs_online %d\n", ONLINE);
+    buf_printf(b, "# HELP discofs_rcall_hung Remote calls that missed their deadline and did not return.\n");
+    buf_printf(b, "# TYPE discofs_rcall_hung gauge\n");
+    buf_printf(b, "discofs_rcall_hung %d\n", rcall_hung());
+
+    buf_printf(b, "# HELP discofs_fsop_duration_seconds Duration of file system operations.\n");
+    buf_printf(b, "# TYPE discofs_fsop_duration_seconds histogram\n");
+    for (i = STATS_OP_FIRST; i < STATS_HISTS; i++)
+    {
+        if (!hists[i].count)
+            continue;
+        snprintf(labels, sizeof labels, "op=\"%s\",", op_names[i - STATS_OP_FIRST]);
+        render_hist(b, "discofs_fsop_duration_seconds", labels, &hists[i]);
+    }
+
+    buf_printf(b, "# HELP discofs_fsop_errors_total File system operations that returned an error.\n");
+    buf_printf(b, "# TYPE discofs_fsop_errors_total counter\n");
+    for (i = STATS_OP_FIRST; i < STATS_HISTS; i++)
+    {
+        if (hists[i].errors)
+            buf_printf(b, "discofs_fsop_errors_total{op=\"%s\"} %llu\n",
+                    op_names[i - STATS_OP_FIRST], hists[i].errors);
+    }
+
+    buf_printf(b, "# HELP discofs_jobs Pending jobs.\n");
+    buf_printf(b, "# TYPE discofs_jobs gauge\n");
+    job_store();
+    db_job_count(render_job_count, b);
+
+    buf_printf(b, "# HELP discofs_transfer_bytes_total Bytes transferred by the worker.\n");
+    buf_printf(b, "# TYPE discofs_transfer_bytes_total counter\n");
+    buf_printf(b, "discofs_transfer_bytes_total{dir=\"push\"} %llu\n", counters[STATS_PUSH_BYTES]);
+    buf_printf(b, "discofs_transfer_bytes_total{dir=\"pull\"} %llu\n", counters[STATS_PULL_BYTES]);
+    buf_printf(b, "# HELP discofs_transfer_seconds_total Time spent transferring, bytes divided by this is the throughput.\n");
+    buf_printf(b, "# TYPE discofs_transfer_seconds_total counter\n");
+    buf_printf(b, "discofs_transfer_seconds_total{dir=\"push\"} %g\n", counters[STATS_PUSH_US] / 1e6);
+    buf_printf(b, "discofs_transfer_seconds_total{dir=\"pull\"} %g\n", counters[STATS_PULL_US] / 1e6);
+
+    buf_printf(b, "# HELP discofs_instant_pull_seconds Time opening a file waited for it to be pulled.\n");
+    buf_printf(b, "# TYPE discofs_instant_pull_seconds histogram\n");
+    render_hist(b, "discofs_instant_pull_seconds", "", &hists[STATS_INSTANT_PULL]);
+
+    buf_printf(b, "# HELP discofs_scans_total Completed scans of the remote fs.\n");
+    buf_printf(b, "# TYPE discofs_scans_total counter\n");
+    buf_printf(b, "discofs_scans_total %llu\n", counters[STATS_SCANS]);
+    buf_printf(b, "# HELP discofs_scan_dirs_total Directories scanned.\n");
+    buf_printf(b, "# TYPE discofs_scan_dirs_total counter\n");
+    buf_printf(b, "discofs_scan_dirs_total %llu\n", counters[STATS_SCAN_DIRS]);
+    buf_printf(b, "# HELP discofs_scan_dirs_queued Directories left in the current scan.\n");
+    buf_printf(b, "# TYPE discofs_scan_dirs_queued gauge\n");
+    buf_printf(b, "discofs_scan_dirs_queued %llu\n", counters[STATS_SCAN_QUEUED]);
+    buf_printf(b, "# HELP discofs_scan_last_seconds Duration of the last completed scan.\n");
+    buf_printf(b, "# TYPE discofs_scan_last_seconds gauge\n");
+    buf_printf(b, "discofs_scan_last_seconds %g\n", counters[STATS_SCAN_LAST_US] / 1e6);
+
+    buf_printf(b, "# HELP discofs_db_duration_seconds Duration of database calls.\n");
+    buf_printf(b, "# TYPE discofs_db_duration_seconds histogram\n");
+    render_hist(b, "discofs_db_duration_seconds", "", &hists[STATS_DB]);
+
+    return b;
+}
+
+void stats_buf_free(struct stats_buf *b)
+{
+    if (!b)
+        return;
+
+    free(b->data);
+    free(b);
+}
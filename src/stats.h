@@ -0,0 +1,126 @@
+/*! @file stats.h
+ * counters and latency histograms, readable in the virtual stats file.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_STATS_H
+#define DISCOFS_STATS_H
+
+#include "config.h"
+#include "discofs.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! the virtual stats file, in Prometheus text format */
+#define STATS_DIR "/.discofs"
+#define STATS_FILE STATS_DIR "/stats"
+
+/*! number of histogram buckets. bucket n counts values below 16 * 4^n µs
+   (16µs to 67s) */
+#define STATS_BUCKETS 12
+
+/*! microseconds, monotonic */
+typedef unsigned long long stats_us;
+
+enum stats_counter
+{
+    STATS_PUSH_BYTES,       /* bytes transferred by the worker */
+    STATS_PULL_BYTES,
+    STATS_PUSH_US,          /* time spent transferring */
+    STATS_PULL_US,
+    STATS_SCANS,            /* completed passes of the remote scan */
+    STATS_SCAN_DIRS,        /* directories scanned */
+    STATS_SCAN_QUEUED,      /* directories left in the current pass */
+    STATS_SCAN_LAST_US,     /* duration of the last completed pass */
+    STATS_COUNTERS
+};
+
+enum stats_hist
+{
+    STATS_DB,               /* database calls */
+    STATS_INSTANT_PULL,     /* opening a file that has to be pulled first */
+
+    /* file system operations */
+    STATS_OP_GETATTR,
+    STATS_OP_FGETATTR,
+    STATS_OP_ACCESS,
+    STATS_OP_READLINK,
+    STATS_OP_OPENDIR,
+    STATS_OP_READDIR,
+    STATS_OP_MKNOD,
+    STATS_OP_MKDIR,
+    STATS_OP_RMDIR,
+    STATS_OP_UNLINK,
+    STATS_OP_LINK,
+    STATS_OP_SYMLINK,
+    STATS_OP_RENAME,
+    STATS_OP_RELEASEDIR,
+    STATS_OP_OPEN,
+    STATS_OP_CREATE,
+    STATS_OP_FLUSH,
+    STATS_OP_RELEASE,
+    STATS_OP_FSYNC,
+    STATS_OP_FSYNCDIR,
+    STATS_OP_READ,
+    STATS_OP_WRITE,
+    STATS_OP_TRUNCATE,
+    STATS_OP_CHOWN,
+    STATS_OP_CHMOD,
+    STATS_OP_UTIMENS,
+    STATS_OP_STATFS,
+    STATS_OP_SETXATTR,
+    STATS_OP_GETXATTR,
+    STATS_OP_LISTXATTR,
+    STATS_HISTS
+};
+
+#define STATS_OP_FIRST STATS_OP_GETATTR
+
+/*! contents of the stats file at the time it was opened */
+struct stats_buf
+{
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+stats_us stats_now(void);
+
+/*! add _n_ to a counter */
+void stats_add(int counter, long long n);
+
+/*! set a counter */
+void stats_set(int counter, unsigned long long v);
+
+/*! record the time passed since _start_ */
+void stats_observe(int hist, stats_us start);
+
+/*! record a file system operation started at _start_ that returned _res_ */
+void stats_fsop(int hist, stats_us start, int res);
+
+/*! name of a file system operation, e.g. "getattr" */
+const char *stats_op_name(int hist);
+
+/*! the virtual stats file and its directory */
+int stats_is_file(const char *path);
+int stats_is_dir(const char *path);
+void stats_getattr(const char *path, struct stat *buf);
+
+/*! render the current values */
+struct stats_buf *stats_render(void);
+void stats_buf_free(struct stats_buf *b);
+
+#endif
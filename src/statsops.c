@@ -0,0 +1,373 @@
+/*! @file statsops.c
+ * file system operations that record their duration.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "statsops.h"
+
+#include "stats.h"
+#include "trace.h"
+
+/* the debug operations log (with DEBUG_FSOPS) and trace each operation */
+#include "debugops.h"
+#define OP(name) debug_op_ ## name
+
+#include <fuse.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* wrapper that calls the operation and records its duration */
+#define STATS_OP(hist, name, params, args)      \
+int stats_op_ ## name params                    \
+{                                               \
+    int res;                                    \
+    stats_us start = stats_now();               \
+    res = OP(name) args;                        \
+    stats_fsop(hist, start, res);               \
+    return res;                                 \
+}
+
+/* like STATS_OP, but fails with EACCES if the operation would change the
+   stats directory or something in it */
+#define STATS_OP_RO(hist, name, params, args, paths)    \
+int stats_op_ ## name params                            \
+{                                                       \
+    int res;                                            \
+    stats_us start = stats_now();                       \
+    if (paths)                                          \
+        return -EACCES;                                 \
+    res = OP(name) args;                                \
+    stats_fsop(hist, start, res);                       \
+    return res;                                         \
+}
+
+#define IS_FILE(path) (stats_is_file(path) || trace_is_file(path))
+#define IS_STATS(path) (IS_FILE(path) || stats_is_dir(path))
+
+/* the stats directory or any path below it */
+#define IN_STATS(path) (!strncmp(path, STATS_DIR, sizeof STATS_DIR - 1)   \
+        && (path[sizeof STATS_DIR - 1] == '\0' || path[sizeof STATS_DIR - 1] == '/'))
+
+void *stats_op_init(struct fuse_conn_info *conn)
+{
+    return OP(init)(conn);
+}
+
+void stats_op_destroy(void *p)
+{
+    OP(destroy)(p);
+}
+
+
+/*-----------------------------------*
+ * operations serving the stats and *
+ * trace files                       *
+ *-----------------------------------*/
+
+int stats_op_getattr(const char *path, struct stat *buf)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IS_STATS(path))
+    {
+        stats_getattr(path, buf);
+        return 0;
+    }
+
+    res = OP(getattr)(path, buf);
+    stats_fsop(STATS_OP_GETATTR, start, res);
+    return res;
+}
+
+int stats_op_fgetattr(const char *path, struct stat *buf, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IS_FILE(path))
+    {
+        stats_getattr(path, buf);
+        return 0;
+    }
+
+    res = OP(fgetattr)(path, buf, fi);
+    stats_fsop(STATS_OP_FGETATTR, start, res);
+    return res;
+}
+
+int stats_op_access(const char *path, int mode)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IS_STATS(path))
+        return (mode & W_OK) ? -EACCES : 0;
+
+    res = OP(access)(path, mode);
+    stats_fsop(STATS_OP_ACCESS, start, res);
+    return res;
+}
+
+/* the contents are rendered once per open, so a reader sees consistent
+   values */
+int stats_op_open(const char *path, struct fuse_file_info *fi)
+{
+    int res;
+    struct stats_buf *b;
+    stats_us start = stats_now();
+
+    if (IS_FILE(path))
+    {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+            return -EACCES;
+
+        b = trace_is_file(path) ? trace_dump() : stats_render();
+        if (b == NULL)
+            return -ENOMEM;
+
+        fi->fh = (uint64_t)b;
+        fi->direct_io = 1;
+        return 0;
+    }
+
+    res = OP(open)(path, fi);
+    stats_fsop(STATS_OP_OPEN, start, res);
+    return res;
+}
+
+int stats_op_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    int res;
+    struct stats_buf *b;
+    stats_us start = stats_now();
+
+    if (IS_FILE(path))
+    {
+        b = (struct stats_buf *)fi->fh;
+
+        if (offset >= b->len)
+            return 0;
+        if (size > b->len - offset)
+            size = b->len - offset;
+
+        memcpy(buf, b->data + offset, size);
+        return size;
+    }
+
+    res = OP(read)(path, buf, size, offset, fi);
+    stats_fsop(STATS_OP_READ, start, res);
+    return res;
+}
+
+int stats_op_flush(const char *path, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IS_FILE(path))
+        return 0;
+
+    res = OP(flush)(path, fi);
+    stats_fsop(STATS_OP_FLUSH, start, res);
+    return res;
+}
+
+int stats_op_release(const char *path, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IS_FILE(path))
+    {
+        stats_buf_free((struct stats_buf *)fi->fh);
+        return 0;
+    }
+
+    res = OP(release)(path, fi);
+    stats_fsop(STATS_OP_RELEASE, start, res);
+    return res;
+}
+
+int stats_op_truncate(const char *path, off_t size)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IN_STATS(path))
+        return -EACCES;
+
+    res = OP(truncate)(path, size);
+    stats_fsop(STATS_OP_TRUNCATE, start, res);
+    return res;
+}
+
+/* the stats directory has no handle, its entries are fixed */
+int stats_op_opendir(const char *path, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (stats_is_dir(path))
+    {
+        fi->fh = 0;
+        return 0;
+    }
+
+    res = OP(opendir)(path, fi);
+    stats_fsop(STATS_OP_OPENDIR, start, res);
+    return res;
+}
+
+int stats_op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (stats_is_dir(path))
+    {
+        if (filler(buf, ".", NULL, 0)
+                || filler(buf, "..", NULL, 0)
+                || filler(buf, STATS_FILE + sizeof STATS_DIR, NULL, 0)
+                || filler(buf, TRACE_FILE + sizeof STATS_DIR, NULL, 0))
+            return -ENOMEM;
+        return 0;
+    }
+
+    res = OP(readdir)(path, buf, filler, offset, fi);
+    stats_fsop(STATS_OP_READDIR, start, res);
+    return res;
+}
+
+int stats_op_fsync(const char *path, int isdatasync, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (IS_FILE(path))
+        return 0;
+
+    res = OP(fsync)(path, isdatasync, fi);
+    stats_fsop(STATS_OP_FSYNC, start, res);
+    return res;
+}
+
+int stats_op_fsyncdir(const char *path, int isdatasync, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (stats_is_dir(path))
+        return 0;
+
+    res = OP(fsyncdir)(path, isdatasync, fi);
+    stats_fsop(STATS_OP_FSYNCDIR, start, res);
+    return res;
+}
+
+int stats_op_releasedir(const char *path, struct fuse_file_info *fi)
+{
+    int res;
+    stats_us start = stats_now();
+
+    if (stats_is_dir(path))
+        return 0;
+
+    res = OP(releasedir)(path, fi);
+    stats_fsop(STATS_OP_RELEASEDIR, start, res);
+    return res;
+}
+
+
+/*------------------*
+ * other operations *
+ *------------------*/
+
+STATS_OP(STATS_OP_READLINK, readlink,
+        (const char *path, char *buf, size_t bufsize),
+        (path, buf, bufsize))
+
+STATS_OP_RO(STATS_OP_MKNOD, mknod,
+        (const char *path, mode_t mode, dev_t rdev),
+        (path, mode, rdev),
+        IN_STATS(path))
+
+STATS_OP_RO(STATS_OP_MKDIR, mkdir,
+        (const char *path, mode_t mode),
+        (path, mode),
+        IN_STATS(path))
+
+STATS_OP_RO(STATS_OP_RMDIR, rmdir,
+        (const char *path),
+        (path),
+        IN_STATS(path))
+
+STATS_OP_RO(STATS_OP_UNLINK, unlink,
+        (const char *path),
+        (path),
+        IN_STATS(path))
+
+STATS_OP_RO(STATS_OP_LINK, link,
+        (const char *from, const char *to),
+        (from, to),
+        IN_STATS(from) || IN_STATS(to))
+
+/* _to_ is the content of the link */
+STATS_OP_RO(STATS_OP_SYMLINK, symlink,
+        (const char *to, const char *from),
+        (to, from),
+        IN_STATS(from))
+
+STATS_OP_RO(STATS_OP_RENAME, rename,
+        (const char *from, const char *to),
+        (from, to),
+        IN_STATS(from) || IN_STATS(to))
+
+STATS_OP_RO(STATS_OP_CREATE, create,
+        (const char *path, mode_t mode, struct fuse_file_info *fi),
+        (path, mode, fi),
+        IN_STATS(path))
+
+STATS_OP(STATS_OP_WRITE, write,
+        (const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi),
+        (path, buf, size, offset, fi))
+
+STATS_OP_RO(STATS_OP_CHOWN, chown,
+        (const char *path, uid_t uid, gid_t gid),
+        (path, uid, gid),
+        IN_STATS(path))
+
+STATS_OP_RO(STATS_OP_CHMOD, chmod,
+        (const char *path, mode_t mode),
+        (path, mode),
+        IN_STATS(path))
+
+STATS_OP_RO(STATS_OP_UTIMENS, utimens,
+        (const char *path, const struct timespec ts[2]),
+        (path, ts),
+        IN_STATS(path))
+
+STATS_OP(STATS_OP_STATFS, statfs,
+        (const char *path, struct statvfs *buf),
+        (path, buf))
+
+#if HAVE_SETXATTR
+STATS_OP_RO(STATS_OP_SETXATTR, setxattr,
+        (const char *path, const char *name, const char *value, size_t size, int flags),
+        (path, name, value, size, flags),
+        IN_STATS(path))
+
+STATS_OP(STATS_OP_GETXATTR, getxattr,
+        (const char *path, const char *name, char *value, size_t size),
+        (path, name, value, size))
+
+STATS_OP(STATS_OP_LISTXATTR, listxattr,
+        (const char *path, char *list, size_t size),
+        (path, list, size))
+#endif
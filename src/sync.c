@@ -10,8 +10,10 @@
 #include "state.h"
 #include "log.h"
 #include "funcs.h"
+#include "rcall.h"
 #include "hashtable.h"
 #include "db.h"
+#include "arena.h"
 
 #include <stdint.h>
 #include <errno.h>
@@ -29,20 +31,78 @@
 static queue *sync_queue;
 static pthread_mutex_t m_sync_queue = PTHREAD_MUTEX_INITIALIZER;
 
+/* held while storing the queue, so the db is up to date once another
+   sync_store() returns */
+static pthread_mutex_t m_sync_store = PTHREAD_MUTEX_INITIALIZER;
+
 /* yo dawg i herd u like fast lookups so we put some hashtables inside a
    hashtable so you can have O(1) lookup time while you have O(1) lookup time
 
    sync_ht is a hashtable (we'll call it "dirname ht") which uses
    key:     dirname (for "/foo/bar": /foo)
-   value:   a hashtable ("basename ht") using
+   value:   a struct sync_dir holding a table of entries using
             key:    basename (for "/foo/bar": bar)
             value:  sync data
-    so to get/set sync time, we first need to lookup/create the dirname
+    so to get/set sync time, we first need to lookup/load the dirname
     hashtable and then get/set the entry for basename
+
+   the entries of a directory are read from the db when it is first looked
+   up. when there are more than "synccache" entries, the directories used
+   least recently are dropped, their entries are in the db already.
+
+   entries are allocated from an arena per directory and hold only the
+   basename, the dirname is stored once as the key. they are looked up by
+   open addressing in the slots of their directory.
  */
+
+/* an entry in the arena of its directory */
+struct sync_entry
+{
+    int64_t mtime;              /* seconds */
+    int64_t ctime;
+    uint32_t hash;              /* of name */
+    char data[];                /* the nanoseconds of mtime and ctime as
+                                   uint32_t if the remote fs has them
+                                   (sync_dir.ns), then the basename */
+};
+
+struct sync_dir
+{
+    char *path;                 /* key in sync_ht */
+    struct arena arena;         /* entries */
+    struct sync_entry **slots;  /* NULL: free, SYNC_REMOVED: was used */
+    size_t size;                /* number of slots, a power of 2 */
+    size_t used;                /* slots that aren't free */
+    size_t n;                   /* entries */
+    size_t dead;                /* bytes of removed entries in arena */
+    size_t ns;                  /* bytes of nanoseconds in each entry */
+    struct sync_dir *prev;      /* more recently used */
+    struct sync_dir *next;      /* less recently used */
+};
+
+/* slots of a new directory, doubled when they are 3/4 used */
+#define SYNC_SLOTS_MIN 8
+
+/* a directory is read from the db again if more than this and more than
+   half of its arena is taken by removed entries */
+#define SYNC_DEAD_MAX 4096
+
+static struct sync_entry sync_removed;
+#define SYNC_REMOVED (&sync_removed)
+
+#define ENTRY_NAME(d, e) ((e)->data + (d)->ns)
+#define ENTRY_SIZE(d, len) (sizeof(struct sync_entry) + (d)->ns + (len) + 1)
+
 static hashtable *sync_ht = NULL;
 static pthread_mutex_t m_sync_ht = PTHREAD_MUTEX_INITIALIZER;
 
+/* loaded directories, most recently used first */
+static struct sync_dir *lru_first = NULL;
+static struct sync_dir *lru_last = NULL;
+
+/* entries of all loaded directories */
+static size_t sync_n = 0;
+
 
 /*-------------------*
  * static prototypes *
@@ -54,15 +114,50 @@ static hash_t sync_hash(const void *p, const void *n);
 /* compare function for hashtables */
 static int sync_cmp(const void *p1, const void *p2, const void *n);
 
-/* free dirname ht + contained basename hts */
+/* free dirname ht + contained directories */
 static void sync_ht_free(void);
 
 /* set sync entry */
-static struct sync *sync_ht_set(const char *path, sync_xtime_t mtime, sync_xtime_t ctime);
+static int sync_ht_set(const char *path, sync_xtime_t mtime, sync_xtime_t ctime);
 
 /* retrieve sync entry */
 static int sync_ht_get(const char *path, struct sync *s);
 
+/* the loaded directory of the first _n_ characters of _path_, or NULL */
+static struct sync_dir *sync_dir_cached(const char *path, size_t n);
+
+/* the same, loaded from the db if needed */
+static struct sync_dir *sync_dir_get(const char *path, size_t n);
+
+/* the slot of _name_ in _d_, or of the first free one */
+static struct sync_entry **sync_dir_slot(struct sync_dir *d, const char *name, uint32_t hash);
+
+/* the entry of _name_ in _d_ or NULL */
+static struct sync_entry *sync_dir_find(struct sync_dir *d, const char *name);
+
+/* set the entry of the basename of _path_ in _d_, adding it if needed */
+static int sync_dir_set(struct sync_dir *d, const char *path,
+        sync_xtime_t mtime, sync_xtime_t ctime);
+
+/* db_load_sync() callback */
+static int sync_dir_add(const char *path, sync_xtime_t mtime, sync_xtime_t ctime, void *arg);
+
+/* remove the entry of _path_ if its directory is loaded. returns 0 and its
+   times in _mtime_ and _ctime_ if it was */
+static int sync_dir_remove(const char *path, sync_xtime_t *mtime, sync_xtime_t *ctime);
+
+/* forget a loaded directory */
+static void sync_dir_drop(struct sync_dir *d);
+
+/* forget _path_ and the directories below it */
+static void sync_dir_drop_below(const char *path);
+
+/* free a directory that isn't in sync_ht */
+static void sync_dir_free(struct sync_dir *d);
+
+/* drop directories used least recently, except _keep_ */
+static void sync_evict(struct sync_dir *keep);
+
 
 /*==================*
  * STATIC FUNCTIONS *
@@ -86,31 +181,14 @@ static int sync_cmp(const void *p1, const void *p2, const void *n)
 
 static void sync_ht_free(void)
 {
-    htiter *it;
-    hashtable *ht;
-    char *p;
-
     /* sync_ht must be initialized */
     if (!sync_ht)
         return;
 
     pthread_mutex_lock(&m_sync_ht);
 
-    /* create iterator */
-    it = ht_iter(sync_ht);
-
-    /* free all items of dirname hashtable */
-    while (htiter_next(it, (void**)&p, (void**)&ht))
-    {
-        /* free basename ht */
-        ht_free_f(ht, NULL, sync_free);
-
-        /* free path */
-        free(p);
-    }
-
-    /* free iterator object */
-    free(it);
+    while (lru_first)
+        sync_dir_drop(lru_first);
 
     /* finally free the dirname hashtable */
     ht_free(sync_ht);
@@ -119,104 +197,331 @@ static void sync_ht_free(void)
     pthread_mutex_unlock(&m_sync_ht);
 }
 
-static struct sync *sync_ht_set(const char *path, sync_xtime_t mtime, sync_xtime_t ctime)
+static int sync_ht_set(const char *path, sync_xtime_t mtime, sync_xtime_t ctime)
 {
-    struct sync *s = NULL;
-    hashtable *ht;
-    char *dir, *base;
-    size_t n;
+    struct sync_dir *d;
 
     /* the first character of path must be a '/' */
     if (*path != '/')
-        return NULL;
+        return -1;
+
+    /* dirname without trailing '/' */
+    if ((d = sync_dir_get(path, strrchr(path, '/') - path)) == NULL)
+        return -1;
+
+    return sync_dir_set(d, path, mtime, ctime);
+}
+
+static int sync_ht_get(const char *path, struct sync *s)
+{
+    struct sync_dir *d;
+    struct sync_entry *e;
+    size_t n;
 
-    /* determine length of dirname (without trailing '/') */
     n = strrchr(path, '/') - path;
 
-    /* get basename ht (or create if it doesn't exist) */
-    if ((ht = ht_get_a(sync_ht, path, &n, &n)) == NULL)
+    /* find directory according to dirname */
+    if ((d = sync_dir_get(path, n)) == NULL)
+        return -1;
+
+    /* get sync entry for filename */
+    if ((e = sync_dir_find(d, path + n + 1)) == NULL)
+        return -1;
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    s->mtime.tv_sec = e->mtime;
+    s->ctime.tv_sec = e->ctime;
+    s->mtime.tv_nsec = 0;
+    s->ctime.tv_nsec = 0;
+
+    if (d->ns)
     {
+        uint32_t ns[2];
+        memcpy(ns, e->data, sizeof ns);
+        s->mtime.tv_nsec = ns[0];
+        s->ctime.tv_nsec = ns[1];
+    }
+#else
+    s->mtime = e->mtime;
+    s->ctime = e->ctime;
+#endif
 
-        /* hash table for dir part of path not found -> create it */
-        if (ht_init(&ht, sync_hash, sync_cmp) == HT_ERROR)
-            return NULL;
+    return 0;
+}
 
-        /* copy dirname */
-        dir = malloc(n+1);
-        if (!dir)
-        {
-            errno = ENOMEM;
-            return NULL;
-        }
-        dir[n] = '\0';
-        memcpy(dir, path, n);
+static struct sync_dir *sync_dir_cached(const char *path, size_t n)
+{
+    return ht_get_a(sync_ht, path, &n, &n);
+}
+
+static struct sync_dir *sync_dir_get(const char *path, size_t n)
+{
+    struct sync_dir *d;
 
-        if (ht_insert(sync_ht, dir, ht) == HT_ERROR)
+    if ((d = sync_dir_cached(path, n)) != NULL)
+    {
+        /* move to the front of the LRU list */
+        if (d != lru_first)
         {
-            ERROR("inserting into sync_ht");
-            free(dir);
-            return NULL;
+            d->prev->next = d->next;
+            if (d->next)
+                d->next->prev = d->prev;
+            else
+                lru_last = d->prev;
+
+            d->prev = NULL;
+            d->next = lru_first;
+            lru_first->prev = d;
+            lru_first = d;
         }
+        return d;
+    }
 
-        s = NULL;
+    if ((d = calloc(1, sizeof *d)) == NULL || (d->path = malloc(n+1)) == NULL
+            || (d->slots = calloc(SYNC_SLOTS_MIN, sizeof *d->slots)) == NULL)
+    {
+        if (d)
+            free(d->path);
+        free(d);
+        errno = ENOMEM;
+        return NULL;
     }
-    else
+    memcpy(d->path, path, n);
+    d->path[n] = '\0';
+    d->size = SYNC_SLOTS_MIN;
+
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    if (discofs_options.fs_features & FEAT_NS)
+        d->ns = 2 * sizeof(uint32_t);
+#endif
+
+    /* entries that aren't stored yet would be missing */
+    sync_store();
+
+    if (db_load_sync(d->path, sync_dir_add, d) != DB_OK)
     {
-        /* find sync item */
-        s = ht_get(ht, path + n + 1);
+        ERROR("loading sync entries of %s", (*d->path) ? d->path : "/");
+        sync_n -= d->n;
+        sync_dir_free(d);
+        return NULL;
     }
 
-    if (!s)
+    if (ht_insert(sync_ht, d->path, d) == HT_ERROR)
+    {
+        ERROR("inserting into sync_ht");
+        sync_n -= d->n;
+        sync_dir_free(d);
+        return NULL;
+    }
+
+    d->next = lru_first;
+    if (lru_first)
+        lru_first->prev = d;
+    else
+        lru_last = d;
+    lru_first = d;
+
+    sync_evict(d);
+    return d;
+}
+
+static struct sync_entry **sync_dir_slot(struct sync_dir *d, const char *name, uint32_t hash)
+{
+    struct sync_entry **slot, **removed = NULL;
+    size_t i, mask = d->size - 1;
+
+    for (i = hash & mask; ; i = (i + 1) & mask)
     {
-        s = sync_create(path, mtime, ctime);
-        /* create new path & sync item */
-        if (!s)
+        slot = &d->slots[i];
+
+        if (!*slot)
+            return (removed) ? removed : slot;
+
+        if (*slot == SYNC_REMOVED)
         {
-            errno = ENOMEM;
-            return NULL;
+            if (!removed)
+                removed = slot;
         }
+        else if ((*slot)->hash == hash && !strcmp(ENTRY_NAME(d, *slot), name))
+            return slot;
+    }
+}
+
+static struct sync_entry *sync_dir_find(struct sync_dir *d, const char *name)
+{
+    struct sync_entry **slot = sync_dir_slot(d, name, djb2(name, SIZE_MAX));
 
-        base = strrchr(s->path, '/') + 1;
+    return (*slot == SYNC_REMOVED) ? NULL : *slot;
+}
+
+static int sync_dir_set(struct sync_dir *d, const char *path,
+        sync_xtime_t mtime, sync_xtime_t ctime)
+{
+    const char *name = strrchr(path, '/') + 1;
+    uint32_t hash = djb2(name, SIZE_MAX);
+    struct sync_entry **slot, **slots, *e;
+    size_t i, j, len, size;
+
+    slot = sync_dir_slot(d, name, hash);
 
-        if (ht_insert(ht, base, s) != HT_OK)
+    if (!*slot || *slot == SYNC_REMOVED)
+    {
+        /* keep at least a quarter of the slots free */
+        if (!*slot && 4 * (d->used + 1) > 3 * d->size)
         {
-            ERROR("error inserting into sync_ht");
-            sync_free(s);
-            return NULL;
+            size = (4 * (d->n + 1) > 3 * d->size) ? 2 * d->size : d->size;
+            if ((slots = calloc(size, sizeof *slots)) == NULL)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+
+            /* rehash, which also drops the removed slots */
+            for (i = 0; i < d->size; i++)
+            {
+                if (!d->slots[i] || d->slots[i] == SYNC_REMOVED)
+                    continue;
+                for (j = d->slots[i]->hash & (size - 1); slots[j]; j = (j + 1) & (size - 1));
+                slots[j] = d->slots[i];
+            }
+
+            free(d->slots);
+            d->slots = slots;
+            d->size = size;
+            d->used = d->n;
+
+            slot = sync_dir_slot(d, name, hash);
         }
+
+        len = strlen(name);
+        if ((e = arena_alloc(&d->arena, ENTRY_SIZE(d, len))) == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        e->hash = hash;
+        memcpy(ENTRY_NAME(d, e), name, len + 1);
+
+        if (!*slot)
+            d->used++;
+        *slot = e;
+
+        d->n++;
+        sync_n++;
     }
+    else
+        e = *slot;
 
-    /* set data of found or created sync */
-    s->mtime = mtime;
-    s->ctime = ctime;
-    return s;
+#if HAVE_UTIMENSAT && HAVE_CLOCK_GETTIME
+    e->mtime = mtime.tv_sec;
+    e->ctime = ctime.tv_sec;
+
+    if (d->ns)
+    {
+        uint32_t ns[2];
+        ns[0] = mtime.tv_nsec;
+        ns[1] = ctime.tv_nsec;
+        memcpy(e->data, ns, sizeof ns);
+    }
+#else
+    e->mtime = mtime;
+    e->ctime = ctime;
+#endif
+
+    return 0;
 }
 
-static int sync_ht_get(const char *path, struct sync *s)
+static int sync_dir_add(const char *path, sync_xtime_t mtime, sync_xtime_t ctime, void *arg)
 {
-    hashtable *ht;
-    size_t n;
-    struct sync *found;
+    return sync_dir_set(arg, path, mtime, ctime);
+}
 
-    n = strrchr(path, '/') - path;
+static int sync_dir_remove(const char *path, sync_xtime_t *mtime, sync_xtime_t *ctime)
+{
+    struct sync_dir *d;
+    struct sync_entry **slot;
+    struct sync s;
+    const char *name;
+    size_t n = strrchr(path, '/') - path;
 
-    /* find ht according to dirname */
-    if ((ht = ht_get_a(sync_ht, path, &n, &n)) == NULL)
-    {
+    if ((d = sync_dir_cached(path, n)) == NULL)
         return -1;
+
+    name = path + n + 1;
+    slot = sync_dir_slot(d, name, djb2(name, SIZE_MAX));
+    if (!*slot || *slot == SYNC_REMOVED)
+        return -1;
+
+    if (mtime || ctime)
+    {
+        sync_ht_get(path, &s);
+        if (mtime)
+            *mtime = s.mtime;
+        if (ctime)
+            *ctime = s.ctime;
     }
 
-    /* get sync entry for filename */
-    found = ht_get(ht, path + n + 1);
+    d->dead += ENTRY_SIZE(d, strlen(name));
+    *slot = SYNC_REMOVED;
+    d->n--;
+    sync_n--;
+
+    /* the arena only shrinks when the directory is read again */
+    if (d->dead > SYNC_DEAD_MAX && 2 * d->dead > d->arena.size)
+        sync_dir_drop(d);
+
+    return 0;
+}
+
+static void sync_dir_drop(struct sync_dir *d)
+{
+    if (d->prev)
+        d->prev->next = d->next;
+    else
+        lru_first = d->next;
+
+    if (d->next)
+        d->next->prev = d->prev;
+    else
+        lru_last = d->prev;
+
+    ht_remove(sync_ht, d->path);
+    sync_n -= d->n;
+    sync_dir_free(d);
+}
+
+static void sync_dir_drop_below(const char *path)
+{
+    struct sync_dir *d, *next;
+    size_t len = strlen(path);
 
-    if (found)
+    for (d = lru_first; d; d = next)
     {
-        s->mtime = found->mtime;
-        s->ctime = found->ctime;
-        return 0;
+        next = d->next;
+
+        if (!strncmp(d->path, path, len) && (d->path[len] == '\0' || d->path[len] == '/'))
+            sync_dir_drop(d);
     }
+}
+
+static void sync_dir_free(struct sync_dir *d)
+{
+    arena_free(&d->arena);
+    free(d->slots);
+    free(d->path);
+    free(d);
+}
+
+static void sync_evict(struct sync_dir *keep)
+{
+    size_t max = discofs_options.sync_cache;
 
-    return -1;
+    while (max && sync_n > max && lru_last && lru_last != keep)
+    {
+        DEBUG("dropping sync entries of %s", (*lru_last->path) ? lru_last->path : "/");
+        sync_dir_drop(lru_last);
+    }
 }
 
 
@@ -243,22 +548,15 @@ int sync_timecmp(sync_xtime_t t1, sync_xtime_t t2)
 
 int sync_init(void)
 {
-    int res;
-
     sync_queue = q_init();
     if (!sync_queue)
         return -1;
 
-    pthread_mutex_lock(&m_sync_ht);
-
-    /* initialize dirname ht */
-    ht_init(&sync_ht, sync_hash, sync_cmp);
-
-    /* load sync data from db, call sync_ht_set() for each row */
-    res = db_load_sync(sync_ht_set);
+    /* initialize dirname ht, directories are loaded when they are used */
+    if (ht_init(&sync_ht, sync_hash, sync_cmp) == HT_ERROR)
+        return -1;
 
-    pthread_mutex_unlock(&m_sync_ht);
-    return res;
+    return 0;
 }
 
 int sync_destroy(void)
@@ -281,6 +579,8 @@ int sync_store(void)
     struct sync *s;     /* sync data retrieved from queue */
     int res = DB_OK;    /* return value of db_store_sync() */
 
+    pthread_mutex_lock(&m_sync_store);
+
     do {
         /* dequeue data */
         pthread_mutex_lock(&m_sync_queue);
@@ -289,12 +589,17 @@ int sync_store(void)
 
         /* store data in db */
         if (s)
+        {
             res = db_store_sync(s);
+            sync_free(s);
+        }
 
     /* continue if queue wasn't empty and inserting was OK */
     }
     while (s && res == DB_OK);
 
+    pthread_mutex_unlock(&m_sync_store);
+
     /* return error if inserting failed */
     if (res != DB_OK)
         return -1;
@@ -324,7 +629,11 @@ struct sync *sync_create(const char *path, sync_xtime_t mtime, sync_xtime_t ctim
 
 void sync_free(void *p)
 {
-    free(p);
+    struct sync *s = p;
+
+    if (s)
+        free(s->path);
+    free(s);
 }
 
 int sync_set(const char *path, int flags)
@@ -333,7 +642,7 @@ int sync_set(const char *path, int flags)
     char *p;                    /* path to remote file/dir */
     sync_xtime_t mtime, ctime;  /* mtime and ctime of remote file/dir to set */
     struct stat st;             /* stat buffer */
-    struct sync *s;             /* sync data to enqueue */
+    struct sync *q = NULL;      /* sync data to enqueue */
 
     /* only set sync when online */
     if (!ONLINE)
@@ -341,7 +650,7 @@ int sync_set(const char *path, int flags)
 
     /* retrieve mtime and ctime */
     p = remote_path(path);
-    res = lstat(p, &st);
+    res = rcall_lstat(p, &st);
     free(p);
 
     if (res)
@@ -357,21 +666,23 @@ int sync_set(const char *path, int flags)
     pthread_mutex_lock(&m_sync_ht);
 
     VERBOSE("setting sync for %s", path);
-    s = sync_ht_set(path, mtime, ctime);
+    res = sync_ht_set(path, mtime, ctime);
 
-    pthread_mutex_unlock(&m_sync_ht);
-
-    /* if ht entry set successfully, add item to update queue */
-    if (s)
+    /* if ht entry set successfully, add it to the update queue. still
+       holding m_sync_ht, so a directory isn't loaded without it */
+    if (res == 0 && (q = sync_create(path, mtime, ctime)) != NULL)
     {
         pthread_mutex_lock(&m_sync_queue);
 
-        q_enqueue(sync_queue, s);
+        q_enqueue(sync_queue, q);
 
         pthread_mutex_unlock(&m_sync_queue);
     }
+
+    pthread_mutex_unlock(&m_sync_ht);
+
     /* or log error and return -1 */
-    else
+    if (!q)
     {
         ERROR("sync_set failed");
         return -1;
@@ -395,13 +706,14 @@ int sync_get_stat(const char *path, struct stat *buf)
         return -1;
     }
 
-    res = lstat(p, &st);
+    res = rcall_lstat(p, &st);
     free(p);
 
-    /* no such file */
+    /* no such file. a remote fs that doesn't answer says nothing about
+       the file */
     if (res == -1)
     {
-        return SYNC_NOT_FOUND;
+        return (errno == ETIMEDOUT) ? -1 : SYNC_NOT_FOUND;
     }
 
     /* copy stat data to caller-provided buffer */
@@ -435,193 +747,90 @@ int sync_get_stat(const char *path, struct stat *buf)
 
 int sync_rename_dir(const char *from, const char *to)
 {
-    hashtable *ht;
-    htiter *it;
-    char *p, *oldpath, *newpath;
-    size_t from_len, to_len;       /* string lengths */
-    queue *q = q_init();           /* queue for hashtables to "rename" */
-
-    sync_store();
-
-    from_len = strlen(from);
-    to_len = strlen(to);
+    int res;
 
     pthread_mutex_lock(&m_sync_ht);
 
-    it = ht_iter(sync_ht);
-    if (!it)
-    {
-        pthread_mutex_unlock(&m_sync_ht);
-        return -1;
-    }
-
-    /* find all basename hashtables where key is a directory below "path" */
-    while (htiter_next(it, (void**)&p, NULL))
-    {
-
-        /* enqueue key if key is below "path" ? */
-        if (strncmp(p, from, from_len))
-        {
-
-            /* create copy of the key */
-            oldpath = strdup(p);
-            if (!oldpath)
-            {
-                pthread_mutex_unlock(&m_sync_ht);
-                q_clear(q, free);
-                free(it);
-                errno = ENOMEM;
-                return -1;
-            }
-            /* enqueue the copy */
-            q_enqueue(q, oldpath);
-        }
-    }
-
-    free(it);
-
-    /* dequeue found keys, remove corresp onding ht and reinsert with renamed key */
-    while ((oldpath = q_dequeue(q)))
-    {
-        /* generate new key */
-        newpath = join_path2(to, to_len, oldpath+from_len, 0);
-        if (!newpath)
-        {
-            free(oldpath);
-            errno = ENOMEM;
-            break;
-        }
+    sync_store();
 
-        /* remove basename ht */
-        ht = ht_remove_f(sync_ht, oldpath, free);
+    /* the entries below both are read from the db again when needed */
+    sync_dir_drop_below(from);
+    sync_dir_drop_below(to);
 
-        /* insert basename ht with new key */
-        ht_insert(sync_ht, newpath, ht);
-
-        free(oldpath);
-    }
+    res = db_sync_rename_dir(from, to);
 
     pthread_mutex_unlock(&m_sync_ht);
 
-    /* if q is not empty something terrible happened! */
-    if (!q_empty(q))
-    {
-        q_clear(q, free);
-        return -1;
-    }
-
-    if (db_sync_rename_dir(from, to) != DB_OK)
-        return -1;
-
-    return 0;
+    return (res == DB_OK) ? 0 : -1;
 }
 
 int sync_rename_file(const char *from, const char *to)
 {
-    hashtable *ht;
-    char *newpath, *base;
-    struct sync *s;
-    size_t n;
-
-    sync_store();
-
-    n = strrchr(from, '/') - from;
-
-    /* find ht according to dirname */
-    if ((ht = ht_get_a(sync_ht, from, &n, &n)) == NULL)
-    {
-        return -1;
-    }
-
-    /* new path */
-    newpath = strdup(to);
-    if (!newpath)
-    {
-        return -1;
-    }
+    struct sync_dir *d;
+    sync_xtime_t mtime, ctime;
+    int res, found;
 
+    pthread_mutex_lock(&m_sync_ht);
 
-    /* remove basename ht entry */
-    s = ht_remove(ht, from + n + 1);
-    if (!s)
-    {
-        free(newpath);
-        return -1;
-    }
+    sync_store();
 
-    /* set new path */
-    free(s->path);
-    s->path = newpath;
+    /* remove the entry from its directory */
+    found = !sync_dir_remove(from, &mtime, &ctime);
 
-    base = strrchr(s->path, '/') + 1;
+    /* and set it in the new one, which may be another one */
+    sync_dir_remove(to, NULL, NULL);
+    if (found && (d = sync_dir_cached(to, strrchr(to, '/') - to)) != NULL
+            && sync_dir_set(d, to, mtime, ctime))
+        sync_dir_drop(d);
 
-    /* reinsert with new key */
-    if (ht_insert(ht, base, s))
-        return -1;
+    res = db_sync_rename_file(from, to);
 
-    if (db_sync_rename_file(from, to) != DB_OK)
-        return -1;
+    pthread_mutex_unlock(&m_sync_ht);
 
-    return 0;
+    return (res == DB_OK) ? 0 : -1;
 }
 
 int sync_delete_dir(const char *path)
 {
-    hashtable *ht;
-
-    sync_store();
+    struct sync_dir *d;
+    int res;
 
     pthread_mutex_lock(&m_sync_ht);
 
-    /* remove basename ht from dirname ht */
-    ht = ht_remove_f(sync_ht, path, free);
-
-    pthread_mutex_unlock(&m_sync_ht);
-
-    /* no hashtable found */
-    if (!ht)
-        return -1;
+    sync_store();
 
     /* ht should be empty (rmdir is only allowed on empty dirs)
-       if it isn't, nag a little and free it's content */
-    if (!ht_empty(ht))
+       if it isn't, nag a little */
+    if ((d = sync_dir_cached(path, strlen(path))) != NULL)
     {
-        ERROR("deleting non-empty dir hashtable");
-        ht_free_f(ht, NULL, sync_free);
+        if (d->n)
+            ERROR("deleting non-empty dir hashtable");
+        sync_dir_drop(d);
     }
 
-    if (db_sync_delete_path(path) != DB_OK)
-        return -1;
+    /* the directory's own entry */
+    sync_dir_remove(path, NULL, NULL);
 
-    return 0;
+    res = db_sync_delete_path(path);
+
+    pthread_mutex_unlock(&m_sync_ht);
+
+    return (res == DB_OK) ? 0 : -1;
 }
 
 int sync_delete_file(const char *path)
 {
-    hashtable *ht;
-    struct sync *s;
-    size_t n;
-
-    sync_store();
+    int res;
 
-    n = strrchr(path, '/') - path;
+    pthread_mutex_lock(&m_sync_ht);
 
-    /* find basename ht */
-    if ((ht = ht_get_a(sync_ht, path, &n, &n)) == NULL)
-    {
-        return -1;
-    }
+    sync_store();
 
-    /* remove sync entry (path+n+1 points to basename part) */
-    s = ht_remove(ht, path + n + 1);
-    if (!s)
-        return -1;
+    sync_dir_remove(path, NULL, NULL);
 
-    /* free it */
-    sync_free(s);
+    res = db_sync_delete_path(path);
 
-    if (db_sync_delete_path(path) != DB_OK)
-        return -1;
+    pthread_mutex_unlock(&m_sync_ht);
 
-    return 0;
+    return (res == DB_OK) ? 0 : -1;
 }
@@ -34,7 +34,7 @@ typedef time_t sync_xtime_t;
 #endif
 
 
-/*! sync object */
+/*! sync data of a file, as queued for and read from the db */
 struct sync
 {
     char *path;
@@ -44,7 +44,7 @@ struct sync
 
 
 /*! callback function type for db_load_sync() */
-typedef struct sync * (*sync_load_cb_t) (const char*, sync_xtime_t, sync_xtime_t);
+typedef int (*sync_load_cb_t) (const char*, sync_xtime_t, sync_xtime_t, void*);
 
 
 /*-----------------------------*
@@ -0,0 +1,177 @@
+/*! @file timer.c
+ * deadlines of deferred jobs.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "timer.h"
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+#define HEAP_MIN_SIZE 64
+
+/*! binary min-heap of deadlines. a deadline is only needed to know when
+   to wake up the worker, so jobs that are deleted or renamed before they
+   are due are not looked for, their deadline just passes */
+static struct
+{
+    timer_ms *d;
+    size_t n;
+    size_t size;
+} heap;
+
+static pthread_mutex_t m_timer = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static void heap_up(size_t i);
+static void heap_down(size_t i);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+static void heap_up(size_t i)
+{
+    timer_ms tmp;
+
+    while (i > 0 && heap.d[(i - 1) / 2] > heap.d[i])
+    {
+        tmp = heap.d[i];
+        heap.d[i] = heap.d[(i - 1) / 2];
+        heap.d[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(size_t i)
+{
+    size_t min, l, r;
+    timer_ms tmp;
+
+    for (;;)
+    {
+        l = 2 * i + 1;
+        r = l + 1;
+        min = i;
+
+        if (l < heap.n && heap.d[l] < heap.d[min])
+            min = l;
+        if (r < heap.n && heap.d[r] < heap.d[min])
+            min = r;
+
+        if (min == i)
+            return;
+
+        tmp = heap.d[i];
+        heap.d[i] = heap.d[min];
+        heap.d[min] = tmp;
+        i = min;
+    }
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int timer_init(void)
+{
+    heap.d = malloc(HEAP_MIN_SIZE * sizeof *heap.d);
+    if (!heap.d)
+        return -1;
+
+    heap.n = 0;
+    heap.size = HEAP_MIN_SIZE;
+    return 0;
+}
+
+void timer_destroy(void)
+{
+    free(heap.d);
+    heap.d = NULL;
+    heap.n = heap.size = 0;
+}
+
+timer_ms timer_now(void)
+{
+#if HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (timer_ms)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (timer_ms)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+int timer_add(timer_ms due)
+{
+    timer_ms *tmp;
+
+    pthread_mutex_lock(&m_timer);
+
+    if (heap.n == heap.size)
+    {
+        if ((tmp = realloc(heap.d, 2 * heap.size * sizeof *heap.d)) == NULL)
+        {
+            pthread_mutex_unlock(&m_timer);
+            return -1;
+        }
+        heap.d = tmp;
+        heap.size *= 2;
+    }
+
+    heap.d[heap.n] = due;
+    heap_up(heap.n++);
+
+    pthread_mutex_unlock(&m_timer);
+    return 0;
+}
+
+timer_ms timer_next(timer_ms now)
+{
+    timer_ms next = 0;
+
+    pthread_mutex_lock(&m_timer);
+
+    /* forget deadlines that passed */
+    while (heap.n && heap.d[0] <= now)
+    {
+        heap.d[0] = heap.d[--heap.n];
+        heap_down(0);
+    }
+
+    if (heap.n)
+        next = heap.d[0];
+
+    /* give memory back after a burst of deferred jobs */
+    if (heap.size > HEAP_MIN_SIZE && heap.n < heap.size / 4)
+    {
+        timer_ms *tmp = realloc(heap.d, heap.size / 2 * sizeof *heap.d);
+        if (tmp)
+        {
+            heap.d = tmp;
+            heap.size /= 2;
+        }
+    }
+
+    pthread_mutex_unlock(&m_timer);
+    return next;
+}
@@ -0,0 +1,34 @@
+/*! @file timer.h
+ * deadlines of deferred jobs.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_TIMER_H
+#define DISCOFS_TIMER_H
+
+#include "config.h"
+#include "discofs.h"
+
+/*! milliseconds since the epoch */
+typedef long long timer_ms;
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int timer_init(void);
+void timer_destroy(void);
+
+/*! current time */
+timer_ms timer_now(void);
+
+/*! remember that a job becomes due at _due_ */
+int timer_add(timer_ms due);
+
+/*! get the earliest deadline after _now_, 0 if there is none. deadlines
+   that passed are forgotten */
+timer_ms timer_next(timer_ms now);
+
+#endif
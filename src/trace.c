@@ -0,0 +1,258 @@
+/*! @file trace.c
+ * per-thread trace of file system operations.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#include "config.h"
+#include "trace.h"
+
+#include "funcs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! records of one thread. only the owner writes records and advances
+   _head_, readers copy the records and check _head_ afterwards to drop
+   those that were overwritten meanwhile. rings of threads that exited are
+   handed on to new threads */
+struct ring
+{
+    struct ring *next;
+    volatile unsigned long head;    /* number of records written */
+    int owned;
+    uint16_t id;
+    struct trace_rec recs[];
+};
+
+static struct ring *rings = NULL;
+static unsigned long ring_size = 0;     /* power of 2 */
+static uint16_t ring_n = 0;
+
+static pthread_key_t ring_key;
+static pthread_mutex_t m_trace = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*-------------------*
+ * static prototypes *
+ *-------------------*/
+
+static struct ring *ring_get(void);
+static void ring_release(void *p);
+static int buf_append(struct stats_buf *b, const void *p, size_t n);
+
+
+/*==================*
+ * STATIC FUNCTIONS *
+ *==================*/
+
+/* ring of the calling thread, taken over or allocated on its first
+   operation */
+static struct ring *ring_get(void)
+{
+    struct ring *r;
+
+    if ((r = pthread_getspecific(ring_key)) != NULL)
+        return r;
+
+    pthread_mutex_lock(&m_trace);
+
+    for (r = rings; r && r->owned; r = r->next);
+
+    if (!r && (r = malloc(sizeof *r + ring_size * sizeof *r->recs)) != NULL)
+    {
+        r->head = 0;
+        r->id = ring_n++;
+        r->next = rings;
+        rings = r;
+    }
+
+    if (r)
+        r->owned = 1;
+
+    pthread_mutex_unlock(&m_trace);
+
+    if (r)
+        pthread_setspecific(ring_key, r);
+
+    return r;
+}
+
+/* called when the owning thread exits, the records stay */
+static void ring_release(void *p)
+{
+    struct ring *r = p;
+
+    pthread_mutex_lock(&m_trace);
+    r->owned = 0;
+    pthread_mutex_unlock(&m_trace);
+}
+
+static int buf_append(struct stats_buf *b, const void *p, size_t n)
+{
+    char *tmp;
+
+    if (b->len + n > b->size)
+    {
+        if ((tmp = realloc(b->data, 2 * b->size + n)) == NULL)
+            return -1;
+        b->data = tmp;
+        b->size = 2 * b->size + n;
+    }
+
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return 0;
+}
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+int trace_init(void)
+{
+    if (!discofs_options.trace)
+        return 0;
+
+    for (ring_size = 1; ring_size < discofs_options.trace; ring_size <<= 1);
+
+    if (pthread_key_create(&ring_key, ring_release))
+        return -1;
+
+    return 0;
+}
+
+void trace_destroy(void)
+{
+    struct ring *r;
+
+    if (!ring_size)
+        return;
+
+    pthread_mutex_lock(&m_trace);
+    while (rings)
+    {
+        r = rings;
+        rings = r->next;
+        free(r);
+    }
+    pthread_mutex_unlock(&m_trace);
+
+    pthread_key_delete(ring_key);
+    ring_size = 0;
+}
+
+stats_us trace_start(void)
+{
+    return ring_size ? stats_now() : 0;
+}
+
+void trace_op(int op, const char *path, stats_us start, int res)
+{
+    size_t n;
+    const char *p;
+    struct ring *r;
+    struct trace_rec *rec;
+
+    if (!start || (r = ring_get()) == NULL)
+        return;
+
+    p = strrchr(path, '/');
+    n = (p && p > path) ? p - path : 1;
+
+    rec = &r->recs[r->head & (ring_size - 1)];
+    rec->start = start;
+    rec->end = stats_now();
+    rec->path = djb2(path, SIZE_MAX);
+    rec->dir = djb2(path, n);
+    rec->res = res;
+    rec->op = op - STATS_OP_FIRST;
+    rec->thread = r->id;
+
+    /* the record must be complete before it is counted */
+    __sync_synchronize();
+    r->head++;
+}
+
+int trace_is_file(const char *path)
+{
+    return !strcmp(path, TRACE_FILE);
+}
+
+struct stats_buf *trace_dump(void)
+{
+    int i;
+    const char *name;
+    struct ring *r;
+    struct stats_buf *b;
+    unsigned long h1, h2, first;
+    size_t count_pos;
+    uint32_t hdr[3] = { TRACE_VERSION, STATS_HISTS - STATS_OP_FIRST, 0 };
+
+    if ((b = malloc(sizeof *b)) == NULL)
+        return NULL;
+
+    b->len = 0;
+    b->size = 4096;
+    if ((b->data = malloc(b->size)) == NULL)
+        goto failure;
+
+    if (buf_append(b, TRACE_MAGIC, 4))
+        goto failure;
+    count_pos = b->len + 2 * sizeof *hdr;
+    if (buf_append(b, hdr, sizeof hdr))
+        goto failure;
+
+    for (i = STATS_OP_FIRST; i < STATS_HISTS; i++)
+    {
+        name = stats_op_name(i);
+        if (buf_append(b, name, strlen(name) + 1))
+            goto failure;
+    }
+
+    /* rings are never removed while mounted, new ones are added at the
+       head of the list */
+    pthread_mutex_lock(&m_trace);
+    r = rings;
+    pthread_mutex_unlock(&m_trace);
+
+    for (; r && ring_size; r = r->next)
+    {
+        __sync_synchronize();
+        h1 = r->head;
+        first = (h1 > ring_size) ? h1 - ring_size : 0;
+
+        for (; first < h1; first++)
+        {
+            if (buf_append(b, &r->recs[first & (ring_size - 1)], sizeof *r->recs))
+                goto failure;
+
+            __sync_synchronize();
+            h2 = r->head;
+            /* overwritten while copying */
+            if (h2 >= ring_size && first <= h2 - ring_size)
+            {
+                b->len -= sizeof *r->recs;
+                continue;
+            }
+
+            hdr[2]++;
+        }
+    }
+
+    memcpy(b->data + count_pos, &hdr[2], sizeof hdr[2]);
+    return b;
+
+failure:
+    if (b)
+        free(b->data);
+    free(b);
+    return NULL;
+}
@@ -0,0 +1,67 @@
+/*! @file trace.h
+ * per-thread trace of file system operations.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ */
+
+#ifndef DISCOFS_TRACE_H
+#define DISCOFS_TRACE_H
+
+#include "config.h"
+#include "discofs.h"
+#include "stats.h"
+
+#include <stdint.h>
+
+/*=============*
+ * DEFINITIONS *
+ *=============*/
+
+/*! the virtual trace file, next to the stats file */
+#define TRACE_FILE STATS_DIR "/trace"
+
+#define TRACE_MAGIC "DTRC"
+#define TRACE_VERSION 1
+
+/*! one operation. the trace file consists of
+ *  - the header: TRACE_MAGIC, then TRACE_VERSION, the number of operation
+ *    names and the number of records as uint32_t
+ *  - the operation names, each terminated by '\0'. trace_rec.op indexes
+ *    these
+ *  - the records, oldest first for each thread
+ * all in host byte order. tools/discofs-trace.c reads this. */
+struct trace_rec
+{
+    uint64_t start;             /* µs, monotonic */
+    uint64_t end;
+    uint32_t path;              /* djb2 of the path */
+    uint32_t dir;               /* djb2 of its directory ("/" for the root) */
+    int32_t res;                /* return value of the operation */
+    uint16_t op;
+    uint16_t thread;            /* ring buffer the record was written to */
+};
+
+
+/*====================*
+ * EXPORTED FUNCTIONS *
+ *====================*/
+
+/*! with "trace=0", nothing is recorded */
+int trace_init(void);
+void trace_destroy(void);
+
+/*! start of an operation, 0 if tracing is disabled */
+stats_us trace_start(void);
+
+/*! record an operation (a STATS_OP_ hist) on _path_ started at _start_
+   that returned _res_. doesn't block */
+void trace_op(int op, const char *path, stats_us start, int res);
+
+/*! the virtual trace file */
+int trace_is_file(const char *path);
+
+/*! copy the records of all threads, in the format described above */
+struct stats_buf *trace_dump(void);
+
+#endif
@@ -12,6 +12,12 @@
 #include "sync.h"
 #include "lock.h"
 #include "worker.h"
+#include "sparse.h"
+#include "evict.h"
+#include "policy.h"
+#include "bwlimit.h"
+#include "stats.h"
+#include "db.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,11 +37,13 @@ static struct transfer_state
     struct job *job;
     char *read_path, *write_path;
     bool active;
+    bool instant;   /* a process waits for the file, ignore bandwidth limits */
     off_t offset;
 } t_state;
 
 static void transfer_reset_state(void);
 static int transfer_pull_dir(const char *path);
+static int transfer_placeholder(const char *path, int instant);
 
 static void transfer_reset_state(void)
 {
@@ -44,6 +52,7 @@ static void transfer_reset_state(void)
     free(t_state.write_path);
 
     t_state.active = false;
+    t_state.instant = false;
     t_state.job = NULL;
     t_state.read_path = NULL;
     t_state.write_path = NULL;
@@ -51,6 +60,22 @@ static void transfer_reset_state(void)
     pthread_mutex_unlock(&m_transfer);
 }
 
+/* return non-zero if pulling _path_ should only create a placeholder.
+   files that are being opened (_instant_) are copied completely unless
+   sparse mode or the "ondemand" policy are active */
+static int transfer_placeholder(const char *path, int instant)
+{
+    switch (policy_get(path))
+    {
+        case POLICY_OFFLINE:
+            return 0;
+        case POLICY_ONDEMAND:
+            return 1;
+    }
+
+    return discofs_options.sparse || (!instant && sparse_has(path));
+}
+
 static int transfer_pull_dir(const char *path)
 {
     int res;
@@ -99,6 +124,8 @@ int transfer(const char *from, const char *to)
     ssize_t readbytes;
     char buf[TRANSFER_SIZE];
     int w_flags;
+    int push;
+    stats_us start;
 
     pthread_mutex_lock(&m_transfer);
 
@@ -145,8 +172,15 @@ int transfer(const char *from, const char *to)
         goto failure;
     }
 
+    push = (t_state.job->op == JOB_PUSH);
+    start = stats_now();
+
     while (ONLINE && !worker_blocked())
     {
+        /* stay within the bandwidth limit, continue later if it takes long */
+        if (!t_state.instant && bwlimit_wait(push ? BW_PUSH : BW_PULL, sizeof buf))
+            break;
+
         readbytes = read(fdread, buf, sizeof buf);
         if (readbytes && (readbytes < 0 || write(fdwrite, buf, readbytes) < readbytes || fsync(fdwrite)))
         {
@@ -159,14 +193,25 @@ int transfer(const char *from, const char *to)
             goto failure;
         }
 
+        stats_add(push ? STATS_PUSH_BYTES : STATS_PULL_BYTES, readbytes);
+
         /* copy completed, set mode and ownership */
         if (readbytes < sizeof buf)
         {
+            stats_add(push ? STATS_PUSH_US : STATS_PULL_US, stats_now() - start);
+
             CLOSE(fdread);
             CLOSE(fdwrite);
 
             copy_attrs(t_state.read_path, t_state.write_path);
 
+            /* the whole file is in the cache now */
+            if (t_state.job->op == JOB_PULL)
+            {
+                sparse_delete(t_state.job->path);
+                evict_update(t_state.job->path);
+            }
+
             VERBOSE("transfer finished: '%s' -> '%s'", t_state.read_path, t_state.write_path);
 
             lock_remove(t_state.job->path, LOCK_TRANSFER);
@@ -178,6 +223,7 @@ int transfer(const char *from, const char *to)
     }
 
     t_state.offset = lseek(fdread, 0, SEEK_CUR);
+    stats_add(push ? STATS_PUSH_US : STATS_PULL_US, stats_now() - start);
 
     CLOSE(fdread);
     CLOSE(fdwrite);
@@ -186,6 +232,8 @@ int transfer(const char *from, const char *to)
     return TRANSFER_OK;
 
 failure:
+    if (t_state.job)
+        t_state.job->error = errno;
     pthread_mutex_unlock(&m_transfer);
     transfer_abort();
     return TRANSFER_FAIL;
@@ -208,6 +256,10 @@ int transfer_begin(struct job *j)
     }
     pthread_mutex_unlock(&m_transfer);
 
+    /* only transfers take a turn, other jobs are replayed in batches */
+    if (discofs_options.sched == SCHED_FAIR)
+        db_sched_served(j->path);
+
     p_len = strlen(j->path);
 
     if (j->op == JOB_PUSH)
@@ -234,6 +286,26 @@ int transfer_begin(struct job *j)
         if (!is_reg(pwrite) && !is_nonexist(pwrite))
         {
             DEBUG("write target is non-regular file: %s", pwrite);
+            j->error = EISDIR;
+            free(pread);
+            free(pwrite);
+            return TRANSFER_FAIL;
+        }
+
+        /* in sparse mode, only create a placeholder. evicted files stay
+           evicted, too */
+        if (j->op == JOB_PULL && !(j->n1 & PULL_HOT) && transfer_placeholder(j->path, 0))
+        {
+            free(pread);
+            free(pwrite);
+            return (sparse_create(j->path)) ? TRANSFER_FAIL : TRANSFER_FINISH;
+        }
+
+        /* never push holes */
+        if (j->op == JOB_PUSH && sparse_complete(j->path))
+        {
+            ERROR("fetching missing blocks of %s failed", j->path);
+            j->error = errno;
             free(pread);
             free(pwrite);
             return TRANSFER_FAIL;
@@ -272,6 +344,7 @@ int transfer_begin(struct job *j)
     else
     {
         ERROR("cannot read file %s", pread);
+        j->error = errno;
         free(pread);
         free(pwrite);
         return TRANSFER_FAIL;
@@ -369,6 +442,7 @@ int transfer_instant_pull(const char *path)
     char *pc, *pr;
     size_t p_len = strlen(path);
     bool path_equal = false;
+    stats_us start = stats_now();
 
     VERBOSE("instant_pulling %s", path);
 
@@ -382,6 +456,8 @@ int transfer_instant_pull(const char *path)
     pthread_mutex_lock(&m_transfer);
     if (t_state.active)
         path_equal = !strcmp(path, t_state.job->path);
+    if (path_equal)
+        t_state.instant = true;
     pthread_mutex_unlock(&m_transfer);
 
     /* requested file is already being transfered (normally).
@@ -396,12 +472,17 @@ int transfer_instant_pull(const char *path)
         }
         while (ONLINE && res == TRANSFER_OK);
 
+        pthread_mutex_lock(&m_transfer);
+        t_state.instant = false;
+        pthread_mutex_unlock(&m_transfer);
+
         res = (res == TRANSFER_FINISH) ? 0 : 1;
         worker_block();
     }
     else
     {
-        res = copy_file(pr, pc);
+#define INSTANT_COPY() ((transfer_placeholder(path, 1) && is_reg(pr)) ? sparse_create(path) : copy_file(pr, pc))
+        res = INSTANT_COPY();
 
         /* if copy_file failed, possibly because the file's directory didn't
            exist in the cache yet. create it and retry */
@@ -413,9 +494,15 @@ int transfer_instant_pull(const char *path)
             {
                 transfer_pull_dir(dir);
                 free(dir);
-                res = copy_file(pr, pc);
+                res = INSTANT_COPY();
             }
         }
+#undef INSTANT_COPY
+
+        if (!res && !transfer_placeholder(path, 1))
+            sparse_delete(path);
+        if (!res)
+            evict_update(path);
     }
 
     worker_unblock();
@@ -429,6 +516,7 @@ int transfer_instant_pull(const char *path)
     {
         ERROR("instant_pull on %s FAILED", path);
         pthread_mutex_unlock(&m_instant_pull);
+        stats_observe(STATS_INSTANT_PULL, start);
         return -1;
     }
 
@@ -437,5 +525,6 @@ int transfer_instant_pull(const char *path)
     sync_set(path, 0);
 
     pthread_mutex_unlock(&m_instant_pull);
+    stats_observe(STATS_INSTANT_PULL, start);
     return 0;
 }
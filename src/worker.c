@@ -18,10 +18,19 @@
 #include "lock.h"
 #include "job.h"
 #include "conflict.h"
+#include "sparse.h"
+#include "evict.h"
+#include "policy.h"
+#include "hotset.h"
+#include "replay.h"
+#include "timer.h"
+#include "stats.h"
 #include "bst.h"
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/types.h>
@@ -33,30 +42,57 @@ static pthread_mutex_t m_worker_block = PTHREAD_MUTEX_INITIALIZER;
 
 static bool worker_wkup = false;
 static pthread_mutex_t m_worker_wakeup = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_worker_wakeup = PTHREAD_COND_INITIALIZER;
 
 static void worker_scan_remote(void);
 static void worker_scan_dir(queue *scan_q);
 
 static int worker_cancel_scan_dir = 0;
 
+/* periodic scans are skipped while paused */
+static int worker_scan_pause = 0;
+
+/* directories to scan before the next periodic scan, see worker_rescan() */
+static queue *rescan_q = NULL;
+static pthread_mutex_t m_rescan_q = PTHREAD_MUTEX_INITIALIZER;
+
 /*! SLEEP */
 void worker_wakeup(void)
 {
     pthread_mutex_lock(&m_worker_wakeup);
-    DEBUG("waking up worker thread");
     worker_wkup = true;
+    pthread_cond_signal(&c_worker_wakeup);
     pthread_mutex_unlock(&m_worker_wakeup);
 }
 
+/* sleep until woken up, _seconds_ passed or the next deferred job is due */
 void worker_sleep(unsigned int seconds)
 {
+    struct timespec until;
+    timer_ms now = timer_now(), next, end;
+
+    end = now + (timer_ms)seconds * 1000;
+
+    next = timer_next(now);
+    if (next && next < end)
+        end = next;
+
+    until.tv_sec = end / 1000;
+    until.tv_nsec = (end % 1000) * 1000000;
+
     pthread_mutex_lock(&m_worker_wakeup);
-    worker_wkup = false;
-    pthread_mutex_unlock(&m_worker_wakeup);
-    while (seconds-- && !worker_wkup && !(EXITING))
+
+    while (!worker_wkup && !(EXITING))
     {
-        sleep(1);
+        if (pthread_cond_timedwait(&c_worker_wakeup, &m_worker_wakeup, &until) == ETIMEDOUT)
+            break;
     }
+
+    if (worker_wkup)
+        DEBUG("worker thread woken up");
+
+    worker_wkup = false;
+    pthread_mutex_unlock(&m_worker_wakeup);
 }
 
 
@@ -70,12 +106,17 @@ void worker_block(void)
 
 void worker_unblock(void)
 {
+    bool wakeup = false;
+
     pthread_mutex_lock(&m_worker_block);
     if (worker_block_n)
-        worker_block_n--;
+        wakeup = (--worker_block_n == 0);
     else
         DEBUG("BUG: erroneous call to worker_unblock!");
     pthread_mutex_unlock(&m_worker_block);
+
+    if (wakeup)
+        worker_wakeup();
 }
 
 int worker_blocked(void)
@@ -87,27 +128,78 @@ int worker_blocked(void)
 static void worker_scan_remote(void)
 {
     static queue *scan_q = NULL;
+    static queue *target_q = NULL;
+    static time_t scan_last = 0;
+    static stats_us scan_start;
+    time_t now, next;
+    char *p;
 
     if (!scan_q)
         scan_q = q_init();
+    if (!target_q)
+        target_q = q_init();
 
     /* scan was cancelled -> begin a new scan from root */
     if (worker_cancel_scan_dir)
     {
         q_clear(scan_q, free);
+        q_clear(target_q, free);
+        stats_set(STATS_SCAN_QUEUED, 0);
         worker_cancel_scan_dir = 0;
     }
 
+    /* requested rescans come first, even while paused */
+    pthread_mutex_lock(&m_rescan_q);
+    while (rescan_q && (p = q_dequeue(rescan_q)))
+    {
+        if (q_enqueue(target_q, p))
+            free(p);
+        else
+            stats_add(STATS_SCAN_QUEUED, 1);
+    }
+    pthread_mutex_unlock(&m_rescan_q);
+
+    if (!q_empty(target_q))
+    {
+        worker_scan_dir(target_q);
+        return;
+    }
+
+    if (worker_scan_pause)
+    {
+        worker_sleep(SLEEP_LONG);
+        return;
+    }
+
     /* if scan_q is empty, the whole remote directory tree was scanned */
     if (q_empty(scan_q))
     {
-        /* sleep and begin new scan */
-        worker_sleep(discofs_options.scan_interval);
+        /* sleep until the next scan is due. new jobs wake the worker up
+           earlier, the sleep continues in the next call. scan_interval may
+           change meanwhile */
+        now = time(NULL);
+        next = scan_last + discofs_options.scan_interval;
+        if (now < next)
+        {
+            worker_sleep(next - now);
+            return;
+        }
+
         VERBOSE("beginning remote scan");
         q_enqueue(scan_q, strdup("/"));
+        stats_set(STATS_SCAN_QUEUED, 1);
+        scan_start = stats_now();
     }
 
     worker_scan_dir(scan_q);
+
+    if (q_empty(scan_q))
+    {
+        scan_last = time(NULL);
+
+        stats_add(STATS_SCANS, 1);
+        stats_set(STATS_SCAN_LAST_US, stats_now() - scan_start);
+    }
 }
 
 static void worker_scan_dir(queue *scan_q)
@@ -129,6 +221,8 @@ static void worker_scan_dir(queue *scan_q)
         return;
 
     srch = q_dequeue(scan_q);
+    stats_add(STATS_SCAN_QUEUED, -1);
+    stats_add(STATS_SCAN_DIRS, 1);
 
     srch_len = strlen(srch);
     srch_r = remote_path2(srch, srch_len);
@@ -182,6 +276,17 @@ static void worker_scan_dir(queue *scan_q)
         if (S_ISDIR(st.st_mode))
         {
             q_enqueue(scan_q, p);
+            stats_add(STATS_SCAN_QUEUED, 1);
+        }
+        /* the cache is newer until scheduled changes are applied */
+        else if (job_exists(p, REPLAY_JOBS))
+        {
+            free(p);
+        }
+        /* files that are never cached don't need to be pulled */
+        else if (policy_get(p) == POLICY_NEVER)
+        {
+            free(p);
         }
         else
         {
@@ -189,7 +294,7 @@ static void worker_scan_dir(queue *scan_q)
             if (sync == SYNC_MOD || sync == SYNC_NEW)
             {
                 if (!job_exists(p, JOB_PUSH))
-                    job_schedule_pull(p);
+                    job_schedule_pull_sized(p, S_ISREG(st.st_mode) ? st.st_size : 0);
                 else
                 {
                     DEBUG("conflict: sync of target is %s",
@@ -197,6 +302,13 @@ static void worker_scan_dir(queue *scan_q)
                     conflict_handle(p, JOB_PUSH, NULL);
                 }
             }
+            /* files that should be available offline must be complete */
+            else if (sync == SYNC_SYNC && policy_get(p) == POLICY_OFFLINE
+                    && sparse_has(p) && !job_exists(p, JOB_PULL))
+            {
+                DEBUG("%s is incomplete, pulling", p);
+                job_schedule_pull_sized(p, st.st_size);
+            }
             free(p);
         }
     }
@@ -238,7 +350,8 @@ static void worker_scan_dir(queue *scan_q)
             if (!p)
                 break;
 
-            if (!job_exists(p, LOCK_OPEN) && !job_exists(p, JOB_PUSH))
+            if (!job_exists(p, LOCK_OPEN) && !job_exists(p, JOB_PUSH)
+                    && !job_exists(p, REPLAY_JOBS) && !job_renamed_to(p))
             {
                 VERBOSE("removing missing file %s/%s from cache", (strcmp(srch, "/")) ? srch : "", ent->d_name);
                 delete_or_backup(p, CONFLICT_KEEP_REMOTE);
@@ -261,41 +374,45 @@ void worker_cancel_scan(void)
     worker_cancel_scan_dir = 1;
 }
 
+void worker_pause_scan(int pause)
+{
+    worker_scan_pause = pause;
+    worker_wakeup();
+}
+
+int worker_scan_paused(void)
+{
+    return worker_scan_pause;
+}
 
-static int worker_perform(struct job *j)
+/* scan the directory _path_ (and below) as soon as no jobs are due */
+int worker_rescan(const char *path)
 {
-    if (!j)
+    char *p;
+    int res = -1;
+
+    if ((p = strdup(path)) == NULL)
         return -1;
 
-    switch (j->op)
-    {
-        case JOB_RENAME:
-            return remoteop_rename(j->path, j->s1);
-        case JOB_CREATE:
-            return remoteop_create(j->path, j->n1, j->n2);
-        case JOB_UNLINK:
-            return remoteop_unlink(j->path);
-        case JOB_SYMLINK:
-            return remoteop_symlink(j->s1, j->path);
-        case JOB_LINK:
-            return remoteop_link(j->s1, j->path);
-        case JOB_MKDIR:
-            return remoteop_mkdir(j->path, j->n1);
-        case JOB_RMDIR:
-            return remoteop_rmdir(j->path);
-        case JOB_CHOWN:
-            return remoteop_chown(j->path, j->n1, j->n2);
-        case JOB_CHMOD:
-            return remoteop_chmod(j->path, j->n1);
-#if HAVE_SETXATTR
-        case JOB_SETXATTR:
-            return remoteop_setxattr(j->path, j->s1, j->s2, j->n1, j->n2);
-#endif
-    }
+    pthread_mutex_lock(&m_rescan_q);
+
+    if (!rescan_q)
+        rescan_q = q_init();
 
-    return -1;
+    if (rescan_q && !q_enqueue(rescan_q, p))
+        res = 0;
+
+    pthread_mutex_unlock(&m_rescan_q);
+
+    if (res)
+        free(p);
+    else
+        worker_wakeup();
+
+    return res;
 }
 
+
 /*! WORKER THREAD */
 void *worker_main(void *arg)
 {
@@ -310,6 +427,13 @@ void *worker_main(void *arg)
         /* flush sync change queue to db */
         sync_store();
 
+        /* flush changed block bitmaps to db */
+        sparse_store();
+
+        /* keep the cache within its limits */
+        evict_store();
+        evict_run();
+
         if (ONLINE)
         {
             /* sleep if blocked */
@@ -322,6 +446,9 @@ void *worker_main(void *arg)
             /* if a transfer job is in progress, try resume it */
             if (j)
             {
+                /* metadata changes don't wait for (throttled) transfers */
+                replay_run();
+
                 res = transfer(NULL, NULL);
 
                 /* everything OK -> next iteration of main loop */
@@ -335,6 +462,11 @@ void *worker_main(void *arg)
             }
 
 
+            /* apply due metadata changes, independent ones in parallel */
+            if (replay_run() > 0)
+                continue;
+
+
             /*---------------*/
             /* get a new job */
             /*---------------*/
@@ -349,9 +481,10 @@ void *worker_main(void *arg)
                 j = job_get();
             }
 
-            /* no jobs -> scan remote fs for changes*/
+            /* no jobs -> keep working set complete, scan remote fs for changes*/
             if (!j)
             {
+                hotset_run();
                 worker_scan_remote();
                 continue;
             }
@@ -390,12 +523,11 @@ void *worker_main(void *arg)
 
                 /* if result is TRANSFER_OK, keep j */
             }
-            /* neither PUSH nor PULL */
+            /* neither PUSH nor PULL: became due after replay_run(), it is
+               still in the db and will be replayed in the next iteration */
             else
             {
-                VERBOSE("performing %s on %s", job_opstr(j->op), j->path);
-                res = worker_perform(j);
-                job_return(j, (!res) ? JOB_DONE : JOB_FAILED);
+                job_free(j);
                 j = NULL;
             }
         }
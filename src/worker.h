@@ -22,6 +22,9 @@ void worker_unblock(void);
 int worker_blocked(void);
 
 void worker_cancel_scan(void);
+void worker_pause_scan(int pause);
+int worker_scan_paused(void);
+int worker_rescan(const char *path);
 
 void *worker_statecheck(void *arg);
 void *worker_main(void *arg);
@@ -0,0 +1,194 @@
+/*! @file replay.c
+ * tests of replaying changes made while OFFLINE.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: replay
+ *
+ * creates a remote fs and a cache in a temporary directory, makes changes
+ * with the file system operations while OFFLINE and replays them like the
+ * worker thread does when going ONLINE. afterwards, the remote fs must look
+ * like the cache. prints one line per test and exits non-zero if one
+ * failed.
+ */
+
+#include "config.h"
+#include "discofs.h"
+#include "state.h"
+#include "db.h"
+#include "lock.h"
+#include "sync.h"
+#include "timer.h"
+#include "job.h"
+#include "sparse.h"
+#include "evict.h"
+#include "replay.h"
+#include "fsops.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+struct options discofs_options = OPTIONS_INIT;
+
+static char tmpdir[] = "/tmp/discofs-test.XXXXXX";
+static int failed = 0;
+
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "replay: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static char *root(const char *name, size_t *len)
+{
+    char *p;
+
+    if ((p = malloc(sizeof tmpdir + strlen(name) + 1)) == NULL)
+        die("out of memory");
+
+    sprintf(p, "%s/%s", tmpdir, name);
+    if (mkdir(p, 0755))
+        die(p);
+
+    *len = strlen(p);
+    return p;
+}
+
+/* create directory _path_ on the remote fs and in the cache, as if it had
+   been synchronized */
+static void existing_dir(const char *path)
+{
+    char p[PATH_MAX];
+
+    snprintf(p, sizeof p, "%s%s", discofs_options.remote_root, path);
+    if (mkdir(p, 0755))
+        die(p);
+
+    snprintf(p, sizeof p, "%s%s", discofs_options.cache_root, path);
+    if (mkdir(p, 0755))
+        die(p);
+}
+
+/* create file _path_ on the remote fs and in the cache, as if it had been
+   synchronized */
+static void existing_file(const char *path)
+{
+    char p[PATH_MAX];
+    FILE *f;
+
+    snprintf(p, sizeof p, "%s%s", discofs_options.remote_root, path);
+    if ((f = fopen(p, "w")) == NULL || fclose(f))
+        die(p);
+
+    snprintf(p, sizeof p, "%s%s", discofs_options.cache_root, path);
+    if ((f = fopen(p, "w")) == NULL || fclose(f))
+        die(p);
+}
+
+/* return non-zero if _path_ exists on the remote fs */
+static int remote_exists(const char *path)
+{
+    char p[PATH_MAX];
+    struct stat st;
+
+    snprintf(p, sizeof p, "%s%s", discofs_options.remote_root, path);
+    return !lstat(p, &st);
+}
+
+/* replay everything that is due, retrying failed jobs right away */
+static void replay_all(void)
+{
+    int i;
+    unsigned long n;
+
+    state_set(STATE_ONLINE, NULL);
+
+    for (i = 0; i < JOB_MAX_ATTEMPTS; i++)
+    {
+        job_store();
+        db_job_update("/", -1, timer_now(), &n);
+
+        if (replay_run() <= 0)
+            break;
+    }
+
+    state_set(STATE_OFFLINE, NULL);
+}
+
+static void check(const char *name, int ok)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    if (!ok)
+        failed = 1;
+}
+
+/* "mkdir d/sub, mv d e" stores MKDIR e/sub before RENAME d->e */
+static void test_mkdir_rename_dir(void)
+{
+    existing_dir("/d");
+
+    if (op_mkdir("/d/sub", 0755) || op_rename("/d", "/e"))
+        die("mkdir-rename-dir");
+
+    replay_all();
+
+    check("mkdir-rename-dir", remote_exists("/e/sub") && !remote_exists("/d")
+            && !job_exists("/e/sub", JOB_ANY) && !job_exists("/d", JOB_ANY));
+}
+
+/* "mv a b, mv b c, rm c" with c on the remote fs must remove a and c */
+static void test_rename_replace_unlink(void)
+{
+    existing_file("/a");
+    existing_file("/c");
+
+    if (op_rename("/a", "/b") || op_rename("/b", "/c") || op_unlink("/c"))
+        die("rename-replace-unlink");
+
+    replay_all();
+
+    check("rename-replace-unlink", !remote_exists("/a") && !remote_exists("/b")
+            && !remote_exists("/c") && !job_exists("/a", JOB_ANY));
+}
+
+int main(void)
+{
+    char fn[PATH_MAX];
+
+    if (mkdtemp(tmpdir) == NULL)
+        die("mkdtemp");
+
+    discofs_options.remote_root = root("remote", &discofs_options.remote_root_len);
+    discofs_options.cache_root = root("cache", &discofs_options.cache_root_len);
+    discofs_options.data_root = tmpdir;
+
+    snprintf(fn, sizeof fn, "%s/db.sqlite", tmpdir);
+    if (db_init(fn, 1) != DB_OK || lock_init() || sync_init() || timer_init()
+            || job_init() || sparse_init() || evict_init())
+        die("initializing");
+
+    state_set(STATE_OFFLINE, NULL);
+
+    test_mkdir_rename_dir();
+    test_rename_replace_unlink();
+
+    evict_destroy();
+    sparse_destroy();
+    job_destroy();
+    timer_destroy();
+    sync_destroy();
+    lock_destroy();
+    db_destroy();
+
+    snprintf(fn, sizeof fn, "rm -rf '%s'", tmpdir);
+    if (system(fn))
+        fprintf(stderr, "replay: could not remove %s\n", tmpdir);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/*! @file sparse.c
+ * tests of writes to sparse files.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: sparse
+ *
+ * creates a remote fs and a cache in a temporary directory and writes to
+ * placeholders of remote files like op_write() does. after each write,
+ * the cache file must contain the remote data with the written bytes on
+ * top of it. prints one line per test and exits non-zero if one failed.
+ */
+
+#include "config.h"
+#include "discofs.h"
+#include "state.h"
+#include "db.h"
+#include "sparse.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* remote files are this large */
+#define FILE_SIZE (16 * SPARSE_BLOCK_SIZE)
+
+struct options discofs_options = OPTIONS_INIT;
+
+static char tmpdir[] = "/tmp/discofs-test.XXXXXX";
+static unsigned char remote[FILE_SIZE];
+static unsigned char expect[FILE_SIZE];
+static unsigned char cache[FILE_SIZE];
+static int failed = 0;
+
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "sparse: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static char *root(const char *name, size_t *len)
+{
+    char *p;
+
+    if ((p = malloc(sizeof tmpdir + strlen(name) + 1)) == NULL)
+        die("out of memory");
+
+    sprintf(p, "%s/%s", tmpdir, name);
+    if (mkdir(p, 0755))
+        die(p);
+
+    *len = strlen(p);
+    return p;
+}
+
+static void write_file(const char *path, const void *buf, size_t size)
+{
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1
+            || write(fd, buf, size) != (ssize_t)size || close(fd))
+        die(path);
+}
+
+/* write _size_ bytes at _offset_ to a placeholder of a new remote file and
+   compare the blocks the write touched with what they should contain */
+static void test_write(const char *name, off_t offset, size_t size)
+{
+    char path[PATH_MAX], p[PATH_MAX];
+    off_t from, to;
+    size_t i;
+    int fd, res;
+
+    snprintf(path, sizeof path, "/%s", name);
+
+    for (i = 0; i < FILE_SIZE; i++)
+        remote[i] = (unsigned char)(i * 31 + offset);
+
+    snprintf(p, sizeof p, "%s%s", discofs_options.remote_root, path);
+    write_file(p, remote, FILE_SIZE);
+
+    if (sparse_create(path) || !sparse_open(path))
+        die("sparse_create");
+
+    memcpy(expect, remote, FILE_SIZE);
+    memset(expect + offset, 0xaa, size);
+
+    /* as op_write() */
+    snprintf(p, sizeof p, "%s%s", discofs_options.cache_root, path);
+    if ((res = sparse_write(path, offset, size)) == 0)
+    {
+        if ((fd = open(p, O_RDWR)) == -1 || pwrite(fd, expect + offset, size, offset) != (ssize_t)size)
+            die(p);
+        close(fd);
+    }
+
+    if ((fd = open(p, O_RDONLY)) == -1 || read(fd, cache, FILE_SIZE) != FILE_SIZE)
+        die(p);
+    close(fd);
+
+    /* blocks marked present must be complete */
+    from = offset / SPARSE_BLOCK_SIZE * SPARSE_BLOCK_SIZE;
+    to = (offset + size + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE * SPARSE_BLOCK_SIZE;
+    if (to > FILE_SIZE)
+        to = FILE_SIZE;
+
+    if (res || memcmp(cache + from, expect + from, to - from))
+    {
+        printf("FAIL %s\n", name);
+        failed = 1;
+    }
+    else
+        printf("ok   %s\n", name);
+
+    sparse_close(path);
+    sparse_delete(path);
+}
+
+int main(void)
+{
+    char fn[PATH_MAX];
+
+    if (mkdtemp(tmpdir) == NULL)
+        die("mkdtemp");
+
+    discofs_options.remote_root = root("remote", &discofs_options.remote_root_len);
+    discofs_options.cache_root = root("cache", &discofs_options.cache_root_len);
+    discofs_options.data_root = tmpdir;
+
+    snprintf(fn, sizeof fn, "%s/db.sqlite", tmpdir);
+    if (db_init(fn, 1) != DB_OK || sparse_init())
+        die("initializing");
+
+    state_set(STATE_ONLINE, NULL);
+
+    test_write("aligned-start-mid-end", 0, 100);
+    test_write("aligned-block", SPARSE_BLOCK_SIZE, SPARSE_BLOCK_SIZE);
+    test_write("mid-start-mid-end", 100, 100);
+    test_write("mid-start-aligned-end", 100, SPARSE_BLOCK_SIZE - 100);
+    test_write("across-blocks", SPARSE_BLOCK_SIZE - 100, 200);
+    test_write("many-blocks", 100, 5 * SPARSE_BLOCK_SIZE);
+    test_write("last-block", FILE_SIZE - 100, 100);
+
+    sparse_destroy();
+    db_destroy();
+
+    snprintf(fn, sizeof fn, "rm -rf '%s'", tmpdir);
+    if (system(fn))
+        fprintf(stderr, "sparse: could not remove %s\n", tmpdir);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+/*! @file discofs-trace.c
+ * summarize the trace file of discofs.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: discofs-trace [-d] [-n <count>] [-r <dir>] [<file>]
+ *
+ * reads a copy of <mountpoint>/.discofs/trace (or stdin) and prints the
+ * number of calls, errors and latency percentiles of each operation. with
+ * -d, the same is printed for the <count> directories (default 20) with
+ * the highest total time. directories are only known by the hash of their
+ * path; -r <dir> walks <dir> (the mount point or the remote fs) to find
+ * their names.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+
+#define TRACE_MAGIC "DTRC"
+#define TRACE_VERSION 1
+
+/* must match struct trace_rec in src/trace.h */
+struct trace_rec
+{
+    uint64_t start;
+    uint64_t end;
+    uint32_t path;
+    uint32_t dir;
+    int32_t res;
+    uint16_t op;
+    uint16_t thread;
+};
+
+struct dir_name
+{
+    uint32_t hash;
+    char *name;
+};
+
+static char **op_names = NULL;
+static uint32_t op_n = 0;
+
+static struct trace_rec *recs = NULL;
+static uint32_t rec_n = 0;
+
+static struct dir_name *dirs = NULL;
+static size_t dir_n = 0, dir_size = 0;
+static size_t root_len = 0;
+
+
+/* same as djb2() in src/funcs.c */
+static uint32_t djb2(const char *str)
+{
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c;
+
+    return hash;
+}
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "discofs-trace: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void read_trace(FILE *f)
+{
+    uint32_t i, hdr[3];
+    char magic[4];
+    int c;
+    size_t len, size;
+
+    if (fread(magic, sizeof magic, 1, f) != 1 || memcmp(magic, TRACE_MAGIC, 4))
+        die("not a discofs trace");
+    if (fread(hdr, sizeof hdr, 1, f) != 1)
+        die("truncated header");
+    if (hdr[0] != TRACE_VERSION)
+        die("unsupported trace version");
+
+    op_n = hdr[1];
+    rec_n = hdr[2];
+
+    if ((op_names = calloc(op_n, sizeof *op_names)) == NULL)
+        die("out of memory");
+
+    for (i = 0; i < op_n; i++)
+    {
+        len = 0;
+        size = 16;
+        if ((op_names[i] = malloc(size)) == NULL)
+            die("out of memory");
+
+        while ((c = getc(f)) != EOF && c != '\0')
+        {
+            if (len + 1 == size && (op_names[i] = realloc(op_names[i], size *= 2)) == NULL)
+                die("out of memory");
+            op_names[i][len++] = c;
+        }
+        if (c == EOF)
+            die("truncated operation names");
+        op_names[i][len] = '\0';
+    }
+
+    if ((recs = malloc((size_t)rec_n * sizeof *recs + 1)) == NULL)
+        die("out of memory");
+    if (fread(recs, sizeof *recs, rec_n, f) != rec_n)
+        die("truncated records");
+}
+
+static int add_dir(const char *fpath, const struct stat *sb, int type, struct FTW *ftw)
+{
+    const char *rel;
+
+    if (type != FTW_D)
+        return 0;
+
+    if (dir_n == dir_size)
+    {
+        dir_size = dir_size ? 2 * dir_size : 256;
+        if ((dirs = realloc(dirs, dir_size * sizeof *dirs)) == NULL)
+            die("out of memory");
+    }
+
+    rel = fpath + root_len;
+    if (!*rel)
+        rel = "/";
+
+    dirs[dir_n].hash = djb2(rel);
+    if ((dirs[dir_n].name = strdup(rel)) == NULL)
+        die("out of memory");
+    dir_n++;
+
+    return 0;
+}
+
+static int cmp_dir(const void *a, const void *b)
+{
+    uint32_t x = ((const struct dir_name *)a)->hash;
+    uint32_t y = ((const struct dir_name *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+static void read_dirs(const char *root)
+{
+    root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/')
+        root_len--;
+
+    if (nftw(root, add_dir, 32, FTW_PHYS))
+        perror(root);
+
+    qsort(dirs, dir_n, sizeof *dirs, cmp_dir);
+}
+
+static const char *dir_name(uint32_t hash)
+{
+    static char buf[16];
+    struct dir_name key, *d;
+
+    key.hash = hash;
+    if (dir_n && (d = bsearch(&key, dirs, dir_n, sizeof *dirs, cmp_dir)) != NULL)
+        return d->name;
+
+    snprintf(buf, sizeof buf, "#%08x", hash);
+    return buf;
+}
+
+static int cmp_us(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* nearest rank */
+static uint64_t percentile(const uint64_t *us, size_t n, int p)
+{
+    size_t i = (n * p + 99) / 100;
+    return us[i ? i - 1 : 0];
+}
+
+/* one line for the records matching _key_ */
+struct group
+{
+    uint32_t key;
+    size_t n;
+    size_t errors;
+    uint64_t total;
+    uint64_t *us;
+};
+
+static void collect(struct group *g, int by_dir)
+{
+    uint32_t i;
+
+    g->n = g->errors = 0;
+    g->total = 0;
+
+    for (i = 0; i < rec_n; i++)
+    {
+        if ((by_dir ? recs[i].dir : recs[i].op) != g->key)
+            continue;
+
+        g->us[g->n] = recs[i].end - recs[i].start;
+        g->total += g->us[g->n];
+        g->n++;
+        if (recs[i].res < 0)
+            g->errors++;
+    }
+
+    qsort(g->us, g->n, sizeof *g->us, cmp_us);
+}
+
+static void print_group(const char *name, const struct group *g)
+{
+    printf("%-24s %9zu %7zu %9llu %9llu %9llu %9llu %11.3f\n", name, g->n, g->errors,
+            (unsigned long long)percentile(g->us, g->n, 50),
+            (unsigned long long)percentile(g->us, g->n, 90),
+            (unsigned long long)percentile(g->us, g->n, 99),
+            (unsigned long long)g->us[g->n - 1],
+            g->total / 1e6);
+}
+
+static void print_header(const char *what)
+{
+    printf("%-24s %9s %7s %9s %9s %9s %9s %11s\n", what,
+            "calls", "errors", "p50/us", "p90/us", "p99/us", "max/us", "total/s");
+}
+
+static int cmp_total(const void *a, const void *b)
+{
+    uint64_t x = ((const struct group *)a)->total;
+    uint64_t y = ((const struct group *)b)->total;
+    return (x < y) - (x > y);
+}
+
+static int cmp_rec_dir(const void *a, const void *b)
+{
+    uint32_t x = ((const struct trace_rec *)a)->dir;
+    uint32_t y = ((const struct trace_rec *)b)->dir;
+    return (x > y) - (x < y);
+}
+
+static void print_ops(void)
+{
+    uint32_t op;
+    struct group g;
+
+    if ((g.us = malloc((size_t)rec_n * sizeof *g.us + 1)) == NULL)
+        die("out of memory");
+
+    print_header("operation");
+    for (op = 0; op < op_n; op++)
+    {
+        g.key = op;
+        collect(&g, 0);
+        if (g.n)
+            print_group(op_names[op], &g);
+    }
+
+    free(g.us);
+}
+
+/* the records are sorted by directory, so each group is a slice of them */
+static void print_dirs(size_t count)
+{
+    uint32_t i, j;
+    size_t k, n = 0;
+    struct group *groups;
+    uint64_t *us;
+
+    qsort(recs, rec_n, sizeof *recs, cmp_rec_dir);
+
+    if ((groups = malloc((size_t)rec_n * sizeof *groups + 1)) == NULL
+            || (us = malloc((size_t)rec_n * sizeof *us + 1)) == NULL)
+        die("out of memory");
+
+    for (i = 0; i < rec_n; i = j)
+    {
+        groups[n].key = recs[i].dir;
+        groups[n].n = groups[n].errors = 0;
+        groups[n].total = 0;
+        groups[n].us = us + i;
+
+        for (j = i; j < rec_n && recs[j].dir == recs[i].dir; j++)
+        {
+            us[j] = recs[j].end - recs[j].start;
+            groups[n].total += us[j];
+            groups[n].n++;
+            if (recs[j].res < 0)
+                groups[n].errors++;
+        }
+
+        qsort(groups[n].us, groups[n].n, sizeof *us, cmp_us);
+        n++;
+    }
+
+    qsort(groups, n, sizeof *groups, cmp_total);
+
+    printf("\n");
+    print_header("directory");
+    for (k = 0; k < n && k < count; k++)
+        print_group(dir_name(groups[k].key), &groups[k]);
+
+    free(groups);
+    free(us);
+}
+
+int main(int argc, char **argv)
+{
+    int c, by_dir = 0;
+    size_t count = 20;
+    FILE *f = stdin;
+
+    while ((c = getopt(argc, argv, "dn:r:")) != -1)
+    {
+        switch (c)
+        {
+            case 'd':
+                by_dir = 1;
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                read_dirs(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d] [-n <count>] [-r <dir>] [<file>]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc && strcmp(argv[optind], "-") && (f = fopen(argv[optind], "rb")) == NULL)
+    {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    read_trace(f);
+
+    if (f != stdin)
+        fclose(f);
+
+    print_ops();
+
+    if (by_dir)
+        print_dirs(count);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/*! @file discofsctl.c
+ * control a mounted discofs.
+ * discofs - disconnected file system
+ * Copyright (c) 2012 Robin Martinjak
+ * see LICENSE for full license (BSD 2-Clause)
+ *
+ * usage: discofsctl [-s <socket> | -m <mountpoint>] <command> [<args>]
+ *
+ * sends <command> to the control socket of discofs (see src/ctl.h) and
+ * prints the reply. with -m, the socket is looked up from the remote fs
+ * mounted at <mountpoint>, the same way discofs finds its data directory.
+ * without either, $DISCOFS_CTL names the socket.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <mntent.h>
+#include <pwd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CTL_REQ_MAX 4096
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "discofsctl: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: discofsctl [-s <socket> | -m <mountpoint>] <command> [<args>]\n"
+        "\n"
+        "commands:\n"
+        "  status\n"
+        "  jobs [<path>]\n"
+        "  prio <path> low|mid|high|urgent\n"
+        "  flush <path>\n"
+        "  set scan_interval|threads|bwpush|bwpull <value>\n"
+        "  scan pause|resume|<path>\n");
+    exit(EXIT_FAILURE);
+}
+
+/* same as djb2() in src/funcs.c */
+static unsigned long djb2(const char *str)
+{
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c;
+
+    return hash;
+}
+
+/* the socket of the discofs mounted at _mp_: "ctl" in the data directory,
+   see paths_data_root() in src/paths.c */
+static char *socket_of(const char *mp)
+{
+    static char buf[PATH_MAX];
+    char real[PATH_MAX];
+    char remote[PATH_MAX] = "";
+    const char *root;
+    struct passwd *pw;
+    struct mntent *ent;
+    FILE *f;
+
+    if (!realpath(mp, real))
+        die("mount point not found");
+
+    if ((f = setmntent("/proc/mounts", "r")) == NULL)
+        die("can't read /proc/mounts");
+
+    /* the file system name is the remote fs, the last mount counts */
+    while ((ent = getmntent(f)))
+    {
+        if (!strcmp(ent->mnt_dir, real) && !strncmp(ent->mnt_type, "fuse", 4))
+            snprintf(remote, sizeof remote, "%s", ent->mnt_fsname);
+    }
+    endmntent(f);
+
+    if (!*remote)
+        die("no discofs mounted there");
+
+    root = getenv("XDG_DATA_HOME");
+    if (root && *root == '/')
+        snprintf(buf, sizeof buf, "%s/discofs/%lu/ctl", root, djb2(remote));
+    else
+    {
+        if ((root = getenv("HOME")) == NULL)
+        {
+            if ((pw = getpwuid(getuid())) == NULL)
+                die("can't find the home directory");
+            root = pw->pw_dir;
+        }
+        snprintf(buf, sizeof buf, "%s/.local/share/discofs/%lu/ctl", root, djb2(remote));
+    }
+
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    char req[CTL_REQ_MAX];
+    char line[4096];
+    char last[4096] = "";
+    const char *sock = getenv("DISCOFS_CTL");
+    size_t len = 0, n;
+    int fd, i, opt;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "s:m:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                sock = optarg;
+                break;
+            case 'm':
+                sock = socket_of(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind >= argc)
+        usage();
+    if (!sock)
+        die("no socket given, use -s or -m or set DISCOFS_CTL");
+
+    /* arguments, each terminated by '\0' */
+    for (i = optind; i < argc; i++)
+    {
+        n = strlen(argv[i]) + 1;
+        if (len + n > sizeof req)
+            die("arguments too long");
+        memcpy(req + len, argv[i], n);
+        len += n;
+    }
+
+    if (strlen(sock) >= sizeof addr.sun_path)
+        die("socket path too long");
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        die("can't create socket");
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr))
+    {
+        perror(sock);
+        die("can't connect, is discofs mounted?");
+    }
+
+    if (write(fd, req, len) != (ssize_t)len || shutdown(fd, SHUT_WR))
+        die("sending the command failed");
+
+    if ((f = fdopen(fd, "r")) == NULL)
+        die("reading the reply failed");
+
+    /* print everything but the status line at the end */
+    while (fgets(line, sizeof line, f))
+    {
+        fputs(last, stdout);
+        strcpy(last, line);
+    }
+    fclose(f);
+
+    if (!strcmp(last, "OK\n"))
+        return EXIT_SUCCESS;
+
+    if (!strncmp(last, "ERROR ", 6))
+        fprintf(stderr, "discofsctl: %s", last + 6);
+    else
+        fprintf(stderr, "discofsctl: no reply\n");
+
+    return EXIT_FAILURE;
+}